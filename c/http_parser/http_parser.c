@@ -0,0 +1,251 @@
+
+/* HTTP/1.x request-line, status-line and header parser.
+   Written by Cosmin Apreutesei. Public Domain.
+
+   Parses a whole message head (start line + headers + blank line) in one
+   pass and returns offsets into the buffer instead of strings, so that the
+   Lua side only makes strings for the parts it actually uses.
+
+   The buffer is modified in place: header names are lowercased and header
+   values are normalized (folded lines are joined, runs of whitespace are
+   collapsed to one space and trailing whitespace is removed) which is why
+   spans are only filled in after the whole head is found to be complete.
+
+   Scanning for delimiters is done 16 bytes at a time with SSE 4.2's
+   pcmpestri on byte ranges, falling back to a byte loop on the tail
+   of the buffer or when compiled without SSE 4.2.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+typedef struct {
+	uint32_t i, n; /* offset and length of a string in the buffer */
+} http_span_t;
+
+typedef struct {
+	/* request: method, uri, version; response: version, status, message. */
+	http_span_t line[3];
+	int header_count;
+	int max_headers;
+	http_span_t* headers; /* pairs of name, value spans; 2 * max_headers */
+	uint32_t scanned; /* bytes searched for the end of an incomplete head */
+} http_head_t;
+
+#define HTTP_INCOMPLETE       0
+#define HTTP_INVALID_LINE    -1
+#define HTTP_INVALID_HEADER  -2
+#define HTTP_TOO_MANY_HEADERS -3
+
+/* byte classes as inclusive ranges for pcmpestri (max 8 ranges).
+   arrays are 16 bytes so that they can be loaded into a register as is. */
+static const char ranges_cr    [16] = "\r\r";                       /* CR */
+static const char ranges_uri   [16] = "\x00\x20\x7f\x7f";         /* CTL, SP */
+static const char ranges_name  [16] = "\x00\x20::\x7f\x7f";       /* CTL, SP, ':' */
+static const char ranges_value [16] = "\x00\x08\x0a\x1f\x7f\x7f"; /* CTL but HTAB */
+
+static inline int in_ranges(uint8_t c, const char* r, int rn) {
+	for (int i = 0; i < rn; i += 2)
+		if (c >= (uint8_t)r[i] && c <= (uint8_t)r[i+1])
+			return 1;
+	return 0;
+}
+
+/* find the first byte in [p, end) that falls in any of the ranges. */
+static inline const uint8_t* find_ranges(const uint8_t* p, const uint8_t* end,
+	const char* r, int rn)
+{
+#ifdef __SSE4_2__
+	__m128i rv = _mm_loadu_si128((const __m128i*)r);
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		int i = _mm_cmpestri(rv, rn, v, 16,
+			_SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+		if (i < 16)
+			return p + i;
+		p += 16;
+	}
+#endif
+	for (; p < end; p++)
+		if (in_ranges(*p, r, rn))
+			return p;
+	return end;
+}
+
+static inline int is_ws(uint8_t c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static inline int is_digit(uint8_t c) {
+	return c >= '0' && c <= '9';
+}
+
+/* find the end of the head and return its length including the final CRLF,
+   or 0 if the head is incomplete, in which case the search is resumed from
+   where it stopped on the next call, when more data has been read. */
+static size_t head_size(const uint8_t* buf, size_t len, uint32_t* scanned) {
+	const uint8_t* p = buf + (*scanned <= len ? *scanned : 0);
+	const uint8_t* end = buf + len;
+	for (;;) {
+		p = find_ranges(p, end, ranges_cr, 2);
+		if (end - p < 4) {
+			*scanned = (uint32_t)(p - buf);
+			return 0;
+		}
+		if (p[1] == '\n' && p[2] == '\r' && p[3] == '\n')
+			return (size_t)(p + 4 - buf);
+		p++;
+	}
+}
+
+static inline void span(http_span_t* s, const uint8_t* buf,
+	const uint8_t* p0, const uint8_t* p1)
+{
+	s->i = (uint32_t)(p0 - buf);
+	s->n = (uint32_t)(p1 - p0);
+}
+
+/* "HTTP/" 1*DIGIT "." 1*DIGIT */
+static const uint8_t* parse_version(const uint8_t* p, const uint8_t* end) {
+	if (end - p < 8 || p[0] != 'H' || p[1] != 'T' || p[2] != 'T' || p[3] != 'P'
+		|| p[4] != '/')
+		return NULL;
+	p += 5;
+	const uint8_t* p0 = p;
+	while (p < end && is_digit(*p)) p++;
+	if (p == p0 || p == end || *p != '.') return NULL;
+	p0 = ++p;
+	while (p < end && is_digit(*p)) p++;
+	if (p == p0) return NULL;
+	return p;
+}
+
+/* METHOD SP+ URI SP+ HTTP/x.y SP* CRLF */
+static const uint8_t* parse_request_line(http_head_t* h,
+	const uint8_t* buf, const uint8_t* p, const uint8_t* end)
+{
+	const uint8_t* p0 = p;
+	while (p < end && *p >= 'A' && *p <= 'Z') p++;
+	if (p == p0 || p == end || *p != ' ') return NULL;
+	span(&h->line[0], buf, p0, p);
+	while (p < end && *p == ' ') p++;
+	p0 = p;
+	p = find_ranges(p, end, ranges_uri, 4);
+	if (p == p0 || p == end || *p != ' ') return NULL;
+	span(&h->line[1], buf, p0, p);
+	while (p < end && *p == ' ') p++;
+	p0 = p;
+	p = parse_version(p, end);
+	if (!p) return NULL;
+	span(&h->line[2], buf, p0 + 5, p);
+	while (p < end && *p == ' ') p++;
+	if (end - p < 2 || p[0] != '\r' || p[1] != '\n') return NULL;
+	return p + 2;
+}
+
+/* HTTP/x.y SP+ DIGIT DIGIT DIGIT SP* MESSAGE CRLF */
+static const uint8_t* parse_status_line(http_head_t* h,
+	const uint8_t* buf, const uint8_t* p, const uint8_t* end)
+{
+	const uint8_t* p0 = p;
+	p = parse_version(p, end);
+	if (!p) return NULL;
+	span(&h->line[0], buf, p0 + 5, p);
+	if (p == end || *p != ' ') return NULL;
+	while (p < end && *p == ' ') p++;
+	if (end - p < 3 || !is_digit(p[0]) || !is_digit(p[1]) || !is_digit(p[2]))
+		return NULL;
+	span(&h->line[1], buf, p, p + 3);
+	p += 3;
+	while (p < end && *p == ' ') p++;
+	p0 = p;
+	p = find_ranges(p, end, ranges_value, 6);
+	if (end - p < 2 || p[0] != '\r' || p[1] != '\n') return NULL;
+	span(&h->line[2], buf, p0, p);
+	return p + 2;
+}
+
+/* collapse whitespace runs to one space and remove trailing whitespace.
+   returns the new length, which is never larger than the old one. */
+static uint32_t normalize_value(uint8_t* s, uint32_t n) {
+	uint8_t* d = s;
+	uint8_t* end = s + n;
+	int ws = 0;
+	for (uint8_t* p = s; p < end; p++) {
+		if (is_ws(*p)) {
+			ws = 1;
+		} else {
+			if (ws) {
+				*d++ = ' ';
+				ws = 0;
+			}
+			*d++ = *p;
+		}
+	}
+	return (uint32_t)(d - s);
+}
+
+int http_parse_head(uint8_t* buf, size_t len, int response, http_head_t* h) {
+
+	size_t hlen = head_size(buf, len, &h->scanned);
+	if (!hlen)
+		return HTTP_INCOMPLETE;
+	h->scanned = 0;
+
+	const uint8_t* end = buf + hlen;
+	const uint8_t* p = response
+		? parse_status_line(h, buf, buf, end)
+		: parse_request_line(h, buf, buf, end);
+	if (!p)
+		return HTTP_INVALID_LINE;
+
+	int n = 0;
+	while (p[0] != '\r') { /* headers end with a blank line */
+
+		/* name: anything but CTLs and spaces, up to ':' (RFC 7230 3.2.4) */
+		const uint8_t* p0 = p;
+		p = find_ranges(p, end, ranges_name, 6);
+		if (p == p0 || *p != ':')
+			return HTTP_INVALID_HEADER;
+		if (n == h->max_headers)
+			return HTTP_TOO_MANY_HEADERS;
+		for (uint8_t* c = (uint8_t*)p0; c < p; c++) /* lowercase in place */
+			if (*c >= 'A' && *c <= 'Z')
+				*c |= 0x20;
+		span(&h->headers[2*n], buf, p0, p);
+
+		/* value: skip leading spaces, then scan to CRLF, joining any
+		   folded lines (lines starting with SP or HTAB). */
+		p++;
+		while (*p == ' ' || *p == '\t') p++;
+		p0 = p;
+		int dirty = 0;
+		for (;;) {
+			p = find_ranges(p, end, ranges_value, 6);
+			if (p[0] != '\r' || p[1] != '\n')
+				return HTTP_INVALID_HEADER;
+			if (p[2] != ' ' && p[2] != '\t')
+				break;
+			dirty = 1;
+			p += 3;
+		}
+		http_span_t* v = &h->headers[2*n+1];
+		span(v, buf, p0, p);
+		if (!dirty) { /* check for anything that normalization would change */
+			for (const uint8_t* c = p0; c < p; c++)
+				if (*c == '\t' || (*c == ' ' && (c + 1 == p || c[1] == ' '))) {
+					dirty = 1;
+					break;
+				}
+		}
+		if (dirty)
+			v->n = normalize_value(buf + v->i, v->n);
+		p += 2;
+		n++;
+	}
+	h->header_count = n;
+	return (int)hlen;
+}
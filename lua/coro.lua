@@ -44,6 +44,15 @@ coro.create(f, [onfinish], [fmt, ...]) -> thread
 	`onfinish` is a finalizer function `f(thread, ok, ...) -> ok, ...` that is
 	called from inside the thread when the thread finishes.
 
+coro.create_pooled(f, [onfinish], [fmt, ...]) -> thread
+
+	Like `coro.create()` but the thread is taken from a pool of finished
+	threads if available, and returns to the pool when it finishes, so that
+	its Lua stack can be reused instead of creating and collecting a new
+	coroutine every time. Up to `coro.max_pooled` threads are kept (0).
+	Finished pooled threads report status 'dead' and must not be referenced
+	after they finish since they will be reused for other functions.
+
 coro.transfer(thread[, ...]) -> ...
 
 	Transfer control (and optionally any values) to a coroutine, suspending
@@ -98,7 +107,7 @@ coro.main -> thread
 
 coro.status(thread) -> status
 
-	Behaves like standard coroutine.status()
+	Behaves like standard coroutine.status() (finished pooled threads are 'dead').
 
 NOTE: In this implementation `type(thread) == 'thread'`.
 
@@ -158,6 +167,8 @@ local function unprotect(ok, ...)
 	return ...
 end
 
+local idle = setmetatable({}, {__mode = 'k'}) --{thread -> true}: pooled threads
+
 local FIN = {}
 function coro.finish_with(thread, ok, ...)
 	return FIN, thread, ok, ...
@@ -183,7 +194,7 @@ local function finish(thread, ok, ...)
 		end
 	elseif caller == thread then
 		return main, false, 'coroutine ended by transferring control to itself'
-	elseif caller ~= main and status(caller) == 'dead' then
+	elseif caller ~= main and coro.status(caller) == 'dead' then --or pooled.
 		return main, false, 'coroutine ended by transferring control to a dead coroutine'
 	end
 	return caller, ok, ...
@@ -205,11 +216,63 @@ function coro.create(f, onfinish, fmt, ...)
 	return thread
 end
 
+--pooled threads: instead of returning (and dying) when finished, the thread
+--makes its last transfer by yielding and waits in the pool to be started again.
+--returning from the thread's main function makes the last transfer too.
+coro.max_pooled = 0
+local pool = {} --{thread1, ...}
+local pool_f = setmetatable({}, {__mode = 'k'}) --{thread -> f}
+local pool_onfinish = setmetatable({}, {__mode = 'k'}) --{thread -> onfinish}
+
+local pooled_run --fw. decl.
+local function pooled_finished(thread, ...)
+	if #pool >= coro.max_pooled then
+		return ...
+	end
+	pool[#pool+1] = thread
+	idle[thread] = true
+	return pooled_run(thread, yield(...))
+end
+function pooled_run(thread, ok, ...)
+	local f, onfinish = pool_f[thread], pool_onfinish[thread]
+	pool_f[thread] = nil
+	pool_onfinish[thread] = nil
+	if not ok then --transferred into with an error.
+		return pooled_finished(thread, finish(thread, onfinish(thread, false, ...)))
+	end
+	return pooled_finished(thread, finish(thread, onfinish(thread, coro.pcall(f, ...))))
+end
+
+function coro.create_pooled(f, onfinish, fmt, ...)
+	local n = #pool
+	local thread
+	if n > 0 then
+		thread = pool[n]
+		pool[n] = nil
+		idle[thread] = nil
+	else
+		thread = cocreate(function(ok, ...)
+			return pooled_run(thread, ok, ...)
+		end)
+	end
+	pool_f[thread] = f
+	pool_onfinish[thread] = onfinish or onfinish_pass
+	if fmt then
+		coro.live(thread, fmt, ...)
+	else
+		coro.live(thread, '%s', traceback'unnamed thread')
+	end
+	return thread
+end
+
 function coro.running()
 	return current, current == main
 end
 
-coro.status = status
+function coro.status(thread)
+	if idle[thread] then return 'dead' end
+	return status(thread)
+end
 
 local function go(thread, ok, ...)
 	current = thread
@@ -222,7 +285,8 @@ local function go(thread, ok, ...)
 end
 
 local function transfer_with(thread, ok, ...)
-	assert(status(thread) ~= 'dead', 'cannot transfer to a dead coroutine')
+	assert(status(thread) ~= 'dead' and not idle[thread],
+		'cannot transfer to a dead coroutine')
 	assert(thread ~= current, 'trying to transfer to the running thread')
 	if current ~= main then
 		--we're inside a coroutine: signal the transfer request by yielding.
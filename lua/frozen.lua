@@ -0,0 +1,430 @@
+--[=[
+
+	Frozen values: immutable Lua data in a flat, shareable memory block.
+	Written by Cosmin Apreutesei. Public Domain.
+
+	freeze() packs a Lua value (usually a big lookup table) into a single
+	read-only memory block that can be read in place, without decoding it
+	into Lua tables first. Tables are read through small cdata proxies that
+	look up keys directly in the block (arrays are indexed, hash parts use
+	open addressing on xxhash32 keys). Since the block has no pointers in it,
+	it can be shared with other Lua states (it's an os_thread shareable),
+	saved to a file and mmap'ed by other processes.
+
+	freeze(v) -> fz                      freeze a Lua value
+	frozen(p, size) -> fz                open a frozen block (eg. from mmap or fz:tostring())
+	fz.value -> v                        the frozen value (tables are proxies)
+	fz.size -> n                         block size in bytes
+	fz:tostring() -> s                   get the block as a string (to save it)
+	isfrozen(v) -> true|false            check if v is a frozen table proxy
+	frozen_pairs(t) -> iter() -> k, v    iterate a frozen table (array part first)
+	frozen_ipairs(t) -> iter() -> i, v   iterate the array part of a frozen table
+	thaw(v) -> v                         deep-copy a frozen value into Lua tables
+
+	Values that can be frozen: nil, booleans, numbers, strings and tables
+	made of those (as keys and values). Repeated strings and tables that are
+	referenced multiple times are stored only once. Cyclic tables are not
+	supported.
+
+	Frozen tables support `t[k]` and `#t` (length of the array part) and
+	raise an error on assignment. Use frozen_pairs() instead of pairs().
+	Strings are copied into Lua strings when read.
+
+	Table proxies don't keep the block alive: keep a reference to `fz` for as
+	long as you use any of its tables. When `fz` is passed to os_thread() only
+	the block's address is passed and it's kept alive until the thread is
+	joined (see os_thread).
+
+]=]
+
+if not ... then require'frozen_test'; return end
+
+require'glue'
+require'xxhash'
+
+local bxor, band, shl, shr, tobit =
+	bit.bxor, bit.band, bit.lshift, bit.rshift, bit.tobit
+
+cdef[[
+typedef struct frozen_slot {
+	uint32_t type;
+	uint32_t x;     /* int value, or offset of number, string or table */
+} frozen_slot_t;
+
+typedef struct frozen_table_header {
+	uint32_t narr;  /* array part: slots for t[1..narr] */
+	uint32_t nhash;
+	uint32_t cap;   /* hash part: cap * {key slot, val slot} */
+	uint32_t _pad;
+} frozen_table_header_t;
+
+typedef struct frozen_header {
+	char magic[4];
+	uint32_t size;
+	frozen_slot_t root;
+} frozen_header_t;
+
+typedef struct frozen_table {
+	const uint8_t *base;
+	uint32_t off;
+} frozen_table_t;
+]]
+
+local MAGIC = 'FRZ1'
+
+local T_NIL   = 0
+local T_FALSE = 1
+local T_TRUE  = 2
+local T_INT   = 3 --int32 in x
+local T_NUM   = 4 --double at x
+local T_STR   = 5 --uint32 len at x followed by the bytes
+local T_TABLE = 6 --frozen_table_header_t at x followed by the slots
+
+local slot_ct    = ctype'frozen_slot_t'
+local slot_arr   = ctype'frozen_slot_t[?]'
+local slot_ptr   = ctype'frozen_slot_t*'
+local theader_ct = ctype'frozen_table_header_t'
+local theader_ptr= ctype'frozen_table_header_t*'
+local header_ct  = ctype'frozen_header_t'
+local header_ptr = ctype'frozen_header_t*'
+local dp         = ctype'double*'
+local d1         = ctype'double[1]'
+local table_ct   = ctype'frozen_table_t'
+
+local THEADER_SIZE = sizeof(theader_ct)
+local SLOT_SIZE = sizeof(slot_ct)
+
+local function isint32(v)
+	return floor(v) == v and v >= -2^31 and v < 2^31
+end
+
+--low 32 bits of a * b, multiplying 16-bit halves so that no product goes
+--over 2^53 and loses its low bits like a plain double multiplication would.
+local function mul32(a, b)
+	local al, ah = band(a, 0xffff), shr(a, 16)
+	local bl, bh = band(b, 0xffff), shr(b, 16)
+	return tobit(al * bl + shl(ah * bl + al * bh, 16))
+end
+
+local function hash_int(x)
+	x = tobit(x)
+	x = mul32(bxor(x, shr(x, 16)), 0x45d9f3b)
+	return bxor(x, shr(x, 16))
+end
+
+local hash_buf = d1()
+local function hash_num(v)
+	hash_buf[0] = v
+	return xxhash32(hash_buf, 8, 0)
+end
+
+local function hash_str(s)
+	return xxhash32(s, #s, 0)
+end
+
+local function key_hash(k)
+	local tk = type(k)
+	if tk == 'string' then
+		return hash_str(k)
+	elseif tk == 'number' then
+		return isint32(k) and hash_int(k) or hash_num(k)
+	elseif tk == 'boolean' then
+		return k and T_TRUE or T_FALSE
+	end
+end
+
+--freezing -------------------------------------------------------------------
+
+function freeze(v)
+	local b = string_buffer()
+	local strings = {} --{s -> offset}
+	local tables = {} --{t -> offset | false while being frozen}
+
+	local function align()
+		local pad = -#b % 8
+		if pad > 0 then b:put(('\0'):rep(pad)) end
+	end
+
+	local n1 = new('uint32_t[1]')
+	local encode --fw. decl.
+
+	local function encode_table(t)
+		local off = tables[t]
+		if off then return off end
+		assert(off ~= false, 'cannot freeze cyclic table')
+		tables[t] = false
+
+		local narr = 0
+		while t[narr + 1] ~= nil do
+			narr = narr + 1
+		end
+		local keys = {}
+		for k in pairs(t) do
+			if not (isnum(k) and isint(k) and k >= 1 and k <= narr) then
+				assertf(key_hash(k), 'cannot freeze key of type %s', type(k))
+				assert(k == k, 'cannot freeze NaN key')
+				add(keys, k)
+			end
+		end
+		local nhash = #keys
+		local cap = nhash > 0 and nextpow2(nhash * 2) or 0
+
+		--encode children first so that we know their offsets.
+		local slots = slot_arr(max(1, narr + cap * 2))
+		for i = 1, narr do
+			local s = slots[i-1]
+			s.type, s.x = encode(t[i])
+		end
+		local mask = cap - 1
+		for _,k in ipairs(keys) do
+			local i = band(key_hash(k), mask)
+			while slots[narr + i * 2].type ~= T_NIL do
+				i = band(i + 1, mask)
+			end
+			local ks, vs = slots[narr + i * 2], slots[narr + i * 2 + 1]
+			ks.type, ks.x = encode(k)
+			vs.type, vs.x = encode(t[k])
+		end
+
+		align()
+		off = #b
+		local h = theader_ct(narr, nhash, cap, 0)
+		b:putcdata(h, THEADER_SIZE)
+		b:putcdata(slots, (narr + cap * 2) * SLOT_SIZE)
+		tables[t] = off
+		return off
+	end
+
+	function encode(v)
+		local tv = type(v)
+		if v == nil then
+			return T_NIL, 0
+		elseif v == false then
+			return T_FALSE, 0
+		elseif v == true then
+			return T_TRUE, 0
+		elseif tv == 'number' then
+			if isint32(v) then
+				return T_INT, tobit(v) % 2^32
+			end
+			align()
+			local off = #b
+			hash_buf[0] = v
+			b:putcdata(hash_buf, 8)
+			return T_NUM, off
+		elseif tv == 'string' then
+			local off = strings[v]
+			if not off then
+				align()
+				off = #b
+				n1[0] = #v
+				b:putcdata(n1, 4)
+				b:put(v)
+				strings[v] = off
+			end
+			return T_STR, off
+		elseif tv == 'table' then
+			return T_TABLE, encode_table(v)
+		else
+			error('cannot freeze value of type '..tv)
+		end
+	end
+
+	b:put(('\0'):rep(sizeof(header_ct)))
+	local root_type, root_x = encode(v)
+	local p, n = b:ref()
+	local buf = new('uint8_t[?]', n)
+	copy(buf, p, n)
+	b:free()
+	local h = cast(header_ptr, buf)
+	copy(h.magic, MAGIC, 4)
+	h.size = n
+	h.root.type = root_type
+	h.root.x = root_x
+	return frozen(buf, n)
+end
+
+--reading --------------------------------------------------------------------
+
+local function decode(base, type, x)
+	if type == T_INT then
+		return x < 2^31 and x or x - 2^32
+	elseif type == T_STR then
+		return str(base + x + 4, cast(u32p, base + x)[0])
+	elseif type == T_TABLE then
+		return table_ct(base, x)
+	elseif type == T_NUM then
+		return cast(dp, base + x)[0]
+	elseif type == T_TRUE then
+		return true
+	elseif type == T_FALSE then
+		return false
+	end
+	return nil
+end
+
+local function key_equals(base, s, k)
+	local tk = type(k)
+	local type = s.type
+	if tk == 'string' then
+		if type ~= T_STR then return false end
+		local len = cast(u32p, base + s.x)[0]
+		return len == #k and C.memcmp(base + s.x + 4, k, len) == 0
+	elseif tk == 'number' then
+		if type == T_INT then
+			local x = s.x
+			return (x < 2^31 and x or x - 2^32) == k
+		elseif type == T_NUM then
+			return cast(dp, base + s.x)[0] == k
+		end
+		return false
+	else
+		return type == (k and T_TRUE or T_FALSE)
+	end
+end
+
+local function table_get(t, k)
+	local base = t.base
+	local h = cast(theader_ptr, base + t.off)
+	local slots = cast(slot_ptr, base + t.off + THEADER_SIZE)
+	local narr = h.narr
+	if isnum(k) and k >= 1 and k <= narr and floor(k) == k then
+		local s = slots[k-1]
+		return decode(base, s.type, s.x)
+	end
+	local cap = h.cap
+	if cap == 0 then return nil end
+	local hash = key_hash(k)
+	if not hash or k ~= k then return nil end
+	local mask = cap - 1
+	local i = band(hash, mask)
+	slots = slots + narr
+	while true do
+		local ks = slots[i * 2]
+		if ks.type == T_NIL then
+			return nil
+		end
+		if key_equals(base, ks, k) then
+			local vs = slots[i * 2 + 1]
+			return decode(base, vs.type, vs.x)
+		end
+		i = band(i + 1, mask)
+	end
+end
+
+local function table_len(t)
+	return cast(theader_ptr, t.base + t.off).narr
+end
+
+metatype(table_ct, {
+	__index = table_get,
+	__len = table_len,
+	__newindex = function(t, k)
+		error('attempt to modify a frozen table', 2)
+	end,
+	__eq = function(t1, t2)
+		return isfrozen(t1) and isfrozen(t2)
+			and t1.base == t2.base and t1.off == t2.off
+	end,
+	__tostring = function(t)
+		return _('frozen table: %s+%d', t.base, t.off)
+	end,
+})
+
+function isfrozen(v)
+	return isctype(table_ct, v)
+end
+
+function frozen_ipairs(t)
+	local base = t.base
+	local slots = cast(slot_ptr, base + t.off + THEADER_SIZE)
+	local narr = table_len(t)
+	local i = 0
+	return function()
+		if i >= narr then return nil end
+		i = i + 1
+		local s = slots[i-1]
+		return i, decode(base, s.type, s.x)
+	end
+end
+
+function frozen_pairs(t)
+	local base = t.base
+	local h = cast(theader_ptr, base + t.off)
+	local slots = cast(slot_ptr, base + t.off + THEADER_SIZE)
+	local narr, n = h.narr, h.narr + h.cap
+	local i = 0
+	return function()
+		while i < n do
+			i = i + 1
+			if i <= narr then
+				local s = slots[i-1]
+				return i, decode(base, s.type, s.x)
+			end
+			local ks = slots[narr + (i - narr - 1) * 2]
+			if ks.type ~= T_NIL then
+				local vs = slots[narr + (i - narr - 1) * 2 + 1]
+				return decode(base, ks.type, ks.x), decode(base, vs.type, vs.x)
+			end
+		end
+	end
+end
+
+function thaw(v, seen)
+	if not isfrozen(v) then return v end
+	seen = seen or {}
+	local key = tonumber(v.off)
+	local t = seen[key]
+	if t then return t end
+	t = {}
+	seen[key] = t
+	for k, v in frozen_pairs(v) do
+		t[k] = thaw(v, seen)
+	end
+	return t
+end
+
+--frozen blocks --------------------------------------------------------------
+
+local fz_class = {}
+fz_class.__index = fz_class
+
+--NOTE: `buf` can be a cdata pointer into memory we don't own, in which case
+--it must be kept alive by other means (eg. mmap'ed file, os_thread args).
+function frozen(buf, size)
+	local base = cast(u8p, buf)
+	local h = cast(header_ptr, base)
+	assert(size >= sizeof(header_ct), 'invalid frozen block')
+	assert(str(h.magic, 4) == MAGIC, 'invalid frozen block')
+	assert(h.size <= size, 'frozen block truncated')
+	return setmetatable({
+		buf = buf, --anchored
+		base = base,
+		size = tonumber(h.size),
+		value = decode(base, h.root.type, h.root.x),
+	}, fz_class)
+end
+
+function fz_class:tostring()
+	return str(self.base, self.size)
+end
+
+--frozen blocks / os_thread shareable interface
+
+frozen_shareable = {module = 'frozen'}
+
+function frozen_shareable.identify(fz)
+	return getmetatable(fz) == fz_class
+end
+
+function frozen_shareable.serialize(fz)
+	return {addr = ptr_serialize(fz.base), size = fz.size}
+end
+
+function frozen_shareable.deserialize(t)
+	return frozen(ptr_deserialize(u8p, t.addr), t.size)
+end
+
+if shared_object then --os_thread loaded first.
+	shared_object('frozen', frozen_shareable)
+end
@@ -2358,6 +2358,7 @@ cdef[[
 void* malloc  (size_t size);
 void* realloc (void* ptr, size_t size);
 void  free    (void* ptr);
+int   memcmp  (const void*, const void*, size_t);
 ]]
 
 local function ptr(p) --convert nulls to nil so that `if not p` works.
@@ -31,6 +31,22 @@ inflate(read, write, [bufsize], [format], [windowBits])
 	* for `windowBits`, `memLevel` and `strategy` refer to the zlib manual.
 	  * note that our `windowBits` is always in the positive range 8..15.
 
+DEFLATE streams --------------------------------------------------------------
+
+deflater([format], [level], [windowBits], [memLevel], [strategy], [bufsize]) -> zs
+inflater([format], [windowBits], [bufsize]) -> zs
+zs:push(data, [size], [flush], write) -> true | nil,err
+zs:reset()
+zs:free()
+
+	Push-style (de)compression for protocols that compress a stream of
+	messages with a shared dictionary, like permessage-deflate in websockets.
+
+	* `data` is a string or a cdata buffer with `size` bytes.
+	* `flush` can be 'none' (default), 'sync', 'full' or 'finish'.
+	* `write(cdata, size)` is called for each output chunk.
+	* `reset()` starts a new stream (i.e. discards the dictionary).
+
 GZIP files -------------------------------------------------------------------
 
 [try_]gzip_open(filename[, mode][, bufsize]) -> gzfile
@@ -167,6 +183,86 @@ function inflate(read, write, bufsize, format, windowBits)
 	return inflate_deflate(false, read, write, bufsize, format, windowBits)
 end
 
+--deflate streams ------------------------------------------------------------
+
+local zs = {}
+local zs_meta = {__index = zs}
+
+local flush_enum
+
+local function zstream(deflate, format, windowBits, bufsize)
+	windowBits = windowBits or C.Z_MAX_WBITS
+	if format == 'gzip' then windowBits = windowBits + 16 end
+	if format == 'raw'  then windowBits = -windowBits end
+	bufsize = bufsize or 16 * 1024
+	local self = setmetatable({
+		deflate = deflate,
+		strm = new'z_stream',
+		bufsize = bufsize,
+		buf = u8a(bufsize),
+		flate = deflate and C.deflate or C.inflate,
+		flate_end = deflate and C.deflateEnd or C.inflateEnd,
+		flate_reset = deflate and C.deflateReset or C.inflateReset,
+	}, zs_meta)
+	return self, windowBits
+end
+
+local function zcheck(ret)
+	if ret == 0 then return end
+	error(str(C.zError(ret)))
+end
+
+function deflater(format, level, windowBits, memLevel, strategy, bufsize)
+	local self, windowBits = zstream(true, format, windowBits, bufsize)
+	zcheck(C.deflateInit2_(self.strm,
+		level or C.Z_DEFAULT_COMPRESSION, C.Z_DEFLATED, windowBits,
+		memLevel or 8, strategy or C.Z_DEFAULT_STRATEGY,
+		C.zlibVersion(), sizeof(self.strm)))
+	gc(self.strm, self.flate_end)
+	return self
+end
+
+function inflater(format, windowBits, bufsize)
+	local self, windowBits = zstream(false, format, windowBits, bufsize)
+	zcheck(C.inflateInit2_(self.strm, windowBits,
+		C.zlibVersion(), sizeof(self.strm)))
+	gc(self.strm, self.flate_end)
+	return self
+end
+
+function zs:push(data, size, flush, write)
+	local strm, buf, bufsize = self.strm, self.buf, self.bufsize
+	size = size or #data
+	flush = flush_enum[flush or 'none']
+	strm.next_in, strm.avail_in = data, size
+	repeat
+		strm.next_out, strm.avail_out = buf, bufsize
+		local ret = self.flate(strm, flush)
+		if not (ret == 0 or ret == C.Z_STREAM_END or ret == C.Z_BUF_ERROR) then
+			strm.next_in = nil
+			return nil, str(C.zError(ret))
+		end
+		local n = bufsize - strm.avail_out
+		if n > 0 then
+			write(buf, n)
+		end
+		--a full output buffer means there might be more output pending.
+	until strm.avail_out ~= 0 or ret == C.Z_STREAM_END
+	strm.next_in = nil --don't keep a dangling pointer to data.
+	return true
+end
+
+function zs:reset()
+	zcheck(self.flate_reset(self.strm))
+end
+
+function zs:free()
+	if not self.strm then return end
+	self.flate_end(gc(self.strm, nil))
+	self.strm = nil
+	self.buf = nil
+end
+
 --gzip file access functions -------------------------------------------------
 
 local function checkz(ret) assert(ret == 0) end
@@ -190,7 +286,7 @@ function gzip_open(...)
 	return assert(try_gzip_open(...))
 end
 
-local flush_enum = {
+flush_enum = {
 	none    = C.Z_NO_FLUSH,
 	partial = C.Z_PARTIAL_FLUSH,
 	sync    = C.Z_SYNC_FLUSH,
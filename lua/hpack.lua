@@ -0,0 +1,512 @@
+--[=[
+
+	HPACK header compression for HTTP/2 (RFC 7541).
+	Written by Cosmin Apreutesei. Public Domain.
+
+	Headers are passed around as flat lists {name1, value1, ...} so that
+	their order and duplicates are preserved. Header blocks are decoded from
+	and encoded to cdata buffers.
+
+	hpack_decoder([max_table_size]) -> dec      create a decoder for a connection
+	dec:decode(p, n, [t]) -> t | nil,err        decode a header block
+	dec.max_table_size                          max. table size announced to peer
+	dec.max_header_list_size                    max. decoded size (optional)
+
+	hpack_encoder([max_table_size]) -> enc      create an encoder for a connection
+	enc:encode(t, buf)                          encode headers into a string buffer
+	enc:set_max_table_size(size)                apply peer's table size setting
+	enc.sensitive                               {name->true} never-indexed headers
+
+	huffman_size(s) -> n                        size of Huffman-encoded string
+	huffman_encode(s, buf) -> n                 Huffman-encode into a string buffer
+	huffman_decode(p, n, buf) -> true | nil     Huffman-decode into a string buffer
+
+]=]
+
+if not ... then require'hpack_test'; return end
+
+require'glue'
+
+local
+	band, bor, shl, shr, byte, floor, str =
+	band, bor, shl, shr, string.byte, math.floor, str
+
+--static table ---------------------------------------------------------------
+
+local static = {
+	':authority'                  , '',
+	':method'                     , 'GET',
+	':method'                     , 'POST',
+	':path'                       , '/',
+	':path'                       , '/index.html',
+	':scheme'                     , 'http',
+	':scheme'                     , 'https',
+	':status'                     , '200',
+	':status'                     , '204',
+	':status'                     , '206',
+	':status'                     , '304',
+	':status'                     , '400',
+	':status'                     , '404',
+	':status'                     , '500',
+	'accept-charset'              , '',
+	'accept-encoding'             , 'gzip, deflate',
+	'accept-language'             , '',
+	'accept-ranges'               , '',
+	'accept'                      , '',
+	'access-control-allow-origin' , '',
+	'age'                         , '',
+	'allow'                       , '',
+	'authorization'               , '',
+	'cache-control'               , '',
+	'content-disposition'         , '',
+	'content-encoding'            , '',
+	'content-language'            , '',
+	'content-length'              , '',
+	'content-location'            , '',
+	'content-range'               , '',
+	'content-type'                , '',
+	'cookie'                      , '',
+	'date'                        , '',
+	'etag'                        , '',
+	'expect'                      , '',
+	'expires'                     , '',
+	'from'                        , '',
+	'host'                        , '',
+	'if-match'                    , '',
+	'if-modified-since'           , '',
+	'if-none-match'               , '',
+	'if-range'                    , '',
+	'if-unmodified-since'         , '',
+	'last-modified'               , '',
+	'link'                        , '',
+	'location'                    , '',
+	'max-forwards'                , '',
+	'proxy-authenticate'          , '',
+	'proxy-authorization'         , '',
+	'range'                       , '',
+	'referer'                     , '',
+	'refresh'                     , '',
+	'retry-after'                 , '',
+	'server'                      , '',
+	'set-cookie'                  , '',
+	'strict-transport-security'   , '',
+	'transfer-encoding'           , '',
+	'user-agent'                  , '',
+	'vary'                        , '',
+	'via'                         , '',
+	'www-authenticate'            , '',
+}
+local STATIC_N = #static / 2
+
+local static_names = {}
+local static_values = {}
+local static_name_index = {} --{name -> index}
+local static_nv_index = {} --{name\0value -> index}
+for i = 1, STATIC_N do
+	local k, v = static[2*i-1], static[2*i]
+	static_names[i] = k
+	static_values[i] = v
+	static_name_index[k] = static_name_index[k] or i
+	static_nv_index[k..'\0'..v] = i
+end
+
+--Huffman code ---------------------------------------------------------------
+
+--code lengths for symbols 0..256 (256 is EOS). The code is canonical so the
+--codes themselves are generated from the lengths.
+local lens = {[0] =
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30,
+}
+
+local codes = {} --{sym -> code}
+local counts = {} --{len -> number of codes of that length}
+local symbols = {} --{0-based index -> sym}, sorted by code
+do
+	for len = 1, 30 do counts[len] = 0 end
+	for sym = 0, 256 do
+		symbols[sym+1] = sym
+		counts[lens[sym]] = counts[lens[sym]] + 1
+	end
+	table.sort(symbols, function(a, b)
+		if lens[a] ~= lens[b] then return lens[a] < lens[b] end
+		return a < b
+	end)
+	local code, len = 0, lens[symbols[1]]
+	for i = 1, 257 do
+		local sym = symbols[i]
+		code = code * 2^(lens[sym] - len)
+		len = lens[sym]
+		codes[sym] = code
+		code = code + 1
+	end
+	for i = 0, 256 do --make it 0-based.
+		symbols[i] = symbols[i+1]
+	end
+	symbols[257] = nil
+end
+
+function huffman_size(s)
+	local bits = 0
+	for i = 1, #s do
+		bits = bits + lens[byte(s, i)]
+	end
+	return shr(bits + 7, 3)
+end
+
+function huffman_encode(s, buf)
+	local n = #s
+	local p = buf:reserve(n * 4)
+	local acc, bits, j = 0, 0, 0
+	for i = 1, n do
+		local c = byte(s, i)
+		local len = lens[c]
+		acc = acc * 2^len + codes[c]
+		bits = bits + len
+		while bits >= 8 do
+			bits = bits - 8
+			local m = 2^bits
+			local b = floor(acc / m)
+			p[j] = b
+			j = j + 1
+			acc = acc - b * m
+		end
+	end
+	if bits > 0 then --pad with the most significant bits of EOS (all ones).
+		local pad = 8 - bits
+		p[j] = acc * 2^pad + 2^pad - 1
+		j = j + 1
+	end
+	buf:commit(j)
+	return j
+end
+
+--canonical decoding, one bit at a time, same as zlib's puff.c.
+function huffman_decode(p, n, buf)
+	local out = buf:reserve(floor(n * 8 / 5) + 1) --5 bits is the shortest code.
+	local j = 0
+	local code, first, index, len = 0, 0, 0, 0
+	for i = 0, n-1 do
+		local b = p[i]
+		for k = 7, 0, -1 do
+			code = bor(code, band(shr(b, k), 1))
+			len = len + 1
+			local count = counts[len]
+			if code - count < first then
+				local sym = symbols[index + code - first]
+				if sym == 256 then return nil end --EOS is invalid in strings.
+				out[j] = sym
+				j = j + 1
+				code, first, index, len = 0, 0, 0, 0
+			else
+				if len == 30 then return nil end
+				index = index + count
+				first = shl(first + count, 1)
+				code = shl(code, 1)
+			end
+		end
+	end
+	--padding must be shorter than 8 bits and made of EOS's MSBs (all ones).
+	if len > 7 or shr(code, 1) ~= shl(1, len) - 1 then return nil end
+	buf:commit(j)
+	return true
+end
+
+--dynamic table --------------------------------------------------------------
+
+--entries are kept in a queue with absolute indices from `first` (oldest)
+--to `last` (newest). HPACK index 62 is the newest entry.
+local dyntable = {}
+
+local function entry_size(k, v)
+	return #k + #v + 32
+end
+
+function dyntable:_evict()
+	local i = self.first
+	local k, v = self.names[i], self.values[i]
+	self.names[i] = nil
+	self.values[i] = nil
+	self.first = i + 1
+	self.size = self.size - entry_size(k, v)
+	self:evicted(i, k, v)
+end
+
+dyntable.evicted = noop
+
+function dyntable:_resize(max_size)
+	self.max_size = max_size
+	while self.size > max_size do
+		self:_evict()
+	end
+end
+
+--adding an entry larger than the table empties the table (it's not an error).
+function dyntable:_add(k, v)
+	local sz = entry_size(k, v)
+	while self.size + sz > self.max_size and self.last >= self.first do
+		self:_evict()
+	end
+	if sz > self.max_size then return end
+	local i = self.last + 1
+	self.last = i
+	self.names[i] = k
+	self.values[i] = v
+	self.size = self.size + sz
+	return i
+end
+
+function dyntable:_get(index)
+	if index <= STATIC_N then
+		return static_names[index], static_values[index]
+	end
+	local i = self.last - (index - STATIC_N - 1)
+	if i < self.first then return nil end
+	return self.names[i], self.values[i]
+end
+
+function dyntable:_index(i) --absolute index -> HPACK index
+	return STATIC_N + 1 + self.last - i
+end
+
+local function init_dyntable(self, max_size)
+	self.names = {}
+	self.values = {}
+	self.first = 1
+	self.last = 0
+	self.size = 0
+	self.max_size = max_size or 4096
+	return self
+end
+
+--decoder --------------------------------------------------------------------
+
+local dec = object(dyntable)
+
+function hpack_decoder(max_table_size)
+	local self = init_dyntable(object(dec), max_table_size)
+	self.max_table_size = self.max_size
+	self.sb = string_buffer()
+	return self
+end
+
+local function decode_int(p, n, i, bits)
+	local max = shl(1, bits) - 1
+	local v = band(p[i], max)
+	i = i + 1
+	if v < max then return v, i end
+	local m = 1
+	while true do
+		if i >= n or m > 2^21 then return nil end --truncated or too large.
+		local b = p[i]
+		i = i + 1
+		v = v + band(b, 0x7f) * m
+		m = m * 128
+		if b < 0x80 then return v, i end
+	end
+end
+
+function dec:_string(p, n, i)
+	if i >= n then return nil end
+	local huffman = p[i] >= 0x80
+	local len, i = decode_int(p, n, i, 7)
+	if not len or i + len > n then return nil end
+	if huffman then
+		local sb = self.sb
+		sb:reset()
+		if not huffman_decode(p + i, len, sb) then return nil end
+		return sb:tostring(), i + len
+	else
+		return str(p + i, len), i + len
+	end
+end
+
+function dec:_literal(p, n, i, bits)
+	local index, i = decode_int(p, n, i, bits)
+	if not index then return nil end
+	local k
+	if index == 0 then
+		k, i = self:_string(p, n, i)
+	else
+		k = self:_get(index)
+	end
+	if not k then return nil end
+	local v, i = self:_string(p, n, i)
+	if not v then return nil end
+	return k, v, i
+end
+
+function dec:decode(p, n, t)
+	t = t or {}
+	local t0 = #t
+	local i = 0
+	local list_size = 0
+	local max_list_size = self.max_header_list_size or 1/0
+	while i < n do
+		local b = p[i]
+		local k, v
+		if b >= 0x80 then --indexed field
+			local index
+			index, i = decode_int(p, n, i, 7)
+			if not index or index == 0 then
+				return nil, 'invalid index'
+			end
+			k, v = self:_get(index)
+			if not k then return nil, 'invalid index' end
+		elseif b >= 0x40 then --literal with incremental indexing
+			k, v, i = self:_literal(p, n, i, 6)
+			if not k then return nil, 'invalid literal' end
+			self:_add(k, v)
+		elseif b >= 0x20 then --table size update, only at the start of a block.
+			if #t > t0 then return nil, 'misplaced table size update' end
+			local size
+			size, i = decode_int(p, n, i, 5)
+			if not size or size > self.max_table_size then
+				return nil, 'invalid table size'
+			end
+			self:_resize(size)
+		else --literal without indexing or never indexed
+			k, v, i = self:_literal(p, n, i, 4)
+			if not k then return nil, 'invalid literal' end
+		end
+		if k then
+			list_size = list_size + entry_size(k, v)
+			if list_size > max_list_size then
+				return nil, 'header list too large'
+			end
+			t[#t+1] = k
+			t[#t+1] = v
+		end
+	end
+	return t
+end
+
+--encoder --------------------------------------------------------------------
+
+local enc = object(dyntable, {
+	sensitive = index{'authorization', 'proxy-authorization', 'cookie', 'set-cookie'},
+	--headers that change with every message and would only pollute the table.
+	unindexed = index{'content-length', 'etag', 'last-modified', 'date', ':path'},
+})
+
+function hpack_encoder(max_table_size)
+	local self = init_dyntable(object(enc), max_table_size)
+	self.max_table_size = self.max_size
+	self.name_ids = {} --{name -> absolute index}
+	self.nv_ids = {} --{name\0value -> absolute index}
+	return self
+end
+
+function enc:evicted(i, k, v)
+	if self.name_ids[k] == i then self.name_ids[k] = nil end
+	local nv = k..'\0'..v
+	if self.nv_ids[nv] == i then self.nv_ids[nv] = nil end
+end
+
+--the peer's setting is an upper limit, we only go as far as our own limit.
+--if the size changes more than once between header blocks, the smallest size
+--in between must be signaled too, since entries were evicted (RFC 7541 4.2).
+function enc:set_max_table_size(size)
+	size = math.min(size, self.max_table_size)
+	if size == self.max_size then return end
+	self:_resize(size)
+	self.size_update = size
+	self.min_size_update = math.min(self.min_size_update or size, size)
+end
+
+local function encode_int(buf, flags, bits, v)
+	local max = shl(1, bits) - 1
+	local p = buf:reserve(6)
+	if v < max then
+		p[0] = bor(flags, v)
+		buf:commit(1)
+		return
+	end
+	p[0] = bor(flags, max)
+	v = v - max
+	local j = 1
+	while v >= 0x80 do
+		p[j] = bor(band(v, 0x7f), 0x80)
+		v = shr(v, 7)
+		j = j + 1
+	end
+	p[j] = v
+	buf:commit(j + 1)
+end
+
+local function encode_string(buf, s)
+	local hn = huffman_size(s)
+	if hn < #s then
+		encode_int(buf, 0x80, 7, hn)
+		huffman_encode(s, buf)
+	else
+		encode_int(buf, 0, 7, #s)
+		buf:put(s)
+	end
+end
+
+function enc:encode(t, buf)
+	if self.size_update then
+		if self.min_size_update < self.size_update then
+			encode_int(buf, 0x20, 5, self.min_size_update)
+		end
+		encode_int(buf, 0x20, 5, self.size_update)
+		self.size_update = nil
+		self.min_size_update = nil
+	end
+	for i = 1, #t, 2 do
+		local k, v = t[i], t[i+1]
+		local nv = k..'\0'..v
+		local index = static_nv_index[nv]
+		if not index then
+			local id = self.nv_ids[nv]
+			index = id and self:_index(id)
+		end
+		if index then
+			encode_int(buf, 0x80, 7, index)
+		else
+			local name_index = static_name_index[k]
+			if not name_index then
+				local id = self.name_ids[k]
+				name_index = id and self:_index(id)
+			end
+			local indexed
+			if self.sensitive[k] then
+				encode_int(buf, 0x10, 4, name_index or 0)
+			elseif self.unindexed[k]
+				or entry_size(k, v) > self.max_size / 2
+			then
+				encode_int(buf, 0x00, 4, name_index or 0)
+			else
+				encode_int(buf, 0x40, 6, name_index or 0)
+				indexed = true
+			end
+			if not name_index then
+				encode_string(buf, k)
+			end
+			encode_string(buf, v)
+			if indexed then
+				local id = self:_add(k, v)
+				if id then
+					self.name_ids[k] = id
+					self.nv_ids[nv] = id
+				end
+			end
+		end
+	end
+end
@@ -52,6 +52,14 @@ http:build_response(sreq, opt) -> sres       | Make a HTTP response object.
 
 http:send_response(sres) -> true | nil,err   | Send a response.
 
+http:is_websocket_request(sreq) -> true|false   | Check for a websocket upgrade.
+http:accept_websocket(sreq, opt) -> ws          | Switch protocols (see websocket.lua).
+
+	protocol                value for sec-websocket-protocol (optional)
+	compress                false: don't negotiate permessage-deflate
+	max_message_size        max. size of received messages
+	headers                 extra headers to send (optional)
+
 ]=]
 
 if not ... then require'http_server_test'; return end
@@ -60,6 +68,8 @@ require'glue'
 require'pbuffer'
 require'gzip'
 require'sock'
+require'http_parser'
+require'websocket'
 local http_headers = require'http_headers'
 
 local http = {type = 'http_connection', debug_prefix = 'H'}
@@ -89,6 +99,7 @@ end
 
 --only useful (i.e. that browsers act on) status codes are listed here.
 http.status_messages = {
+	[101] = 'Switching Protocols',   --websocket upgrade.
 	[200] = 'OK',
 	[500] = 'Internal Server Error', --crash handler.
 	[406] = 'Not Acceptable',        --basically 400, based on `accept-encoding`.
@@ -118,14 +129,6 @@ function http:send_request_line(method, uri, http_version)
 	return true
 end
 
-function http:read_request_line()
-	local line = self.b:needline()
-	local method, uri, http_version = line:match'^([%u]+)%s+([^%s]+)%s+HTTP/(%d+%.%d+)'
-	self:dp('<=', '%s %s HTTP/%s', method, uri, http_version)
-	self.f:checkp(method and (http_version == '1.0' or http_version == '1.1'), 'invalid request line')
-	return http_version, method, uri
-end
-
 function http:send_status_line(status, message, http_version)
 	message = message
 		and message:gsub('[\r?\n]', ' ')
@@ -137,17 +140,6 @@ function http:send_status_line(status, message, http_version)
 	self.f:send(s)
 end
 
-function http:read_status_line()
-	local line, err = self.b:needline()
-	if not line then return nil, err end
-	local http_version, status, status_message
-		= line:match'^HTTP/(%d+%.%d+)%s+(%d%d%d)%s*(.*)'
-	self:dp('<=', '%s %s %s', status, status_message, http_version)
-	status = tonumber(status)
-	self.f:checkp(http_version and status, 'invalid status line')
-	return http_version, status, status_message
-end
-
 --headers --------------------------------------------------------------------
 
 function http:format_header(k, v)
@@ -187,37 +179,88 @@ function http:send_headers(headers)
 	self.f:send'\r\n'
 end
 
-function http:read_headers(rawheaders)
-	local line, name, value
-	line = self.b:needline()
-	while line ~= '' do --headers end up with a blank line
-		name, value = line:match'^([^:]+):%s*(.*)'
-		self.f:checkp(name, 'invalid header')
-		name = name:lower() --header names are case-insensitive
-		line = self.b:needline()
-		while line:find'^%s' do --unfold any folded values
-			value = value .. line
-			line = self.b:needline()
-		end
-		value = value:gsub('%s+', ' ') --multiple spaces equal one space.
-		value = value:gsub('%s*$', '') --around-spaces are meaningless.
-		self:dp('<-', '%-17s %s', name, value)
-		if http_headers.nofold[name] then --prevent folding.
-			if rawheaders[name] then --duplicate header: add to list.
-				table.insert(rawheaders[name], value)
-			else
-				rawheaders[name] = {value}
-			end
-		else
-			if rawheaders[name] then --duplicate header: fold.
-				rawheaders[name] = rawheaders[name] .. ',' .. value
-			else
-				rawheaders[name] = value
+--message head ---------------------------------------------------------------
+
+--the start line and headers are parsed in one pass by http_parser which
+--lowercases header names, normalizes header values and makes the strings
+--for the headers lazily when accessed. The head is read into a buffer of
+--its own which the parsed message keeps so that it doesn't have to be copied
+--out of the receive buffer. Bytes read past the head go to the receive buffer.
+
+http.max_head_size = 64 * 1024
+http.max_headers = 100
+http.head_buffer_size = 4096
+
+local function read_head_more(self, hb, n)
+	local size = min(max(n, self.head_buffer_size), self.max_head_size - n)
+	local len = self.b:read(hb:reserve(size), size)
+	if len == 0 then return false end
+	hb:commit(len)
+	return true
+end
+
+--wait for a message to start and read the start of its head.
+--returns false on eof before a new message.
+function http:have_head()
+	if self.hb then return true end
+	local hb = string_buffer()
+	local b = self.b
+	local p, n = b:ref()
+	if n > 0 then --pipelined or read-ahead bytes after the previous message.
+		hb:putcdata(p, n)
+		b:reset()
+	elseif not read_head_more(self, hb, 0) then
+		return false
+	end
+	self.hb = hb
+	return true
+end
+
+function http:read_head(response)
+	local b = self.b
+	b:check_io(self:have_head(), 'eof')
+	local hb = self.hb
+	while true do
+		local p, n = hb:ref()
+		local head_size, err = self.hp:parse(p, n, response, hb)
+		self.f:checkp(head_size, err)
+		if head_size > 0 then
+			if n > head_size then --body or pipelined bytes.
+				b:putcdata(p + head_size, n - head_size)
 			end
+			self.hb = false
+			break
 		end
+		self.f:checkp(n < self.max_head_size, 'message head too large')
+		b:check_io(read_head_more(self, hb, n), 'eof')
+	end
+end
+
+function http:log_headers()
+	if self.dp == noop then return end
+	for name, value in self.hp:each_header() do
+		self:dp('<-', '%-17s %s', name, value)
 	end
 end
 
+function http:read_request_head()
+	self:read_head(false)
+	local method, uri, http_version = self.hp:line()
+	self:dp('<=', '%s %s HTTP/%s', method, uri, http_version)
+	self.f:checkp(http_version == '1.0' or http_version == '1.1',
+		'invalid request line')
+	self:log_headers()
+	return http_version, method, uri, self.hp:rawheaders()
+end
+
+function http:read_response_head()
+	self:read_head(true)
+	local http_version, status, status_message = self.hp:line()
+	self:dp('<=', '%s %s %s', status, status_message, http_version)
+	self:log_headers()
+	return http_version, status, status_message, self.hp:rawheaders()
+end
+
 --body -----------------------------------------------------------------------
 
 function http:set_body_headers(headers, content, content_size, close)
@@ -545,19 +588,15 @@ local cres = {type = 'http_response', debug_prefix = '<'}
 function http:read_response(req)
 	local res = object(cres, {http = self, request = req})
 	req.response = res
-	res.rawheaders = {}
 
 	local dt = req.reply_timeout
 	self.f:setexpires('r', dt and clock() + dt or nil)
 
-	res.http_version, res.status, res.status_message = self:read_status_line()
+	repeat --ignore any 100-continue messages
+		res.http_version, res.status, res.status_message, res.rawheaders =
+			self:read_response_head()
+	until res.status ~= 100
 
-	while res.status == 100 do --ignore any 100-continue messages
-		self:read_headers(res.rawheaders)
-		res.http_version, res.status = self:read_status_line()
-	end
-
-	self:read_headers(res.rawheaders)
 	res.headers = self:parsed_headers(res.rawheaders)
 
 	if req.headers_received then
@@ -592,9 +631,8 @@ http.server_request_class = sreq
 function http:read_request()
 	local req = object(sreq, {http = self})
 	self.start_time = clock()
-	req.http_version, req.method, req.uri = self:read_request_line()
-	req.rawheaders = {}
-	self:read_headers(req.rawheaders)
+	req.http_version, req.method, req.uri, req.rawheaders =
+		self:read_request_head()
 	req.headers = self:parsed_headers(req.rawheaders)
 	req.close = req.headers['connection'] and req.headers['connection'].close
 	return req
@@ -638,6 +676,7 @@ http.nocompress_mime_types = index{
 	'application/x-bz2',
 	'audio/mpeg',
 	'text/event-stream',
+	'application/vnd.openxmlformats-officedocument.spreadsheetml.sheet',
 }
 
 function http:accept_content_type(req, opt)
@@ -745,6 +784,41 @@ function http:send_response(res)
 	return ret, err
 end
 
+--websocket upgrade -----------------------------------------------------------
+
+function http:is_websocket_request(req)
+	local h = req.headers
+	return req.method == 'GET'
+		and h['upgrade'] and h['upgrade'].websocket
+		and h['connection'] and h['connection'].upgrade
+		and h['sec-websocket-version'] == '13'
+		and h['sec-websocket-key'] and true or false
+end
+
+function http:accept_websocket(req, opt)
+	local headers = {
+		upgrade = 'websocket',
+		connection = 'upgrade',
+		['sec-websocket-accept'] = websocket_accept_key(req.headers['sec-websocket-key']),
+		['sec-websocket-protocol'] = opt.protocol,
+	}
+	local deflate
+	if repl(opt.compress, nil, self.compress) ~= false then
+		deflate, headers['sec-websocket-extensions'] =
+			websocket_deflate_accept(req.headers['sec-websocket-extensions'])
+	end
+	update(headers, opt.headers)
+	self:send_status_line(101, nil, '1.1')
+	self:send_headers(headers)
+	return websocket{
+		f = self.f,
+		b = self.b,
+		deflate = deflate,
+		max_message_size = opt.max_message_size,
+	}
+end
+http:protect'accept_websocket'
+
 --instantiation --------------------------------------------------------------
 
 function _G.http(t)
@@ -770,9 +844,12 @@ function _G.http(t)
 		readahead = self.recv_buffer_size,
 	} --for reading only
 
+	self.hp = http_head_parser(self.max_headers)
+
 	return self
 end
 
 function http:free()
 	self.b:free()
+	self.hp:free()
 end
@@ -0,0 +1,879 @@
+--[=[
+
+	HTTP/2 server protocol (RFC 9113).
+	Written by Cosmin Apreutesei. Public Domain.
+
+	This module implements framing, stream multiplexing and flow control
+	and presents each stream as a HTTP protocol object (see http.lua) with
+	its own request, so that http_server.lua can handle HTTP/2 requests with
+	the same req/respond code that handles HTTP/1.1 requests. Each stream is
+	handled on its own thread. Server push and priorities are not implemented
+	(both are deprecated in RFC 9113).
+
+	http2_requested(http) -> true|false  check if the client speaks HTTP/2
+
+		Check if the client asked for HTTP/2 with TLS-ALPN or by sending the
+		connection preface right away (prior knowledge, on cleartext ports).
+		Blocks until the first bytes are received.
+
+	http2(opt) -> h2                     create a HTTP/2 connection object
+		http                               the http object of the connection
+		max_concurrent_streams             max. streams per connection (100)
+		initial_window_size                receive window per stream (256K)
+		connection_window_size             receive window per connection (1M)
+		max_frame_size                     max. frame size we accept (16K)
+		max_header_list_size               max. size of decoded headers (64K)
+		settings_timeout                   max. seconds to get the preface & SETTINGS (10)
+		idle_timeout                       close after n seconds without streams (60)
+
+	h2:serve(handler)                    read frames until the connection closes
+		handler(stream_http, req)          called on a new thread for each stream
+
+	h2:goaway([error_code])              tell the client to stop opening streams
+
+	Stream http objects inherit the connection's http object and have:
+		.h2                                the connection object
+		.conn                              the connection's http object
+		.stream_id                         the stream id
+		.f                                 the stream's pseudo-socket
+
+	NOTE: the stream's pseudo-socket inherits the connection's socket so that
+	socket fields like remote_addr keep working, but timeouts are set on the
+	connection, so f:setexpires() does nothing on streams. The connection is
+	timed by h2 itself: the client must send the connection preface and its
+	SETTINGS frame within `settings_timeout` seconds, and the connection is
+	closed when no streams are open for `idle_timeout` seconds.
+
+	NOTE: websocket upgrades are not possible on HTTP/2 streams.
+
+]=]
+
+if not ... then require'http_server_test'; return end
+
+require'glue'
+require'sock'
+require'hpack'
+
+local
+	band, bor, shl, shr, min, cast, u8p, remove, byte, str =
+	band, bor, shl, shr, math.min, cast, u8p, table.remove, string.byte, str
+
+local PREFACE = 'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n'
+
+local DATA          = 0x0
+local HEADERS       = 0x1
+local PRIORITY      = 0x2
+local RST_STREAM    = 0x3
+local SETTINGS      = 0x4
+local PUSH_PROMISE  = 0x5
+local PING          = 0x6
+local GOAWAY        = 0x7
+local WINDOW_UPDATE = 0x8
+local CONTINUATION  = 0x9
+
+local frame_names = {[0] =
+	'DATA', 'HEADERS', 'PRIORITY', 'RST_STREAM', 'SETTINGS',
+	'PUSH_PROMISE', 'PING', 'GOAWAY', 'WINDOW_UPDATE', 'CONTINUATION',
+}
+
+local END_STREAM  = 0x1
+local ACK         = 0x1
+local END_HEADERS = 0x4
+local PADDED      = 0x8
+local PRIO        = 0x20
+
+local SETTINGS_HEADER_TABLE_SIZE      = 0x1
+local SETTINGS_MAX_CONCURRENT_STREAMS = 0x3
+local SETTINGS_INITIAL_WINDOW_SIZE    = 0x4
+local SETTINGS_MAX_FRAME_SIZE         = 0x5
+local SETTINGS_MAX_HEADER_LIST_SIZE   = 0x6
+
+local NO_ERROR            = 0x0
+local PROTOCOL_ERROR      = 0x1
+local INTERNAL_ERROR      = 0x2
+local FLOW_CONTROL_ERROR  = 0x3
+local STREAM_CLOSED       = 0x5
+local FRAME_SIZE_ERROR    = 0x6
+local REFUSED_STREAM      = 0x7
+local CANCEL              = 0x8
+local COMPRESSION_ERROR   = 0x9
+local ENHANCE_YOUR_CALM   = 0xb
+
+local MAX_WINDOW = 2^31-1
+
+--headers that are not allowed in HTTP/2 messages.
+local connection_headers = index{
+	'connection', 'keep-alive', 'proxy-connection', 'transfer-encoding', 'upgrade',
+}
+
+local nofold = require'http_headers'.nofold
+
+function http2_requested(http)
+	local f = http.f
+	if not http:have_head() then return false end
+	if f.alpn_selected and f:alpn_selected() == 'h2' then return true end
+	local p, n = http.hb:ref()
+	return n >= 3 and p[0] == 80 and p[1] == 82 and p[2] == 73 --PRI
+end
+
+local h2 = {
+	type = 'http2_connection',
+	max_concurrent_streams = 100,
+	initial_window_size = 256 * 1024,
+	connection_window_size = 1024 * 1024,
+	max_frame_size = 16384,
+	max_header_list_size = 64 * 1024,
+	settings_timeout = 10,
+	idle_timeout = 60,
+}
+
+local stream = {type = 'http2_stream'} --methods of stream http objects.
+local sf = {} --methods of stream pseudo-sockets.
+
+function http2(opt)
+	local self = object(h2, {}, opt)
+	local http = assert(self.http)
+	http.start_time = http.start_time or clock()
+	self.f = http.f
+	self.b = http.b
+	if http.hb then --the start of the preface, read by http2_requested().
+		self.b:putcdata(http.hb:ref())
+		http.hb = false
+	end
+	self.streams = {} --{id -> stream}
+	self.stream_count = 0
+	self.last_stream_id = 0
+	self.send_window = 65535
+	self.recv_window = self.connection_window_size
+	self.recv_consumed = 0
+	self.peer_initial_window_size = 65535
+	self.peer_max_frame_size = 16384
+	self.enc = hpack_encoder()
+	self.dec = hpack_decoder()
+	self.dec.max_header_list_size = self.max_header_list_size
+	self.wb = string_buffer() --write buffer, used under lock.
+	self.hb = string_buffer() --header block buffer.
+	self.stream_class = object(http, {h2 = self, conn = http}, stream)
+	return self
+end
+
+function h2:dp(...)
+	return self.http:dp(...)
+end
+
+--sending frames -------------------------------------------------------------
+
+--frames from different streams must not interleave on the wire so all
+--sending is done under a lock. frames are assembled into a write buffer
+--and sent with a single write.
+
+function h2:_lock()
+	while self.sending do
+		push(attr(self, 'send_queue'), currentthread())
+		suspend()
+	end
+	self.sending = true
+end
+
+function h2:_unlock()
+	self.sending = false
+	local thread = self.send_queue and remove(self.send_queue, 1)
+	if thread then
+		resume(thread)
+	end
+end
+
+function h2:_send(build, ...)
+	self:_lock()
+	local wb = self.wb
+	wb:reset()
+	local ok, err = pcall(build, self, wb, ...)
+	if ok then
+		local p, n = wb:ref()
+		ok, err = pcall(self.f.send, self.f, p, n)
+	end
+	self:_unlock()
+	if not ok then error(err, 0) end
+end
+
+local function put_u32(p, i, v)
+	p[i+0] = band(shr(v, 24), 0xff)
+	p[i+1] = band(shr(v, 16), 0xff)
+	p[i+2] = band(shr(v,  8), 0xff)
+	p[i+3] = band(v, 0xff)
+end
+
+local function get_u32(p, i)
+	return ((p[i] * 256 + p[i+1]) * 256 + p[i+2]) * 256 + p[i+3]
+end
+
+local function put_frame(wb, typ, flags, sid, p, n)
+	local h = wb:reserve(9)
+	h[0] = band(shr(n, 16), 0xff)
+	h[1] = band(shr(n,  8), 0xff)
+	h[2] = band(n, 0xff)
+	h[3] = typ
+	h[4] = flags
+	put_u32(h, 5, sid)
+	wb:commit(9)
+	if n > 0 then
+		wb:putcdata(p, n)
+	end
+end
+
+local function frame(self, wb, ...)
+	put_frame(wb, ...)
+end
+
+local function put_settings(self, wb)
+	local t = {
+		SETTINGS_MAX_CONCURRENT_STREAMS, self.max_concurrent_streams,
+		SETTINGS_INITIAL_WINDOW_SIZE   , self.initial_window_size,
+		SETTINGS_MAX_FRAME_SIZE        , self.max_frame_size,
+		SETTINGS_MAX_HEADER_LIST_SIZE  , self.max_header_list_size,
+	}
+	local n = #t / 2 * 6
+	local p = new('uint8_t[?]', n)
+	for i = 0, #t / 2 - 1 do
+		local id, v = t[2*i+1], t[2*i+2]
+		p[6*i+0] = 0
+		p[6*i+1] = id
+		put_u32(p, 6*i+2, v)
+	end
+	put_frame(wb, SETTINGS, 0, 0, p, n)
+	local inc = self.connection_window_size - 65535
+	if inc > 0 then
+		local p = new('uint8_t[4]')
+		put_u32(p, 0, inc)
+		put_frame(wb, WINDOW_UPDATE, 0, 0, p, 4)
+	end
+end
+
+local function put_control(self, wb, typ, flags, sid, u32a, u32b)
+	local p = new('uint8_t[8]')
+	put_u32(p, 0, u32a)
+	local n = 4
+	if u32b then
+		put_u32(p, 4, u32b)
+		n = 8
+	end
+	put_frame(wb, typ, flags, sid, p, n)
+end
+
+function h2:_send_control(typ, flags, sid, u32a, u32b)
+	self:dp('->', '%s %d %s %s', frame_names[typ], sid, u32a, u32b or '')
+	self:_send(put_control, typ, flags, sid, u32a, u32b)
+end
+
+function h2:_send_window_update(sid, inc)
+	self:_send_control(WINDOW_UPDATE, 0, sid, inc)
+end
+
+function h2:_rst(sid, code)
+	if self.closed then return end
+	self:_send_control(RST_STREAM, 0, sid, code)
+end
+
+function h2:goaway(code)
+	if self.goaway_sent or self.closed then return end
+	self.goaway_sent = true
+	self:_send_control(GOAWAY, 0, 0, self.last_stream_id, code or NO_ERROR)
+end
+
+--connection errors are fatal: tell the client why and close the connection.
+function h2:_error(code, err)
+	pcall(self.goaway, self, code)
+	self.f:checkp(false, 'http2: %s', err)
+end
+
+local function put_headers(self, wb, sid, t, end_stream)
+	local hb = self.hb
+	hb:reset()
+	self.enc:encode(t, hb)
+	local p, n = hb:ref()
+	local max = self.peer_max_frame_size
+	local typ = HEADERS
+	local flags = end_stream and END_STREAM or 0
+	repeat
+		local len = min(n, max)
+		n = n - len
+		put_frame(wb, typ, n == 0 and bor(flags, END_HEADERS) or flags, sid, p, len)
+		p = p + len
+		typ, flags = CONTINUATION, 0
+	until n == 0
+end
+
+--NOTE: window space is reserved before taking the lock so that no other
+--thread can take it in between.
+function h2:_send_data(stream, p, n, end_stream)
+	if n == 0 and not end_stream then return end
+	local s = p --anchor strings.
+	if isstr(p) then p = cast(u8p, p) end
+	local i = 0
+	while true do
+		stream:_check()
+		local len = min(n - i, self.peer_max_frame_size)
+		if len > 0 then
+			len = min(len, self.send_window, stream.send_window)
+		end
+		if len <= 0 and i < n then --blocked by flow control.
+			stream.window_thread = currentthread()
+			suspend()
+			stream.window_thread = nil
+		else
+			self.send_window = self.send_window - len
+			stream.send_window = stream.send_window - len
+			i = i + len
+			local flags = (end_stream and i == n) and END_STREAM or 0
+			if flags ~= 0 then
+				stream.local_closed = true
+			end
+			self:_send(frame, DATA, flags, stream.stream_id,
+				len > 0 and p + (i - len) or nil, len)
+			if i == n then break end
+		end
+	end
+	self:dp('>>', '%d %7d bytes%s', stream.stream_id, n, end_stream and ' (end)' or '')
+end
+
+--receive flow control -------------------------------------------------------
+
+--window updates are sent when the app consumes half of the window, which
+--means that a slow reader makes the client stop sending (backpressure).
+function h2:_consumed(stream, n)
+	self.recv_consumed = self.recv_consumed + n
+	if self.recv_consumed >= self.connection_window_size / 2 then
+		local inc = self.recv_consumed
+		self.recv_consumed = 0
+		self.recv_window = self.recv_window + inc
+		self:_send_window_update(0, inc)
+	end
+	if stream and not stream.remote_closed and not stream.reset then
+		stream.recv_consumed = stream.recv_consumed + n
+		if stream.recv_consumed >= self.initial_window_size / 2 then
+			local inc = stream.recv_consumed
+			stream.recv_consumed = 0
+			stream.recv_window = stream.recv_window + inc
+			self:_send_window_update(stream.stream_id, inc)
+		end
+	end
+end
+
+--streams --------------------------------------------------------------------
+
+local function wake(thread)
+	if thread then
+		resume(thread)
+	end
+end
+
+function stream:_wake()
+	wake(self.reader_thread)
+	wake(self.window_thread)
+end
+
+function stream:_check()
+	if self.reset then
+		self.f:check_io(false, 'stream reset')
+	elseif self.h2.closed then
+		self.f:check_io(false, 'closed')
+	end
+end
+
+function stream:_read_data()
+	while true do
+		local s = remove(self.inq, 1)
+		if s then
+			self.h2:_consumed(self, #s)
+			return s
+		end
+		if self.remote_closed then return end
+		self:_check()
+		self.reader_thread = currentthread()
+		suspend()
+		self.reader_thread = nil
+	end
+end
+
+function stream:read_body_to_writer(headers, write, from_server, close, state)
+	if state then state.body_was_read = false end
+	write = write and self:chained_decoder(write, headers['content-encoding'])
+		or noop
+	local total = 0
+	while true do
+		local s = self:_read_data()
+		if not s then break end
+		total = total + #s
+		write(cast(u8p, s), #s)
+	end
+	self:dp('<<', '%7d bytes total', total)
+	if state then state.body_was_read = true end
+end
+
+function stream:send_headers(headers, end_stream)
+	local t = {':status', tostring(self.status or 200)}
+	for k, v in pairs(headers) do
+		if v ~= self.remove then
+			k, v = self:format_header(k, v)
+			if v and not connection_headers[k] then
+				if istab(v) then --must be sent unfolded.
+					for _,v in ipairs(v) do
+						t[#t+1] = k
+						t[#t+1] = tostring(v)
+						self:dp('->', '%-17s %s', k, v)
+					end
+				else
+					t[#t+1] = k
+					t[#t+1] = tostring(v)
+					self:dp('->', '%-17s %s', k, v)
+				end
+			end
+		end
+	end
+	if end_stream then
+		self.local_closed = true
+	end
+	self.h2:_send(put_headers, self.stream_id, t, end_stream)
+end
+
+function stream:send_status_line(status, message)
+	self:dp('=>', '%d %s %s', self.stream_id, status, message or '')
+	self.status = status
+end
+
+function stream:send_body(content, content_size)
+	local h2 = self.h2
+	if isfunc(content) then
+		while true do
+			local chunk, len = content()
+			if not chunk then break end --eof
+			h2:_send_data(self, chunk, len or #chunk)
+		end
+		h2:_send_data(self, nil, 0, true)
+	else
+		h2:_send_data(self, content, content_size or #content, true)
+	end
+end
+
+function stream:send_response(res)
+	local has_body = self:should_have_response_body(res.request.method, res.status)
+		and not (isstr(res.content) and #res.content == 0)
+	self:send_status_line(res.status, res.status_message)
+	self:send_headers(res.headers, not has_body)
+	if has_body then
+		self:send_body(res.content, res.content_size)
+	end
+	return true
+end
+stream.send_response = protect_io(stream.send_response)
+local send_response = stream.send_response
+function stream:send_response(res)
+	local ret, err = send_response(self, res)
+	self:after_send_response(ret, err)
+	if ret then return ret end
+	return ret, err
+end
+
+--the stream pseudo-socket: closing it means resetting the stream.
+
+function sf:try_close()
+	if self._closed then return true end
+	self._closed = true
+	local stream = self.stream
+	if not stream.local_closed and not stream.reset then
+		stream.reset = true
+		pcall(stream.h2._rst, stream.h2, stream.stream_id, CANCEL)
+	end
+	if self._after_close then
+		self:_after_close()
+	end
+	return true
+end
+
+function sf:close()
+	self:try_close()
+end
+
+function sf:closed()
+	return self._closed or self.stream.h2.closed or false
+end
+
+function sf:onclose(fn)
+	after(self, '_after_close', fn)
+end
+
+sf.setexpires = noop
+
+function h2:_new_stream(sid, end_stream)
+	local f = self.f
+	local stream = object(self.stream_class, {
+		stream_id = sid,
+		start_time = clock(),
+		inq = {},
+		send_window = self.peer_initial_window_size,
+		recv_window = self.initial_window_size,
+		recv_consumed = 0,
+		remote_closed = end_stream,
+	})
+	stream.f = object(f, {stream = stream, __tostring = function()
+		return _('%s/%d', logarg(f), sid)
+	end}, sf)
+	self.streams[sid] = stream
+	self.stream_count = self.stream_count + 1
+	self:_stop_idle_timer()
+	return stream
+end
+
+function h2:_free_stream(stream)
+	if self.streams[stream.stream_id] ~= stream then return end
+	self.streams[stream.stream_id] = nil
+	self.stream_count = self.stream_count - 1
+	if self.stream_count == 0 then
+		self:_start_idle_timer()
+	end
+end
+
+--NOTE: the idle timeout can't be a read deadline on the socket because
+--streams are opened and closed while the reader thread is waiting on it.
+function h2:_start_idle_timer()
+	if not self.idle_timeout or self.idle_job or self.closed then return end
+	self.idle_job = runafter(self.idle_timeout, function()
+		self.idle_job = false
+		if self.stream_count > 0 or self.closed then return end
+		self:dp('--', 'idle timeout')
+		pcall(self.goaway, self)
+		self.f:close()
+	end)
+end
+
+function h2:_stop_idle_timer()
+	if not self.idle_job then return end
+	self.idle_job:cancel()
+	self.idle_job = false
+end
+
+--build a server request object out of a decoded header list.
+function h2:_request(stream, t)
+	local method, path, scheme, authority
+	local rawheaders = {}
+	local regular
+	for i = 1, #t, 2 do
+		local k, v = t[i], t[i+1]
+		if byte(k, 1) == 58 then --pseudo-header
+			if regular then return nil end
+			if     k == ':method'    and not method    then method    = v
+			elseif k == ':path'      and not path      then path      = v
+			elseif k == ':scheme'    and not scheme    then scheme    = v
+			elseif k == ':authority' and not authority then authority = v
+			else return nil end
+		else
+			regular = true
+			if k:find'[A-Z]' or connection_headers[k] then return nil end
+			if k == 'te' and v ~= 'trailers' then return nil end
+			local v0 = rawheaders[k]
+			if nofold[k] then
+				v0 = v0 or {}
+				add(v0, v)
+				v = v0
+			elseif v0 then --cookies can be split in HTTP/2.
+				v = v0 .. (k == 'cookie' and '; ' or ',') .. v
+			end
+			rawheaders[k] = v
+		end
+	end
+	if not method or not path or not scheme then return nil end
+	rawheaders.host = rawheaders.host or authority
+	local req = object(self.http.server_request_class, {
+		http = stream,
+		http_version = '2',
+		method = method,
+		uri = path,
+		rawheaders = rawheaders,
+	})
+	req.headers = stream:parsed_headers(rawheaders)
+	self:dp('<=', '%d %s %s', stream.stream_id, method, path)
+	return req
+end
+
+function h2:_start_stream(stream, req)
+	local thread = thread(function()
+		local ok, err = pcall(self.handler, stream, req)
+		if not ok and not stream.local_closed and not stream.reset then
+			stream.reset = true
+			pcall(self._rst, self, stream.stream_id, INTERNAL_ERROR)
+		end
+		stream.f:try_close() --reset the stream if not ended, run onclose hooks.
+		self:_free_stream(stream)
+		if not ok then error(err, 0) end
+	end, 'http2-stream %s %d', self.f, stream.stream_id)
+	resume(thread)
+end
+
+--receiving frames -----------------------------------------------------------
+
+function h2:_headers(sid, flags, p, n)
+	local t, err = self.dec:decode(p, n)
+	if not t then --HPACK state is now out of sync.
+		self:_error(COMPRESSION_ERROR, err)
+	end
+	local end_stream = band(flags, END_STREAM) ~= 0
+	local stream = self.streams[sid]
+	if stream then --trailers
+		if stream.remote_closed or not end_stream then
+			stream.reset = true
+			self:_rst(sid, PROTOCOL_ERROR)
+			stream:_wake()
+			return
+		end
+		stream.remote_closed = true
+		stream:_wake()
+		return
+	end
+	if sid <= self.last_stream_id then
+		return --trailers of a finished stream.
+	end
+	if band(sid, 1) == 0 then
+		self:_error(PROTOCOL_ERROR, 'even stream id')
+	end
+	self.last_stream_id = sid
+	if self.goaway_sent or self.stream_count >= self.max_concurrent_streams then
+		self:_rst(sid, REFUSED_STREAM)
+		return
+	end
+	local stream = self:_new_stream(sid, end_stream)
+	local req = self:_request(stream, t)
+	if not req then
+		self:_free_stream(stream)
+		self:_rst(sid, PROTOCOL_ERROR)
+		return
+	end
+	self:_start_stream(stream, req)
+end
+
+local handlers = {}
+
+handlers[DATA] = function(self, sid, flags, p, n)
+	if sid == 0 then self:_error(PROTOCOL_ERROR, 'DATA on stream 0') end
+	self.recv_window = self.recv_window - n
+	if self.recv_window < 0 then
+		self:_error(FLOW_CONTROL_ERROR, 'connection window exceeded')
+	end
+	local len = n
+	if band(flags, PADDED) ~= 0 then
+		if n < 1 or p[0] >= n then self:_error(PROTOCOL_ERROR, 'invalid padding') end
+		len = n - 1 - p[0]
+		p = p + 1
+	end
+	local stream = self.streams[sid]
+	if not stream or stream.remote_closed or stream.reset then
+		if sid > self.last_stream_id then
+			self:_error(PROTOCOL_ERROR, 'DATA on idle stream')
+		end
+		self:_consumed(nil, n)
+		if stream and not stream.reset then
+			self:_rst(sid, STREAM_CLOSED)
+		end
+		return
+	end
+	stream.recv_window = stream.recv_window - n
+	if stream.recv_window < 0 then
+		stream.reset = true
+		self:_rst(sid, FLOW_CONTROL_ERROR)
+		stream:_wake()
+		self:_consumed(nil, n)
+		return
+	end
+	if n > len then --padding is consumed right away.
+		self:_consumed(stream, n - len)
+	end
+	if len > 0 then
+		add(stream.inq, str(p, len))
+	end
+	if band(flags, END_STREAM) ~= 0 then
+		stream.remote_closed = true
+	end
+	wake(stream.reader_thread)
+end
+
+handlers[HEADERS] = function(self, sid, flags, p, n)
+	if sid == 0 then self:_error(PROTOCOL_ERROR, 'HEADERS on stream 0') end
+	local i, j = 0, n
+	if band(flags, PADDED) ~= 0 then
+		if n < 1 then self:_error(PROTOCOL_ERROR, 'invalid padding') end
+		j = j - p[0]
+		i = i + 1
+	end
+	if band(flags, PRIO) ~= 0 then
+		i = i + 5
+	end
+	if i > j then self:_error(PROTOCOL_ERROR, 'invalid padding') end
+	if band(flags, END_HEADERS) ~= 0 then
+		self:_headers(sid, flags, p + i, j - i)
+	else
+		self.cont_sid = sid
+		self.cont_flags = flags
+		self.cont_buf = self.cont_buf or string_buffer()
+		self.cont_buf:reset()
+		self.cont_buf:putcdata(p + i, j - i)
+	end
+end
+
+handlers[CONTINUATION] = function(self, sid, flags, p, n)
+	if not self.cont_sid then self:_error(PROTOCOL_ERROR, 'unexpected CONTINUATION') end
+	local buf = self.cont_buf
+	buf:putcdata(p, n)
+	if #buf > self.max_header_list_size then
+		self:_error(ENHANCE_YOUR_CALM, 'header block too large')
+	end
+	if band(flags, END_HEADERS) ~= 0 then
+		self.cont_sid = nil
+		local p, n = buf:ref()
+		self:_headers(sid, self.cont_flags, p, n)
+	end
+end
+
+handlers[PRIORITY] = function(self, sid, flags, p, n)
+	if sid == 0 then self:_error(PROTOCOL_ERROR, 'PRIORITY on stream 0') end
+	if n ~= 5 then self:_rst(sid, FRAME_SIZE_ERROR) end
+end
+
+handlers[RST_STREAM] = function(self, sid, flags, p, n)
+	if sid == 0 then self:_error(PROTOCOL_ERROR, 'RST_STREAM on stream 0') end
+	if n ~= 4 then self:_error(FRAME_SIZE_ERROR, 'invalid RST_STREAM') end
+	if sid > self.last_stream_id then
+		self:_error(PROTOCOL_ERROR, 'RST_STREAM on idle stream')
+	end
+	local stream = self.streams[sid]
+	if not stream then return end
+	stream.reset = true
+	stream:_wake()
+end
+
+handlers[SETTINGS] = function(self, sid, flags, p, n)
+	if sid ~= 0 then self:_error(PROTOCOL_ERROR, 'SETTINGS not on stream 0') end
+	if band(flags, ACK) ~= 0 then
+		if n ~= 0 then self:_error(FRAME_SIZE_ERROR, 'invalid SETTINGS ack') end
+		return
+	end
+	if n % 6 ~= 0 then self:_error(FRAME_SIZE_ERROR, 'invalid SETTINGS') end
+	for i = 0, n-1, 6 do
+		local id = p[i] * 256 + p[i+1]
+		local v = get_u32(p, i+2)
+		self:dp('<-', '%-17s %d = %d', 'SETTING', id, v)
+		if id == SETTINGS_HEADER_TABLE_SIZE then
+			self.enc:set_max_table_size(v)
+		elseif id == SETTINGS_INITIAL_WINDOW_SIZE then
+			if v > MAX_WINDOW then
+				self:_error(FLOW_CONTROL_ERROR, 'invalid initial window size')
+			end
+			local delta = v - self.peer_initial_window_size
+			self.peer_initial_window_size = v
+			for _,stream in pairs(self.streams) do
+				stream.send_window = stream.send_window + delta
+				if delta > 0 then
+					wake(stream.window_thread)
+				end
+			end
+		elseif id == SETTINGS_MAX_FRAME_SIZE then
+			if v < 16384 or v > 2^24-1 then
+				self:_error(PROTOCOL_ERROR, 'invalid max frame size')
+			end
+			self.peer_max_frame_size = v
+		end
+	end
+	self:_send(frame, SETTINGS, ACK, 0, nil, 0)
+end
+
+handlers[PUSH_PROMISE] = function(self)
+	self:_error(PROTOCOL_ERROR, 'PUSH_PROMISE from client')
+end
+
+handlers[PING] = function(self, sid, flags, p, n)
+	if sid ~= 0 then self:_error(PROTOCOL_ERROR, 'PING not on stream 0') end
+	if n ~= 8 then self:_error(FRAME_SIZE_ERROR, 'invalid PING') end
+	if band(flags, ACK) ~= 0 then return end
+	self:_send(frame, PING, ACK, 0, p, 8)
+end
+
+handlers[GOAWAY] = function(self, sid, flags, p, n)
+	if sid ~= 0 then self:_error(PROTOCOL_ERROR, 'GOAWAY not on stream 0') end
+	self.goaway_received = true
+end
+
+handlers[WINDOW_UPDATE] = function(self, sid, flags, p, n)
+	if n ~= 4 then self:_error(FRAME_SIZE_ERROR, 'invalid WINDOW_UPDATE') end
+	local inc = band(get_u32(p, 0), 0x7fffffff)
+	if sid == 0 then
+		if inc == 0 then self:_error(PROTOCOL_ERROR, 'zero window increment') end
+		self.send_window = self.send_window + inc
+		if self.send_window > MAX_WINDOW then
+			self:_error(FLOW_CONTROL_ERROR, 'connection window overflow')
+		end
+		for _,stream in pairs(self.streams) do
+			wake(stream.window_thread)
+		end
+	else
+		local stream = self.streams[sid]
+		if not stream or stream.reset then return end
+		if inc == 0 or stream.send_window + inc > MAX_WINDOW then
+			stream.reset = true
+			self:_rst(sid, inc == 0 and PROTOCOL_ERROR or FLOW_CONTROL_ERROR)
+			stream:_wake()
+			return
+		end
+		stream.send_window = stream.send_window + inc
+		wake(stream.window_thread)
+	end
+end
+
+function h2:_read_frame()
+	local b = self.b
+	local p = b:need(9):ref()
+	local n = (p[0] * 256 + p[1]) * 256 + p[2]
+	local typ, flags = p[3], p[4]
+	local sid = band(get_u32(p, 5), 0x7fffffff)
+	b:_skip(9)
+	if n > self.max_frame_size then
+		self:_error(FRAME_SIZE_ERROR, 'frame too large')
+	end
+	if self.cont_sid and (typ ~= CONTINUATION or sid ~= self.cont_sid) then
+		self:_error(PROTOCOL_ERROR, 'CONTINUATION expected')
+	end
+	self:dp('<-', '%s %d %d%s', frame_names[typ] or typ, sid, n,
+		band(flags, END_STREAM) ~= 0 and typ <= HEADERS and ' (end)' or '')
+	local p = b:need(n):ref()
+	local handler = handlers[typ]
+	if handler then --unknown frame types must be ignored.
+		handler(self, sid, flags, p, n)
+	end
+	b:_skip(n)
+	return typ
+end
+
+function h2:_serve()
+	local b, f = self.b, self.f
+	f:setexpires('r', self.settings_timeout and clock() + self.settings_timeout)
+	b:need(#PREFACE)
+	f:checkp(b:get(#PREFACE) == PREFACE, 'http2: invalid connection preface')
+	self:_send(put_settings)
+	if self:_read_frame() ~= SETTINGS then
+		self:_error(PROTOCOL_ERROR, 'SETTINGS expected')
+	end
+	f:setexpires('r', nil)
+	self:_start_idle_timer()
+	while true do
+		self:_read_frame()
+	end
+end
+
+function h2:serve(handler)
+	self.handler = handler
+	local ok, err = pcall(self._serve, self)
+	self.closed = true
+	self:_stop_idle_timer()
+	for _,stream in pairs(self.streams) do
+		stream:_wake()
+		stream.f:try_close()
+	end
+	if not ok then error(err, 0) end
+end
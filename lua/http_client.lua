@@ -10,6 +10,7 @@
 
 	http_client(opt) -> client           create a client object
 	client:request(opt) -> req, res      make a HTTP request
+	client:websocket(opt) -> ws, res     open a websocket
 	client:close_all()                   close all connections
 	getpage(...) -> ...                  perform a http request on a static client
 
@@ -51,6 +52,17 @@ client:request(opt) -> req, res
 		request_timeout           timeout for the request part (optional)
 		reply_timeout             timeout for the reply part (optional)
 
+client:websocket(opt) -> ws, res
+
+	Open a websocket (see websocket.lua). Takes the same options as
+	`client:request()` plus:
+
+		protocol                  value for sec-websocket-protocol (optional)
+		compress                  false: don't offer permessage-deflate
+		max_message_size          max. size of received messages
+
+	The connection is taken out of the pool and closed with `ws:close()`.
+
 client:close_all()
 
 	Close all connections. This must be called after the socket loop finishes.
@@ -65,6 +77,7 @@ require'url'
 require'sock'
 require'sock_libtls'
 require'gzip'
+require'websocket'
 require'fs'
 require'resolver'
 require'http'
@@ -518,6 +531,64 @@ function client:request(t)
 	return res, true, req
 end
 
+--websockets -----------------------------------------------------------------
+
+function client:websocket(t)
+
+	local target = self:target(t)
+
+	local http, err = self:get_conn(target)
+	if not http then return nil, err end
+
+	local key = websocket_key()
+	local headers = update({
+		upgrade = 'websocket',
+		connection = 'upgrade',
+		['sec-websocket-key'] = key,
+		['sec-websocket-version'] = '13',
+		['sec-websocket-protocol'] = t.protocol,
+		['sec-websocket-extensions'] = t.compress ~= false
+			and websocket_deflate_offer() or nil,
+	}, t.headers)
+	local req = http:build_request(update({}, t, {
+		method = 'GET', headers = headers, compress = false,
+	}))
+
+	self:dp(target, '+WS', '%s.%s %s', target, http, req.uri)
+
+	local ok, err = http:send_request(req)
+	if not ok then return nil, err end
+
+	local res, err = self:read_response_now(http, req)
+	if not res then return nil, err end
+
+	if res.status ~= 101 then
+		http.f:close()
+		return nil, _('websocket upgrade failed: %d %s',
+			res.status, res.status_message), res
+	end
+	if res.headers['sec-websocket-accept'] ~= websocket_accept_key(key) then
+		http.f:close()
+		return nil, 'websocket upgrade failed: invalid accept key', res
+	end
+	local deflate, err = websocket_deflate_params(res.headers['sec-websocket-extensions'])
+	if err then
+		http.f:close()
+		return nil, err, res
+	end
+
+	self:dp(target, '-WS', '%s.%s deflate: %s', target, http, deflate and true or false)
+
+	local ws = websocket{
+		f = http.f,
+		b = http.b,
+		client = true,
+		deflate = deflate,
+		max_message_size = t.max_message_size,
+	}
+	return ws, res
+end
+
 --hi-level API: getpage ------------------------------------------------------
 
 function client:getpage(arg1, upload, receive_content)
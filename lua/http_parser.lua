@@ -0,0 +1,187 @@
+--[=[
+
+	Native HTTP/1.x message head parser.
+	Written by Cosmin Apreutesei. Public Domain.
+
+	Parses the request line or status line and all the headers in one pass
+	in C (see c/http_parser) and only makes Lua strings for the parts of the
+	head that are actually accessed.
+
+	http_head_parser([max_headers]) -> hp
+
+		Create a parser object. One parser should be used per connection.
+
+	hp:parse(buf, len, [response], [owner]) -> head_size | 0 | nil, err
+
+		Parse a message head from a buffer. The buffer is modified in place
+		(header names are lowercased and values are normalized). Returns 0 if
+		the head is incomplete, in which case the search for the end of the
+		head is resumed where it stopped on the next call, which must pass the
+		same head with more data appended. On success the parsed message
+		points into the buffer instead of copying the head out of it, so the
+		buffer must not be modified while the message is in use. `owner` (eg.
+		the string.buffer that `buf` points into) is kept alive by the parser
+		and by the message's rawheaders table.
+
+	hp:line() -> method, uri, http_version     after parsing a request
+	hp:line() -> http_version, status, message after parsing a response
+
+	hp:rawheaders() -> t
+
+		Get a table of raw header values (after normalization and folding of
+		duplicate headers) which creates the values on first access. Iterating
+		it with pairs() creates them all.
+
+	hp:free()
+
+]=]
+
+if not ... then require'http_parser_test'; return end
+
+require'glue'
+local http_headers = require'http_headers'
+
+local C = ffi.load'http_parser'
+
+cdef[[
+typedef struct {
+	uint32_t i, n;
+} http_span_t;
+
+typedef struct {
+	http_span_t line[3];
+	int header_count;
+	int max_headers;
+	http_span_t* headers;
+	uint32_t scanned;
+} http_head_t;
+
+int http_parse_head(uint8_t* buf, size_t len, int response, http_head_t* h);
+]]
+local memcmp = ffi.C.memcmp
+
+local errors = {
+	[-1] = 'invalid request line',
+	[-2] = 'invalid header',
+	[-3] = 'too many headers',
+}
+
+local nofold = http_headers.nofold
+
+local hp = {}
+
+function http_head_parser(max_headers)
+	local self = object(hp, {})
+	max_headers = max_headers or 100
+	self.h = new'http_head_t'
+	self.spans = new('http_span_t[?]', 2 * max_headers)
+	self.h.headers = self.spans
+	self.h.max_headers = max_headers
+	return self
+end
+
+local spana = ctype'http_span_t[?]'
+
+--NOTE: the header spans (but not the head) are copied on each parse so that
+--the rawheaders table of a message stays valid for as long as the message
+--object and its buffer are alive, which is important for keep-alive
+--connections where the next message is parsed by the same parser.
+function hp:parse(buf, len, response, owner)
+	local h = self.h
+	local ret = C.http_parse_head(buf, len, response and 1 or 0, h)
+	if ret == 0 then return 0 end
+	if ret < 0 then
+		h.scanned = 0
+		return nil, response and ret == -1 and 'invalid status line'
+			or errors[tonumber(ret)]
+	end
+	local n = h.header_count
+	local spans = spana(2 * n)
+	copy(spans, self.spans, 2 * n * sizeof'http_span_t')
+	self.head, self.head_spans, self.header_count = buf, spans, n
+	self.head_owner = owner or false
+	self.response = response
+	return ret
+end
+
+local function str(head, s)
+	return ffi.string(head + s.i, s.n)
+end
+
+function hp:line()
+	local head, line = self.head, self.h.line
+	if self.response then
+		return
+			str(head, line[0]),
+			tonumber(str(head, line[1])),
+			str(head, line[2])
+	else
+		return
+			str(head, line[0]),
+			str(head, line[1]),
+			str(head, line[2])
+	end
+end
+
+--find all the values of header `k` and fold them into one value, or into
+--a list for headers that it isn't safe to fold.
+local function header_value(head, spans, count, k)
+	local n = #k
+	local v
+	for i = 0, count-1 do
+		local name = spans[2*i]
+		if name.n == n and memcmp(head + name.i, k, n) == 0 then
+			local s = str(head, spans[2*i+1])
+			if nofold[k] then
+				v = v or {}
+				add(v, s)
+			elseif v then --duplicate header: fold.
+				v = v .. ',' .. s
+			else
+				v = s
+			end
+		end
+	end
+	return v
+end
+
+function hp:rawheaders()
+	local head, spans, count = self.head, self.head_spans, self.header_count
+	return setmetatable({}, {
+		owner = self.head_owner, --keep the buffer alive.
+		__index = function(t, k)
+			if not isstr(k) then return nil end
+			local v = header_value(head, spans, count, k)
+			if v ~= nil then rawset(t, k, v) end
+			return v
+		end,
+		__pairs = function(t)
+			for i = 0, count-1 do
+				local k = str(head, spans[2*i])
+				if rawget(t, k) == nil then
+					rawset(t, k, header_value(head, spans, count, k))
+				end
+			end
+			return next, t, nil
+		end,
+	})
+end
+
+--iterate headers as they appear in the message, for debugging.
+function hp:each_header()
+	local head, spans, count = self.head, self.head_spans, self.header_count
+	local i = -1
+	return function()
+		i = i + 1
+		if i >= count then return nil end
+		return str(head, spans[2*i]), str(head, spans[2*i+1])
+	end
+end
+
+function hp:free()
+	self.h = nil
+	self.spans = nil
+	self.head = nil
+	self.head_spans = nil
+	self.head_owner = nil
+end
@@ -1,10 +1,11 @@
 --[=[
 
-	HTTP 1.1 coroutine-based async server (based on sock.lua, sock_libtls.lua).
+	HTTP 1.1 & HTTP/2 coroutine-based async server (based on sock.lua, sock_libtls.lua).
 	Written by Cosmin Apreutesei. Public Domain.
 
 	Features, https, gzip compression, persistent connections, pipelining,
-	resource limits, multi-level debugging, cdata-buffer-based I/O.
+	HTTP/2 (see http2.lua), resource limits, multi-level debugging,
+	cdata-buffer-based I/O.
 
 http_server(opt1,...) -> server   Create a server object
 	opt.listen                     {lopt1, lopt2, ..}
@@ -26,14 +27,30 @@ http_server(opt1,...) -> server   Create a server object
 	opt.max_line_size           -> http.max_line_size
 	opt.recv_buffer_size        -> http.recv_buffer_size
 	opt.debug                   -> http.debug
+	opt.http2                      false to disable HTTP/2
+	opt.http2_options           -> http2()
+	opt.idle_timeout               close keep-alive connections after n seconds idle (60)
+	opt.header_timeout             max. seconds to receive the request line & headers (30)
+	opt.body_timeout               max. seconds to receive the request body (300)
+	opt.max_conns                  max. open connections; accepting pauses while reached (inf)
+	opt.max_conns_per_ip           max. open connections per client IP (inf)
+	opt.max_loop_lag               reply 503 to new connections while loop lags more (inf)
+	                               (TLS connections are closed without a reply)
+	opt.loop_lag_interval          how often to sample the event loop lag (.5)
 	opt.respond(server, req)
 		req                      <- http:read_request()
 		req:respond(opt) -> out
 			opt                   -> http:build_response()
 			opt.want_out_function    have respond() return an out() function
 		req:onfinish(f)             add code to run when request finishes
+		req:websocket([opt]) -> ws  upgrade to websocket (HTTP/1.1 only, see http:accept_websocket())
 		req.thread                  the thread that handled the request
 
+server.conn_count                 number of open connections
+server.loop_lag                   sampled event loop lag (if opt.max_loop_lag is set)
+server.rejected_count             connections closed for exceeding max_conns_per_ip
+server.shed_count                 connections shed due to loop lag
+
 http_request([thread]) -> req     (current) thread's http request object
 http_error(t | status,[content])  raise http error
 http_redirect(url, [status=303])  raise http redirect error
@@ -56,7 +73,14 @@ CONFIG
 	https_crt_file                 ../../tests/localhost.crt
 	https_key_file                 ../../tests.localhost.key
 	http_compress                  nil, means enabled (set to false to disable)
+	http2                          nil, means enabled (set to false to disable)
 	http_debug                     nil (set to true to enable)
+	http_idle_timeout              60 (set to false to disable)
+	http_header_timeout            30 (set to false to disable)
+	http_body_timeout              300 (set to false to disable)
+	http_max_conns                 inf
+	http_max_conns_per_ip          inf
+	http_max_loop_lag              inf
 
 ]=]
 
@@ -68,6 +92,7 @@ require'sock_libtls'
 require'gzip'
 require'fs'
 require'http'
+require'http2'
 
 local server = {
 	type = 'http_server', http = http,
@@ -86,9 +111,12 @@ local server = {
 			ECDHE-RSA-AES128-SHA256
 		]],
 		prefer_ciphers_server = true,
+		alpn = 'h2,http/1.1',
 	},
 }
 
+server.loop_lag_interval = .5
+
 function server:log(tcp, severity, module, event, fmt, ...)
 	if not logging or logging.filter[severity] then return end
 	local s = isstr(fmt) and _(fmt, logargs(...)) or fmt or ''
@@ -100,6 +128,10 @@ function server:check(tcp, ret, ...)
 	self:log(tcp, 'ERROR', 'htsrv', ...)
 end
 
+local function deadline(timeout)
+	return timeout and clock() + timeout or nil
+end
+
 local function req_onfinish(req, f)
 	after(req, 'finish', f)
 end
@@ -155,10 +187,23 @@ function http_server(...)
 	local self = object(server, {
 		listen = listen,
 		compress = config'http_compress',
+		http2 = config'http2',
 		debug = config'http_debug'
 			and index(collect(words(config'http_debug' or ''))),
+		idle_timeout     = config('http_idle_timeout', 60) or nil,
+		header_timeout   = config('http_header_timeout', 30) or nil,
+		body_timeout     = config('http_body_timeout', 300) or nil,
+		max_conns        = config('http_max_conns', 1/0),
+		max_conns_per_ip = config('http_max_conns_per_ip', 1/0),
+		max_loop_lag     = config('http_max_loop_lag', 1/0),
 	}, ...)
 
+	self.conn_count = 0
+	self.ip_conns = {} --{ip->n}
+	self.loop_lag = 0
+	self.rejected_count = 0
+	self.shed_count = 0
+
 	local next_request_id = 1
 
 	local function handle_request(ctcp, http, req)
@@ -187,6 +232,23 @@ function http_server(...)
 			end
 		end
 
+		--NOTE: the connection is closed when the request handler returns,
+		--so the handler must keep running for as long as `ws` is in use.
+		--NOTE: HTTP/2 streams can't be upgraded so they don't get this method.
+		if req.http_version == '1.1' then
+			function req.websocket(req, opt)
+				if not http:is_websocket_request(req) then
+					http_error(400, 'websocket upgrade expected')
+				end
+				ctcp:setexpires('r', nil) --websockets have their own keep-alive.
+				send_started = true
+				local ws = assert(http:accept_websocket(req, opt or empty))
+				send_finished = true
+				req.upgraded = true
+				return ws
+			end
+		end
+
 		req.thread = currentthread()
 
 		req.onfinish = req_onfinish
@@ -227,6 +289,8 @@ function http_server(...)
 			end
 		end
 
+		if req.upgraded then return end --not http anymore.
+
 		--the request must be entirely read before we can read the next request.
 		if req.body_was_read == nil then
 			req:read_body()
@@ -235,11 +299,48 @@ function http_server(...)
 
 	end
 
+	--HTTP/2 streams are handled on their own threads.
+	local function handle_stream(ctcp, http, req)
+		ownthreadenv().http_request = req
+		local ok, err = pcall(handle_request, ctcp, http, req)
+		self:check(ctcp, ok or iserror(err, 'io'), 'handler', '%s', err)
+	end
+
 	local function handle_connection(stcp, ctcp, http)
+		ctcp:setexpires('r', deadline(self.header_timeout))
+		if self.http2 ~= false and http2_requested(http) then
+			ctcp:setexpires('r', nil) --streams are multiplexed, h2 times the connection.
+			local h2 = http2(update({
+				http = http,
+				settings_timeout = self.header_timeout or false,
+				idle_timeout = self.idle_timeout or false,
+			}, self.http2_options))
+			h2:serve(function(http, req)
+				handle_stream(ctcp, http, req)
+			end)
+			return
+		end
+		--the body deadline only covers reading the body, not handling the
+		--request, so it's disarmed as soon as the body was read.
+		local read_body_to_writer = http.read_body_to_writer
+		function http:read_body_to_writer(...)
+			read_body_to_writer(self, ...)
+			ctcp:setexpires('r', nil)
+		end
+		local first = true
 		while not ctcp:closed() do
+			--wait for the request to start, closing idle keep-alive connections.
+			if not first then
+				ctcp:setexpires('r', deadline(self.idle_timeout))
+			end
+			if not http:have_head() then break end --closed by client.
+			ctcp:setexpires('r', deadline(self.header_timeout))
 			local req = assert(http:read_request())
+			ctcp:setexpires('r', deadline(self.body_timeout))
 			ownthreadenv().http_request = req
 			handle_request(ctcp, http, req)
+			if req.upgraded then break end
+			first = false
 		end
 	end
 
@@ -248,6 +349,74 @@ function http_server(...)
 		stop = true
 	end
 
+	--admission control: limit open connections globally and per client IP
+	--and shed load while the event loop is lagging.
+
+	local accept_jobs = {} --{job->true}: listeners paused while at max_conns.
+
+	local function conn_opened(ip)
+		self.conn_count = self.conn_count + 1
+		self.ip_conns[ip] = (self.ip_conns[ip] or 0) + 1
+	end
+
+	local function conn_closed(ip)
+		self.conn_count = self.conn_count - 1
+		local n = self.ip_conns[ip] - 1
+		self.ip_conns[ip] = n > 0 and n or nil
+		if self.conn_count < self.max_conns then
+			for job in pairs(accept_jobs) do
+				accept_jobs[job] = nil
+				job:resume()
+			end
+		end
+	end
+
+	local function wait_for_conn_slot()
+		while self.conn_count >= self.max_conns and not stop do
+			local job = wait_job()
+			accept_jobs[job] = true
+			job:wait(1) --also check `stop` every second.
+			accept_jobs[job] = nil
+		end
+	end
+
+	local RESPONSE_503 = 'HTTP/1.1 503 Service Unavailable\r\n'
+		..'retry-after: 1\r\nconnection: close\r\ncontent-length: 0\r\n\r\n'
+
+	local function admit(ctcp, ip)
+		if (self.ip_conns[ip] or 0) >= self.max_conns_per_ip then
+			self.rejected_count = self.rejected_count + 1
+			self:log(ctcp, 'warn', 'htsrv', 'reject', 'too many connections from %s', ip)
+			return false
+		end
+		if self.loop_lag > self.max_loop_lag then
+			self.shed_count = self.shed_count + 1
+			self:log(ctcp, 'warn', 'htsrv', 'shed', 'loop lag: %.2fs', self.loop_lag)
+			--NOTE: TLS connections are closed without a 503: the handshake
+			--hasn't been done yet and doing it is the work we're shedding.
+			if not ctcp.tcp then
+				ctcp:setexpires('w', clock() + 1)
+				ctcp:try_send(RESPONSE_503)
+			end
+			return false
+		end
+		return true
+	end
+
+	if self.max_loop_lag < 1/0 then
+		resume(thread(function()
+			local dt = self.loop_lag_interval
+			while not stop do
+				local t0 = clock()
+				wait(dt)
+				local lag = max(0, clock() - t0 - dt)
+				--rise fast, decay slowly so that a single fast tick doesn't
+				--re-open the gates while still overloaded.
+				self.loop_lag = max(lag, self.loop_lag * .5)
+			end
+		end, 'http-loop-lag'))
+	end
+
 	self.sockets = {}
 
 	assert(self.listen and #self.listen > 0, 'listen option is missing or empty')
@@ -287,6 +456,9 @@ function http_server(...)
 		local tls = listen_opt.tls
 		if tls then
 			local opt = update(self.tls_options, listen_opt.tls_options)
+			if self.http2 == false then
+				opt.alpn = 'http/1.1'
+			end
 			local stcp = server_stcp(tcp, opt)
 			live(stcp, 'listen %s:%d', tcp.bound_addr, tcp.bound_port)
 			tcp = stcp
@@ -306,7 +478,16 @@ function http_server(...)
 					return
 				end
 			end
-			resume(thread(function()
+			local ip = (ctcp.tcp or ctcp).remote_addr or '?'
+			conn_opened(ip)
+			--connection threads aren't referenced after they finish,
+			--so their coroutines can be reused.
+			resume(pooled_thread(function()
+				if not admit(ctcp, ip) then
+					conn_closed(ip)
+					ctcp:close()
+					return
+				end
 				local http = http({
 					debug = self.debug,
 					max_line_size = self.max_line_size,
@@ -317,6 +498,7 @@ function http_server(...)
 				local ok, err = pcall(handle_connection, tcp, ctcp, http)
 				http:free()
 				self:check(ctcp, ok or iserror(err, 'io'), 'handler', '%s', err)
+				conn_closed(ip)
 				ctcp:close()
 			end, 'http-server-client %s', ctcp))
 		end
@@ -331,6 +513,7 @@ function http_server(...)
 
 		resume(thread(function()
 			while not stop do
+				wait_for_conn_slot()
 				accept_connection()
 			end
 		end, 'http-listen %s', tcp))
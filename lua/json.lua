@@ -5,12 +5,25 @@
 
 	[try_]json_decode(s[, null_val]) -> v   decode JSON
 	json_encode(v[, indent]) -> s       encode JSON
+	json_encode_stream(v, write, [chunk_size]) -> tail   encode JSON in chunks
 	null                                value to encode/decode json `null`
 	json_asarray(t) -> t                mark t to be encoded as a json array
 	json_pack(...) -> t                 like pack() but nils become null
 	json_unpack(t) -> ...               like unpack() but nulls become nil
 	repl_nulls(t) -> t                  replace `null` values in `t` recursively
 
+
+json_encode_stream(v, write, [chunk_size]) -> tail
+
+	Encode `v` without building the whole document in memory: the output is
+	accumulated in a buffer which is passed to `write(buf, len)` whenever it
+	gets over `chunk_size` (64K) and then reused. The remaining output is
+	returned as a string, so for small documents `write` is never called and
+	the return value is the entire document. Tables that don't contain other
+	tables are encoded by cjson in one go. Functions are lazy arrays: they
+	are called repeatedly and their return values become the array's elements
+	until they return nil, so rows can be encoded while they are being read.
+
 ]==]
 
 local cjson      = require'cjson'.new()
@@ -152,3 +165,95 @@ function json_encode(v, indent)
 		return s
 	end
 end
+
+--streaming encoder ----------------------------------------------------------
+
+local string_buffer = require'string.buffer'.new
+local cjson_encode = cjson.encode
+local getmetatable, tostring, floor = getmetatable, tostring, math.floor
+
+local function is_leaf(t) --no nested tables or lazy arrays: cjson can do it.
+	for k,v in pairs(t) do
+		local tv = type(v)
+		if tv == 'table' or tv == 'function' then
+			return false
+		end
+	end
+	return true
+end
+
+local function array_len(t) --same rules as cjson for telling arrays from objects.
+	if getmetatable(t) == cjson.array_mt then
+		return #t
+	end
+	local n = 0
+	for k in pairs(t) do
+		if type(k) ~= 'number' or k < 1 or floor(k) ~= k then
+			return nil
+		end
+		if k > n then n = k end
+	end
+	return n
+end
+
+function json_encode_stream(v, write, chunk_size)
+	chunk_size = chunk_size or 64 * 1024
+	local b = string_buffer()
+	local function flush()
+		if #b >= chunk_size then
+			write(b:ref())
+			b:reset()
+		end
+	end
+	local enc
+	local function enc_lazy_array(f)
+		b:put'['
+		local i = 0
+		while true do
+			local e = f()
+			if e == nil then break end
+			if i > 0 then b:put',' end
+			i = i + 1
+			enc(e)
+			flush()
+		end
+		b:put']'
+	end
+	function enc(v)
+		local tv = type(v)
+		if tv == 'function' then
+			enc_lazy_array(v)
+		elseif tv ~= 'table' or is_leaf(v) then
+			b:put(cjson_encode(v))
+		else
+			local n = array_len(v)
+			if n then
+				b:put'['
+				for i=1,n do
+					if i > 1 then b:put',' end
+					local e = v[i]
+					if e == nil then
+						b:put'null'
+					else
+						enc(e)
+					end
+					flush()
+				end
+				b:put']'
+			else
+				b:put'{'
+				local first = true
+				for k,e in pairs(v) do
+					if not first then b:put',' end
+					first = false
+					b:put(cjson_encode(type(k) == 'number' and tostring(k) or k), ':')
+					enc(e)
+					flush()
+				end
+				b:put'}'
+			end
+		end
+	end
+	enc(v)
+	return b:tostring()
+end
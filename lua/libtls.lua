@@ -341,6 +341,12 @@ function tls:try_send(buf, sz)
 	return checklen(self, C.tls_write(self, buf, sz or #buf))
 end
 
+--the protocol selected with ALPN, available after the handshake.
+function tls:alpn_selected()
+	local s = C.tls_conn_alpn_selected(self)
+	return s ~= nil and str(s) or nil
+end
+
 function tls:try_close()
 	local len, err = checklen(self, C.tls_close(self))
 	if not len then return nil, err end
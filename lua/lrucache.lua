@@ -7,8 +7,14 @@
 	the cache is full, just enough old values are removed to make room for the
 	new value and not exceed the cache max size.
 
+	Values can also have a max. age after which they are considered expired.
+	Expired values are removed lazily when they are accessed or when they are
+	the least recently used values when making room for new values.
+
 	lrucache([options]) -> cache      create a new cache
 	cache.max_size <- size            set the cache size limit
+	cache.max_age <- seconds          set the default max. age of values (inf)
+	cache.clock <- f() -> seconds     clock for expiring values (glue.clock)
 	cache:clear()                     clear the cache
 	cache:free()                      destroy the cache
 	cache:free_value(val)             value destructor (to be overriden)
@@ -18,16 +24,25 @@
 	cache:remove(key) -> val          remove a value from the cache by key
 	cache:remove_val(val) -> key      remove a value from the cache
 	cache:remove_last() -> val        remove the last value from the cache
-	cache:put(key, val)               put a value in the cache, making room as needed
+	cache:put(key, val, [max_age])    put a value in the cache, making room as needed
+	cache:count() -> n                number of values in the cache
+	cache.hits, cache.misses          number of successful and failed get() calls
+	cache.evictions                   number of values removed to make room
+	cache.expirations                 number of values removed due to expiry
 
 ]=]
 
+if not ... then require'lrucache_test'; return end
+
+require'glue'
 require'linkedlist'
 
 local lrucache = {}
 lrucache.__index = lrucache
 
 lrucache.max_size = 1
+lrucache.max_age = 1/0
+lrucache.clock = clock
 
 function lrucache:clear()
 	if self.keys then
@@ -38,7 +53,12 @@ function lrucache:clear()
 	self.lru = linkedlist()
 	self.values = {} --{key -> val}
 	self.keys = {} --{val -> key}
+	self.expires = {} --{val -> expire_clock}
 	self.total_size = 0
+	self.hits = 0
+	self.misses = 0
+	self.evictions = 0
+	self.expirations = 0
 	return self
 end
 
@@ -57,6 +77,7 @@ function lrucache:free()
 		self.lru = false
 		self.values = false
 		self.keys = false
+		self.expires = false
 		self.total_size = 0
 	end
 end
@@ -68,9 +89,24 @@ end
 function lrucache:value_size(val) return 1 end --stub, size must be >= 0 always
 function lrucache:free_value(val) end --stub
 
+function lrucache:count()
+	return self.lru.length
+end
+
 function lrucache:get(key)
 	local val = self.values[key]
-	if not val then return nil end
+	if not val then
+		self.misses = self.misses + 1
+		return nil
+	end
+	local expires = self.expires[val]
+	if expires and expires <= self.clock() then
+		self:_remove(key, val)
+		self.expirations = self.expirations + 1
+		self.misses = self.misses + 1
+		return nil
+	end
+	self.hits = self.hits + 1
 	self.lru:remove(val)
 	self.lru:insert_first(val)
 	return val
@@ -82,6 +118,7 @@ function lrucache:_remove(key, val)
 	self:free_value(val)
 	self.values[key] = nil
 	self.keys[val] = nil
+	self.expires[val] = nil
 	self.total_size = self.total_size - val_size
 end
 
@@ -106,34 +143,31 @@ function lrucache:remove_last()
 	return val
 end
 
-function lrucache:put(key, val)
+function lrucache:put(key, val, max_age)
 	local val_size = self:value_size(val)
 	local old_val = self.values[key]
 	if old_val then
+		local old_val_size = self:value_size(old_val)
 		self.lru:remove(old_val)
 		self.keys[old_val] = nil
-		self.total_size = self.total_size - val_size
+		self.expires[old_val] = nil
+		self.values[key] = nil
+		self.total_size = self.total_size - old_val_size
 	end
 	while self.lru.last and self.total_size + val_size > self.max_size do
+		local last = self.lru.last
+		local expires = self.expires[last]
+		if expires and expires <= self.clock() then
+			self.expirations = self.expirations + 1
+		else
+			self.evictions = self.evictions + 1
+		end
 		self:remove_last()
 	end
+	max_age = max_age or self.max_age
 	self.values[key] = val
 	self.keys[val] = key
+	self.expires[val] = max_age < 1/0 and self.clock() + max_age or nil
 	self.lru:insert_first(val)
 	self.total_size = self.total_size + val_size
 end
-
-
-if not ... then
-
-	local cache = _G.lrucache()
-
-	local k1 = {}
-	local v1 = {}
-	local v2 = {}
-	local v3 = {}
-	cache:put(k1, v1)
-	cache:put(k1, v2)
-	cache:put(k1, v3)
-
-end
@@ -0,0 +1,251 @@
+--[=[
+
+	Size-limited LRU cache with a cdata node pool.
+	Written by Cosmin Apreutesei. Public Domain.
+
+	Same API as lrucache but made for caches with a large number of entries:
+	the LRU list is an index-linked list of nodes in a cdata array and keys
+	and values are kept in two Lua arrays at the node's index, so there are
+	no per-entry Lua objects to create or collect and values can be any Lua
+	value. The node array grows in powers of two up to `max_count`. Like with
+	lrucache, values are also indexed (for remove_val()) so they should be
+	unique: if the same value is put under more keys, remove_val() only finds
+	the most recently put one.
+
+	lrucache_ffi([options]) -> cache  create a new cache
+	cache.max_size <- size            set the cache size limit (inf)
+	cache.max_count <- n              set the max. number of values (1e5)
+	cache.max_age <- seconds          set the default max. age of values (inf)
+	cache.clock <- f() -> seconds     clock for expiring values (glue.clock)
+	cache:clear()                     clear the cache
+	cache:free()                      destroy the cache
+	cache:free_value(val)             value destructor (to be overriden)
+	cache:value_size(val) -> size     get value size (to be overriden; returns 1)
+	cache:free_size() -> size         size left until `max_size`
+	cache:count() -> n                number of values in the cache
+	cache:get(key) -> val             get a value from the cache by key
+	cache:remove(key) -> val          remove a value from the cache by key
+	cache:remove_val(val) -> key      remove a value from the cache
+	cache:remove_last() -> val        remove the last value from the cache
+	cache:put(key, val, [max_age])    put a value in the cache, making room as needed
+	cache.hits, cache.misses          number of successful and failed get() calls
+	cache.evictions                   number of values removed to make room
+	cache.expirations                 number of values removed due to expiry
+
+]=]
+
+if not ... then require'lrucache_ffi_test'; return end
+
+require'glue'
+
+cdef[[
+typedef struct lrucache_node {
+	int32_t prev;
+	int32_t next;
+	double  expires;
+	double  size;
+} lrucache_node_t;
+]]
+local node_arr = ctype'lrucache_node_t[?]'
+
+local cache = {}
+
+cache.max_size = 1/0
+cache.max_count = 1e5
+cache.max_age = 1/0
+cache.clock = clock
+
+local MIN_CAPACITY = 64
+
+--node 0 is the list head: head.next is the most recently used node and
+--head.prev is the least recently used node.
+
+local function link_first(nodes, i)
+	local first = nodes[0].next
+	nodes[i].prev = 0
+	nodes[i].next = first
+	nodes[first].prev = i
+	nodes[0].next = i
+end
+
+local function unlink(nodes, i)
+	local node = nodes[i]
+	nodes[node.prev].next = node.next
+	nodes[node.next].prev = node.prev
+end
+
+local function grow(self)
+	local capacity = min(self.capacity * 2, self.max_count)
+	local nodes = node_arr(capacity + 1)
+	copy(nodes, self.nodes, (self.capacity + 1) * sizeof'lrucache_node_t')
+	for i = capacity, self.capacity + 1, -1 do --add new nodes to the freelist.
+		nodes[i].next = self.free_node
+		self.free_node = i
+	end
+	self.nodes = nodes
+	self.capacity = capacity
+end
+
+function cache:clear()
+	if self.index then
+		for i, val in pairs(self.vals) do
+			self:free_value(val)
+		end
+	end
+	local capacity = min(MIN_CAPACITY, self.max_count)
+	self.nodes = node_arr(capacity + 1)
+	self.capacity = capacity
+	self.free_node = 0 --freelist head, linked through `next`.
+	for i = capacity, 1, -1 do
+		self.nodes[i].next = self.free_node
+		self.free_node = i
+	end
+	self.index = {} --{key -> i}
+	self.keys = {} --{i -> key}
+	self.vals = {} --{i -> val}
+	self.val_index = {} --{val -> i}
+	self.length = 0
+	self.total_size = 0
+	self.hits = 0
+	self.misses = 0
+	self.evictions = 0
+	self.expirations = 0
+	return self
+end
+
+function lrucache_ffi(t)
+	local self = object(cache, t)
+	return self:clear()
+end
+
+function cache:free()
+	if self.index then
+		for i, val in pairs(self.vals) do
+			self:free_value(val)
+		end
+		self.nodes = false
+		self.index = false
+		self.keys = false
+		self.vals = false
+		self.val_index = false
+		self.length = 0
+		self.total_size = 0
+	end
+end
+
+function cache:free_size()
+	return self.max_size - self.total_size
+end
+
+function cache:value_size(val) return 1 end --stub, size must be >= 0 always
+function cache:free_value(val) end --stub
+
+function cache:count()
+	return self.length
+end
+
+function cache:_remove(i)
+	local nodes = self.nodes
+	local key, val = self.keys[i], self.vals[i]
+	unlink(nodes, i)
+	self.total_size = self.total_size - nodes[i].size
+	nodes[i].next = self.free_node
+	self.free_node = i
+	self.index[key] = nil
+	self.keys[i] = nil
+	self.vals[i] = nil
+	if val == val and self.val_index[val] == i then --NaN can't be a key.
+		self.val_index[val] = nil
+	end
+	self.length = self.length - 1
+	self:free_value(val)
+	return key, val
+end
+
+function cache:get(key)
+	local i = self.index[key]
+	if not i then
+		self.misses = self.misses + 1
+		return nil
+	end
+	local nodes = self.nodes
+	if nodes[i].expires <= self.clock() then
+		self:_remove(i)
+		self.expirations = self.expirations + 1
+		self.misses = self.misses + 1
+		return nil
+	end
+	self.hits = self.hits + 1
+	if nodes[0].next ~= i then
+		unlink(nodes, i)
+		link_first(nodes, i)
+	end
+	return self.vals[i]
+end
+
+function cache:remove(key)
+	local i = self.index[key]
+	if not i then return nil end
+	local _, val = self:_remove(i)
+	return val
+end
+
+function cache:remove_val(val)
+	local i = val == val and self.val_index[val]
+	if not i then return nil end
+	return (self:_remove(i))
+end
+
+function cache:remove_last()
+	local i = self.nodes[0].prev
+	if i == 0 then return nil end
+	local _, val = self:_remove(i)
+	return val
+end
+
+function cache:put(key, val, max_age)
+	local val_size = self:value_size(val)
+	local i = self.index[key]
+	if i then --replace value, keeping the node.
+		local nodes = self.nodes
+		local old_val = self.vals[i]
+		if old_val == old_val and self.val_index[old_val] == i then
+			self.val_index[old_val] = nil
+		end
+		unlink(nodes, i)
+		self.total_size = self.total_size - nodes[i].size
+		self.length = self.length - 1
+	end
+	local nodes = self.nodes
+	while nodes[0].prev ~= 0 and (self.total_size + val_size > self.max_size
+		or (not i and self.length >= self.max_count))
+	do
+		local last = nodes[0].prev
+		if nodes[last].expires <= self.clock() then
+			self.expirations = self.expirations + 1
+		else
+			self.evictions = self.evictions + 1
+		end
+		self:_remove(last)
+	end
+	if not i then
+		if self.free_node == 0 then
+			grow(self)
+			nodes = self.nodes
+		end
+		i = self.free_node
+		self.free_node = nodes[i].next
+		self.index[key] = i
+		self.keys[i] = key
+	end
+	max_age = max_age or self.max_age
+	self.vals[i] = val
+	if val == val then
+		self.val_index[val] = i
+	end
+	nodes[i].expires = max_age < 1/0 and self.clock() + max_age or 1/0
+	nodes[i].size = val_size
+	link_first(nodes, i)
+	self.length = self.length + 1
+	self.total_size = self.total_size + val_size
+end
@@ -13,7 +13,7 @@ DECODING
 ENCODING
 	mp:encoding_buffer([min_size]) -> b  create a buffer for encoding
 	b:encode(v) -> b                     encode a value (see below)
-	b:encode_array(t, [n]) -> b          encode an array
+	b:encode_array(t, [n], [encode_elem]) -> b  encode an array
 	b:encode_map(t, [pairs]) -> b        encode a map
 	b:encode_int(x) -> b                 encode a number as integer
 	b:encode_float(x) -> b               encode a float
@@ -22,6 +22,7 @@ ENCODING
 	b:encode_ext(type, [n]) -> b         encode the header for an ext value
 	b:encode_ext_int(ctype, x) -> b      encode a raw integer (see code)
 	b:encode_timestamp(ts) -> b          encode a timestamp value
+	b:encode_f64_array(t, [n], [nil_val]) -> b  encode numbers as bin of native doubles
 	b:size() -> n                        get the buffer content size
 	b:get() -> p, n                      get the buffer and its size
 	b:tostring() -> s                    get the buffer as a string
@@ -39,6 +40,8 @@ CUSTOMIZATION
 	mp:decode_unknown(mp, p, i, len, type_code) end     decode an unknown ext type
 	mp:isarray(t)                        decide if t is an array or map
 	mp.N                                 key for array element count
+	mp.nil_value                         value to encode as nil (eg. json's null)
+	mt.__tomsgpack(t, b)                 custom encoder for tables with metatable mt
 	mp.error(err)                        custom error constructor
 
 DECODING BEHAVIOR
@@ -46,6 +49,7 @@ DECODING BEHAVIOR
 	* nil array elements create Lua sparse arrays, unless mp.nil_element is set.
 	* extension types are decoded with mp.decoder[type], falling back to
 	mp:decode_unknown() (pre-defined as a stub that returns nil).
+	* timestamps (ext type -1) are decoded as seconds since epoch (can be float).
 	* decoding errors are raised with mp.error() which defaults to _G.error.
 	* there's no way to tell an empty array from an empty map.
 
@@ -68,14 +72,24 @@ local
 	type, bor, band, shr, floor, noop, repl, update, dynarray =
 	type, bor, band, shr, floor, noop, repl, update, dynarray
 local
-	isctype, copy, cast, ffi_string =
-	isctype, copy, cast, ffi.string
+	isctype, copy, cast, ffi_string, sizeof, getmetatable =
+	isctype, copy, cast, ffi.string, sizeof, getmetatable
 local
 	u32, i64, u64, u8a, i8p, u8p, i16p, u16p, i32p, u32p, i64p, u64p, f32p, f64p =
 	u32, i64, u64, u8a, i8p, u8p, i16p, u16p, i32p, u32p, i64p, u64p, f32p, f64p
 
 local t_buf = u8a(8)
 
+local ptr_cts = {}
+local function ptr_ct(ct)
+	local pct = ptr_cts[ct]
+	if not pct then
+		pct = ffi.typeof('$*', ct)
+		ptr_cts[ct] = pct
+	end
+	return pct
+end
+
 local mp = {decoder = {}}
 
 function mp:decode_unknown() return nil end --stub
@@ -201,6 +215,23 @@ end
 	self.error'invalid message'
 end
 
+mp.decoder[-1] = function(self, p, i, len) --timestamp
+	local n = i + len
+	if len == 4 then
+		local _, s = num(self, p, n, i, u32p, 4)
+		return s
+	elseif len == 8 then --nsec in the upper 30 bits, sec in the lower 34 bits.
+		local _, hi = num(self, p, n, i  , u32p, 4)
+		local _, lo = num(self, p, n, i+4, u32p, 4)
+		return (hi % 4) * 2^32 + lo + floor(hi / 4) * 1e-9
+	elseif len == 12 then
+		local _, ns = num(self, p, n, i  , u32p, 4)
+		local _, s  = num(self, p, n, i+4, i64p, 8, tonumber)
+		return s + ns * 1e-9
+	end
+	self.error'invalid timestamp'
+end
+
 function mp:decode_next(p, n, i)
 	p = cast(u8p, p)
 	return obj(self, 0, p, n, i or 0)
@@ -261,7 +292,7 @@ function mp:encoding_buffer(min_size)
 			rev4(p, i+1)
 		end
 	end
-	function buf:encode_array(t, n)
+	function buf:encode_array(t, n, encode_elem)
 		local n = n or repl(t[mp.N], true, #t) or #t
 		if n <= 0x0f then
 			local p, i = b(1)
@@ -269,8 +300,9 @@ function mp:encoding_buffer(min_size)
 		else
 			encode_len(n, nil, 0xdc, 0xdd)
 		end
+		local encode = encode_elem or self.encode
 		for i = 1, n do
-			self:encode(t[i])
+			encode(self, t[i])
 		end
 		return self
 	end
@@ -401,7 +433,7 @@ function mp:encoding_buffer(min_size)
 			p[i] = 0xd8
 			p[i+1] = typ
 		else
-			encode_len(0xc7, 0xc8, 0xc9)
+			encode_len(n, 0xc7, 0xc8, 0xc9)
 			local p, i = b(1)
 			p[i] = typ
 		end
@@ -410,32 +442,48 @@ function mp:encoding_buffer(min_size)
 	function buf:encode_ext_int(ct, x)
 		local n = sizeof(ct)
 		local p, i = b(n)
-		cast(ct, p+i)[0] = v
+		cast(ptr_ct(ct), p+i)[0] = x
 		local rev = n == 1 and noop or n == 2 and rev2
 			or n == 4 and rev4 or n == 8 and rev8
 		rev(p, i)
 		return self
 	end
 	function buf:encode_timestamp(v)
-		local n
-		if v >= 0 and v <= 0xffffffff then
-			if floor(v) == v then
+		local s = floor(v)
+		local ns = floor((v - s) * 1e9 + .5)
+		if ns >= 1e9 then
+			s, ns = s + 1, 0
+		end
+		if s >= 0 and s < 2^34 then
+			if ns == 0 and s <= 0xffffffff then
 				self:encode_ext(-1, 4)
-				self:encode_ext_int(u32, v)
-			else
+				self:encode_ext_int(u32, s)
+			else --nsec in the upper 30 bits, sec in the lower 34 bits.
 				self:encode_ext(-1, 8)
-				self:encode_ext_int(u32, (v - floor(v)) * 1e9)
-				self:encode_ext_int(u32, v)
+				self:encode_ext_int(u32, ns * 4 + floor(s / 2^32))
+				self:encode_ext_int(u32, s % 2^32)
 			end
 		else
 			self:encode_ext(-1, 4+8)
-			self:encode_ext_int(u32, (v - floor(v)) * 1e9)
-			self:encode_ext_int(i64, v)
+			self:encode_ext_int(u32, ns)
+			self:encode_ext_int(i64, s)
+		end
+		return self
+	end
+	--typed array for numeric columns: ready for `new Float64Array()` in JS.
+	function buf:encode_f64_array(t, n, nil_val)
+		local n = n or #t
+		encode_len(n * 8, 0xc4, 0xc5, 0xc6)
+		local p, i = b(n * 8)
+		local a = cast(f64p, p + i)
+		for j = 1, n do
+			local v = t[j]
+			a[j-1] = (v == nil or v == nil_val) and 0/0 or v
 		end
 		return self
 	end
 	function buf:encode(v)
-		if v == nil then
+		if v == nil or v == mp.nil_value then
 			local p, i = b(1)
 			p[i] = 0xc0
 		elseif v == false then
@@ -460,7 +508,10 @@ function mp:encoding_buffer(min_size)
 			local p, i = b(#v)
 			copy(p + i, v, #v)
 		elseif type(v) == 'table' then
-			if mp:isarray(v) then
+			local mt = getmetatable(v)
+			if mt and mt.__tomsgpack then
+				mt.__tomsgpack(v, self)
+			elseif mp:isarray(v) then
 				self:encode_array(v)
 			else
 				self:encode_map(v)
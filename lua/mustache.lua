@@ -1,6 +1,6 @@
 --[=[
 
-	Full-spec mustache parser and bytecode-based renderer.
+	Full-spec mustache parser, compiler and renderer.
 	Written by Cosmin Apreutesei. Public Domain.
 
 	Produces the exact same output as mustache.js on the same template and
@@ -31,6 +31,7 @@ FEATURES
 		* escapes &, >, <, ", ', /, `, = like mustache.js.
 	* other:
 		* error reporting with line and column number information.
+		* templates are compiled to Lua code specialized for each template.
 		* dump tool for debugging compiled templates.
 		* text position info for all tokens (can be used for syntax highlighting).
 
@@ -47,14 +48,30 @@ mustache_render(template, [data], [partials], [write], [d1, d2], [escape_func])
 	d1, d2      : initial set delimiters.
 	escape_func : the escape function for {{var}} substitutions.
 
+	The output is written with a single call to write() at the end.
+
 mustache_compile(template[, d1, d2]) -> template
 
-	Compile a template to bytecode (if not already compiled).
+	Compile a template to bytecode (if not already compiled). The first time
+	a compiled template is rendered, its bytecode is translated into a Lua
+	function which is kept in the compiled template, so hold on to it if you
+	want to avoid the translation cost on each render (the template cache
+	is weak). Indented standalone partials are compiled once per indent and
+	kept in the compiled partial, so the same goes for partials.
+
+mustache_interpret(template, [data], [partials], [write], [d1, d2], [escape_func]) -> s
+
+	Render a template by interpreting its bytecode, which is what's used
+	for templates that are too large to be translated to Lua.
 
 mustache_dump(program, [d1, d2], [print])
 
 	Dump the template bytecode (for debugging).
 
+mustache_lua(program, [d1, d2]) -> s
+
+	Get the Lua source code generated for a template (for debugging).
+
 ]=]
 
 if not ... then require'mustache_test'; return end
@@ -322,7 +339,24 @@ local function listvalues(t)
 end
 
 local function indent(s, indent)
-	return s:gsub('([^\r\n]+\r?\n?)', indent..'%1')
+	return (s:gsub('([^\r\n]+\r?\n?)', indent..'%1'))
+end
+
+--get the compiled program of a partial with its lines indented, which is
+--kept in the partial's program so that it's not recompiled on every render.
+local function indented(partial, spaces)
+	local prog = mustache_compile(partial)
+	local t = prog.indented
+	if not t then
+		t = {} --{spaces -> prog}
+		prog.indented = t
+	end
+	local iprog = t[spaces]
+	if not iprog then
+		iprog = mustache_compile(indent(prog.template, spaces))
+		t[spaces] = iprog
+	end
+	return iprog
 end
 
 local function lookup(ctx_stack, var, i) --search up a context stack
@@ -490,8 +524,7 @@ local function render(prog, ctx_stack, getpartial, write, d1, d2, esc)
 			local partial = getpartial(partial)
 			if partial then
 				if i1 >= i then --indented
-					local spaces = prog.template:sub(i, i1)
-					partial = indent(partial, spaces)
+					partial = indented(partial, prog.template:sub(i, i1))
 				end
 				render(partial, ctx_stack, getpartial, write, nil, nil, esc)
 			end
@@ -503,7 +536,241 @@ local function render(prog, ctx_stack, getpartial, write, d1, d2, esc)
 	end
 end
 
+--code generator -------------------------------------------------------------
+
+--The program of a template is translated into a Lua chunk that renders that
+--template specifically: text pieces become string constants, var paths are
+--split at compile time, html escaping is inlined and each section body
+--becomes a function that is called once per iterated value. Only the
+--context stack is dynamic. The generated render functions have the
+--signature f(ctx_stack, n, buf, R) where n is the context stack top,
+--buf is a string buffer and R holds the per-render state {getpartial, esc}.
+
+local E = { --from mustache.js (same as html_escape() from glue)
+	['&']  = '&amp;',
+	['<']  = '&lt;',
+	['>']  = '&gt;',
+	['"']  = '&quot;',
+	["'"]  = '&#39;',
+	['/']  = '&#x2F;',
+	['`']  = '&#x60;',
+	['=']  = '&#x3D;',
+}
+local P = '[&<>"\'/`=]'
+
+local function codegen_lookup(cs, n, var) --search up a context stack
+	for i = n, 1, -1 do
+		local val = cs[i][var]
+		if val ~= nil then
+			return val
+		end
+	end
+end
+
+local function codegen_field(val, k) --resolve the next field in 'a.b.c'
+	if not istrue(val) then --falsey values resolve to ''
+		return nil
+	elseif type(val) ~= 'table' then
+		raise(nil, nil, 'table expected for field "%s" but got %s', k, type(val))
+	end
+	return val[k]
+end
+
+local function codegen_section(f, val, cs, n, buf, R)
+	local nextvalue = listvalues(val)
+	if nextvalue then --it's a list, iterate it
+		n = n + 1
+		local val = nextvalue() --always non-nil
+		repeat
+			cs[n] = val
+			f(cs, n, buf, R)
+			val = nextvalue()
+		until val == nil
+		cs[n] = nil
+	elseif istab(val) then --hashmap, set as context
+		n = n + 1
+		cs[n] = val
+		f(cs, n, buf, R)
+		cs[n] = nil
+	else --conditional section, don't push a context
+		f(cs, n, buf, R)
+	end
+end
+
+local renderer --fw. decl.
+
+local function render_lambda(s, cs, n, R, d1, d2)
+	local buf = string_buffer()
+	renderer(s, d1, d2)(cs, n, buf, R)
+	return buf:tostring()
+end
+
+local function lambda_result(val, cs, n, R, d1, d2)
+	if type(val) == 'string' and val:find('{{', 1, true) then
+		val = render_lambda(val, cs, n, R, d1, d2)
+	end
+	return val
+end
+
+local function codegen_value_lambda(f, cs, n, R)
+	return lambda_result((f()), cs, n, R)
+end
+
+local function codegen_section_lambda(f, inverted, text, d1, d2, cs, n, buf, R)
+	local val = f(text, function(text)
+		return render_lambda(text, cs, n, R, d1, d2)
+	end)
+	if inverted then --lambdas on inv. sections must be truthy
+		val = nil
+	end
+	val = lambda_result(val, cs, n, R, d1, d2)
+	if istrue(val) then
+		buf:put(tostring(val))
+	end
+end
+
+local function codegen_partial(name, spaces, cs, n, buf, R)
+	local partial = R.getpartial and R.getpartial(name)
+	if partial then
+		if spaces then --indented
+			partial = indented(partial, spaces)
+		end
+		renderer(partial)(cs, n, buf, R)
+	end
+end
+
+--generate the source code of the render function of a program.
+local function codegen(prog)
+	local template = prog.template
+	local funcs = {} --section body functions
+	local function q(s)
+		return _('%q', s)
+	end
+	local function var_expr(var)
+		if var == '.' then
+			return 'cs[n]'
+		elseif isstr(var) then
+			return _('lookup(cs, n, %s)', q(var))
+		end
+		local e = _('lookup(cs, n, %s)', q(var[1]))
+		for i=2,#var do
+			e = _('field(%s, %s)', e, q(var[i]))
+		end
+		return e
+	end
+	local function gen(t, pc, endpc)
+		while pc < endpc do
+			local cmd = prog[pc]
+			if cmd == 'text' then
+				add(t, _('buf:put(%s)', q(prog[pc+3])))
+				pc = pc + 4
+			elseif cmd == 'html' or cmd == 'string' then
+				add(t, 'do local v = '..var_expr(prog[pc+3]))
+				add(t, 'if type(v) == "function" then v = value_lambda(v, cs, n, R) end')
+				add(t, 'if v ~= nil then v = tostring(v)')
+				if cmd == 'html' then
+					add(t, 'local esc = R.esc; if esc then v = esc(v)'
+						..' elseif find(v, P) then v = gsub(v, P, E) end')
+				end
+				add(t, 'buf:put(v) end end')
+				pc = pc + 4
+			elseif cmd == 'iter' or cmd == 'ifnot' then
+				local var, nextpc, ti, tj, d1, d2 = unpack(prog, pc+3, pc+8)
+				add(t, 'do local v = '..var_expr(var))
+				add(t, _('if type(v) == "function" then '
+					..'section_lambda(v, %s, %s, %s, %s, cs, n, buf, R)',
+					tostring(cmd == 'ifnot'), q(template:sub(ti, tj)), q(d1), q(d2)))
+				if cmd == 'iter' then
+					local ft = {}
+					gen(ft, pc+9, nextpc-3) --section body, without the 'end' cmd
+					add(funcs, _('S[%d] = function(cs, n, buf, R)\n%s\nend',
+						#funcs+1, concat(ft, '\n')))
+					add(t, _('elseif istrue(v) then section(S[%d], v, cs, n, buf, R)',
+						#funcs))
+				else
+					add(t, 'elseif not istrue(v) then')
+					gen(t, pc+9, nextpc-3)
+				end
+				add(t, 'end end')
+				pc = nextpc
+			elseif cmd == 'render' then
+				local i, name, i1 = prog[pc+1], prog[pc+3], prog[pc+4]
+				local spaces = i1 >= i and q(template:sub(i, i1)) or 'nil'
+				add(t, _('partial(%s, %s, cs, n, buf, R)', q(name), spaces))
+				pc = pc + 5
+			else
+				assert(false)
+			end
+		end
+	end
+	local t = {}
+	gen(t, 1, #prog + 1)
+	return concat({
+		'local lookup, field, istrue, section, section_lambda, value_lambda,',
+		'\tpartial, type, tostring, find, gsub, P, E = ...',
+		'local S = {}',
+		concat(funcs, '\n'),
+		'return function(cs, n, buf, R)',
+		concat(t, '\n'),
+		'end',
+	}, '\n')
+end
+
+local function load_codegen(prog)
+	local chunk, err = loadstring(codegen(prog), '=mustache')
+	if not chunk then --too big for the Lua compiler: interpret it instead.
+		return function(cs, n, buf, R)
+			render(prog, cs, R.getpartial, function(s) buf:put(s) end,
+				nil, nil, R.esc or html_escape)
+		end
+	end
+	return chunk(
+		codegen_lookup, codegen_field, istrue, codegen_section,
+		codegen_section_lambda, codegen_value_lambda, codegen_partial,
+		type, tostring, string.find, string.gsub, P, E)
+end
+
+--get the render function of a template (compile it if not already compiled).
+function renderer(template, d1, d2)
+	local prog = mustache_compile(template, d1, d2)
+	local f = prog.render
+	if not f then
+		f = load_codegen(prog)
+		prog.render = f
+	end
+	return f
+end
+
+function mustache_lua(template, d1, d2) --dump generated code
+	return codegen(mustache_compile(template, d1, d2))
+end
+
+local bufs = {} --string buffer freelist
+
 function mustache_render(prog, view, getpartial, write, d1, d2, esc)
+	if istab(getpartial) then --partials table given, build getter
+		local partials = getpartial
+		getpartial = function(name)
+			return partials[name]
+		end
+	end
+	local f = renderer(prog, d1, d2)
+	local R = {getpartial = getpartial, esc = esc ~= html_escape and esc or nil}
+	local buf = pop(bufs) or string_buffer()
+	local ok, err = pcall(f, {view}, view ~= nil and 1 or 0, buf, R)
+	local s = ok and buf:tostring()
+	push(bufs, buf:reset())
+	if not ok then
+		error(err, 2)
+	end
+	if write then
+		write(s)
+	else
+		return s
+	end
+end
+
+function mustache_interpret(prog, view, getpartial, write, d1, d2, esc)
 	if istab(getpartial) then --partials table given, build getter
 		local partials = getpartial
 		getpartial = function(name)
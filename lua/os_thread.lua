@@ -7,6 +7,12 @@ THREADS
 	os_thread(func, args...) -> th         create and start an os thread
 	th:join() -> retvals...                wait on a thread to finish
 
+STATE POOL
+	os_thread_preload(module_name|func, ...)  load modules in all thread states
+	os_thread_prewarm([n])                 create idle thread states in advance
+	os_thread_free_states([n])             close idle thread states down to n
+	os_thread_max_free_states <- n         max. idle states to keep (8)
+
 QUEUES
 	synchronized_queue([maxlength]) -> q   create a synchronized queue
 	q:length() -> n                        queue length
@@ -55,7 +61,8 @@ os_thread(func, args...) -> th
 	tables without cyclic references or multiple references to the same
 	table inside.
 	* shareable types are: pthread threads, mutexes, cond vars and rwlocks,
-	top level Lua states, threads, queues and events.
+	top level Lua states, threads, queues, events and frozen values
+	(see frozen.lua).
 
 	Copiable objects are copied over to the Lua state, while shareable
 	objects are only shared with the thread. All args are kept from being
@@ -64,12 +71,37 @@ os_thread(func, args...) -> th
 	The returned thread object must not be discarded and `th:join()`
 	must be called on it to release the thread resources.
 
+	The thread runs on a Lua state taken from the state pool if available,
+	or on a new Lua state otherwise (see below).
+
 th:join() -> retvals...
 
 	Wait on a thread to finish and return the return values of its worker
 	function. Same rules apply for copying return values as for args.
 	Errors are propagated to the calling thread.
 
+	The thread's Lua state is put back into the state pool after the join
+	unless there are already `os_thread_max_free_states` idle states.
+
+STATE POOL -------------------------------------------------------------------
+
+os_thread_preload(module_name|func, ...)
+
+	Add modules to be required (and functions to be called) when creating
+	thread states, after glue, pthread, luastate and os_thread are loaded.
+	Functions must not have upvalues; use them to warm up the JIT on hot code
+	paths ahead of time. Idle states made before the call are closed.
+
+os_thread_prewarm([n])
+
+	Create idle thread states until there are `n` of them in the pool
+	(default is `os_thread_max_free_states`). Call this at startup, after
+	os_thread_preload(), to take the cost of creating states off the first
+	threads.
+
+	Recycled states keep the globals and loaded modules of previous threads
+	so worker functions should not rely on a pristine global environment.
+
 QUEUES -----------------------------------------------------------------------
 
 synchronized_queue([maxlength]) -> q
@@ -99,7 +131,8 @@ thread.event([initially_set]) -> e
 NOTES ------------------------------------------------------------------------
 
 Creating hi-level threads is slow because Lua modules must be loaded
-every time for each thread. For best results, use a thread pool.
+in each new Lua state. Threads started on recycled or pre-warmed states from
+the state pool skip that, but for best results use a thread pool.
 
 On Windows, the current directory is per thread! Same goes for env vars.
 
@@ -133,6 +166,8 @@ local function pointer_class(in_ctype, out_ctype)
 	return class
 end
 
+--NOTE: set `class.module` to have the module that implements the class
+--loaded automatically in the receiving Lua state.
 function shared_object(name, class)
 	if typemap[name] then return end --ignore duplicate registrations
 	typemap[name] = class
@@ -148,12 +183,17 @@ shared_pointer('pthread_mutex_t'  , 'pthread_mutex_t*')
 shared_pointer('pthread_rwlock_t' , 'pthread_rwlock_t*')
 shared_pointer('pthread_cond_t'   , 'pthread_cond_t*')
 
+if frozen_shareable then --frozen loaded first.
+	shared_object('frozen', frozen_shareable)
+end
+
 --identify a shareable object and serialize it.
 local function serialize_shareable(x)
 	for typename, class in pairs(typemap) do
 		if class.identify(x) then
 			local t = class.serialize(x)
 			t.serialize_type = typename
+			t.serialize_module = class.module
 			return t
 		end
 	end
@@ -161,6 +201,9 @@ end
 
 --deserialize a serialized shareable object
 local function deserialize_shareable(t)
+	if not typemap[t.serialize_type] and t.serialize_module then
+		require(t.serialize_module) --registers the type.
+	end
 	return typemap[t.serialize_type].deserialize(t)
 end
 
@@ -404,7 +447,17 @@ shared_object('queue', queue)
 local thread = {type = 'os_thread', debug_prefix = '!'}
 thread.__index = thread
 
-function os_thread(func, ...)
+--state pool: threads are started on pre-initialized Lua states which are
+--recycled when the thread is joined, so that short-lived threads don't pay
+--for creating a Lua state and loading modules into it every time.
+
+os_thread_max_free_states = 8 --max. idle states to keep around
+
+local preload = {} --{module_name|func, ...}
+local preload_gen = 0 --states made before the last preload change are discarded.
+local free_states = {} --{{state=, worker_cb_ptr=, gen=}, ...}
+
+local function new_thread_state()
 	local state = luastate()
 
 	state:openlibs()
@@ -415,34 +468,97 @@ function os_thread(func, ...)
 		bundle_luastate.init_bundle(state)
 	end
 
-	state:push(function(func, args)
+	state:push(function(preload)
 
 	   require'glue'
 		require'pthread'
 		require'luastate'
 		require'os_thread'
 
+		for _,mod in ipairs(preload) do
+			if type(mod) == 'string' then
+				require(mod)
+			else
+				mod() --warm-up function.
+			end
+		end
+
 		local function pass(ok, ...)
 			local retvals = _os_thread_serialize_args(pack(ok, ...))
 			rawset(_G, '__ret', retvals) --is this the only way to get them out?
 		end
 	   local function worker()
-	   	local t = _os_thread_deserialize_args(args)
-	   	pass(pcall(func, unpack(t)))
+			local job = rawget(_G, '__job')
+			rawset(_G, '__job', nil)
+	   	local t = _os_thread_deserialize_args(job.args)
+	   	pass(pcall(job.func, unpack(t, 1, t.n)))
 	   end
 
 		--worker_cb is anchored by luajit along with the function it frames.
+		--it's made only once per state since luajit has a limited number of
+		--callback slots and the state can be reused for many threads.
 	   local worker_cb = cast('void *(*)(void *)', worker)
 	   return ptr_serialize(worker_cb)
 	end)
+	local worker_cb_ptr = ptr_deserialize(state:call(preload))
+
+	return {state = state, worker_cb_ptr = worker_cb_ptr, gen = preload_gen}
+end
+
+local function checkout_state()
+	return pop(free_states) or new_thread_state()
+end
+
+local function recycle_state(ts)
+	if ts.gen ~= preload_gen or #free_states >= os_thread_max_free_states then
+		ts.state:close()
+		return
+	end
+	ts.state:push(nil)
+	ts.state:setglobal'__ret'
+	ts.state:settop(0)
+	ts.state:gc(C.LUA_GCCOLLECT, 0)
+	add(free_states, ts)
+end
+
+function os_thread_preload(...)
+	for i = 1, select('#', ...) do
+		add(preload, (select(i, ...)))
+	end
+	preload_gen = preload_gen + 1
+	os_thread_free_states(0)
+end
+
+function os_thread_prewarm(n)
+	n = min(n or os_thread_max_free_states, os_thread_max_free_states)
+	while #free_states < n do
+		add(free_states, new_thread_state())
+	end
+end
+
+function os_thread_free_states(n)
+	n = n or 0
+	while #free_states > n do
+		pop(free_states).state:close()
+	end
+end
+
+function os_thread(func, ...)
+	local ts = checkout_state()
+	local state = ts.state
+
+	state:push(function(func, args)
+		rawset(_G, '__job', {func = func, args = args})
+	end)
 	local args = pack(...)
 	local serialized_args = _os_thread_serialize_args(args)
-	local worker_cb_ptr = ptr_deserialize(state:call(func, serialized_args))
-	local pthread = pthread(worker_cb_ptr)
+	state:call(func, serialized_args)
+	local pthread = pthread(ts.worker_cb_ptr)
 
 	return setmetatable({
 			pthread = pthread,
 			state = state,
+			ts = ts,
 			args = args, --keep args to avoid shareables from being collected
 		}, thread)
 end
@@ -453,7 +569,12 @@ function thread:join()
 	--get the return values of worker function
 	self.state:getglobal'__ret'
 	local retvals = self.state:get()
-	self.state:close()
+	if self.ts then
+		recycle_state(self.ts)
+		self.ts = nil
+	else
+		self.state:close()
+	end
 	--propagate the error.
 	retvals = _os_thread_deserialize_args(retvals)
 	if not retvals[1] then
@@ -502,7 +623,7 @@ function os_thread_pool(n)
 	local t = {}
 	t.queue = synchronized_queue(1)
 	for i = 1, n do
-		t[i] = thread(pool_worker, t.queue)
+		t[i] = os_thread(pool_worker, t.queue)
 	end
 	return setmetatable(t, pool)
 end
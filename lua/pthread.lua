@@ -15,7 +15,7 @@ THREADS
 	pthread_yield()                               relinquish control to the scheduler
 
 MUTEXES
-	mutex([mattrs]) -> mutex                      create a mutex
+	mutex([mattrs], [space]) -> mutex             create a mutex
 	mutex:free()                                  free a mutex
 	mutex:lock()                                  lock a mutex
 	mutex:unlock()                                unlock a mutex
@@ -59,7 +59,7 @@ pthread(func_ptr[, attrs]) -> th
   * `stacksize = n` - stack size in bytes (OS restrictions apply).
 
 
-mutex([mattrs]) -> mutex
+mutex([mattrs], [space]) -> mutex
 
 	Create a mutex. The optional mattrs table can have the fields:
 
@@ -72,6 +72,9 @@ mutex([mattrs]) -> mutex
 		* 'errorcheck' - non-recursive mutex with error checking, so
 		double-locking and unlocking by a different thread results
 		in an error being raised.
+	* `pshared = true`: allow the mutex to be used from multiple processes
+	(the mutex must be created in shared memory with the `space` arg;
+	Linux and OSX only).
 
 IMPLEMENTATION NOTES ---------------------------------------------------------
 
@@ -156,6 +159,7 @@ if ffi.os == 'Linux' then
 		PTHREAD_CANCELED = -1,
 		PTHREAD_EXPLICIT_SCHED = 1,
 		PTHREAD_PROCESS_PRIVATE = 0,
+		PTHREAD_PROCESS_SHARED = 1,
 		PTHREAD_MUTEX_NORMAL = 0,
 		PTHREAD_MUTEX_ERRORCHECK = 2,
 		PTHREAD_MUTEX_RECURSIVE = 1,
@@ -242,6 +246,7 @@ elseif ffi.os == 'OSX' then
 		PTHREAD_CANCELED = 1,
 		PTHREAD_EXPLICIT_SCHED = 2,
 		PTHREAD_PROCESS_PRIVATE = 2,
+		PTHREAD_PROCESS_SHARED = 1,
 		PTHREAD_MUTEX_NORMAL = 0,
 		PTHREAD_MUTEX_ERRORCHECK = 1,
 		PTHREAD_MUTEX_RECURSIVE = 2,
@@ -318,6 +323,7 @@ elseif ffi.os == 'Windows' then
 		PTHREAD_CANCELED = 0xDEADBEEF,
 		PTHREAD_EXPLICIT_SCHED = 0,
 		PTHREAD_PROCESS_PRIVATE = 0,
+		PTHREAD_PROCESS_SHARED = 1,
 		PTHREAD_MUTEX_NORMAL = 0,
 		PTHREAD_MUTEX_ERRORCHECK = 1,
 		PTHREAD_MUTEX_RECURSIVE = 2,
@@ -389,6 +395,7 @@ int pthread_mutex_trylock(pthread_mutex_t *m);
 int pthread_mutexattr_init(pthread_mutexattr_t *a);
 int pthread_mutexattr_destroy(pthread_mutexattr_t *a);
 int pthread_mutexattr_settype(pthread_mutexattr_t *a, int type);
+int pthread_mutexattr_setpshared(pthread_mutexattr_t *a, int pshared);
 
 int pthread_cond_init(pthread_cond_t *cv, const pthread_condattr_t *a);
 int pthread_cond_destroy(pthread_cond_t *cv);
@@ -555,6 +562,9 @@ function _G.mutex(mattrs, space)
 			local mtype = assert(mtypes[mattrs.type], 'invalid mutex type')
 			checkz(C.pthread_mutexattr_settype(mattr, mtype))
 		end
+		if mattrs.pshared then
+			checkz(C.pthread_mutexattr_setpshared(mattr, C.PTHREAD_PROCESS_SHARED))
+		end
 	end
 	local ret = C.pthread_mutex_init(mutex, mattr)
 	if mattr then
@@ -8,6 +8,8 @@
 	the first reply and discards the rest. This results in the best lookup
 	times and impact-free (for the client) failovers at the expense of a little
 	more network traffic which DNS servers are already made to handle.
+	A query is sent to all servers with a single `sendmmsg()` call and replies
+	are received in batches with `recvmmsg()`.
 
 	IMPORTANT: call `randomseed` prior to using this module to decrease
 	the chance of cache poisoning attacks.
@@ -61,7 +63,7 @@ GLOBAL RESOLVER
 ]=]
 
 require'glue'
-require'lrucache'
+require'lrucache_ffi'
 require'sock'
 
 local
@@ -311,22 +313,25 @@ concurrently from different coroutines, so we need to account for the fact
 that responses may come out-of-order, some may not come at all, and some may
 come way later than the timeout of the query which we must always respect.
 
-The solution: when calling the resolver's lookup function from a sock thread,
-a query object is created, sent to the server and queued for response.
-Then the calling thread suspends itself. A scheduler that runs in its own
-thread reads responses as they come, matches queries in the queue based on
-id and resumes their corresponding threads with the answers. If/when
-the queue gets empty, the scheduler suspends itself, waiting to be resumed
-again when the first new request arrives.
+The solution: all UDP queries go through a single unconnected socket per
+address family. When calling the resolver's lookup function from a sock
+thread, a query object is created, sent to all the servers at once with
+sendmmsg() and queued for response. Then the calling thread suspends itself.
+A scheduler that runs in its own thread reads responses in batches with
+recvmmsg() as they come, discards those that don't come from one of the
+servers, matches queries in the queue based on id and resumes their
+corresponding threads with the answers. If/when the queue gets empty, the
+scheduler suspends itself, waiting to be resumed again when the first new
+request arrives.
 
 Timed out queries are not dequeued right away to avoid reusing an id for a
 query for which an answer might still come later.
 
-If there's more than one server configured, the lookup function queries all
-servers simultaneously in separate threads and suspends itself. The first
-thread to receive a response wakes up the lookup thread which finishes up
-with that response. Later responses are discarded. This results in the best
-lookup times and impact-free (for the client) failovers.
+The first reply for a query id wins, later replies from the other servers
+are discarded. Servers configured with `tcp_only` are queried in separate
+threads and the lookup thread finishes up with the first response from any
+of the threads. This results in the best lookup times and impact-free (for
+the client) failovers.
 
 TIP: When coding complex flows with coroutines, the question to ask before
 suspending any thread is: "who is now responsible for resuming this thread?".
@@ -356,7 +361,7 @@ function rs:_dbg(ns, q, ...)
 	print(
 		'resolver.lua:'..debug.getinfo(3).currentline..':',
 		threadname(),
-		ns and count(ns.queue) or '',
+		ns and ns.queue and count(ns.queue) or '',
 		q and q.name:sub(1, 7) or '',
 		q and q.i or '',
 		...)
@@ -412,15 +417,15 @@ local function tcp_query(rs, ns, q)
 	return parse_response(q, buf, len)
 end
 
-local function gen_qid(rs, ns, now)
+local function gen_qid(rs, link, now)
 	for i = 1, 10 do --expect a 50% chance of collision at around 362 qids.
 		local qid = random(0, 65535)
-		local q = ns.queue[qid]
+		local q = link.queue[qid]
 		if not q then
 			return qid
 		elseif q.lost and now > q.expires + 120 then --safe to reuse this id.
-			rs:dbg(ns, q, 'REUSE')
-			ns.queue[qid] = nil
+			rs:dbg(link, q, 'REUSE')
+			link.queue[qid] = nil
 			return qid
 		end
 	end
@@ -429,47 +434,62 @@ end
 
 local qi = 0
 
-local function ns_query(rs, ns, q)
+local function init_query(q, qid)
+	q.id = qid
+	qi = qi + 1
+	q.i = qi
+	q.s = request_str(q)
+end
+
+local function ns_tcp_query(rs, ns, q)
+	assert(q.timeout >= 0.1)
+	q.expires = clock() + q.timeout
+	init_query(q, random(0, 65535))
+	return tcp_query(rs, ns, q)
+end
+local try_ns_tcp_query = protect_io(ns_tcp_query)
+
+--send the query to all the servers of a link at once and wait for the first reply.
+local function link_query(rs, link, q)
 
 	assert(q.timeout >= 0.1)
 
 	--generate a request with a random id.
 	local now = clock()
 	q.expires = now + q.timeout
-	q.id = check_io(q, gen_qid(rs, ns, now))
-	qi = qi + 1
-	q.i = qi
-	q.s = request_str(q)
-
-	if q.tcp_only or ns.tcp_only or rs.tcp_only then
-		return tcp_query(rs, ns, q)
-	end
+	init_query(q, check_io(q, gen_qid(rs, link, now)))
 
 	--queue the query for response before sending it because the scheduler
-	--might recv() our response even before our send() returns!
-	ns.queue[q.id] = q
-
-	--send the request. being resume()'d, this thread will now suspend
-	--itself inside send(), returning control to the calling thread.
-	--the I/O scheduler will resume this thread next when send() completes.
-	rs:dbg(ns, q, 'SEND.')
-	ns.udp:setexpires(q.expires)
-	ns.udp:send(q.s)
-	rs:dbg(ns, q, 'SENT')
+	--might recv() our response even before our sendmmsg() returns!
+	link.queue[q.id] = q
+
+	--send the request to all servers in one syscall. being resume()'d, this
+	--thread will now suspend itself inside sendmmsg() if the socket's send
+	--buffer is full, returning control to the calling thread.
+	local b = link.free_batch or udp_batch(#link.servers, 512)
+	link.free_batch = false --in use: concurrent senders make their own.
+	for i, ns in ipairs(link.servers) do
+		b:set(i, q.s, nil, ns.ai)
+	end
+	rs:dbg(link, q, 'SEND.')
+	link.udp:setexpires('w', q.expires)
+	link.udp:sendmmsg(b, #link.servers)
+	link.free_batch = b
+	rs:dbg(link, q, 'SENT')
 
 	--start the scheduler or suspend. the scheduler will resume() us back
 	--on the matching recv() or on timeout.
 	q.thread = currentthread()
-	local buf, len
-	if not ns.scheduler_running then
-		rs:dbgr(ns, q, ns.scheduler)
-		buf, len = check_io(q, transfer(ns.scheduler))
+	local buf, len, ns
+	if not link.scheduler_running then
+		rs:dbgr(link, q, link.scheduler)
+		buf, len, ns = check_io(q, transfer(link.scheduler))
 	elseif q.result then
-		rs:dbg(ns, q, 'EARLY', len)
-		buf, len = check_io(q, unpack(q.result))
+		rs:dbg(link, q, 'EARLY', len)
+		buf, len, ns = check_io(q, unpack(q.result))
 	else
-		rs:dbgs(ns, q)
-		buf, len = check_io(q, suspend())
+		rs:dbgs(link, q)
+		buf, len, ns = check_io(q, suspend())
 	end
 
 	local answers, err = parse_response(q, buf, len)
@@ -480,73 +500,81 @@ local function ns_query(rs, ns, q)
 
 	return answers, err
 end
-local try_ns_query = protect_io(ns_query)
+local try_link_query = protect_io(link_query)
 
-local function schedule(rs, ns)
-	local sz = 4096
-	local buf = u8a(sz)
-	local function respond(q, ...)
+local function schedule(rs, link)
+	local b = udp_batch(16, 4096)
+	local function respond(q, buf, len, ...)
 		if q.thread then
-			resume(q.thread, ...)
-		else
-			q.result = pack(...)
+			resume(q.thread, buf, len, ...)
+		else --the batch buffer will be reused so we must copy the reply.
+			if buf then
+				local p = u8a(len)
+				copy(p, buf, len)
+				buf = p
+			end
+			q.result = pack(buf, len, ...)
 		end
 	end
 	while true do
-		ns.scheduler_running = true
+		link.scheduler_running = true
 		while true do
 			local min_expires
 			local now = clock()
-			for qid, q in pairs(ns.queue) do
+			for qid, q in pairs(link.queue) do
 				if not q.lost then
 					if now < q.expires then
 						min_expires = min(min_expires or 1/0, q.expires)
 					else
 						q.lost = true
-						rs:dbgt(ns, q, 'TIMEOUT')
-						respond(q, nil, 'timeut')
+						rs:dbgt(link, q, 'TIMEOUT')
+						respond(q, nil, 'timeout')
 					end
 				elseif now > q.expires + 120 then --safe to reuse this id.
-					rs:dbg(ns, q, 'REUSE')
-					ns.queue[qid] = nil
+					rs:dbg(link, q, 'REUSE')
+					link.queue[qid] = nil
 				end
 			end
-			rs:dbg(ns, nil, 'RECV.',
+			rs:dbg(link, nil, 'RECV.',
 				rs.debug and min_expires and string.format('%.2f', min_expires - now)
 					or 'ALL EXPIRED')
 			if not min_expires then
 				break
 			end
-			ns.udp:setexpires(min_expires)
-			local len, err = ns.udp:try_recv(buf, sz)
-			rs:dbg(ns, nil, 'RECV', len, err)
-			if not len then
-				for qid, q in pairs(ns.queue) do
+			link.udp:setexpires('r', min_expires)
+			local n, err = link.udp:try_recvmmsg(b)
+			rs:dbg(link, nil, 'RECV', n, err)
+			if not n then
+				for qid, q in pairs(link.queue) do
 					if not q.lost then
 						q.lost = true
-						rs:dbgt(ns, q, 'ERROR', err)
+						rs:dbgt(link, q, 'ERROR', err)
 						respond(q, nil, err)
 					end
 				end
 			else
-				local qid = parse_qid(empty, buf, len)
-				local q = ns.queue[qid]
-				if q then
-					if clock() < q.expires then
-						ns.queue[qid] = nil
-						rs:dbgt(ns, q, 'DATA', len)
-						respond(q, buf, len)
+				for i = 1, n do
+					local buf, len = b:buf(i)
+					local sa = b:addr(i)
+					--the socket is not connected so we must filter out replies
+					--from addresses that we didn't query.
+					local ns = sa and link.by_addr[sa:tostring()]
+					local q = ns and len >= 2 and link.queue[parse_qid(empty, buf, len)]
+					if not q or q.lost then
+						rs:dbg(link, nil, '???', ns and ns.i)
+					elseif clock() < q.expires then
+						link.queue[q.id] = nil
+						rs:dbgt(link, q, 'DATA', len)
+						respond(q, buf, len, ns)
 					else
 						q.lost = true
-						rs:dbgt(ns, q, 'TIMEOUT')
+						rs:dbgt(link, q, 'TIMEOUT')
 						respond(q, nil, 'timeout')
 					end
-				else
-					rs:dbg(ns, nil, '???', qid)
 				end
 			end
 		end
-		ns.scheduler_running = false
+		link.scheduler_running = false
 		rs:dbgs()
 		suspend()
 	end
@@ -565,6 +593,9 @@ function resolver(opt)
 	local servers = collect(words(rs.servers))
 
 	rs.nst = {}
+	rs.tcp_nst = {} --{ns1, ...}
+	rs.links = {} --{link1, ...}
+	local links = {} --{family -> link}
 	for i,ns in ipairs(rs.servers) do
 		local host, port, tcp_only
 		if istab(ns) then
@@ -574,19 +605,33 @@ function resolver(opt)
 		else
 			host, port = ns, 53
 		end
-		local ai = getaddrinfo(host, port)
-		local udp = udp()
-		udp:connect(ai)
-		local ns = {ai = ai, udp = udp, tcp_only = tcp_only, queue = {}}
-		ns.scheduler = thread(function()
-			schedule(rs, ns)
-		end, 'N'..i)
+		local ai = getaddrinfo(host, port, 'udp')
+		local ns = {ai = ai, tcp_only = tcp_only, i = i}
 		rs.nst[i] = ns
-		ns.i = i
-		rs:dbg(ns, nil, 'NS', rs.debug and ai:tostring())
+		if tcp_only then
+			add(rs.tcp_nst, ns)
+		else
+			--one unconnected socket per address family for all servers.
+			local af = ai:family()
+			local link = links[af]
+			if not link then
+				local udp = udp(nil, af)
+				udp:bind(af == 'inet6' and '::' or '*', 0)
+				link = {udp = udp, servers = {}, by_addr = {}, queue = {},
+					free_batch = false, i = #rs.links + 1}
+				link.scheduler = thread(function()
+					schedule(rs, link)
+				end, 'N%d', link.i)
+				links[af] = link
+				add(rs.links, link)
+			end
+			add(link.servers, ns)
+			link.by_addr[ai.addr:tostring()] = ns
+		end
+		rs:dbg(nil, nil, 'NS', rs.debug and ai.addr:tostring())
 	end
 
-	rs.cache = lrucache{max_size = rs.max_cache_entries}
+	rs.cache = lrucache_ffi{max_count = rs.max_cache_entries}
 
 	return rs
 end
@@ -599,34 +644,33 @@ function rs.try_query(rs, qname, qtype, timeout)
 	qtype = qtype or 'A'
 	rs:dbg(nil, {name = qname}, 'LOOKUP')
 	local key = qtype..' '..qname
-	local res = rs.cache:get(key)
-	if res and now() > res.expires then
-		rs.cache:remove_val(res)
-		res = nil
-	end
+	local res = rs.cache:get(key) --expired entries are removed by get().
 	if res then
 		return res
 	end
 	local lookup_thread = currentthread()
-	local queries_left = #rs.nst
-	for i,ns in ipairs(rs.nst) do
+	local tcp_only = rs.tcp_only or (t and t.tcp_only)
+	local links = tcp_only and empty or rs.links
+	local tcp_nst = tcp_only and rs.nst or rs.tcp_nst
+	local queries_left = #links + #tcp_nst
+	local function query(query_func, dest, name)
 		resume(thread(function()
 			local t = update({name = qname, type = qtype, timeout = timeout}, t)
 			local q = object(q, t)
-			local res, err = try_ns_query(rs, ns, q) --suspends inside the first send().
+			local res, err = query_func(rs, dest, q) --suspends inside the first send().
 			queries_left = queries_left - 1
 			if not lookup_thread then
-				rs:dbg(ns, q, 'DISCARD (late)')
+				rs:dbg(dest, q, 'DISCARD (late)')
 				return
 			end
 			if not res and iserror(err, 'io') and queries_left > 0 then
-				rs:dbg(ns, q, 'DISCARD (I/O error and not last)')
+				rs:dbg(dest, q, 'DISCARD (I/O error and not last)')
 				return
 			end
 			local lt = lookup_thread
 			lookup_thread = nil
 			if not res then
-				rs:dbgr(ns, q, lt, nil, err)
+				rs:dbgr(dest, q, lt, nil, err)
 				resume(lt, nil, err)
 			else
 				local min_ttl = 1/0
@@ -634,11 +678,17 @@ function rs.try_query(rs, qname, qtype, timeout)
 					min_ttl = min(min_ttl, answer.ttl)
 				end
 				res.expires = now() + min_ttl
-				rs.cache:put(key, res)
-				rs:dbgr(ns, q, lt, '{...}')
+				rs.cache:put(key, res, min_ttl)
+				rs:dbgr(dest, q, lt, '{...}')
 				resume(lt, res)
 			end
-		end, 'N'..i))
+		end, name))
+	end
+	for i,link in ipairs(links) do
+		query(try_link_query, link, 'N'..i)
+	end
+	for i,ns in ipairs(tcp_nst) do
+		query(try_ns_tcp_query, ns, 'T'..ns.i)
 	end
 	rs:dbgs()
 	return suspend() -- the first thread to finish will resume us.
@@ -0,0 +1,571 @@
+--[=[
+
+	Shared-memory key/value cache.
+	Written by Cosmin Apreutesei. Public Domain.
+
+	A size-limited cache of string keys and values which lives in a shared
+	memory mapping so that multiple worker processes can use the same cache.
+
+	The memory is split into shards that are locked independently to reduce
+	lock contention. Each shard has a hash index (open addressing with linear
+	probing on xxhash32 keys) and an arena of fixed-size chunks. Each item
+	takes a chain of chunks holding the key and the value, so there's no
+	fragmentation. When a shard runs out of chunks or index slots, items are
+	evicted using the CLOCK algorithm (an approximation of LRU). Items can
+	have a max. age after which they are removed lazily.
+
+	shmcache([options]) -> cache          create or open a shared cache
+	cache:get(key) -> val                 get a value from the cache by key
+	cache:put(key, val, [max_age]) -> ok  put a value in the cache, making room as needed
+	cache:remove(key) -> true|false       remove a value from the cache by key
+	cache:clear()                         clear the cache
+	cache:count() -> n                    number of values in the cache
+	cache:stats() -> t                    get cache metrics
+	cache:free()                          unmap the cache memory
+	cache:unlink()                        remove the shared memory file of a named cache
+
+shmcache([options]) -> cache
+
+	Options:
+
+	* `name`          : shared memory name (see `tagname` in fs.mmap()).
+	                    Without a name, an anonymous mapping is created which
+	                    is shared only with forked child processes.
+	* `create`        : initialize the memory (default is true only for
+	                    anonymous caches). For named caches, the master process
+	                    must create the cache before starting the workers which
+	                    then open it with just the `name` option.
+	* `size`          : total memory size in bytes (64M).
+	* `shards`        : number of independently locked shards (16).
+	* `chunk_size`    : arena chunk size, multiple of 8 (128).
+	* `avg_item_size` : expected average key + value size for sizing the index (256).
+	* `max_age`       : default max. age of values, in seconds (inf).
+	* `encode, decode`: value serializers (by default values must be strings).
+
+cache:put(key, val, [max_age]) -> true | false
+
+	Put a value in the cache. Returns false if the value is too large to fit
+	in a shard.
+
+cache:stats() -> t
+
+	Get `{count=, bytes=, hits=, misses=, evictions=, expirations=}` summed
+	over all shards. The counters are shared by all processes.
+
+LIMITATIONS
+
+	* the shard locks are process-shared pthread mutexes so a process that
+	crashes while holding one leaves that shard locked (Linux and OSX only).
+	* keys and values are copied in and out of the shared memory on every
+	get() and put() so this is not a replacement for an in-process cache of
+	Lua objects, but something to put behind one.
+
+]=]
+
+if not ... then require'shmcache_test'; return end
+
+require'glue'
+require'fs'
+require'pthread'
+require'xxhash'
+
+cdef[[
+typedef struct shmcache_header {
+	uint32_t magic;
+	uint32_t shards;
+	uint32_t slots;       // index slots per shard (power of 2)
+	uint32_t max_count;   // max. items per shard
+	uint32_t chunks;      // chunks per shard
+	uint32_t chunk_size;
+	uint64_t shard_size;  // bytes per shard, including the index and the chunks
+	uint64_t size;        // total mapped size
+} shmcache_header_t;
+
+typedef struct shmcache_shard {
+	pthread_mutex_t mutex;
+	uint32_t count;       // number of items
+	uint32_t free_count;  // number of free chunks
+	uint32_t free_chunk;  // free chunk list head
+	uint32_t hand;        // CLOCK hand
+	double bytes;         // sum of key + value sizes
+	double hits;
+	double misses;
+	double evictions;
+	double expirations;
+} shmcache_shard_t;
+
+typedef struct shmcache_slot {
+	uint32_t hash;
+	uint32_t chunk;       // first chunk of the item (1-based); 0 means empty
+} shmcache_slot_t;
+
+typedef struct shmcache_chunk {
+	uint32_t next;        // next chunk in the item or in the free list (1-based)
+	uint8_t  flags;
+	uint8_t  _pad[3];
+} shmcache_chunk_t;
+
+typedef struct shmcache_item {
+	shmcache_chunk_t chunk;
+	uint32_t hash;
+	uint32_t klen;
+	uint32_t vlen;
+	uint32_t _pad;
+	double   expires;
+} shmcache_item_t;
+]]
+
+local MAGIC = 0x53484d31 --'SHM1'
+
+local HEAD = 1 --chunk is the first chunk of an item
+local REF  = 2 --item was accessed since the last CLOCK sweep
+
+local hdr_ct   = ctype'shmcache_header_t*'
+local shard_ct = ctype'shmcache_shard_t*'
+local slot_ct  = ctype'shmcache_slot_t*'
+local chunk_ct = ctype'shmcache_chunk_t*'
+local item_ct  = ctype'shmcache_item_t*'
+local cu8p     = ctype'const uint8_t*'
+
+local HDR_SIZE   = 64 --keep the shards cache-line aligned.
+local SHARD_SIZE = 128
+local CHUNK_HDR  = sizeof'shmcache_chunk_t'
+local ITEM_HDR   = sizeof'shmcache_item_t'
+assert(sizeof'shmcache_header_t' <= HDR_SIZE)
+assert(sizeof'shmcache_shard_t' <= SHARD_SIZE)
+
+local min, floor, ceil = math.min, math.floor, math.ceil
+local memcmp = C.memcmp
+
+local cache = {
+	size = 64 * 1024^2,
+	shards = 16,
+	chunk_size = 128,
+	avg_item_size = 256,
+	max_age = 1/0,
+}
+
+--chunk chains ---------------------------------------------------------------
+
+local function chunk(s, c)
+	return cast(chunk_ct, s.base + (c - 1) * s.chunk_size)
+end
+
+local function item(s, c)
+	return cast(item_ct, s.base + (c - 1) * s.chunk_size)
+end
+
+local function chunks_needed(s, n)
+	local cs = s.chunk_size
+	n = n - (cs - ITEM_HDR)
+	if n <= 0 then return 1 end
+	return 1 + ceil(n / (cs - CHUNK_HDR))
+end
+
+--copy n bytes from p to a chunk chain at chunk c, offset off.
+local function write(s, c, off, p, n)
+	local cs = s.chunk_size
+	while n > 0 do
+		if off == cs then
+			c, off = chunk(s, c).next, CHUNK_HDR
+		end
+		local m = min(n, cs - off)
+		copy(s.base + (c - 1) * cs + off, p, m)
+		p, n, off = p + m, n - m, off + m
+	end
+	return c, off
+end
+
+--copy n bytes from a chunk chain at chunk c, offset off to p.
+local function read(s, c, off, p, n)
+	local cs = s.chunk_size
+	while n > 0 do
+		if off == cs then
+			c, off = chunk(s, c).next, CHUNK_HDR
+		end
+		local m = min(n, cs - off)
+		copy(p, s.base + (c - 1) * cs + off, m)
+		p, n, off = p + m, n - m, off + m
+	end
+	return c, off
+end
+
+--advance n bytes in a chunk chain from chunk c, offset off.
+local function seek(s, c, off, n)
+	local cs = s.chunk_size
+	while n > 0 do
+		if off == cs then
+			c, off = chunk(s, c).next, CHUNK_HDR
+		end
+		local m = min(n, cs - off)
+		n, off = n - m, off + m
+	end
+	return c, off
+end
+
+local function key_equals(s, c, p, n)
+	local cs = s.chunk_size
+	local off = ITEM_HDR
+	while n > 0 do
+		if off == cs then
+			c, off = chunk(s, c).next, CHUNK_HDR
+		end
+		local m = min(n, cs - off)
+		if memcmp(s.base + (c - 1) * cs + off, p, m) ~= 0 then
+			return false
+		end
+		p, n, off = p + m, n - m, off + m
+	end
+	return true
+end
+
+local function alloc(s, n) --assumes there are enough free chunks.
+	local sh = s.sh
+	local first = sh.free_chunk
+	local c = first
+	for i = 1, n-1 do
+		c = chunk(s, c).next
+	end
+	local last = chunk(s, c)
+	sh.free_chunk = last.next
+	sh.free_count = sh.free_count - n
+	last.next = 0
+	return first
+end
+
+local function free_chain(s, c)
+	local sh = s.sh
+	local first, n = c, 0
+	local ch
+	while true do
+		ch = chunk(s, c)
+		ch.flags = 0
+		n = n + 1
+		if ch.next == 0 then break end
+		c = ch.next
+	end
+	ch.next = sh.free_chunk
+	sh.free_chunk = first
+	sh.free_count = sh.free_count + n
+end
+
+--hash index -----------------------------------------------------------------
+
+local function find(s, h, p, n)
+	local slots, mask = s.slots, s.mask
+	local i = band(h, mask)
+	while true do
+		local slot = slots[i]
+		local c = slot.chunk
+		if c == 0 then
+			return nil
+		end
+		if slot.hash == h then
+			local it = item(s, c)
+			if it.klen == n and key_equals(s, c, p, n) then
+				return i, c
+			end
+		end
+		i = band(i + 1, mask)
+	end
+end
+
+local function find_chunk(s, h, c)
+	local slots, mask = s.slots, s.mask
+	local i = band(h, mask)
+	while slots[i].chunk ~= c do
+		i = band(i + 1, mask)
+	end
+	return i
+end
+
+local function insert_slot(s, h, c)
+	local slots, mask = s.slots, s.mask
+	local i = band(h, mask)
+	while slots[i].chunk ~= 0 do
+		i = band(i + 1, mask)
+	end
+	slots[i].hash = h
+	slots[i].chunk = c
+end
+
+--remove a slot by shifting back the slots that follow it in its probe
+--sequence so that no tombstones are needed.
+local function remove_slot(s, i)
+	local slots, mask = s.slots, s.mask
+	local j = i
+	while true do
+		j = band(j + 1, mask)
+		local slot = slots[j]
+		if slot.chunk == 0 then break end
+		local k = band(slot.hash, mask) --home slot
+		local stays
+		if i <= j then
+			stays = i < k and k <= j
+		else
+			stays = i < k or k <= j
+		end
+		if not stays then
+			slots[i].hash = slot.hash
+			slots[i].chunk = slot.chunk
+			i = j
+		end
+	end
+	slots[i].chunk = 0
+end
+
+local function remove_item(s, i, c)
+	local sh = s.sh
+	local it = item(s, c)
+	sh.bytes = sh.bytes - (it.klen + it.vlen)
+	sh.count = sh.count - 1
+	remove_slot(s, i)
+	free_chain(s, c)
+end
+
+--make room for an item of n chunks using the CLOCK algorithm.
+local function make_room(s, n, now)
+	local sh = s.sh
+	local chunks = s.chunks
+	while sh.free_count < n or sh.count >= s.max_count do
+		local c = sh.hand + 1
+		sh.hand = c % chunks
+		local it = item(s, c)
+		local flags = it.chunk.flags
+		if band(flags, HEAD) ~= 0 then
+			if it.expires <= now then
+				remove_item(s, find_chunk(s, it.hash, c), c)
+				sh.expirations = sh.expirations + 1
+			elseif band(flags, REF) ~= 0 then
+				it.chunk.flags = HEAD
+			else
+				remove_item(s, find_chunk(s, it.hash, c), c)
+				sh.evictions = sh.evictions + 1
+			end
+		end
+	end
+end
+
+--shards ---------------------------------------------------------------------
+
+local function init_shard(s)
+	local sh = s.sh
+	fill(s.slots, (s.mask + 1) * sizeof'shmcache_slot_t')
+	for c = 1, s.chunks do
+		local ch = chunk(s, c)
+		ch.next = c < s.chunks and c + 1 or 0
+		ch.flags = 0
+	end
+	sh.count = 0
+	sh.free_count = s.chunks
+	sh.free_chunk = 1
+	sh.hand = 0
+	sh.bytes = 0
+end
+
+local function layout(self)
+	local hdr = self.hdr
+	local p = cast(u8p, hdr)
+	self.shard = {}
+	for i = 0, hdr.shards-1 do
+		local sp = p + HDR_SIZE + i * hdr.shard_size
+		local slots = cast(slot_ct, sp + SHARD_SIZE)
+		self.shard[i] = {
+			sh = cast(shard_ct, sp),
+			slots = slots,
+			mask = hdr.slots - 1,
+			max_count = hdr.max_count,
+			chunks = hdr.chunks,
+			chunk_size = hdr.chunk_size,
+			base = cast(u8p, slots + hdr.slots),
+		}
+	end
+	self.nshards = hdr.shards
+end
+
+function shmcache(opt)
+	local self = object(cache, opt)
+	local create = self.create
+	if create == nil then
+		create = not self.name
+	end
+	if create then
+		local shards = self.shards
+		local cs = self.chunk_size
+		assert(cs % 8 == 0 and cs > ITEM_HDR, 'invalid chunk_size')
+		local shard_bytes = floor((self.size - HDR_SIZE) / shards / 8) * 8
+		local slots = nextpow2(ceil(shard_bytes / self.avg_item_size * 4 / 3))
+		local chunks = floor((shard_bytes - SHARD_SIZE - slots * 8) / cs)
+		assert(chunks > 0, 'cache size too small')
+		self.map = mmap{tagname = self.name, access = 'w', size = self.size}
+		local hdr = cast(hdr_ct, self.map.addr)
+		hdr.magic = 0
+		hdr.shards = shards
+		hdr.slots = slots
+		hdr.max_count = min(chunks, floor(slots * 3 / 4))
+		hdr.chunks = chunks
+		hdr.chunk_size = cs
+		hdr.shard_size = shard_bytes
+		hdr.size = self.size
+		self.hdr = hdr
+		layout(self)
+		for i = 0, shards-1 do
+			local s = self.shard[i]
+			fill(s.sh, SHARD_SIZE)
+			mutex({pshared = true}, s.sh.mutex)
+			init_shard(s)
+		end
+		hdr.magic = MAGIC
+	else
+		--map the header first to find out the size of the whole thing.
+		local map = mmap{tagname = self.name, access = 'w', size = HDR_SIZE}
+		local hdr = cast(hdr_ct, map.addr)
+		assert(hdr.magic == MAGIC, 'shmcache not initialized')
+		local size = tonumber(hdr.size)
+		map:free()
+		self.map = mmap{tagname = self.name, access = 'w', size = size}
+		self.hdr = cast(hdr_ct, self.map.addr)
+		layout(self)
+	end
+	return self
+end
+
+local function shard(self, h)
+	return self.shard[shr(h, 24) % self.nshards]
+end
+
+--API ------------------------------------------------------------------------
+
+local vbuf = string_buffer()
+
+function cache:get(key)
+	local n = #key
+	local h = xxhash32(key, n, 0)
+	local s = shard(self, h)
+	local sh = s.sh
+	local val
+	sh.mutex:lock()
+	local i, c = find(s, h, cast(cu8p, key), n)
+	if c then
+		local it = item(s, c)
+		if it.expires <= now() then
+			remove_item(s, i, c)
+			sh.expirations = sh.expirations + 1
+			sh.misses = sh.misses + 1
+		else
+			it.chunk.flags = HEAD + REF
+			sh.hits = sh.hits + 1
+			local vlen = it.vlen
+			local p = vbuf:reset():reserve(vlen)
+			local c1, off = seek(s, c, ITEM_HDR, n)
+			read(s, c1, off, p, vlen)
+			vbuf:commit(vlen)
+			val = vbuf:tostring()
+		end
+	else
+		sh.misses = sh.misses + 1
+	end
+	sh.mutex:unlock()
+	if val and self.decode then
+		val = self.decode(val)
+	end
+	return val
+end
+
+function cache:put(key, val, max_age)
+	if self.encode then
+		val = self.encode(val)
+	end
+	local klen, vlen = #key, #val
+	local h = xxhash32(key, klen, 0)
+	local s = shard(self, h)
+	local n = chunks_needed(s, klen + vlen)
+	if n > s.chunks then
+		return false
+	end
+	local t = now()
+	local expires = t + (max_age or self.max_age)
+	local sh = s.sh
+	sh.mutex:lock()
+	local i, c = find(s, h, cast(cu8p, key), klen)
+	if c then
+		remove_item(s, i, c)
+	end
+	make_room(s, n, t)
+	c = alloc(s, n)
+	local it = item(s, c)
+	it.chunk.flags = HEAD
+	it.hash = h
+	it.klen = klen
+	it.vlen = vlen
+	it.expires = expires
+	local c1, off = write(s, c, ITEM_HDR, cast(cu8p, key), klen)
+	write(s, c1, off, cast(cu8p, val), vlen)
+	insert_slot(s, h, c)
+	sh.count = sh.count + 1
+	sh.bytes = sh.bytes + klen + vlen
+	sh.mutex:unlock()
+	return true
+end
+
+function cache:remove(key)
+	local n = #key
+	local h = xxhash32(key, n, 0)
+	local s = shard(self, h)
+	local sh = s.sh
+	sh.mutex:lock()
+	local i, c = find(s, h, cast(cu8p, key), n)
+	if c then
+		remove_item(s, i, c)
+	end
+	sh.mutex:unlock()
+	return c and true or false
+end
+
+function cache:clear()
+	for i = 0, self.nshards-1 do
+		local s = self.shard[i]
+		s.sh.mutex:lock()
+		init_shard(s)
+		s.sh.mutex:unlock()
+	end
+end
+
+function cache:stats()
+	local t = {count = 0, bytes = 0, hits = 0, misses = 0,
+		evictions = 0, expirations = 0}
+	for i = 0, self.nshards-1 do
+		local sh = self.shard[i].sh
+		sh.mutex:lock()
+		t.count       = t.count       + sh.count
+		t.bytes       = t.bytes       + sh.bytes
+		t.hits        = t.hits        + sh.hits
+		t.misses      = t.misses      + sh.misses
+		t.evictions   = t.evictions   + sh.evictions
+		t.expirations = t.expirations + sh.expirations
+		sh.mutex:unlock()
+	end
+	return t
+end
+
+function cache:count()
+	local n = 0
+	for i = 0, self.nshards-1 do
+		n = n + self.shard[i].sh.count
+	end
+	return n
+end
+
+function cache:free()
+	if not self.map then return end
+	self.map:free()
+	self.map = nil
+	self.hdr = nil
+	self.shard = nil
+end
+
+function cache:unlink()
+	if self.name then
+		unlink_mapfile(self.name)
+	end
+end
@@ -50,11 +50,15 @@ SOCKETS
 	tcp:[try_]recvall_read() -> read                make a buffered read function
 	udp:[try_]sendto(host, port, s|buf, [len], [aflags]) -> len    send a datagram to an address
 	udp:[try_]recvnext(buf, maxlen, [flags]) -> len, sa        receive the next datagram
+	udp_batch([size], [bufsize]) -> b                           make a batch of datagrams
+	udp:[try_]recvmmsg(b, [maxn], [flags]) -> n                 receive datagrams in batch
+	udp:[try_]sendmmsg(b, [n], [flags]) -> n                    send datagrams in batch
 	tcp:[try_]shutdown(['r'|'w'|'rw'])         send FIN
 	s:debug([protocol])                        enable debugging
 
 THREADS
 	thread(func[, fmt, ...]) -> co         create a coroutine for async I/O
+	pooled_thread(func[, fmt, ...]) -> co  create a thread that is recycled when finished
 	resume(thread, ...)                    resume thread
 	yield(...) -> ...                      safe yield (see [coro])
 	suspend() -> ...                       suspend thread
@@ -73,6 +77,12 @@ SCHEDULER
 	stop()                                 stop polling
 	run(f, ...) -> ...                     run a function inside a thread
 
+EVENT LOOP STATS
+	loop_stats_start([log_interval])       start recording event loop stats
+	loop_stats_stop()                      stop recording and discard stats
+	loop_stats([reset]) -> t               get (and reset) recorded stats
+	loop_stats_buckets <- {s1, ...}        histogram bucket upper bounds
+
 TIMERS
 	wait_job() -> sj            make an interruptible async wait job
 	  sj:wait_until(t) -> ...   wait until clock()
@@ -95,6 +105,15 @@ THREAD SETS
 	  ts:thread(f, [fmt, ...]) -> co
 	  ts:join() -> {{ok=,ret=,thread=},...}
 
+CHANNELS
+	chan([size]) -> c                      make a channel that buffers `size` messages (0)
+	  c:send(v, [expires]) -> true | nil,err  send a message, waiting if the buffer is full
+	  c:recv([expires]) -> v | nil,err     receive a message, waiting if there isn't one
+	  c:close()                            close channel, waking up all waiting threads
+	  c:closed() -> t|f                    check if the channel is closed
+	  c:count() -> n                       number of buffered messages
+	chan_select(c1, ..., [expires]) -> c, v | c, nil,'closed' | nil,'timeout'
+
 MULTI-THREADING (WITH OS THREADS)
 	iocp([iocp_h]) -> iocp_h    get/set IOCP handle (Windows)
 	epoll_fd([epfd]) -> epfd    get/set epoll fd (Linux)
@@ -243,6 +262,33 @@ udp:[try_]recvnext(buf, maxlen, [flags]) -> len, sa
 	Receive the next incoming datagram, wherever it came from, along with the
 	source address. If the socket is connected, packets are still filtered though.
 
+udp_batch([size], [bufsize]) -> b
+
+	Make a batch of `size` (32) datagram slots of `bufsize` (2048) bytes each,
+	for sending and receiving multiple datagrams with a single syscall.
+
+	* `b:set(i, s|buf, [len], [ai|sa])` - copy a message into slot `i`, with
+	  an optional destination address (needed if the socket is not connected).
+	* `b:buf(i) -> buf, len` - get the message at slot `i`.
+	* `b:addr(i) -> sa` - get the address at slot `i` (the source address
+	  for received messages).
+	* `b.n` - number of filled slots.
+
+udp:[try_]recvmmsg(b, [maxn], [flags]) -> n
+
+	Wait for at least one datagram and then receive as many datagrams as are
+	already queued, up to `maxn` (defaults to the batch size), into slots
+	`1..n` of batch `b`, along with their source addresses. Datagrams larger
+	than the batch's `bufsize` are truncated. Uses `recvmmsg()` on Linux and
+	receives one datagram per call on other platforms.
+
+udp:[try_]sendmmsg(b, [n], [flags]) -> n
+
+	Send the datagrams at slots `1..n` (defaults to `b.n`) of batch `b`,
+	waiting for the socket to become writable as needed. On error, returns
+	`nil, err, sent_n`. Uses `sendmmsg()` on Linux and sends one datagram per
+	syscall on other platforms.
+
 tcp:[try_]shutdown(['r'|'w'|'rw'])
 
 	Shutdown the socket for receiving, sending or both (default). Does not block.
@@ -279,6 +325,16 @@ thread(func[, fmt, ...]) -> co
 	Full-duplex I/O on a socket can be achieved by performing reads in one thread
 	and writes in another.
 
+pooled_thread(func[, fmt, ...]) -> co
+
+	Like `thread()` but when the thread finishes, its coroutine goes into
+	a pool (of up to `coro.max_pooled` coroutines, 1000 by default) to be
+	reused by a future call to `pooled_thread()`, along with its Lua stack.
+	Its threadenv and finalizers are cleared when it finishes. Use it only
+	for threads that nobody references after they finish (their status is
+	'dead' while pooled but they come back to life on reuse), eg. the threads
+	of short-lived server connections.
+
 resume(thread, ...)
 
 	Resume a thread, which means transfer control to it, but also temporarily
@@ -317,6 +373,52 @@ wait_job() -> sj
 	`sj:resume()` to resume the waiting thread. Any arguments passed to
 	`sj:resume()` will be returned by `wait()`.
 
+EVENT LOOP STATS -------------------------------------------------------------
+
+loop_stats_start([log_interval])
+
+	Start recording event loop stats, for finding out which threads are
+	blocking the loop. Until started, recording costs nothing. If `log_interval`
+	is given, the stats are also published with `logging.logvar('loop_stats')`
+	every `log_interval` seconds. They can also be requested with the
+	`get_loop_stats` logging RPC.
+
+loop_stats([reset]) -> t
+
+	Get the stats recorded since start or since the last reset:
+
+	* `iterations`, `duration`, `wait_count` - poll loop iterations, seconds
+	  since recording started and number of threads waiting for I/O.
+	* `busy_time`, `max_lag`, `lag_hist` - time spent running threads in all
+	  poll iterations, in the longest iteration, and a histogram of that time
+	  per iteration, with buckets `loop_stats_buckets`.
+	* `wakeups`, `max_wakeups` - number of threads resumed by the loop, total
+	  and max. per iteration.
+	* `timers`, `timer_slip`, `max_timer_slip`, `slip_hist` - number of expired
+	  waits and timeouts and how late they fired, total, max. and histogram.
+	* `threads` - `{name -> {time=, max_time=, wakeups=}}` run time of threads
+	  resumed by the loop, grouped by the format string given to `thread()`.
+	  Time spent in threads that a thread resumes is added to that thread.
+
+CHANNELS ---------------------------------------------------------------------
+
+chan([size]) -> c
+
+	Make a channel for passing messages between threads. Up to `size` messages
+	are buffered: sending to a full channel waits until a message is received
+	and receiving from an empty channel waits until a message is sent.
+	Unbuffered channels (size 0) make the sender wait for a receiver.
+
+	Messages are single non-nil values. Waiting threads are woken up in FIFO
+	order. The `expires` arg is a clock() value: when reached, `nil, 'timeout'`
+	is returned (pass `0` to never wait). Closing a channel makes waiting and
+	future senders get `nil, 'closed'` and receivers get `nil, 'closed'` after
+	the buffered messages are consumed.
+
+chan_select(c1, ..., [expires]) -> c, v | c, nil,'closed' | nil,'timeout'
+
+	Receive a message from whichever channel has one first.
+
 MULTI-THREADING --------------------------------------------------------------
 
 iocp([iocp_handle]) -> iocp_handle
@@ -349,18 +451,32 @@ if not ... then require'sock_test'; return end
 require'glue'
 require'heap'
 local coro = require'coro'
-coro.live  = live
 coro.pcall = pcall
 
+local thread_names = setmetatable({}, {__mode = 'k'}) --{thread -> fmt}
+function coro.live(thread, fmt, ...)
+	thread_names[thread] = fmt
+	return live(thread, fmt, ...)
+end
+
 local
 	assert, isstr, clock, max, abs, min, bor, band, cast, u8p, fill, str, errno =
 	assert, isstr, clock, max, abs, min, bor, band, cast, u8p, fill, str, errno
 
 local coro_create   = coro.create
+local coro_create_pooled = coro.create_pooled
 local coro_safewrap = coro.safewrap
 local coro_transfer = coro.transfer
 local coro_finish   = coro.finish
 
+--the poll loop resumes threads through these so that loop_stats_start()
+--can replace them with instrumented versions.
+local wake_thread = coro_transfer
+local function expire_thread(late, thread, ...) --late: seconds past deadline
+	return coro_transfer(thread, ...)
+end
+local poll_done = noop
+
 do
 	local debug_getinfo = debug.getinfo
 	local string_format = string.format
@@ -373,6 +489,7 @@ do
 	end
 
 	local coro_create0   = coro_create
+	local coro_create_pooled0 = coro_create_pooled
 	local coro_safewrap0 = coro_safewrap
 	local counts --{line->count}
 	local threads --{line->{thread->true}}
@@ -395,6 +512,12 @@ do
 			trace_coro_at(line, th)
 			return th
 		end
+		function coro_create_pooled(...)
+			local line = trace_line(3, counts)
+			local th = coro_create_pooled0(...)
+			trace_coro_at(line, th)
+			return th
+		end
 		function coro_safewrap(...)
 			local line = trace_line(3, counts)
 			local f, th = coro_safewrap0(...)
@@ -626,6 +749,18 @@ do
 	end
 
 	function try_getaddrinfo(host, port, socket_type, family, protocol, flags)
+		if isctype(addrinfo_ct, host) then
+			return host, true --pass-through and return "not owned" flag
+		elseif isctype(sockaddr_ct, host) then --eg. the source of recvnext()
+			local ai = addrinfo_ct(1)
+			local sa = ai.addrs[0]
+			copy(sa, host, sizeof(sa))
+			ai.socktype_num = socket_types[socket_type] or socket_type or 0
+			ai.family_num = sa.family_num
+			ai.addrlen = sizeof(sa)
+			ai.addr = sa
+			return ai, true
+		end
 		if host == '*' then host = '0.0.0.0' end --all.
 		if host:starts'unix:' then
 			local ai = addrinfo_ct(1)
@@ -639,8 +774,6 @@ do
 			ai.addrlen = sizeof(hints)
 			ai.addr = sa
 			return ai, true --second retval is to prevent calling free() on it
-		elseif isctype(addrinfo_ct, host) then
-			return host, true --pass-through and return "not owned" flag
 		elseif istab(host) then
 			local t = host
 			host, port, family, socket_type, protocol, flags =
@@ -1229,7 +1362,8 @@ do
 					if not job then
 						break
 					end
-					if job.expires - t <= .05 then --arbitrary threshold.
+					local expires = job.expires
+					if expires - t <= .05 then --arbitrary threshold.
 						expires_heap:pop()
 						job.expires = nil
 						if job.socket then
@@ -1241,13 +1375,13 @@ do
 								if err == ERROR_NOT_FOUND then --too late, already gone
 									--TODO: https://learn.microsoft.com/en-us/answers/questions/116109/
 									free_overlapped(o)
-									coro_transfer(job.thread, nil, 'timeout')
+									wake_thread(job.thread, nil, 'timeout')
 								else
 									assert(check(ok, err))
 								end
 							end
 						else --wait()
-							coro_transfer(job.thread)
+							expire_thread(t - expires, job.thread)
 						end
 					else
 						--jobs are popped in expire-order so no point looking beyond this.
@@ -1267,16 +1401,16 @@ do
 				if job.expires then
 					assert(expires_heap:remove(job))
 				end
-				coro_transfer(job.thread, job:done(n))
+				wake_thread(job.thread, job:done(n))
 			else
 				local err = WSAGetLastError()
 				if err == ERROR_OPERATION_ABORTED then --canceled
-					coro_transfer(job.thread, nil, job.socket.s and 'timeout' or 'closed')
+					wake_thread(job.thread, nil, job.socket.s and 'timeout' or 'closed')
 				else
 					if job.expires then
 						assert(expires_heap:remove(job))
 					end
-					coro_transfer(job.thread, check(nil, err))
+					wake_thread(job.thread, check(nil, err))
 				end
 			end
 			return true
@@ -1777,6 +1911,103 @@ do
 	end
 end
 
+if Linux then --batched UDP I/O
+
+cdef[[
+struct iovec {
+	void  *iov_base;
+	size_t iov_len;
+};
+struct msghdr {
+	void         *msg_name;
+	int           msg_namelen;
+	struct iovec *msg_iov;
+	size_t        msg_iovlen;
+	void         *msg_control;
+	size_t        msg_controllen;
+	int           msg_flags;
+};
+struct mmsghdr {
+	struct msghdr msg_hdr;
+	unsigned int  msg_len;
+};
+int recvmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags, void *timeout);
+int sendmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+]]
+
+local sa_len = sizeof(sockaddr_ct)
+
+local function batch_hdrs(b) --headers are made on first use and reused.
+	if b.hdrs then return b.hdrs end
+	local hdrs = new('struct mmsghdr[?]', b.size)
+	local iovs = new('struct iovec[?]', b.size)
+	for i = 0, b.size-1 do
+		iovs[i].iov_base = b.data + i * b.bufsize
+		hdrs[i].msg_hdr.msg_iov = iovs + i
+		hdrs[i].msg_hdr.msg_iovlen = 1
+	end
+	b.hdrs = hdrs
+	b.iovs = iovs
+	return hdrs
+end
+
+local udp_recvmmsg = make_async(false, false, function(self, hdrs, n, flags)
+	return C.recvmmsg(self.s, hdrs, n, flags or 0, nil)
+end, EWOULDBLOCK)
+
+function udp:try_recvmmsg(b, n, flags)
+	n = min(n or b.size, b.size)
+	assert(n > 0)
+	local hdrs, iovs = batch_hdrs(b), b.iovs
+	for i = 0, n-1 do
+		local h = hdrs[i].msg_hdr
+		h.msg_name = b.addrs + i
+		h.msg_namelen = sa_len
+		iovs[i].iov_len = b.bufsize
+	end
+	local n, err = udp_recvmmsg(self, hdrs, n, flags)
+	if not n then return nil, err end
+	local r = 0
+	for i = 0, n-1 do
+		local len = hdrs[i].msg_len
+		b.lens[i] = len
+		b.addrlens[i] = hdrs[i].msg_hdr.msg_namelen
+		r = r + len
+	end
+	self.r = self.r + r
+	b.n = n
+	return n
+end
+
+local udp_sendmmsg = make_async(true, false, function(self, hdrs, n, flags)
+	return C.sendmmsg(self.s, hdrs, n, flags or 0)
+end, EWOULDBLOCK)
+
+function udp:try_sendmmsg(b, n, flags)
+	n = n or b.n
+	assert(n <= b.size)
+	local hdrs, iovs = batch_hdrs(b), b.iovs
+	local w = 0
+	for i = 0, n-1 do
+		local h = hdrs[i].msg_hdr
+		local sa_len = b.addrlens[i]
+		h.msg_name = sa_len > 0 and b.addrs + i or nil
+		h.msg_namelen = sa_len
+		iovs[i].iov_len = b.lens[i]
+		w = w + b.lens[i]
+	end
+	local sent = 0
+	while sent < n do --sendmmsg() can stop short when the send buffer fills.
+		local ret, err = udp_sendmmsg(self, hdrs + sent, n - sent, flags)
+		if not ret then return nil, err, sent end
+		sent = sent + ret
+	end
+	self.w = self.w + w
+	return n
+end
+
+end --if Linux
+
 --making normal files async.
 
 _file_async_write = make_async(true, true, function(self, buf, len)
@@ -1895,9 +2126,9 @@ do
 		end
 		if has_err then
 			local err = socket:try_getopt'error' --NOTE: this clears the error!
-			coro_transfer(thread, nil, err or 'socket error')
+			wake_thread(thread, nil, err or 'socket error')
 		else
-			coro_transfer(thread, true)
+			wake_thread(thread, true)
 		end
 	end
 
@@ -1907,12 +2138,13 @@ do
 			if not socket then
 				break
 			end
-			if socket[EXPIRES] - t <= .05 then --arbitrary threshold.
+			local expires = socket[EXPIRES]
+			if expires - t <= .05 then --arbitrary threshold.
 				assert(heap:pop())
 				socket[EXPIRES] = nil
 				local thread = socket[THREAD]
 				socket[THREAD] = nil
-				coro_transfer(thread, nil, 'timeout')
+				expire_thread(t - expires, thread, nil, 'timeout')
 			else
 				--socket are popped in expire-order so no point looking beyond this.
 				break
@@ -2470,6 +2702,87 @@ function tcp:recvall_read()
 	return buffer_reader(self:recvall())
 end
 
+--batched UDP I/O ------------------------------------------------------------
+
+do
+local batch = {}
+
+function udp_batch(size, bufsize)
+	size = size or 32
+	bufsize = bufsize or 2048
+	return object(batch, {
+		size = size, bufsize = bufsize, n = 0,
+		data     = u8a(size * bufsize),
+		lens     = new('int[?]', size),
+		addrs    = new('sockaddr[?]', size),
+		addrlens = new('int[?]', size),
+		dests    = {}, --{i -> ai|sa} for the portable sendmmsg().
+	})
+end
+
+function batch:buf(i)
+	assert(i >= 1 and i <= self.size)
+	return self.data + (i-1) * self.bufsize, self.lens[i-1]
+end
+
+function batch:addr(i)
+	assert(i >= 1 and i <= self.size)
+	return self.addrlens[i-1] > 0 and self.addrs + (i-1) or nil
+end
+
+local ai_ct = ctype'struct addrinfo'
+local sa_len = sizeof(sockaddr_ct)
+
+function batch:set(i, buf, len, dest)
+	assert(i >= 1 and i <= self.size)
+	len = len or #buf
+	assert(len <= self.bufsize, 'message too long')
+	copy(self.data + (i-1) * self.bufsize, buf, len)
+	self.lens[i-1] = len
+	if isctype(ai_ct, dest) then --addrinfo
+		copy(self.addrs + (i-1), dest.addr, dest.addrlen)
+		self.addrlens[i-1] = dest.addrlen
+	elseif dest then --sockaddr
+		copy(self.addrs + (i-1), dest, sa_len)
+		self.addrlens[i-1] = sa_len
+	else --connected socket
+		self.addrlens[i-1] = 0
+	end
+	self.dests[i] = dest or nil
+	self.n = max(self.n, i)
+end
+
+--portable versions: one datagram per syscall.
+if not udp.try_recvmmsg then
+	function udp:try_recvmmsg(b, n, flags)
+		local p = b:buf(1)
+		local len, sa = self:try_recvnext(p, b.bufsize, flags)
+		if not len then return nil, sa end
+		b.lens[0] = len
+		copy(b.addrs, sa, sa_len)
+		b.addrlens[0] = sa_len
+		b.n = 1
+		return 1
+	end
+	function udp:try_sendmmsg(b, n, flags)
+		n = n or b.n
+		for i = 1, n do
+			local p, len = b:buf(i)
+			local dest = b.dests[i]
+			local ok, err
+			if dest then
+				ok, err = self:try_sendto(dest, nil, p, len, flags)
+			else
+				ok, err = self:try_send(p, len, flags)
+			end
+			if not ok then return nil, err, i-1 end
+		end
+		return n
+	end
+end
+
+end
+
 --sleeping & timers ----------------------------------------------------------
 
 function wait_until(expires)
@@ -2599,6 +2912,8 @@ udp.connect    = unprotect_io(udp.try_connect)
 udp.recvnext   = unprotect_io(udp.try_recvnext)
 udp.send       = unprotect_io(udp.try_send)
 udp.sendto     = unprotect_io(udp.try_sendto)
+udp.recvmmsg   = unprotect_io(udp.try_recvmmsg)
+udp.sendmmsg   = unprotect_io(udp.try_sendmmsg)
 
 function tcp:accept()
 	local s, err, retry = self:try_accept()
@@ -2719,6 +3034,7 @@ function poll(ignore_interrupts)
 		return nil, 'empty'
 	end
 	local ok, err = _poll()
+	poll_done()
 	if ok then return true end
 	if err == 'interrupted' then
 		log('note', 'sock', 'poll', 'interrupted: %s.',
@@ -2730,6 +3046,120 @@ function poll(ignore_interrupts)
 	return false, err
 end
 
+--event loop stats -----------------------------------------------------------
+
+--upper bounds of histogram buckets, in seconds.
+loop_stats_buckets = {.001, .005, .01, .05, .1, .5, 1, 1/0}
+
+local stats, stats_job
+local iter_busy, iter_wakeups = 0, 0
+
+local function hist_add(hist, v)
+	local buckets = loop_stats_buckets
+	for i = 1, #buckets do
+		if v <= buckets[i] then
+			hist[i] = hist[i] + 1
+			return
+		end
+	end
+end
+
+local function zeros(n)
+	local t = {}
+	for i = 1, n do t[i] = 0 end
+	return t
+end
+
+local function new_stats()
+	local n = #loop_stats_buckets
+	return {
+		started = clock(),
+		iterations = 0, busy_time = 0, max_lag = 0, lag_hist = zeros(n),
+		wakeups = 0, max_wakeups = 0,
+		timers = 0, timer_slip = 0, max_timer_slip = 0, slip_hist = zeros(n),
+		threads = {}, --{name -> {time=, max_time=, wakeups=}}
+	}
+end
+
+local function timed_wake(thread, ...)
+	local name = thread_names[thread] or '?' --gone after the thread finishes.
+	local threads = stats.threads --stats can be reset by the thread.
+	local t0 = clock()
+	coro_transfer(thread, ...)
+	local dt = clock() - t0
+	iter_busy = iter_busy + dt
+	iter_wakeups = iter_wakeups + 1
+	local t = threads[name]
+	if not t then
+		t = {time = 0, max_time = 0, wakeups = 0}
+		threads[name] = t
+	end
+	t.time = t.time + dt
+	t.max_time = max(t.max_time, dt)
+	t.wakeups = t.wakeups + 1
+end
+
+local function timed_expire(late, thread, ...)
+	late = max(0, late)
+	stats.timers = stats.timers + 1
+	stats.timer_slip = stats.timer_slip + late
+	stats.max_timer_slip = max(stats.max_timer_slip, late)
+	hist_add(stats.slip_hist, late)
+	timed_wake(thread, ...)
+end
+
+local function timed_poll_done()
+	stats.iterations = stats.iterations + 1
+	stats.busy_time = stats.busy_time + iter_busy
+	stats.max_lag = max(stats.max_lag, iter_busy)
+	hist_add(stats.lag_hist, iter_busy)
+	stats.wakeups = stats.wakeups + iter_wakeups
+	stats.max_wakeups = max(stats.max_wakeups, iter_wakeups)
+	iter_busy, iter_wakeups = 0, 0
+end
+
+local wake_thread0, expire_thread0, poll_done0 = wake_thread, expire_thread, poll_done
+
+function loop_stats_start(log_interval)
+	if not stats then
+		stats = new_stats()
+		wake_thread, expire_thread, poll_done = timed_wake, timed_expire, timed_poll_done
+	end
+	if log_interval and not stats_job then
+		stats_job = runevery(log_interval, function()
+			logging.logvar('loop_stats', loop_stats())
+		end, 'loop-stats')
+	end
+end
+
+function loop_stats_stop()
+	if stats_job then
+		stats_job:cancel()
+		stats_job = nil
+	end
+	stats = nil
+	wake_thread, expire_thread, poll_done = wake_thread0, expire_thread0, poll_done0
+	iter_busy, iter_wakeups = 0, 0
+end
+
+function loop_stats(reset)
+	local t = stats and update({}, stats) or {}
+	t.enabled = stats ~= nil
+	t.wait_count = wait_count
+	t.buckets = loop_stats_buckets
+	if stats then
+		t.duration = clock() - stats.started
+		if reset then
+			stats = new_stats()
+		end
+	end
+	return t
+end
+
+function logging.rpc:get_loop_stats(reset)
+	self.logvar('loop_stats', loop_stats(reset))
+end
+
 local threadfinish = setmetatable({}, weak_keys)
 function onthreadfinish(thread, f)
 	after(threadfinish, thread, f)
@@ -2774,6 +3204,10 @@ local function thread_onfinish(thread, ok, ...)
 	if not ok then
 		log('ERROR', 'sock', 'thread', '%s', ...)
 	end
+	--the coroutine might be reused by pooled_thread() so clear all its state.
+	threadfinish[thread] = nil
+	threadenvs[thread] = nil
+	ownthreadenvs[thread] = nil
 	return true, coro_finish(poll_thread)
 end
 function thread(f, ...)
@@ -2782,6 +3216,13 @@ function thread(f, ...)
 	return thread
 end
 
+coro.max_pooled = 1000
+function pooled_thread(f, ...)
+	local thread = coro_create_pooled(f, thread_onfinish, ...)
+	threadenvs[thread] = threadenvs[currentthread()] --inherit threadenv.
+	return thread
+end
+
 local function cowrap_onfinish(thread, ok, ...)
 	local finish = threadfinish[thread]
 	if finish then
@@ -2933,33 +3374,187 @@ function run(f, ...)
 	end
 end
 
-function chan() --golang-like unbuffered channels (untested)
-	local c = {}
-	local get_thread
-	local put_thread
-	local function reset(...)
-		get_thread = nil
-		return ...
+--channels -------------------------------------------------------------------
+
+--Threads waiting on a channel wait on a per-thread wait job (so they can
+--time out) which sits in the channel's recvq or sendq. Senders waiting for
+--room keep their message in their wait job. Messages are passed by resuming
+--the waiting thread with them, so the only allocations are the channel
+--itself and one wait job per thread that ever had to wait on a channel.
+
+local chan_class = {type = 'chan', debug_prefix = 'C'}
+
+local chan_jobs = setmetatable({}, weak_keys) --{thread -> wait_job}
+local function chan_job()
+	local thread = currentthread()
+	local job = chan_jobs[thread]
+	if not job then
+		job = wait_job()
+		chan_jobs[thread] = job
 	end
-	function c:get()
-		assert(not get_thread)
-		get_thread = currentthread()
-		if put_thread then
-			return reset(transfer(put_thread))
+	return job
+end
+
+function chan(size)
+	size = size or 0
+	assert(size >= 0 and floor(size) == size, 'invalid channel size')
+	return object(chan_class, {
+		size = size,
+		n = 0, --number of buffered messages
+		head = 0, --buffered messages are at buf[head+1..head+n] (mod size)
+		buf = {},
+		recvq = {}, --{wait_job1, ...}
+		sendq = {}, --{wait_job1, ...}
+	})
+end
+
+local function buf_push(c, v)
+	c.buf[(c.head + c.n) % c.size + 1] = v
+	c.n = c.n + 1
+end
+
+local function buf_shift(c)
+	local i = c.head + 1
+	local v = c.buf[i]
+	c.buf[i] = nil
+	c.head = i % c.size
+	c.n = c.n - 1
+	return v
+end
+
+function chan_class:count()
+	return self.n
+end
+
+function chan_class:closed()
+	return self.closed_ or false
+end
+
+function chan_class:send(v, expires)
+	assert(v ~= nil, 'cannot send nil')
+	if self.closed_ then
+		return nil, 'closed'
+	end
+	local rjob = remove(self.recvq, 1) --receiver waiting, so buffer is empty.
+	if rjob then
+		rjob:resume(self, v)
+		return true
+	end
+	if self.n < self.size then
+		buf_push(self, v)
+		return true
+	end
+	if expires and expires <= clock() then
+		return nil, 'timeout'
+	end
+	local job = chan_job()
+	job.chan_msg = v
+	add(self.sendq, job)
+	local ok, err = job:wait_until(expires or 1/0)
+	if not ok then --timed out or closed.
+		remove_value(self.sendq, job)
+		job.chan_msg = nil
+		return nil, err
+	end
+	return true
+end
+
+--take a message from the buffer or from a waiting sender, if any.
+local function try_recv(c)
+	local sjob = remove(c.sendq, 1)
+	local v
+	if c.n > 0 then
+		v = buf_shift(c)
+		if sjob then --sender waiting for room.
+			buf_push(c, sjob.chan_msg)
 		end
-		return reset(suspend()) --wait for :put() to resume() us
-	end
-	function c:put(...)
-		assert(not put_thread)
-		if not get_thread then
-			put_thread = currentthread()
-			suspend() --wait for :get() to transfer() to us
-			put_thread = nil
-			assert(get_thread)
+	elseif sjob then --unbuffered channel: take the message from the sender.
+		v = sjob.chan_msg
+	else
+		return nil
+	end
+	if sjob then
+		sjob.chan_msg = nil
+		sjob:resume(true)
+	end
+	return v
+end
+
+function chan_class:recv(expires)
+	local v = try_recv(self)
+	if v ~= nil then
+		return v
+	end
+	if self.closed_ then
+		return nil, 'closed'
+	end
+	if expires and expires <= clock() then
+		return nil, 'timeout'
+	end
+	local job = chan_job()
+	add(self.recvq, job)
+	local c, v, err = job:wait_until(expires or 1/0)
+	if c == nil then --timed out ('timeout' is in v).
+		remove_value(self.recvq, job)
+		return nil, v
+	end
+	return v, err
+end
+
+--wake up all waiting threads. buffered messages can still be received.
+function chan_class:close()
+	if self.closed_ then return end
+	self.closed_ = true
+	local recvq, sendq = self.recvq, self.sendq
+	while #recvq > 0 do
+		remove(recvq, 1):resume(self, nil, 'closed')
+	end
+	while #sendq > 0 do
+		local job = remove(sendq, 1)
+		job.chan_msg = nil
+		job:resume(nil, 'closed')
+	end
+end
+
+chan_class.get = chan_class.recv
+chan_class.put = chan_class.send
+
+local random = math.random
+function chan_select(...)
+	local n = select('#', ...)
+	local expires = select(n, ...)
+	if expires == nil or isnum(expires) then
+		n = n - 1
+	else
+		expires = nil
+	end
+	--poll the channels starting at a random one so that a busy channel
+	--can't starve the others.
+	local i0 = n > 1 and random(n) - 1 or 0
+	for i = 0, n-1 do
+		local c = select((i0 + i) % n + 1, ...)
+		local v = try_recv(c)
+		if v ~= nil then
+			return c, v
+		elseif c.closed_ then
+			return c, nil, 'closed'
 		end
-		resume(get_thread, ...)
 	end
-	return c
+	if expires and expires <= clock() then
+		return nil, 'timeout'
+	end
+	local job = chan_job()
+	for i = 1, n do
+		add((select(i, ...)).recvq, job)
+	end
+	local c, v, err = job:wait_until(expires or 1/0)
+	for i = 1, n do
+		remove_value((select(i, ...)).recvq, job)
+	end
+	if c == nil then --timed out ('timeout' is in v).
+		return nil, v
+	end
+	return c, v, err
 end
 
 --init stdin/out/err as async pipes ------------------------------------------
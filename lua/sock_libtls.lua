@@ -17,6 +17,8 @@ API
 	cstcp:[try_]recvall()                 same semantics as `tcp:recvall()`
 	cstcp:[try_]recvall_read()            same semantics as `tcp:recvall_read()`
 	cstcp:[try_]shutdown('r'|'w'|'rw')    calls `self.tcp:shutdown()`
+	cstcp:alpn_selected() -> s|nil        ALPN protocol (after the first recv)
+	cstcp:setexpires(['r'|'w'], clock|nil)  same semantics as `tcp:setexpires()`
 	cstcp:[try_]close()                   close client socket
 	sstcp:[try_]close()                   close server socket
 
@@ -259,6 +261,18 @@ function server_stcp:try_accept()
 	return wrap_stcp(client_stcp, ctcp, ctls, buf_slot)
 end
 
+function client_stcp:alpn_selected()
+	return self.tls:alpn_selected()
+end
+
+--timeouts are enforced by the underlying tcp socket.
+function stcp:setexpires(rw, expires)
+	self.tcp:setexpires(rw, expires)
+end
+function stcp:settimeout(s, rw)
+	self.tcp:settimeout(s, rw)
+end
+
 function stcp:try_shutdown(mode)
 	return self.tcp:try_shutdown(mode)
 end
@@ -106,8 +106,12 @@ MDL COMMANDS
 	cmd:insert_row(tbl, vals, [col_map])         insert a row
 	cmd:insert_or_update_row(tbl, vals, [col_map], [compact], [opt]) insert or update row
 	cmd:insert_rows(tbl, rows, [col_map], [opt]) insert rows with one query
+	cmd:update_rows(tbl, rows, col_map, [opt])   update rows with one query
+	cmd:delete_rows(tbl, rows, col_map, [opt])   delete rows with one query
+	cmd:insert_id_step() -> step|nil             id step between rows of insert_rows()
 	cmd:update_row(tbl, vals, col_map, [scurity_filter], [opt]) update row
 	cmd:delete_row(tbl, vals, col_map, [scurity_filter], [opt]) delete row
+	cmd:copy_table(tbl, dst_cmd, [opt]) -> n      copy a table's rows to another connection
 
 MODULE SYSTEM
 	function sqlpp_package.NAME(spp) end         extend the preprocessor with a module
@@ -210,6 +214,19 @@ The schema can be defined manually or it can be taken from the server.
 ```lua
 cmd.schemas[cmd.db] = cmd:extract_schema()
 ```
+
+### Copying tables
+
+`cmd:copy_table(tbl, dst_cmd, [opt]) -> n` copies all rows of `tbl` into the
+same table on `dst_cmd`, which can be of a different engine. The source is
+read in pages of `opt.page_size` rows (`cmd.copy_page_size`) in pk order,
+each page starting after the last pk of the previous page (`opt.pk` can be
+given as a list or string; `false` forces limit/offset paging, in which case
+rows are ordered by all columns to keep the pages stable). Rows are sent
+in multi-row inserts no larger than `dst_cmd:max_query_size()` to
+`opt.writers` (1) writer connections, which are opened with `opt.connect()`
+or with the options of the `dst_cmd` connection. `opt.progress(n)` is called
+after each insert.
 ]=]
 
 if not ... then require'sqlpp_mysql_test'; return end
@@ -1042,6 +1059,12 @@ function _G.sqlpp(init)
 			end
 		end
 		local dt = {}
+		if opt.pad == false then --compact, for machines.
+			for ri,srow in ipairs(srows) do
+				dt[ri] = '('..cat(srow, ',')..')'
+			end
+			return cat(dt, ',')
+		end
 		local prefix = (opt and opt.indent or '')..'('
 		for ri,srow in ipairs(srows) do
 			local t = {}
@@ -1208,6 +1231,7 @@ function _G.sqlpp(init)
 	function spp.connect(opt)
 		local self = object(nil, nil, cmd)
 		self.rawconn = self:assert(self:rawconnect(opt))
+		self.connect_options = opt --for opening more connections.
 		set_schema(self, opt.schema)
 		return self
 	end
@@ -1412,10 +1436,26 @@ function _G.sqlpp(init)
 		return pass(self:assert(self:rawprepare(sql, opt)))
 	end
 
+	--when already in a transaction, a savepoint is used instead so that
+	--only the changes made by `f` are rolled back on error.
 	function cmd:atomic(f, onerror, ...)
-		self:start_transaction()
+		local savepoint
+		if self:in_transaction() then
+			self.atomic_depth = (self.atomic_depth or 0) + 1
+			savepoint = 'atomic'..self.atomic_depth
+			self:query({parse = false}, 'savepoint '..savepoint)
+		else
+			self:start_transaction()
+		end
 		local function pass(ok, ...)
-			self:end_transaction(ok and 'commit' or 'rollback')
+			if savepoint then
+				self.atomic_depth = self.atomic_depth - 1
+				self:query({parse = false}, ok
+					and 'release savepoint '..savepoint
+					 or 'rollback to savepoint '..savepoint)
+			else
+				self:end_transaction(ok and 'commit' or 'rollback')
+			end
 			if not ok and onerror then
 				onerror()
 			end
@@ -1766,8 +1806,7 @@ function _G.sqlpp(init)
 	end
 
 	--NOTE: The returned insert_id is that of the first inserted row.
-	--You do the math for the other rows, they should be consecutive even
-	--while other inserts are happening at the same time but I'm not sure.
+	--Use insert_id_step() to do the math for the other rows.
 	function cmd:insert_rows(tbl, rows, col_map, compact, opt)
 		assertf(type(tbl) == 'string', 'table name expected, got %s', type(tbl))
 		local col_map = col_map_arg(assert(col_map))
@@ -1779,44 +1818,325 @@ function _G.sqlpp(init)
 			col_map = col_map,
 			fields = tdef.fields,
 			compact = compact,
-			indent = '\t',
+			pad = false,
 		})
 		local t = {}
 		for i,s in ipairs(keys(col_map, true)) do
 			t[i] = self:sqlname(s)
 		end
 		local cols_sql = cat(t, ', ')
+		local sql = fmt('insert into %s (%s) values %s',
+			self:sqlname(tbl), cols_sql, rows_sql)
+		return self:query(update({parse = false}, opt), sql)
+	end
+
+	--the step between the ids of rows inserted with one insert_rows() call
+	--or nil if they are not guaranteed to be consecutive. Engines override this.
+	function cmd:insert_id_step() end
+
+	--where clause matching multiple rows by their pk.
+	local function where_rows_sql(self, rows, col_map, pk, fields)
+		local t = {}
+		if #pk == 1 then --`pk in (...)` can be served with an index range.
+			for i, vals in ipairs(rows) do
+				local col = pk[1]
+				local v = vals[1]
+				if v == nil then
+					local val_name = col..':old'
+					v = vals[col_map[val_name] or val_name]
+				end
+				t[i] = self:sqlval(v, fields[col])
+			end
+			return self:sqlname(pk[1])..' in ('..cat(t, ', ')..')'
+		end
+		for i, vals in ipairs(rows) do
+			t[i] = '('..where_sql(self, vals, col_map, pk, fields)..')'
+		end
+		return cat(t, ' or ')
+	end
+
+	--update multiple rows with one query: each changed column is set with
+	--a `case` on the rows' pk. Rows that change their pk are updated one by
+	--one because pk columns can't be both set and matched in the same query.
+	function cmd:update_rows(tbl, rows, col_map, opt)
+		assertf(type(tbl) == 'string', 'table name expected, got %s', type(tbl))
+		local col_map = col_map_arg(assert(col_map))
+		local tdef = assertf(self:table_def(tbl), 'invalid table: %s', tbl)
+		local pk = tdef.pk
+		local affected_rows = 0
+		local batch = {}
+		for _, vals in ipairs(rows) do
+			local pk_changed
+			for _, col in ipairs(pk) do
+				local val_name = col_map[col]
+				if val_name and vals[val_name] ~= nil then
+					pk_changed = true
+					break
+				end
+			end
+			if pk_changed then
+				local ret = self:update_row(tbl, vals, col_map, nil, opt)
+				affected_rows = affected_rows + ret.affected_rows
+			else
+				add(batch, vals)
+			end
+		end
+		local sets = {}
+		for _, field in ipairs(tdef.fields) do
+			local val_name = col_map[field.col]
+			if val_name then
+				local t
+				for _, vals in ipairs(batch) do
+					local v = vals[val_name]
+					if v ~= nil then
+						t = t or {'case'}
+						add(t, 'when '..where_sql(self, vals, col_map, pk, tdef.fields)
+							..' then '..self:sqlval(v, field))
+					end
+				end
+				if t then
+					local col = self:sqlname(field.col)
+					add(t, 'else '..col..' end')
+					add(sets, col..' = '..cat(t, '\n\t\t'))
+				end
+			end
+		end
+		if #sets == 0 then
+			return {affected_rows = affected_rows}
+		end
 		local sql = fmt(outdent[[
-			insert into %s
-				(%s)
-			values
+			update %s set
 				%s
-		]], self:sqlname(tbl), cols_sql, rows_sql)
+			where %s
+		]], self:sqlname(tbl), cat(sets, ',\n\t'),
+			where_rows_sql(self, batch, col_map, pk, tdef.fields))
+		local ret = self:query(update({parse = false}, opt), sql)
+		ret.affected_rows = ret.affected_rows + affected_rows
+		return ret
+	end
+
+	function cmd:delete_rows(tbl, rows, col_map, opt)
+		assertf(type(tbl) == 'string', 'table name expected, got %s', type(tbl))
+		local col_map = col_map_arg(assert(col_map))
+		if #rows == 0 then
+			return {affected_rows = 0}
+		end
+		local tdef = assertf(self:table_def(tbl), 'invalid table: %s', tbl)
+		local sql = fmt('delete from %s where %s', self:sqlname(tbl),
+			where_rows_sql(self, rows, col_map, tdef.pk, tdef.fields))
 		return self:query(update({parse = false}, opt), sql)
 	end
 
-	function cmd:copy_table(tbl, dst_cmd)
+	--table copying -----------------------------------------------------------
 
-		local rows, cols = self:query({compact=1, noparse=1},
-			'select * from '..self:sqlname(tbl))
+	cmd.copy_page_size = 10000 --rows per read.
 
-		local CONVERT = spp.engine .. '_to_' .. dst_cmd.spp.engine
-		for fi,col in ipairs(cols) do
-			local f = col[CONVERT]
-			if f then
-				for ri,row in ipairs(rows) do
-					row[fi] = f(row[fi], col, row, spp)
+	function cmd:max_query_size() --engines override this.
+		return 1024^2
+	end
+
+	--bulk insert API, used by copy_table(). Engines can override these
+	--to insert rows with a faster protocol than SQL.
+
+	function cmd:bulk_row(row, n, cols) --encode a row -> brow, size
+		local t = {}
+		for i = 1, n do
+			t[i] = self:sqlval(row[i], cols[i])
+		end
+		local s = '('..cat(t, ',')..')'
+		return s, #s + 1
+	end
+
+	local function bulk_insert_sql(self, tbl, cols) --the sql before the rows.
+		local t = {}
+		for i, col in ipairs(cols) do
+			t[i] = self:sqlname(col.name or col.col)
+		end
+		return fmt('insert into %s (%s) values ', self:sqlname(tbl), cat(t, ','))
+	end
+
+	function cmd:bulk_insert(tbl, cols, brows)
+		return self:query({parse = false},
+			bulk_insert_sql(self, tbl, cols)..cat(brows, ','))
+	end
+
+	--size of a bulk insert without the rows, for staying under max_query_size.
+	function cmd:bulk_insert_size(tbl, cols)
+		return #bulk_insert_sql(self, tbl, cols)
+	end
+
+	--read a table one page at a time, in pk order. Each page starts after the
+	--pk of the last row of the previous page so that reads stay fast on large
+	--tables. Without a pk we resort to limit-offset paging ordered by all
+	--columns so that the pages are stable (identical rows are interchangeable).
+	local function page_reader(self, tbl, pk, page_size)
+		local order_sql
+		if pk then
+			local t = {}
+			for i, col in ipairs(pk) do
+				t[i] = self:sqlname(col)
+			end
+			order_sql = ' order by '..cat(t, ', ')
+		end
+		local select_sql = 'select * from '..self:sqlname(tbl)
+		local qopt = {compact = true, to_array = false, parse = false}
+		local last_vals, pk_fi, pk_cols
+		local offset = 0
+		return function()
+			if not order_sql then
+				local _, cols = self:query(qopt, select_sql..' limit 0')
+				local t = {}
+				for i = 1, #cols do
+					t[i] = i
 				end
+				order_sql = ' order by '..cat(t, ', ')
 			end
+			local where_sql = ''
+			if last_vals then --(a, b) > (x, y) as: a > x or (a = x and b > y)
+				local ors = {}
+				for i = 1, #pk do
+					local ands = {}
+					for j = 1, i do
+						ands[j] = self:sqlname(pk[j])..(j < i and ' = ' or ' > ')
+							..self:sqlval(last_vals[j], pk_cols[j])
+					end
+					ors[i] = '('..cat(ands, ' and ')..')'
+				end
+				where_sql = ' where '..cat(ors, ' or ')
+			end
+			local sql = select_sql..where_sql..order_sql..' limit '..page_size
+			if not pk and offset > 0 then
+				sql = sql..' offset '..offset
+			end
+			local rows, cols = self:query(qopt, sql)
+			offset = offset + #rows
+			if pk and #rows > 0 then
+				if not pk_fi then --find pk field indices.
+					pk_fi, pk_cols = {}, {}
+					for j, pk_col in ipairs(pk) do
+						for fi, col in ipairs(cols) do
+							if (col.name or col.col):lower() == pk_col:lower() then
+								pk_fi[j] = fi
+								pk_cols[j] = col
+							end
+						end
+						assertf(pk_fi[j], 'pk column not found: %s', pk_col)
+					end
+				end
+				--get pk values before rows are converted.
+				local row = rows[#rows]
+				last_vals = {}
+				for j, fi in ipairs(pk_fi) do
+					last_vals[j] = row[fi]
+				end
+			end
+			return rows, cols
 		end
+	end
 
-		for i,row in ipairs(rows) do
-			dst_cmd:raw_insert_row(tbl, row, #cols)
-			if i % 10000 == 0 then
-				print(i)
+	function cmd:copy_table(tbl, dst_cmd, opt)
+		opt = opt or empty
+		local page_size = opt.page_size or self.copy_page_size
+		local pk = opt.pk
+		if pk == nil then
+			local tdef = self.db and self:table_def(tbl)
+			pk = tdef and tdef.pk
+		end
+		if isstr(pk) then
+			pk = collect(words(pk))
+		end
+		local read_page = page_reader(self, tbl, pk or nil, page_size)
+
+		--writers pull batches from a channel, so the next page is read and
+		--encoded while the previous batches are being inserted.
+		local writers = {dst_cmd}
+		local ok, err = pcall(function()
+			for i = 2, opt.writers or 1 do
+				writers[i] = opt.connect and opt.connect()
+					or dst_cmd.spp.connect(assert(dst_cmd.connect_options,
+						'opt.connect required for multiple writers'))
 			end
+		end)
+		if not ok then
+			for i = 2, #writers do
+				writers[i]:close()
+			end
+			error(err, 2)
+		end
+		local batches = chan(#writers)
+		local done = chan(#writers)
+		local cols
+		local copied = 0
+		local failed
+		for i, w in ipairs(writers) do
+			resume(thread(function()
+				local ok, err = pcall(function()
+					while not failed do
+						local batch = batches:recv()
+						if not batch then break end
+						w:bulk_insert(tbl, cols, batch)
+						copied = copied + #batch
+						if opt.progress then
+							opt.progress(copied)
+						end
+					end
+				end)
+				if not ok then
+					failed = true
+					batches:close() --stop the reader.
+				end
+				done:send(ok or err)
+			end, 'copy-writer %d', i))
 		end
 
+		local max_size --set when the columns are known.
+		local CONVERT = spp.engine .. '_to_' .. dst_cmd.spp.engine
+		local batch, batch_size = {}, 0
+		local function flush()
+			if #batch == 0 then return true end
+			local ok = batches:send(batch)
+			batch, batch_size = {}, 0
+			return ok
+		end
+		local read_ok, read_err = pcall(function()
+			while not failed do
+				local rows, page_cols = read_page()
+				if #rows == 0 then break end
+				cols = page_cols
+				max_size = max_size or dst_cmd:max_query_size()
+					- dst_cmd:bulk_insert_size(tbl, cols)
+				local n = #cols
+				for _, row in ipairs(rows) do
+					for fi = 1, n do
+						local f = cols[fi][CONVERT]
+						if f then
+							row[fi] = f(row[fi], cols[fi], row, spp)
+						end
+					end
+					local brow, size = dst_cmd:bulk_row(row, n, cols)
+					if batch_size + size > max_size and not flush() then
+						return
+					end
+					batch[#batch+1] = brow
+					batch_size = batch_size + size
+				end
+				if #rows < page_size then break end
+			end
+			flush()
+		end)
+		if not read_ok then failed = true end
+		batches:close()
+
+		local err = not read_ok and read_err or nil
+		for i = 1, #writers do
+			local ret = done:recv()
+			if ret ~= true then err = err or ret end
+		end
+		for i = 2, #writers do
+			writers[i]:close()
+		end
+		if err then error(err, 2) end
+		return copied
 	end
 
 	init(spp, cmd)
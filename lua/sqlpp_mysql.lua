@@ -577,6 +577,30 @@ local function init_spp(spp, cmd)
 	spp.errno[1451] = function(self, err) return errno_fk(self, err, 'remove') end
 	spp.errno[1452] = function(self, err) return errno_fk(self, err, 'set') end
 
+	--bulk inserts ------------------------------------------------------------
+
+	--queries are sent in a single packet which has a 24bit length field.
+	function cmd:max_query_size()
+		local cn = self.rawconn
+		if not cn.max_allowed_packet then
+			cn.max_allowed_packet = self:first_row_vals'select @@max_allowed_packet'
+		end
+		return min(cn.max_allowed_packet, 2^24 - 2) --minus the command byte.
+	end
+
+	--multi-row inserts get consecutive ids only with the "consecutive"
+	--(and "traditional") auto-inc lock modes, not with "interleaved"
+	--which is the default since MySQL 8.
+	function cmd:insert_id_step()
+		local cn = self.rawconn
+		if cn.insert_id_step == nil then
+			local lock_mode, step = self:first_row_vals(
+				'select @@innodb_autoinc_lock_mode, @@auto_increment_increment')
+			cn.insert_id_step = lock_mode < 2 and step or false
+		end
+		return cn.insert_id_step or nil
+	end
+
 end
 
 return {
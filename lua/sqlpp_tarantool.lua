@@ -435,6 +435,34 @@ local function init_spp(spp, cmd)
 		return self.rawconn:replace(tbl:upper(), mp.toarray(t, col_count))
 	end
 
+	--bulk inserts: rows are sent as tuples and replaced in one transaction
+	--with a Lua call, skipping SQL. Requires the `execute` privilege.
+
+	function cmd:bulk_row(row, n)
+		local size = 1
+		for i = 1, n do
+			local v = row[i]
+			size = size + (isstr(v) and #v + 5 or 9)
+		end
+		return mp.toarray(row, n), size
+	end
+
+	local replace_rows = [[
+		local space, rows = ...
+		space = box.space[space]
+		box.begin()
+		for i = 1, #rows do
+			space:replace(rows[i])
+		end
+		box.commit()
+	]]
+	function cmd:bulk_insert(tbl, cols, rows)
+		return self.rawconn:eval(replace_rows, tbl:upper(), rows)
+	end
+	function cmd:bulk_insert_size(tbl, cols)
+		return #replace_rows + #tbl + 16 --plus msgpack and iproto headers.
+	end
+
 end
 
 return {
@@ -73,6 +73,21 @@ TASKS
 PROCESS TASK
 	exec_task(cmd_args|{cmd,arg1,...}, opt) -> ta
 
+SCHEDULED TASKS
+	set_scheduled_task(name, opt|nil)   add/update/remove a scheduled task
+		opt.action                 action to run
+		opt.run_every              run every n seconds
+		opt.start_hours            start at n seconds after midnight (and every `run_every`)
+		opt.cron                   run on a cron schedule, eg. '*/5 * * * *' or '@daily'
+		opt.group                  concurrency group (see task_group_max_running)
+		opt.active                 set to false to pause the task
+	scheduled_tasks -> {name->sched}    scheduled tasks
+	task_scheduler('start'|'stop'|'running')
+	task_scheduler_max_running <- n     max. scheduled tasks running at once (inf)
+	task_group_max_running[group] <- n  max. scheduled tasks running at once per group
+	cron_parse(s) -> cron               parse a cron expression
+	cron_next(cron|s, t) -> t           next time matching a cron expression after t
+
 ]]
 
 require'glue'
@@ -80,6 +95,7 @@ require'proc'
 require'sock'
 require'events'
 require'json'
+require'heap'
 
 --terminals ------------------------------------------------------------------
 
@@ -613,69 +629,291 @@ end
 
 scheduled_tasks = {} --{name->sched}
 
-function set_scheduled_task(name, opt)
-	if not opt then
-		scheduled_tasks[name] = nil
-	else
-		assert(opt.action)
-		assert(opt.start_hours or opt.run_every)
-		local sched = scheduled_tasks[name]
-		if not sched then
-			sched = {name = name, ctime = time(), active = true, running = false}
-			scheduled_tasks[name] = sched
+task_scheduler_max_running = 1/0 --max. scheduled tasks running at once
+task_group_max_running = {} --{group->n}: max. tasks running at once per group
+
+--cron expressions ------------------------------------------------------------
+
+local cron_fields = {
+	{'min'  , 0, 59},
+	{'hour' , 0, 23},
+	{'day'  , 1, 31},
+	{'month', 1, 12},
+	{'wday' , 0,  7}, --0 and 7 are both Sunday.
+}
+
+local cron_aliases = {
+	['@yearly' ] = '0 0 1 1 *',
+	['@monthly'] = '0 0 1 * *',
+	['@weekly' ] = '0 0 * * 0',
+	['@daily'  ] = '0 0 * * *',
+	['@hourly' ] = '0 * * * *',
+}
+
+--parse 'min hour day month wday' with `*`, `a`, `a-b`, `*/n`, `a-b/n` and
+--comma-separated lists of those in each field.
+function cron_parse(s)
+	s = cron_aliases[s] or s
+	local cron = {}
+	local i = 0
+	for field in s:gmatch'%S+' do
+		i = i + 1
+		local f = cron_fields[i]
+		assertf(f, 'invalid cron expression: %s', s)
+		local name, min, max = f[1], f[2], f[3]
+		local set = {}
+		for item in field:gmatch'[^,]+' do
+			local range, step = item:match'^([^/]+)/(%d+)$'
+			range = range or item
+			step = tonumber(step) or 1
+			local a, b
+			if range == '*' then
+				a, b = min, max
+			else
+				a, b = range:match'^(%d+)%-(%d+)$'
+				a = tonumber(a or range)
+				b = tonumber(b) or (step > 1 and max or a)
+			end
+			assertf(a and b and a >= min and b <= max and a <= b and step > 0,
+				'invalid cron field %s: %s', name, field)
+			for v = a, b, step do
+				set[v] = true
+			end
+		end
+		cron[name] = set
+		cron[name..'_any'] = field == '*'
+	end
+	assertf(i == 5, 'invalid cron expression: %s', s)
+	if cron.wday[7] then cron.wday[0] = true end
+	return cron
+end
+
+local function cron_day_matches(cron, d)
+	local dom, dow = cron.day[d.day], cron.wday[d.wday - 1]
+	if cron.day_any then return dow end
+	if cron.wday_any then return dom end
+	return dom or dow --both restricted: either matches (like Vixie cron).
+end
+
+--next time (in local time) matching a cron expression after time t.
+function cron_next(cron, t)
+	if isstr(cron) then cron = cron_parse(cron) end
+	t = floor(t / 60) * 60 + 60
+	local t_max = t + 5 * 366 * 24 * 3600
+	while t < t_max do
+		local d = os.date('*t', t)
+		if not cron.month[d.month] then
+			t = os.time{year = d.year, month = d.month + 1, day = 1, hour = 0}
+		elseif not cron_day_matches(cron, d) then
+			t = os.time{year = d.year, month = d.month, day = d.day + 1, hour = 0}
+		elseif not cron.hour[d.hour] then
+			t = os.time{year = d.year, month = d.month, day = d.day,
+				hour = d.hour + 1, min = 0}
+		elseif not cron.min[d.min] then
+			t = t + 60
+		else
+			return t
 		end
-		update(sched, opt)
 	end
+	return nil --no match in the next 5 years (eg. Feb 30).
 end
 
---we need this minimum amount of persistence for scheduled tasks to work.
-function load_tasks_data() end --stub
-function save_task_data(name, t) end --stub
+--scheduler -------------------------------------------------------------------
 
-local function run_tasks()
-	local now = time()
-	local today = day(now)
+--Scheduled tasks are kept in a heap ordered by their next run time and
+--the scheduler thread sleeps until the earliest one is due. Due tasks that
+--can't start because of concurrency limits are put in a run queue which is
+--drained in FIFO order as running tasks finish.
 
-	for name, sched in pairs(scheduled_tasks) do
+local sched_heap = heap{
+	cmp = function(s1, s2)
+		return s1.next_run < s2.next_run
+	end,
+	index_key = 'heap_index', --enable O(log n) removal.
+}
+local run_queue = {} --{sched1,...}
+local running_count = 0
+local group_running = {} --{group->n}
 
-		if sched.active then
+local sched_job, sched_waiting
 
-			local start_hours = sched.start_hours
-			local last_run    = sched.last_run
-			local run_every   = sched.run_every
-			local action      = sched.action
+local function wake_scheduler()
+	if sched_waiting then
+		sched_waiting = false
+		sched_job:resume()
+	end
+end
 
-			local min_time = not start_hours and last_run and run_every
-				and last_run + run_every or -1/0
+local function next_run_time(sched, now)
+	if sched.cron then
+		return cron_next(sched.cron_spec, now) or 1/0
+	end
+	local start_hours = sched.start_hours
+	local run_every = sched.run_every
+	local last_run = sched.last_run
+	if start_hours then
+		run_every = run_every or 24 * 3600
+		local today_at = day(now) + start_hours
+		local seconds_late = (now - today_at) % run_every --always >= 0
+		local last_sched_time = now - seconds_late
+		local already_run = last_run and last_run >= last_sched_time
+		local too_late = seconds_late > run_every / 2
+		if not (already_run or too_late) then
+			return now
+		end
+		return last_sched_time + run_every
+	end
+	return last_run and last_run + run_every or now
+end
 
-			if start_hours and run_every then
-				local today_at = today + start_hours
-				local seconds_late = (now - today_at) % run_every --always >= 0
-				local last_sched_time = now - seconds_late
-				local already_run = last_run and last_run >= last_sched_time
-				local too_late = seconds_late > run_every / 2
-				if already_run or too_late then
-					min_time = 1/0
-				end
+local function reschedule(sched)
+	sched_heap:remove(sched)
+	if not sched.active or scheduled_tasks[sched.name] ~= sched then
+		return
+	end
+	sched.next_run = next_run_time(sched, time())
+	sched_heap:push(sched)
+	wake_scheduler()
+end
+
+local function can_run(sched)
+	if running_count >= task_scheduler_max_running then
+		return false
+	end
+	local group = sched.group
+	if group then
+		local max_running = task_group_max_running[group]
+		if max_running and (group_running[group] or 0) >= max_running then
+			return false
+		end
+	end
+	return true
+end
+
+local run_queued --fw. decl.
+
+local function start_sched(sched)
+	local group = sched.group
+	running_count = running_count + 1
+	if group then
+		group_running[group] = (group_running[group] or 0) + 1
+	end
+	sched.running = true
+	local now = time()
+	sched.last_run = now
+	save_task_data(sched.name, {last_run = now})
+	reschedule(sched)
+	local ta = task(sched)
+	local finished
+	ta:on('setstatus', function(ta, _, status)
+		--NOTE: a task with restart_after gets here once per (re)start.
+		if status ~= 'finished' or finished then return end
+		finished = true
+		sched.running = false
+		running_count = running_count - 1
+		if group then
+			group_running[group] = group_running[group] - 1
+		end
+		run_queued()
+		if not sched_heap:find(sched) then --was due while running.
+			reschedule(sched)
+		end
+	end)
+	ta:start()
+end
+
+local draining, drain_again
+function run_queued()
+	if draining then --called from a task that finished right away.
+		drain_again = true
+		return
+	end
+	draining = true
+	repeat
+		drain_again = false
+		local i = 1
+		while i <= #run_queue do
+			local sched = run_queue[i]
+			if can_run(sched) then
+				remove(run_queue, i)
+				sched.queued = false
+				start_sched(sched)
+			else
+				i = i + 1
 			end
+		end
+	until not drain_again
+	draining = false
+end
 
-			if now >= min_time and not sched.running then
-				local rearm = run_every and true or false
-				sched.last_run = now
-				save_task_data(name, {last_run = now})
-				task(sched):start()
+local function due(sched)
+	if sched.running or sched.queued then
+		return --rescheduled when it finishes or starts.
+	end
+	if can_run(sched) then
+		start_sched(sched)
+	else
+		sched.queued = true
+		add(run_queue, sched)
+	end
+end
+
+local function run_scheduler()
+	while true do
+		local sched = sched_heap:peek()
+		local now = time()
+		if sched and sched.next_run <= now then
+			sched_heap:pop()
+			due(sched)
+		else
+			--sleep at most an hour to catch up with wall clock adjustments.
+			local timeout = min(sched and sched.next_run - now or 1/0, 3600)
+			sched_waiting = true
+			if sched_job:wait(timeout) == sched_job.CANCEL then
+				return
 			end
+			sched_waiting = false
+		end
+	end
+end
 
+function set_scheduled_task(name, opt)
+	local sched = scheduled_tasks[name]
+	if not opt then
+		if sched then
+			scheduled_tasks[name] = nil
+			if sched.queued then
+				remove(run_queue, indexof(sched, run_queue))
+				sched.queued = false
+			end
+			reschedule(sched)
 		end
+	else
+		assert(opt.action)
+		assert(opt.start_hours or opt.run_every or opt.cron)
+		if not sched then
+			sched = {name = name, ctime = time(), active = true, running = false}
+			scheduled_tasks[name] = sched
+		end
+		update(sched, opt)
+		sched.cron_spec = sched.cron and cron_parse(sched.cron) or nil
+		reschedule(sched)
 	end
 end
 
-local sched_job
+--we need this minimum amount of persistence for scheduled tasks to work.
+function load_tasks_data() end --stub
+function save_task_data(name, t) end --stub
+
 function task_scheduler(cmd)
 	if cmd == 'start' and not sched_job then
-		sched_job = runevery(1, run_tasks, 'tasks-sched')
+		sched_job = wait_job()
+		resume(thread(run_scheduler, 'tasks-sched'))
 	elseif cmd == 'stop' and sched_job then
-		sched_job:resume()
+		if sched_waiting then
+			sched_waiting = false
+			sched_job:cancel()
+		end
 		sched_job = nil
 	elseif cmd == 'running' then
 		return sched_job and true or false
@@ -707,6 +945,15 @@ if not ... then
 			run_every = 10,
 		})
 
+		set_scheduled_task('tick', {
+			action = function()
+				notify'Tick!'
+			end,
+			cron = '* * * * *',
+			group = 'ticks',
+		})
+		task_group_max_running.ticks = 1
+
 		task_scheduler'start'
 	end)
 
@@ -68,6 +68,7 @@ OUTPUT
 	outprint(...)                           like Lua's print but uses out()
 	outfile(file, [parse])                  output a file's contents
 	outfile_function(file) -> f()|nil       return an outfile function if the file exists
+	outzipfile_function(file) -> f()|nil    return an outfile function for a www zip entry
 
 URL ENCODING
 
@@ -82,6 +83,7 @@ RESPONSE
 	allow(ret, err) -> ret                  exit with "403 Forbidden"
 	check_etag(s)                           exit with "304 Not modified"
 	setconnectionclose()                    close the connection after this request.
+	websocket_upgrade([opt]) -> ws          upgrade the connection to a websocket
 
 FILESYSTEM
 
@@ -90,6 +92,8 @@ FILESYSTEM
 	wwwfile(file, [default]) -> s           get www file contents
 	wwwfile.filename <- s|f(filename)       set virtual www file contents
 	wwwfiles([filter]) -> {name->true}      list www files
+	wwwzips() -> {za1,...}                  www zip archives (see zip_mmap.lua)
+	wwwzipentry(file) -> za, e              find a file in the www zip archives
 	tmppath([pattern], [t]) -> path         make a tmp file path
 
 MUSTACHE TEMPLATES
@@ -180,11 +184,12 @@ end
 --per-connection memoization.
 function http_once_per_connection(f)
 	return function(...)
-		local req = req()
-		local mf = req.http[f]
+		local http = req().http
+		http = http.conn or http --HTTP/2 stream -> connection
+		local mf = http[f]
 		if not mf then
 			mf = memoize(f)
-			req.http[f] = mf
+			http[f] = mf
 		end
 		return mf(...)
 	end
@@ -405,12 +410,24 @@ function setconnectionclose()
 	req().res.close = true
 end
 
+--NOTE: the connection is closed when the action returns, so the action
+--must loop on ws:recv() for as long as the websocket is in use.
+function websocket_upgrade(opt)
+	local req = req()
+	if not req.websocket then --HTTP/2 stream.
+		http_error(400, 'websocket upgrade not possible over HTTP/2')
+	end
+	req.respond_called = true
+	return req:websocket(opt)
+end
+
 mime_types = {
 	html = 'text/html',
 	txt  = 'text/plain',
 	sh   = 'text/plain',
 	css  = 'text/css',
 	json = 'application/json',
+	msgpack = 'application/msgpack',
 	js   = 'application/javascript',
 	jpg  = 'image/jpeg',
 	jpeg = 'image/jpeg',
@@ -595,6 +612,43 @@ function outfile(...)
 	assert(outfile_function(...))()
 end
 
+local function accepts_gzip()
+	local t = headers'accept-encoding'
+	local gz = t and t.gzip
+	return gz ~= nil and not (istab(gz) and gz.q == 0)
+end
+
+--deflated entries are sent as they are stored in the archive, wrapped in
+--a gzip header and trailer, to clients that accept gzip.
+function outzipfile_function(file)
+
+	local za, e = wwwzipentry(file)
+	if not za then
+		return
+	end
+
+	check_etag(format('%08x:%d', e.crc, e.uncompressed_size))
+
+	return function()
+		if e.compression_method == 'deflate'
+			and not out_buffering() and accepts_gzip()
+		then
+			local p, len = za:data(e)
+			local header = gzip_header(e.mtime)
+			local trailer = gzip_trailer(e.crc, e.uncompressed_size)
+			setcompress(false)
+			setheader('content-encoding', 'gzip')
+			setcontentsize(#header + len + #trailer)
+			out(header)
+			out(p, len)
+			out(trailer)
+		else
+			setcontentsize(e.uncompressed_size)
+			za:read(e, out)
+		end
+	end
+end
+
 function setheader(name, val)
 	req().res.headers[name] = val
 end
@@ -666,25 +720,60 @@ function wwwpath(file, type)
 	return nil, file..' not found'
 end
 
-local function file_object(findfile) --{filename -> content | handler(filename)}
+--zip archives listed in `www_zips` are searched after the www dirs.
+function wwwzips()
+	local t = {}
+	local paths = config'www_zips'
+	if paths then
+		require'zip_mmap'
+		for s in paths:gmatch'[^;]+' do
+			if not path_isabs(s) then
+				s = path_normalize(indir(scriptdir(), s))
+			end
+			add(t, zip_mmap_open(s))
+		end
+	end
+	return t
+end
+wwwzips = memoize(wwwzips)
+
+function wwwzipentry(file)
+	for _,za in ipairs(wwwzips()) do
+		local e = za:entry(file)
+		if e then
+			return za, e
+		end
+	end
+	return nil, file..' not found'
+end
+
+local function wwwzipfile(file)
+	local za, e = wwwzipentry(file)
+	return za and za:read(e)
+end
+
+local function file_object(findfile, findzipfile) --{filename -> content | handler(filename)}
 	return setmetatable({}, {
 		__call = function(self, file, default)
 			local f = call(self[file])
 			if f then
 				return f
 			else
-				local file, err = findfile(file)
-				if file then
-					return load(file, default)
-				else
-					assert(default ~= nil, err)
-					return default
+				local path, err = findfile(file)
+				if path then
+					return load(path, default)
 				end
+				local s = findzipfile and findzipfile(file)
+				if s then
+					return s
+				end
+				assert(default ~= nil, err)
+				return default
 			end
 		end,
 	})
 end
-wwwfile = file_object(wwwpath)
+wwwfile = file_object(wwwpath, wwwzipfile)
 varfile = file_object(varpath)
 
 function wwwfiles(filter)
@@ -709,6 +798,13 @@ function wwwfiles(filter)
 			end
 		end
 	end
+	for _,za in ipairs(wwwzips()) do
+		for name in pairs(za.entries) do
+			if not t[name] and filter(name) then
+				t[name] = true
+			end
+		end
+	end
 	return t
 end
 
@@ -846,14 +942,27 @@ end
 template = {} --{template = html | handler(name)}
 setmetatable(template, {__call = template_call, __newindex = add_template})
 
+--compiled templates are kept around so that they're not translated to Lua
+--again every time mustache's weak template cache gets cleared by the gc.
+local compiled = {} --{name -> compiled template}
+local function compiled_template(name)
+	local s = template(name)
+	local prog = compiled[name]
+	if not prog or prog.template ~= s then
+		prog = mustache_compile(s)
+		compiled[name] = prog
+	end
+	return prog
+end
+
 local partials = {}
 local function get_partial(partials, name)
-	return template(name)
+	return compiled_template(name)
 end
 setmetatable(partials, {__index = get_partial})
 
 function render(name, data)
-	return render_string(template(name), data, partials)
+	return render_string(compiled_template(name), data, partials)
 end
 
 --LuaPages templates ---------------------------------------------------------
@@ -15,6 +15,24 @@ ACTIONS
 	execaction(name, args...) -> ret...|true    execute action internally
 
 	function action.NAME(args) end        define a Lua action handler
+	accepts_msgpack() -> t|f              json actions will respond with msgpack
+
+JSON ACTIONS
+
+	Actions ending in `.json` return a Lua value which is encoded as JSON, or
+	as msgpack if the client asks for `application/msgpack` in the `accept`
+	header with a q-value not lower than that of `application/json`. json's
+	`null` is encoded as msgpack nil and tables with only 1..n keys (and empty
+	tables) are encoded as arrays, same as with JSON.
+
+	JSON output bigger than `json_chunk_size` is streamed to the client in
+	chunks as it is encoded (without an etag), so big results don't need to
+	be held in memory as a single string. Functions inside the returned value
+	are lazy arrays (see json_encode_stream()). They are streamed only in
+	JSON responses: for msgpack and for recorded output they are collected
+	into tables first. NOTE: query() still returns its rows in a table since
+	the mysql driver has no row iterator, so nothing produces lazy arrays of
+	db rows yet.
 
 CONFIG
 
@@ -22,6 +40,7 @@ CONFIG
 	config('404_html_action', '404.html') 404 action for text/html
 	config('404_png_action' , '404.png' ) 404 action for image/png
 	config('404_jpeg_action', '404.jpg' ) 404 action for image/jpeg
+	config('json_chunk_size', 64 * 1024)  chunk size for streaming JSON output
 
 DEFINES
 
@@ -148,10 +167,76 @@ local function html_filter(handler, ...)
 	outall(s)
 end
 
+function accepts_msgpack()
+	local t = headers'accept'
+	local mp = t and t['application/msgpack']
+	if not mp then return false end
+	local json = t['application/json']
+	local mp_q = mp.q or 1
+	return mp_q > 0 and mp_q >= (json and (json.q or 1) or 0)
+end
+
+local mp --msgpack encoder that encodes tables the way cjson does.
+local function json_mp()
+	if not mp then
+		require'msgpack'
+		mp = msgpack{nil_value = null}
+		function mp:isarray(t)
+			local n = #t
+			if n == 0 then
+				return next(t) == nil
+			end
+			local k = 0
+			for _ in pairs(t) do
+				k = k + 1
+			end
+			return k == n
+		end
+		--lazy arrays (see json_encode_stream()) are collected first because
+		--msgpack needs the element count before the elements.
+		local encoding_buffer = mp.encoding_buffer
+		function mp:encoding_buffer(...)
+			local buf = encoding_buffer(self, ...)
+			local encode = buf.encode
+			function buf:encode(v)
+				if type(v) ~= 'function' then
+					return encode(self, v)
+				end
+				local t, n = {}, 0
+				while true do
+					local e = v()
+					if e == nil then break end
+					n = n + 1
+					t[n] = e
+				end
+				return self:encode_array(t, n)
+			end
+			return buf
+		end
+	end
+	return mp
+end
+
 local function json_filter(handler, ...)
 	local s = handler(...)
 	if s ~= nil then
-		s = json_encode(s)
+		setheader('vary', 'accept')
+		if accepts_msgpack() then
+			setmime'msgpack'
+			s = json_mp():encoding_buffer():encode(s):tostring()
+		elseif out_buffering() then
+			s = json_encode_stream(s, nil, 1/0) --never writes, supports lazy arrays.
+		else
+			local streaming
+			s = json_encode_stream(s, function(buf, len)
+				streaming = true
+				out(buf, len)
+			end, config('json_chunk_size', 64 * 1024))
+			if streaming then
+				out(s)
+				return
+			end
+		end
 		check_etag(s)
 		outall(s)
 	end
@@ -228,6 +313,11 @@ local function action_handler(action, ...)
 						http_error(405)
 					end
 					handler = assert(outfile_function(path))
+				elseif wwwzipentry(file) then
+					if not method'get' then
+						http_error(405)
+					end
+					handler = assert(outzipfile_function(file))
 				end
 			end
 		end
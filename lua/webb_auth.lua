@@ -15,6 +15,7 @@ SESSIONS
 	usr_[create|update|create_or_update]({k->v}) -> usr    create and/or update a user
 	usr_delete(usr)                           delete a user
 	clear_userinfo_cache([usr])               clear usr table cache
+	auth_cache_stats() -> t                   session & userinfo cache metrics
 
 SCHEMA
 
@@ -33,6 +34,12 @@ CONFIG
 	auth_code_lifetime           300         one-time auth code lifetime
 	auth_code_maxcount           6           max unexpired auth codes allowed
 
+	session_cache_size           100000      max. sessions to keep in memory
+	session_cache_max_age        3600        max. seconds to cache a session
+	session_negative_cache_max_age 60        max. seconds to cache an invalid session
+	userinfo_cache_size          10000       max. users to keep in memory
+	userinfo_cache_max_age       600         max. seconds to cache user info
+
 API DOC
 
 	[try_]login([auth][, switch_user]) -> usr
@@ -144,6 +151,7 @@ require'query'
 require'schema'
 require'blake3'
 require'bcrypt'
+require'lrucache_ffi'
 
 local function fullname(firstname, lastname)
 	return (catany('', firstname, lastname) or ''):trim()
@@ -281,35 +289,33 @@ end
 
 --session cookie -------------------------------------------------------------
 
---TODO: session cache and userinfo cache are never garbage-collected!
-
-local session_cache = {}
+--{sid -> usr}, with usr = false for invalid sessions.
+local session_cache = memoize(function()
+	return lrucache_ffi{
+		max_count = config('session_cache_size', 100000),
+		max_age   = config('session_cache_max_age', 3600),
+	}
+end)
 
-local function session_cache_get(sid, time)
-	local t = session_cache[sid]
-	if not t then return nil end
-	local usr, expires = t[1], t[2]
-	if expires <= time then
-		session_cache[sid] = nil
-		return nil
-	end
-	return usr
+--returns usr, false for a known invalid session or nil if not cached.
+local function session_cache_get(sid)
+	return session_cache():get(sid)
 end
 
 local function session_cache_update(sid, usr, expires)
+	local cache = session_cache()
 	if not usr then
-		session_cache[sid] = nil
+		cache:remove(sid)
 	else
-		local t = session_cache[sid]
-		if t then
-			t[1], t[2] = usr, expires
-		else
-			t = {usr, expires}
-			session_cache[sid] = t
-		end
+		cache:put(sid, usr, min(cache.max_age, expires - time()))
 	end
 end
 
+local function session_cache_invalid(sid)
+	session_cache():put(sid, false,
+		config('session_negative_cache_max_age', 60))
+end
+
 local function load_session()
 	local cookies = headers('cookie'); if not cookies then return end
 	local session_cookie_name = config('session_cookie_name', 'session')
@@ -320,13 +326,18 @@ local function load_session()
 		local sid, sig = s:match'^(.-)|(.*)$'; if not sid then return end
 		if secret_hash(sid) ~= sig then return end
 		local now = time()
-		local usr, expires = session_cache_get(sid, now)
+		local usr = session_cache_get(sid)
+		if usr == false then return end --known invalid session
 		if not usr then
+			local expires
 			usr, expires = first_row_vals([[
 				select usr, expires
 				from sess where token = ? and expires > ?
 				]], sid, now)
-			if not usr then return end
+			if not usr then
+				session_cache_invalid(sid)
+				return
+			end
 			session_cache_update(sid, usr, expires)
 		end
 		return {id = sid, usr = usr}
@@ -429,7 +440,14 @@ end
 
 local weak_vals_mt = {__mode = 'v'}
 
-local userinfo = memoize(function(usr)
+local userinfo_cache = memoize(function()
+	return lrucache_ffi{
+		max_count = config('userinfo_cache_size', 10000),
+		max_age   = config('userinfo_cache_max_age', 600),
+	}
+end)
+
+local function load_userinfo(usr)
 	local t = usr and first_row([[
 		select
 			usr,
@@ -463,10 +481,44 @@ local userinfo = memoize(function(usr)
 	t.admin = t.roles.admin
 	t.sessions = setmetatable({}, weak_vals_mt)
 	return t
-end)
+end
+
+local function userinfo(usr)
+	if not usr then
+		return load_userinfo()
+	end
+	local cache = userinfo_cache()
+	local t = cache:get(usr)
+	if not t then
+		t = load_userinfo(usr)
+		cache:put(usr, t)
+	end
+	return t
+end
 
 function clear_userinfo_cache(usr)
-	userinfo(poison, usr)
+	if usr then
+		userinfo_cache():remove(usr)
+	else
+		userinfo_cache():clear()
+	end
+end
+
+local function cache_stats(cache)
+	return {
+		count       = cache:count(),
+		max_count   = cache.max_count,
+		hits        = cache.hits,
+		misses      = cache.misses,
+		evictions   = cache.evictions,
+		expirations = cache.expirations,
+	}
+end
+function auth_cache_stats()
+	return {
+		session  = cache_stats(session_cache()),
+		userinfo = cache_stats(userinfo_cache()),
+	}
 end
 
 --session-cookie authentication ----------------------------------------------
@@ -0,0 +1,497 @@
+--[=[
+
+	WebSocket protocol (RFC 6455) with permessage-deflate (RFC 7692).
+	Written by Cosmin Apreutesei. Public Domain.
+
+	This module only implements the framing protocol. The opening handshake
+	is done with req:websocket() in http_server.lua on the server side and
+	with client:websocket() in http_client.lua on the client side, both of
+	which return a `ws` object on the upgraded connection.
+
+	All I/O methods return nil,err on I/O and protocol errors.
+
+websocket(opt) -> ws                      Wrap an upgraded connection.
+
+	f                       the socket (required)
+	b                       the read pbuffer of the http connection (required)
+	client                  true on the client side (outgoing frames are masked)
+	deflate                 negotiated permessage-deflate params (optional)
+	max_message_size        max. size of received messages (16M)
+	compress_min_size       don't compress messages smaller than this (128)
+
+ws:send(s | buf,len, ['text'|'binary']) -> true   Send a message.
+ws:recv() -> s, 'text'|'binary'                    Receive a message.
+ws:recv'buffer' -> buf, len, 'text'|'binary'       Receive into internal buffer.
+ws:recv() -> nil, 'closed', code, reason           Peer closed the connection.
+ws:ping([s]) -> true                               Send a ping.
+ws:close([code], [reason])                         Start the closing handshake.
+ws:closed() -> true|false                          Connection is closed.
+
+	NOTE: Pings are answered automatically inside recv() so there must be
+	a thread calling recv() in a loop for as long as the connection is open.
+	send() can be called from any thread, including while another thread
+	is blocked in recv(): frames are serialized with a send lock.
+
+	NOTE: The buffer returned by recv'buffer' is only valid until the next
+	call to recv(). Text messages are not validated to be UTF-8.
+
+Handshake helpers (used by http_server.lua and http_client.lua):
+
+websocket_key() -> key                      Make a Sec-WebSocket-Key value.
+websocket_accept_key(key) -> s              Compute Sec-WebSocket-Accept.
+websocket_deflate_offer() -> s              Client's extension offer.
+websocket_deflate_accept(s) -> params, s    Server: accept an offer (or nil).
+websocket_deflate_params(s) -> params       Client: parse server's response.
+
+]=]
+
+if not ... then require'websocket_test'; return end
+
+require'glue'
+require'sock'
+require'pbuffer'
+require'gzip'
+require'sha1'
+require'base64'
+
+local
+	band, bor, xor, shl, shr, bswap, cast, u32p, str =
+	band, bor, xor, shl, shr, bswap, cast, u32p, str
+local tobit = bit.tobit
+
+local ws = {type = 'websocket', debug_prefix = 'W'}
+
+local OP_CONT  = 0x0
+local OP_TEXT  = 0x1
+local OP_BIN   = 0x2
+local OP_CLOSE = 0x8
+local OP_PING  = 0x9
+local OP_PONG  = 0xA
+
+--handshake ------------------------------------------------------------------
+
+local GUID = '258EAFA5-E914-47DA-95CA-C5AB0DC85B11'
+
+function websocket_key()
+	return base64_encode(random_string(16))
+end
+
+function websocket_accept_key(key)
+	return base64_encode(sha1(key .. GUID))
+end
+
+--"ext1; k1=v1; k2, ext2" -> {{name='ext1', params={k1='v1', k2=true}}, ...}
+local function parse_extensions(s)
+	local t = {}
+	for ext in s:gmatch'[^,]+' do
+		local e
+		for param in ext:gmatch'[^;]+' do
+			param = trim(param)
+			if not e then
+				e = {name = param:lower(), params = {}}
+			else
+				local k, v = param:match'^([^=]-)%s*=%s*(.*)$'
+				if k then
+					e.params[k:lower()] = v:match'^"(.*)"$' or v
+				else
+					e.params[param:lower()] = true
+				end
+			end
+		end
+		if e then add(t, e) end
+	end
+	return t
+end
+
+local function window_bits(v)
+	v = tonumber(v)
+	--zlib can't make raw deflate streams with a window of 8 bits.
+	return v and v >= 9 and v <= 15 and v == floor(v) and v or nil
+end
+
+function websocket_deflate_offer()
+	return 'permessage-deflate; client_max_window_bits'
+end
+
+--server side: accept the first permessage-deflate offer that we support.
+--the returned params are relative to this side of the connection.
+local server_params = index{
+	'server_no_context_takeover', 'client_no_context_takeover',
+	'server_max_window_bits', 'client_max_window_bits',
+}
+function websocket_deflate_accept(s)
+	if not s then return end
+	for _,e in ipairs(parse_extensions(s)) do
+		if e.name == 'permessage-deflate' then
+			local p = e.params
+			for k in pairs(p) do
+				if not server_params[k] then goto continue end
+			end
+			local swb = p.server_max_window_bits
+			if swb and not window_bits(swb) then goto continue end
+			local cwb = p.client_max_window_bits
+			if cwb and cwb ~= true and not window_bits(cwb) then goto continue end
+			do
+				local t = {'permessage-deflate'}
+				if p.server_no_context_takeover then add(t, 'server_no_context_takeover') end
+				if p.client_no_context_takeover then add(t, 'client_no_context_takeover') end
+				if swb then add(t, 'server_max_window_bits='..swb) end
+				return {
+					deflate_window_bits = window_bits(swb),
+					deflate_no_context_takeover = p.server_no_context_takeover and true,
+					inflate_no_context_takeover = p.client_no_context_takeover and true,
+				}, concat(t, '; ')
+			end
+		end
+		::continue::
+	end
+end
+
+--client side: parse the server's response to our offer.
+function websocket_deflate_params(s)
+	if not s then return end
+	local exts = parse_extensions(s)
+	if #exts ~= 1 or exts[1].name ~= 'permessage-deflate' then
+		return nil, 'invalid extension response: '..s
+	end
+	local p = exts[1].params
+	local cwb = p.client_max_window_bits
+	if cwb and not window_bits(cwb) then
+		return nil, 'unsupported client_max_window_bits: '..tostring(cwb)
+	end
+	return {
+		deflate_window_bits = window_bits(cwb),
+		deflate_no_context_takeover = p.client_no_context_takeover and true,
+		inflate_no_context_takeover = p.server_no_context_takeover and true,
+	}
+end
+
+--masking --------------------------------------------------------------------
+
+--xor a buffer with a 4-byte key (as loaded from memory on a little-endian
+--CPU), 4 bytes at a time.
+local function mask(p, n, key)
+	local n4 = shr(n, 2)
+	local p32 = cast(u32p, p)
+	for i = 0, n4-1 do
+		p32[i] = xor(p32[i], key)
+	end
+	for i = n4 * 4, n-1 do
+		p[i] = xor(p[i], band(shr(key, 8 * band(i, 3)), 0xff))
+	end
+end
+
+local function u16_be_str(x)
+	return string.char(shr(x, 8), band(x, 0xff))
+end
+
+--sending --------------------------------------------------------------------
+
+--frames from different threads must not interleave so sending is serialized.
+function ws:_lock()
+	while self.sending do
+		push(attr(self, 'send_queue'), currentthread())
+		suspend()
+	end
+	self.sending = true
+end
+
+function ws:_unlock()
+	self.sending = false
+	local thread = self.send_queue and remove(self.send_queue, 1)
+	if thread then
+		resume(thread)
+	end
+end
+
+function ws:_send_frame(opcode, rsv1, p, n)
+	local sb = self.sb
+	sb:reset()
+	local masked = self.client
+	local h = sb:reserve(14)
+	h[0] = bor(0x80, rsv1 and 0x40 or 0, opcode) --always FIN
+	local mbit = masked and 0x80 or 0
+	local hn
+	if n < 126 then
+		h[1] = bor(mbit, n)
+		hn = 2
+	elseif n < 0x10000 then
+		h[1] = bor(mbit, 126)
+		h[2] = shr(n, 8)
+		h[3] = band(n, 0xff)
+		hn = 4
+	else
+		h[1] = bor(mbit, 127)
+		local hi, lo = floor(n / 2^32), n % 2^32
+		cast(u32p, h + 2)[0] = bswap(hi)
+		cast(u32p, h + 6)[0] = bswap(tobit(lo))
+		hn = 10
+	end
+	local key
+	if masked then
+		key = tobit(random(0, 2^32-1))
+		cast(u32p, h + hn)[0] = key
+		hn = hn + 4
+	end
+	sb:commit(hn)
+	if n > 0 then
+		if isstr(p) then sb:put(p) else sb:putcdata(p, n) end
+	end
+	local buf, len = sb:ref()
+	if masked then
+		mask(buf + hn, n, key)
+	end
+	self.f:send(buf, len)
+end
+
+function ws:send_frame(opcode, rsv1, p, n)
+	self:_lock()
+	local ok, err = pcall(self._send_frame, self, opcode, rsv1, p, n)
+	self:_unlock()
+	if not ok then error(err, 0) end
+end
+
+--compression is done with the send lock held: the deflater's context and
+--the compression buffer are shared by all senders.
+function ws:_send_message(opcode, p, n)
+	local deflater = self.deflater
+	if deflater and n >= self.compress_min_size then
+		local zb = self.szb
+		zb:reset()
+		local ok, err = deflater:push(p, n, 'sync', function(buf, sz)
+			zb:putcdata(buf, sz)
+		end)
+		assert(ok, err)
+		if self.deflate.deflate_no_context_takeover then
+			deflater:reset()
+		end
+		local buf, len = zb:ref()
+		self:_send_frame(opcode, true, buf, len - 4) --remove 00 00 ff ff
+	else
+		self:_send_frame(opcode, false, p, n)
+	end
+end
+
+function ws:send(p, n, typ)
+	if self.close_sent then return nil, 'closed' end
+	if isstr(n) then n, typ = nil, n end
+	n = n or #p
+	local opcode = typ == 'binary' and OP_BIN or OP_TEXT
+	self:_lock()
+	local ok, err = pcall(self._send_message, self, opcode, p, n)
+	self:_unlock()
+	if not ok then error(err, 0) end
+	return true
+end
+
+function ws:ping(s)
+	if self.close_sent then return nil, 'closed' end
+	s = s or ''
+	assert(#s <= 125, 'ping payload too long')
+	self:send_frame(OP_PING, false, s, #s)
+	return true
+end
+
+function ws:close(code, reason)
+	if self.f:closed() then return true end
+	if not self.close_sent then
+		local s = code and u16_be_str(code) .. (reason or '') or ''
+		assert(#s <= 125, 'close reason too long')
+		self:send_frame(OP_CLOSE, false, s, #s)
+		self.close_sent = true
+	end
+	if not self.reading then --nobody to read the reply, so wait for it here.
+		while self:recv() do end
+	end
+	return true
+end
+
+--receiving ------------------------------------------------------------------
+
+--read a frame header and its payload into the read buffer and unmask it.
+--the payload must be consumed by the caller with b:_skip(n).
+function ws:read_frame()
+	local b = self.b
+	b:need(2)
+	local b0, b1 = b:get_u8(), b:get_u8()
+	local f = self.f
+	f:checkp(band(b0, 0x30) == 0, 'invalid frame: reserved bits set')
+	local fin    = band(b0, 0x80) ~= 0
+	local rsv1   = band(b0, 0x40) ~= 0
+	local opcode = band(b0, 0x0f)
+	local masked = band(b1, 0x80) ~= 0
+	f:checkp(masked == not self.client, 'invalid frame: wrong masking')
+	local n = band(b1, 0x7f)
+	if n == 126 then
+		b:need(2)
+		n = b:get_u16_be()
+	elseif n == 127 then
+		b:need(8)
+		local hi, lo = b:get_u32_be(), b:get_u32_be()
+		f:checkp(hi < 2^21, 'invalid frame: payload too large')
+		n = hi * 2^32 + lo
+	end
+	local key
+	if masked then
+		b:need(4)
+		key = b:get_u32_le() --the bytes as they are in memory.
+	end
+	f:checkp(n <= self.max_message_size, 'message too large')
+	b:need(n)
+	local p = b:ref()
+	if masked then
+		mask(p, n, key)
+	end
+	return fin, rsv1, opcode, p, n
+end
+
+function ws:_control_frame(opcode, p, n)
+	local f = self.f
+	if opcode == OP_PING then
+		if not self.close_sent then
+			local s = str(p, n)
+			self.b:_skip(n)
+			self:send_frame(OP_PONG, false, s, n)
+		else
+			self.b:_skip(n)
+		end
+	elseif opcode == OP_PONG then
+		self.b:_skip(n)
+	elseif opcode == OP_CLOSE then
+		f:checkp(n ~= 1, 'invalid close frame')
+		local code, reason
+		if n >= 2 then
+			code = bor(shl(p[0], 8), p[1])
+			reason = str(p + 2, n - 2)
+		end
+		self.b:_skip(n)
+		if not self.close_sent then --echo the status code back.
+			local s = code and u16_be_str(code) or ''
+			self:send_frame(OP_CLOSE, false, s, #s)
+			self.close_sent = true
+		end
+		--NOTE: the client should wait for the server to close the TCP
+		--connection first, but we don't want to depend on the peer for that.
+		f:close()
+		return code or 1005, reason
+	else
+		f:checkp(false, 'invalid opcode')
+	end
+end
+
+function ws:_recv(to)
+	local msg, f, b = self.msg, self.f, self.b
+	local typ, compressed
+	msg:reset()
+	while true do
+		local fin, rsv1, opcode, p, n = self:read_frame()
+		if opcode >= 0x8 then
+			f:checkp(fin and n <= 125 and not rsv1, 'invalid control frame')
+			local code, reason = self:_control_frame(opcode, p, n)
+			if code then
+				return nil, 'closed', code, reason
+			end
+		else
+			if opcode == OP_CONT then
+				f:checkp(typ, 'invalid continuation frame')
+				f:checkp(not rsv1, 'invalid frame: rsv1 on continuation')
+			else
+				f:checkp(not typ, 'continuation frame expected')
+				f:checkp(opcode == OP_TEXT or opcode == OP_BIN, 'invalid opcode')
+				f:checkp(not rsv1 or self.inflater, 'invalid frame: rsv1 not negotiated')
+				typ = opcode == OP_TEXT and 'text' or 'binary'
+				compressed = rsv1
+				if fin and not compressed and to ~= 'buffer' then
+					--fast path: single uncompressed frame.
+					local s = str(p, n)
+					b:_skip(n)
+					return s, typ
+				end
+			end
+			f:checkp(#msg + n <= self.max_message_size, 'message too large')
+			msg:putcdata(p, n)
+			b:_skip(n)
+			if fin then break end
+		end
+	end
+	if compressed then
+		msg:put'\0\0\255\255'
+		local zb, max_size = self.rzb, self.max_message_size
+		zb:reset()
+		local p, n = msg:ref()
+		local ok, err = self.inflater:push(p, n, 'sync', function(buf, sz)
+			f:checkp(#zb + sz <= max_size, 'message too large')
+			zb:putcdata(buf, sz)
+		end)
+		f:checkp(ok, err)
+		if self.deflate.inflate_no_context_takeover then
+			self.inflater:reset()
+		end
+		msg = zb
+	end
+	if to == 'buffer' then
+		local p, n = msg:ref()
+		return p, n, typ
+	end
+	return msg:tostring(), typ
+end
+
+function ws:recv(to)
+	self.reading = true
+	local ok, a, b, c, d = pcall(self._recv, self, to)
+	self.reading = false
+	if not ok then error(a, 0) end
+	return a, b, c, d
+end
+
+function ws:closed()
+	return self.f:closed()
+end
+
+function ws:try_close()
+	return self.f:try_close()
+end
+
+ws.check_io = check_io
+ws.checkp   = checkp
+
+function ws:protect(method)
+	self[method] = protect_io(self[method])
+end
+ws:protect'send'
+ws:protect'recv'
+ws:protect'ping'
+ws:protect'close'
+
+--instantiation --------------------------------------------------------------
+
+function websocket(opt)
+	local self = object(ws, {
+		max_message_size = 16 * 1024^2,
+		compress_min_size = 128,
+	}, opt)
+	assert(self.f, 'f missing')
+	assert(self.b, 'b missing')
+	self.f:setexpires(nil) --connection can be idle from here on.
+	self.sb  = string_buffer() --send buffer.
+	self.msg = string_buffer() --receive buffer.
+	local d = self.deflate
+	if d then
+		self.szb = string_buffer() --send compression buffer.
+		self.rzb = string_buffer() --receive decompression buffer.
+		self.deflater = deflater('raw', nil, d.deflate_window_bits)
+		self.inflater = inflater('raw')
+	end
+	return self
+end
+
+function ws:free()
+	self.sb:free()
+	self.msg:free()
+	if self.szb then
+		self.szb:free()
+		self.rzb:free()
+		self.deflater:free()
+		self.inflater:free()
+	end
+end
@@ -26,6 +26,11 @@ CONFIG
 	ignore_interrupts
 	host
 	dev_email
+	loop_stats_interval    record event loop stats and log them every n seconds
+
+ACTIONS
+
+	loop_stats.json[/start|stop|reset]    event loop stats (devs only)
 
 ]==]
 
@@ -55,12 +60,26 @@ webrtc.js
 
 require'xauth'
 
+action['loop_stats.json'] = function(cmd)
+	allow(usr'roles'.dev, 'dev role required')
+	if cmd == 'start' then
+		loop_stats_start()
+	elseif cmd == 'stop' then
+		loop_stats_stop()
+	end
+	return loop_stats(cmd == 'reset')
+end
+
 local function xapp(...)
 
 	local app = daemon(...)
 
 	function app:run_server()
 		app.server = webb_http_server()
+		local interval = config'loop_stats_interval'
+		if interval then
+			loop_stats_start(interval)
+		end
 		start(config('ignore_interrupts', true))
 	end
 
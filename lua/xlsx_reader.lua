@@ -0,0 +1,364 @@
+--[=[
+
+	Streaming XLSX reader.
+	Written by Cosmin Apreutesei. Public Domain.
+
+	Reads worksheet rows in constant memory: worksheet entries are inflated
+	from the zip file in chunks and fed to a push XML parser, and rows are
+	returned one by one as they are parsed. Shared strings are loaded into
+	a single buffer with an offset index so that a big shared strings table
+	doesn't turn into a big Lua table.
+
+	[try_]xlsx_open(file | opt) -> xr      open a xlsx file (see zip_open())
+	xr.sheets -> {name1, ...}               worksheet names in workbook order
+	xr:rows([sheet], [opt]) -> iter() -> i, row, n   iterate a worksheet's rows
+		sheet                                sheet name or index (1)
+		opt.dates                            return date cells as timestamps (false)
+		opt.null                             value for empty cells (nil)
+	xr:close()                             close the file
+
+	`i` is the row number in the sheet (empty rows are skipped), `row` is an
+	array of cell values and `n` is the index of the row's last cell. Cell
+	values are numbers, strings or booleans. Error cells are returned as
+	strings, eg. '#N/A'. Formula cells return their cached value.
+
+	Only one iterator can be active at a time: starting a new one or closing
+	the file stops the previous one.
+
+]=]
+
+if not ... then require'xlsx_reader_test'; return end
+
+require'glue'
+require'zip'
+require'xml_parse'
+
+local xr = {}
+
+local BUF_SIZE = 64 * 1024
+
+local function local_name(s) --strip namespace prefix.
+	local i = s:find(':', 1, true)
+	return i and s:sub(i + 1) or s
+end
+
+local function col_index(ref) --'AB12' -> 28
+	local n = 0
+	for i = 1, #ref do
+		local c = ref:byte(i)
+		if c < 65 or c > 90 then break end
+		n = n * 26 + c - 64
+	end
+	return n
+end
+
+--parse a small entry in one go.
+local function parse_entry(z, path, callbacks)
+	if not z:find(path) then return end
+	local s = assert(z:read'*a')
+	assert(xml_parse({string = s}, callbacks))
+	return true
+end
+
+function try_xlsx_open(t)
+	local z, err, ec = try_zip_open(t)
+	if not z then return nil, err, ec end
+	local self = object(xr, {zip = z, sheets = {}, sheet_paths = {}})
+	self.buf = u8a(BUF_SIZE)
+
+	local sheet_rids = {}
+	local ok, err = pcall(parse_entry, z, 'xl/workbook.xml', {
+		start_tag = function(name, attrs)
+			name = local_name(name)
+			if name == 'sheet' then
+				add(self.sheets, attrs.name)
+				add(sheet_rids, attrs['r:id'])
+			elseif name == 'workbookPr' then
+				self.date1904 = attrs.date1904 == '1' or attrs.date1904 == 'true'
+			end
+		end,
+	})
+	if not ok then
+		z:close()
+		return nil, err
+	end
+	local targets = {}
+	local ok, err = pcall(parse_entry, z, 'xl/_rels/workbook.xml.rels', {
+		start_tag = function(name, attrs)
+			if local_name(name) == 'Relationship' then
+				targets[attrs.Id] = attrs.Target
+			end
+		end,
+	})
+	if not ok then
+		z:close()
+		return nil, err
+	end
+	for i,rid in ipairs(sheet_rids) do
+		local target = targets[rid] or 'worksheets/sheet'..i..'.xml'
+		self.sheet_paths[i] = target:starts'/' and target:sub(2) or 'xl/'..target
+	end
+	return self
+end
+
+function xlsx_open(...)
+	return assert(try_xlsx_open(...))
+end
+
+--incremental entry parsing ---------------------------------------------------
+
+--returns a function that parses the next chunk of the entry and returns
+--false when there's no more data.
+function xr:_open_entry_parser(path, callbacks)
+	self:_close_entry_parser()
+	local z = self.zip
+	if not z:find(path) then return end
+	assert(z:open_entry())
+	local xp = xml_parser(callbacks)
+	local buf = self.buf
+	local closed
+	local function close()
+		if closed then return end
+		closed = true
+		xp:free()
+		z:close_entry()
+		self.close_entry_parser = nil
+	end
+	self.close_entry_parser = close
+	return function()
+		if closed then return false end
+		local len = assert(z:read(buf, BUF_SIZE))
+		local ok, err = pcall(xp.push, xp, buf, len, len == 0)
+		if not ok then
+			close()
+			error(err, 2)
+		end
+		if len == 0 then
+			close()
+			return false
+		end
+		return true
+	end
+end
+
+function xr:_close_entry_parser()
+	if self.close_entry_parser then
+		self.close_entry_parser()
+	end
+end
+
+--shared strings --------------------------------------------------------------
+
+--all strings are kept in one buffer and `offsets[i]` is where the i-th
+--(0-based) string ends and the next one starts.
+function xr:_load_shared_strings()
+	if self.sst_count then return end
+	local sb = string_buffer()
+	local offsets = dynarray(u32a)
+	local n = 0
+	local offs = offsets(1)
+	offs[0] = 0
+	local in_t, skip = false, 0
+	local parse_next = self:_open_entry_parser('xl/sharedStrings.xml', {
+		start_tag = function(name)
+			name = local_name(name)
+			if name == 't' then
+				in_t = true
+			elseif name == 'rPh' then --phonetic run: not part of the text.
+				skip = skip + 1
+			end
+		end,
+		end_tag = function(name)
+			name = local_name(name)
+			if name == 't' then
+				in_t = false
+			elseif name == 'rPh' then
+				skip = skip - 1
+			elseif name == 'si' then
+				n = n + 1
+				offs = offsets(n + 1)
+				offs[n] = #sb
+			end
+		end,
+		cdata = function(s)
+			if in_t and skip == 0 then
+				sb:put(s)
+			end
+		end,
+	})
+	if parse_next then
+		while parse_next() do end
+	end
+	self.sst_buf = sb
+	self.sst_ptr = sb:ref()
+	self.sst_offsets = offs
+	self.sst_count = n
+end
+
+function xr:_shared_string(i) --0-based
+	assert(i >= 0 and i < self.sst_count, 'invalid shared string index')
+	local offs = self.sst_offsets
+	local i1, i2 = offs[i], offs[i+1]
+	return str(self.sst_ptr + i1, i2 - i1)
+end
+
+--date styles -----------------------------------------------------------------
+
+local builtin_date_formats = index{
+	14, 15, 16, 17, 18, 19, 20, 21, 22,
+	27, 28, 29, 30, 31, 32, 33, 34, 35, 36,
+	45, 46, 47, 50, 51, 52, 53, 54, 55, 56, 57, 58,
+}
+
+local function is_date_format(code)
+	code = code
+		:gsub('"[^"]*"', '') --literal text
+		:gsub('%[[^%]]*%]', '') --colors, conditions, locales, elapsed time
+		:gsub('\\.', '') --escaped chars
+	return code:find'[dmyhsDMYHS]' ~= nil
+end
+
+--style index (0-based) -> true for styles with a date number format.
+function xr:_load_date_styles()
+	if self.date_styles then return end
+	local custom_formats = {}
+	local date_styles = {}
+	local in_xfs, xf_index = false, 0
+	local ok, err = pcall(parse_entry, self.zip, 'xl/styles.xml', {
+		start_tag = function(name, attrs)
+			name = local_name(name)
+			if name == 'numFmt' then
+				custom_formats[tonumber(attrs.numFmtId)] = attrs.formatCode
+			elseif name == 'cellXfs' then
+				in_xfs = true
+			elseif name == 'xf' and in_xfs then
+				local id = tonumber(attrs.numFmtId) or 0
+				local code = custom_formats[id]
+				if builtin_date_formats[id] or (code and is_date_format(code)) then
+					date_styles[xf_index] = true
+				end
+				xf_index = xf_index + 1
+			end
+		end,
+		end_tag = function(name)
+			if local_name(name) == 'cellXfs' then
+				in_xfs = false
+			end
+		end,
+	})
+	assert(ok, err)
+	self.date_styles = date_styles
+end
+
+--rows ------------------------------------------------------------------------
+
+function xr:rows(sheet, opt)
+	opt = opt or empty
+	local sheet_index = isstr(sheet) and indexof(sheet, self.sheets) or sheet or 1
+	local path = assert(self.sheet_paths[sheet_index], 'sheet not found')
+	local null_val = opt.null
+	local dates = opt.dates
+	local date_offset = self.date1904 and 24107 or 25569 --days to 1970-01-01
+	local date_styles
+	if dates then
+		self:_load_date_styles()
+		date_styles = self.date_styles
+	end
+	self:_load_shared_strings()
+
+	local queue, qi = {}, 1 --{row_num1, row1, n1, ...}
+	local row_num, row, col, n = 0
+	local cell_type, cell_style
+	local tb = string_buffer() --cell text
+	local in_text, in_is, skip = false, false, 0
+	local has_text
+
+	local function cell_value()
+		local s = has_text and tb:tostring()
+		if not s then return null_val end
+		local t = cell_type
+		if t == 's' then
+			return self:_shared_string(tonumber(s))
+		elseif t == 'str' or t == 'inlineStr' or t == 'e' or t == 'd' then
+			return s
+		elseif t == 'b' then
+			return s == '1' or s == 'true'
+		else
+			local v = tonumber(s)
+			if dates and v and cell_style and date_styles[cell_style] then
+				v = floor((v - date_offset) * 86400000 + 0.5) / 1000 --round to ms.
+			end
+			return v
+		end
+	end
+
+	local parse_next = self:_open_entry_parser(path, {
+		start_tag = function(name, attrs)
+			name = local_name(name)
+			if name == 'c' then
+				col = attrs.r and col_index(attrs.r) or col + 1
+				cell_type = attrs.t
+				cell_style = tonumber(attrs.s)
+				has_text = false
+				tb:reset()
+			elseif name == 'v' or (name == 't' and in_is) then
+				in_text = true
+				has_text = true
+			elseif name == 'is' then
+				in_is = true
+			elseif name == 'rPh' then
+				skip = skip + 1
+			elseif name == 'row' then
+				row_num = tonumber(attrs.r) or row_num + 1
+				row = {}
+				col = 0
+				n = 0
+			end
+		end,
+		end_tag = function(name)
+			name = local_name(name)
+			if name == 'v' or name == 't' then
+				in_text = false
+			elseif name == 'is' then
+				in_is = false
+			elseif name == 'rPh' then
+				skip = skip - 1
+			elseif name == 'c' then
+				local v = cell_value()
+				if v ~= nil then
+					row[col] = v
+					n = col
+				end
+			elseif name == 'row' then
+				add(queue, row_num)
+				add(queue, row)
+				add(queue, n)
+				row = nil
+			end
+		end,
+		cdata = function(s)
+			if in_text and skip == 0 then
+				tb:put(s)
+			end
+		end,
+	})
+	local more = parse_next and true or false
+	return function()
+		while qi > #queue do
+			if not more then return nil end
+			for i = #queue, 1, -1 do
+				queue[i] = nil
+			end
+			qi = 1
+			more = parse_next()
+		end
+		local i, row, n = queue[qi], queue[qi+1], queue[qi+2]
+		qi = qi + 3
+		return i, row, n
+	end
+end
+
+function xr:close()
+	self:_close_entry_parser()
+	return self.zip:close()
+end
@@ -109,7 +109,7 @@ end
 --
 function Packager:_create_package()
 
-  self.zip = zip_open(self.filename, 'w')
+  self.zip = self.workbook.stream_zip or zip_open(self.filename, 'w')
 
   self:_write_worksheet_files()
   self:_write_chartsheet_files()
@@ -169,7 +169,7 @@ function Packager:_write_worksheet_files()
 
   local index = 1
   for _, worksheet in ipairs(self.workbook:worksheets()) do
-    if not worksheet.is_chartsheet then
+    if not worksheet.is_chartsheet and not worksheet.stream_zip then
       -- Flush the row data in optimisation mode.
       if worksheet.optimization then worksheet:_write_single_row() end
 
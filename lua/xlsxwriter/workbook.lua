@@ -10,6 +10,7 @@ local Format        = require "xlsxwriter.format"
 local Packager      = require "xlsxwriter.packager"
 local SharedStrings = require "xlsxwriter.sharedstrings"
 local Utility       = require "xlsxwriter.utility"
+require "zip_stream"
 
 ------------------------------------------------------------------------------
 --
@@ -23,8 +24,8 @@ setmetatable(Workbook,{__index = Xmlwriter})
 
 function Workbook:new(filename, options)
 
-  assert(filename, "Filename required by Workbook:new()")
   options = options or {}
+  assert(filename or options["stream"], "Filename required by Workbook:new()")
 
   local instance = Xmlwriter.new(self, {
 
@@ -35,7 +36,9 @@ function Workbook:new(filename, options)
     strings_to_formulas = options["strings_to_formulas"] or true,
     strings_to_urls     = options["strings_to_urls"] or true,
     default_date_format = options["default_date_format"],
-    optimization        = options["constant_memory"],
+    optimization        = options["constant_memory"] or options["stream"] and true,
+    stream_zip          = options["stream"]
+                            and zip_stream_writer(options["stream"]) or false,
     fileclosed         = false,
     filehandle         = false,
     internal_fh        = false,
@@ -288,6 +291,11 @@ function Workbook:_add_sheet(name, is_chartsheet)
   local sheet_index = self.worksheet_count
   local name        = self:_check_sheetname(name)
 
+  -- In streaming mode only the last added worksheet can be written to.
+  if self.stream_zip and self.worksheet_count > 0 then
+    self.worksheet_objs[self.worksheet_count]:_finish_stream()
+  end
+
   -- Initialisation data to pass to the worksheet.
   local init_data = {
     ["name"]                = name,
@@ -302,6 +310,8 @@ function Workbook:_add_sheet(name, is_chartsheet)
     ["strings_to_urls"]     = self.strings_to_urls,
     ["default_date_format"] = self.default_date_format,
     ["default_url_format"]  = self.default_url_format,
+    ["stream_zip"]          = self.stream_zip,
+    ["filename"]            = "xl/worksheets/sheet" .. (sheet_index + 1) .. ".xml",
   }
 
   local worksheet
@@ -349,6 +359,11 @@ function Workbook:_store_workbook()
   -- Set the defined names for the worksheets such as Print Titles.
   self:_prepare_defined_names()
 
+  -- Finish the worksheet that is still being streamed.
+  if self.stream_zip then
+    self.worksheet_objs[self.worksheet_count]:_finish_stream()
+  end
+
   -- Prepare the drawings, charts and images.
   --self:_prepare_drawings()
 
@@ -162,8 +162,18 @@ function Worksheet:_initialize(init_data)
   self.default_date_format = init_data['default_date_format']
   self.default_url_format  = init_data['default_url_format']
 
+  -- In streaming mode row data goes straight into the worksheet's zip entry,
+  -- which is started when the first row is flushed (see _start_stream()).
+  self.stream_zip          = init_data['stream_zip']
+  if self.stream_zip then
+    self.filename = init_data['filename']
+    self.fh = {write = function(fh, s)
+      self:_start_stream()
+      self.fh:write(s)
+    end}
+
   -- Open a temp filehandle to store row data in optimization mode.
-  if self.optimization then
+  elseif self.optimization then
     self.row_data_fh = io.tmpfile()
     -- Set as the worksheet filehandle until the file is assembled.
     self.fh = self.row_data_fh
@@ -176,6 +186,26 @@ end
 --
 function Worksheet:_assemble_xml_file()
 
+  self:_write_sheet_head()
+
+  -- Write the worksheet data such as rows columns and cells.
+  if self.optimization then
+    self:_write_optimized_sheet_data()
+  else
+    self:_write_sheet_data()
+  end
+
+  self:_write_sheet_tail()
+
+  -- Close the XML writer filehandle.
+  self:_xml_close()
+end
+
+----
+-- Write the part of the XML file that comes before the sheet data.
+--
+function Worksheet:_write_sheet_head()
+
   self:_xml_declaration()
 
   -- Write the root worksheet element.
@@ -184,8 +214,10 @@ function Worksheet:_assemble_xml_file()
   -- Write the worksheet properties.
   self:_write_sheet_pr()
 
-  -- Write the worksheet dimensions.
-  self:_write_dimension()
+  -- Write the worksheet dimensions (optional, not known yet when streaming).
+  if not self.stream_zip then
+    self:_write_dimension()
+  end
 
   -- Write the sheet view properties.
   self:_write_sheet_views()
@@ -195,13 +227,12 @@ function Worksheet:_assemble_xml_file()
 
   -- Write the sheet column info.
   self:_write_cols()
+end
 
-  -- Write the worksheet data such as rows columns and cells.
-  if self.optimization then
-    self:_write_optimized_sheet_data()
-  else
-    self:_write_sheet_data()
-  end
+----
+-- Write the part of the XML file that comes after the sheet data.
+--
+function Worksheet:_write_sheet_tail()
 
   -- Write the sheetProtection element.
   self:_write_sheet_protection()
@@ -253,9 +284,39 @@ function Worksheet:_assemble_xml_file()
 
   -- Close the worksheet tag.
   self:_xml_end_tag("worksheet")
+end
 
-  -- Close the XML writer filehandle.
-  self:_xml_close()
+----
+-- Start the worksheet's zip entry in streaming mode and write everything
+-- up to the sheet data. Called when the first row is flushed, so worksheet
+-- properties and columns must be set before writing the second row.
+--
+function Worksheet:_start_stream()
+  local zip = self.stream_zip
+  zip:open_entry(self.filename)
+  self.fh = {write = function(fh, s) zip:write(s) end}
+  if self.worksheet_meta.activesheet == self.index then
+    self.selected = true
+    self.hidden   = false
+  end
+  self:_write_sheet_head()
+  self:_xml_start_tag("sheetData")
+  self.streaming = true
+end
+
+----
+-- Flush the last row and finish the worksheet's zip entry in streaming mode.
+--
+function Worksheet:_finish_stream()
+  if self.stream_finished then return end
+  self.stream_finished = true
+  self:_write_single_row()
+  if not self.streaming then
+    self:_start_stream()
+  end
+  self:_xml_end_tag("sheetData")
+  self:_write_sheet_tail()
+  self.stream_zip:close_entry()
 end
 
 
@@ -40,6 +40,20 @@ xml_parse(source, callbacks) -> true
 	  unknown         = function(name, info) end,
 	}
 
+xml_parser(callbacks, [options]) -> xp
+
+	Create a push parser for parsing a XML document in chunks as they become
+	available. `options` is the `source` table from above without the source.
+
+xp:push(data, [size], [last])
+
+	Parse the next chunk of the document. Set `last` on the final chunk.
+	Callbacks are called from inside this call. Raises on parsing errors.
+
+xp:free()
+
+	Free the parser. Must be called when done parsing, error or not.
+
 xml_parse(source, [known_tags]) -> root_node
 
 	Parse a XML to a tree of nodes. known_tags filters the output so that only
@@ -147,26 +161,24 @@ local cbdecoders = {
 	unknown = function(_, name, info) return str(name), info end,
 }
 
-local parser = {}
+local xp = {} --push parser
 
-function parser.read(read, callbacks, options)
-	local cbt = {}
+function xml_parser(callbacks, options)
+	options = options or empty
+	local self = object(xp, {cbt = {}})
 	local function cb(cbtype, callback, decode)
 		local cb = cast(cbtype, function(...) return callback(decode(...)) end)
-		cbt[#cbt+1] = cb
+		add(self.cbt, cb)
 		return cb
 	end
-	local function free_callbacks()
-		for _,cb in ipairs(cbt) do
-			cb:free()
-		end
-	end
-	return fpcall(function(finally)
-		finally(free_callbacks)
+	return fcall(function(finally, onerror)
+		--free the parser and the callbacks made so far if any step fails.
+		onerror(function() self:free() end)
 
 		local parser = options.namespacesep and C.XML_ParserCreateNS(options.encoding, options.namespacesep:byte())
 				or C.XML_ParserCreate(options.encoding)
-		finally(function() C.XML_ParserFree(parser) end)
+		assert(parser ~= nil, 'XML_ParserCreate() failed')
+		self.parser = parser
 
 		for i=1,#cbsetters,3 do
 			local k, setter, cbtype = cbsetters[i], cbsetters[i+1], cbsetters[i+2]
@@ -184,15 +196,42 @@ function parser.read(read, callbacks, options)
 		end
 
 		C.XML_SetUserData(parser, parser)
+		return self
+	end)
+end
+
+function xp:push(data, size, last)
+	local parser = self.parser
+	if C.XML_Parse(parser, data, size or (data and #data or 0), last and 1 or 0) == 0 then
+		error(format('XML parser error at line %d, col %d: "%s"',
+				tonumber(C.XML_GetCurrentLineNumber(parser)),
+				tonumber(C.XML_GetCurrentColumnNumber(parser)),
+				str(C.XML_ErrorString(C.XML_GetErrorCode(parser)))))
+	end
+end
+
+function xp:free()
+	if self.parser then
+		C.XML_ParserFree(self.parser)
+		self.parser = false
+	end
+	if self.cbt then
+		for _,cb in ipairs(self.cbt) do
+			cb:free()
+		end
+		self.cbt = false
+	end
+end
+
+local parser = {}
 
+function parser.read(read, callbacks, options)
+	return fpcall(function(finally)
+		local xp = xml_parser(callbacks, options)
+		finally(function() xp:free() end)
 		repeat
 			local data, size, more = read()
-			if C.XML_Parse(parser, data, size, more and 0 or 1) == 0 then
-				error(format('XML parser error at line %d, col %d: "%s"',
-						tonumber(C.XML_GetCurrentLineNumber(parser)),
-						tonumber(C.XML_GetCurrentColumnNumber(parser)),
-						str(C.XML_ErrorString(C.XML_GetErrorCode(parser)))))
-			end
+			xp:push(data, size, not more)
 		until not more
 	end)
 end
@@ -256,9 +295,15 @@ local function maketree_callbacks(known_tags)
 	}, root
 end
 
+local function is_callbacks(t)
+	for k,v in pairs(t) do
+		return isfunc(v)
+	end
+end
+
 function xml_parse(t, callbacks)
 	local root = true
-	if not isfunc(callbacks) then
+	if not (callbacks and is_callbacks(callbacks)) then
 		local known_tags = callbacks
 		callbacks, root = maketree_callbacks(known_tags)
 	end
@@ -62,7 +62,8 @@
 		name_col         :               default display col when used as lookup rowset
 
 	Methods to implement:
-		load_rows(result, param_vals)
+		load_rows(result, param_vals, [view])  view: see PAGED LOADING
+		load_changed_rows(result, param_vals, pks) -> false to do a full reload
 		insert_row(vals)
 		update_row(vals)
 		delete_row(vals)
@@ -70,7 +71,7 @@
 
 	Methods to call:
 		rowset_changed(rowset_name)
-		table_changed(table_name)
+		table_changed(table_name, [pks])  pks: {{col->val},...} of changed rows
 
 	Sets by default:
 		- `can_[add|change|remove]_rows` are set to false on missing row update methods.
@@ -79,12 +80,51 @@
 
 GLOBALS
 	rowset_changed(rowset_name, [update_id])
+	table_changed(table_name, [update_id], [push_to_clients], [pks])
 
 ACTIONS
 
 	rowset.json               named rowsets action
+	rowset.json?since=VER     load only the rows changed since version VER
+	rowset.json?view=JSON     load one page of rows
 	xrowset.events            rowset-refresh push-notifications
 
+	With `accept: application/msgpack`, rowset.json responds with msgpack
+	and loaded rows are sent as `columns` and `row_count` instead of `rows`:
+	number columns as bin of doubles (null is NaN), date columns as arrays
+	of timestamps (ext -1) and other columns as arrays.
+
+PAGED LOADING
+
+	Rowsets that support it (see xrowset_sql) can load one page of rows
+	at a time, sorted and filtered on the server. The client sends `view`:
+		offset           : n             rows to skip
+		limit            : n             max rows to load (rs.max_page_size)
+		order_by         : 'col1 col2:desc ...' sort order (pk is always added last)
+		filters          : [[col, op, val],...] op: = <> < > <= >= like in null not_null
+		after            : [v1,...]      values of order_by cols and pk cols of the
+		                                 last row of the previous page (keyset paging)
+		count            : t             return the total row count too
+	and gets `{paged = true, offset =, total =, rows =, ...}` back.
+	Keyset paging (`after`) is much faster than `offset` on large rowsets
+	but it can't start from a row with null sort values.
+
+DELTA LOADING
+
+	Loaded rowsets come with a `version` which the client can send back as
+	`since` on reload to get `{delta = true, version =, rows =, removed =}`
+	with only the rows that were added or changed since, and the pks of the
+	rows that were removed. For this the server keeps a log of the last
+	`rowset_change_log_size` (1000) changes made to tables and rowsets with
+	the pks of the changed rows. A full reload is sent instead when the log
+	doesn't reach back to `since`, when a change was made without pks on a
+	table of the rowset, or when the rowset doesn't implement
+	load_changed_rows(). Changes made in a request are logged when the
+	request finishes, after its transaction is committed. The log is kept
+	in the memory of the server process so it only sees the changes made
+	through that process: clients shouldn't send `since` when multiple
+	server processes or other apps write to the same db.
+
 ]]
 
 require'webb_action'
@@ -116,6 +156,142 @@ local client_field_attrs = {
 local rowset_tables = {} --{table -> {rowset->true}}
 local push_rowset_changed_events --fw. decl.
 
+--msgpack transport ----------------------------------------------------------
+
+--msgpack responses carry rows as columns instead: number columns as typed
+--arrays of doubles (nulls become NaN) and date columns as arrays of msgpack
+--timestamps (dates from the db are taken as UTC).
+
+local function encode_date(b, v)
+	if v == nil or v == null then
+		b:encode(nil)
+	else
+		b:encode_timestamp(v)
+	end
+end
+local num_col_mt = {__tomsgpack = function(t, b)
+	b:encode_f64_array(t, t.n, null)
+end}
+local date_col_mt = {__tomsgpack = function(t, b)
+	b:encode_array(t, t.n, encode_date)
+end}
+
+local function date_time(s)
+	if not isstr(s) then return s end
+	local y, m, d, h, M, sec = s:match'^(%d+)-(%d+)-(%d+)[ T]?(%d*):?(%d*):?([%d%.]*)'
+	if not y then return null end
+	return time(true, tonumber(y), tonumber(m), tonumber(d),
+		tonumber(h) or 0, tonumber(M) or 0, tonumber(sec) or 0) or null
+end
+
+local function rows_to_columns(rs, res)
+	local rows = res.rows
+	if not rows then return end
+	local n = #rows
+	local cols = {}
+	for fi, f in ipairs(rs.fields) do
+		local col = {n = n}
+		local all_nums = f.type == 'number'
+		for ri = 1, n do
+			local v = rows[ri][fi]
+			if all_nums and v ~= null and type(v) ~= 'number' then
+				all_nums = false
+			end
+			col[ri] = v
+		end
+		if all_nums then
+			setmetatable(col, num_col_mt)
+		elseif f.type == 'date' then
+			for ri = 1, n do
+				col[ri] = date_time(col[ri])
+			end
+			setmetatable(col, date_col_mt)
+		else
+			col.n = nil
+			for ri = 1, n do
+				if col[ri] == nil then col[ri] = null end
+			end
+		end
+		cols[fi] = col
+	end
+	res.rows = nil
+	res.columns = cols
+	res.row_count = n
+end
+
+--change log for delta loading ----------------------------------------------
+
+--versions start from the current time so that versions from a previous run
+--of the server are never mistaken for versions of this run.
+local change_log = {} --{ver->{table=|rowset=, pks={{col->val},...}|false}}
+local change_ver = floor(time() * 1000)
+local change_log_min_ver = change_ver --versions <= this are not in the log.
+
+local function log_change(e)
+	change_ver = change_ver + 1
+	change_log[change_ver] = e
+	local max_n = config('rowset_change_log_size', 1000)
+	while change_ver - change_log_min_ver > max_n do
+		change_log_min_ver = change_log_min_ver + 1
+		change_log[change_log_min_ver] = nil
+	end
+end
+
+--changes made in a request are logged when the request finishes, after its
+--transaction is committed by the finish hook that db() installs when the
+--changes are made. Logging them earlier would let a client load the rows
+--before the commit and get a version that says it has the changes.
+local function after_commit(f)
+	local req = http_request()
+	if req then
+		req:onfinish(function(req, ok)
+			if ok then f() end
+		end)
+	else
+		f()
+	end
+end
+
+--get the pks of the rows of a rowset changed since version `since`
+--or nil if the rows can't be determined and a full reload is needed.
+local function changed_pks_since(rs, since)
+	if not since or since < change_log_min_ver or since > change_ver then
+		return
+	end
+	local pks, seen = {}, {}
+	local function add_pk(get_val, t)
+		local pk = {}
+		for i, as_col in ipairs(rs.pk_cols) do
+			local v = get_val(t, as_col)
+			if v == nil then return false end
+			pk[i] = v
+		end
+		local k = cat(imap(pk, tostring), '\0')
+		if not seen[k] then
+			seen[k] = true
+			add(pks, pk)
+		end
+		return true
+	end
+	local function rowset_val(t, as_col) return t[as_col] end
+	local function table_val(t, as_col) return t[rs.fields[as_col].col] end
+	for ver = since + 1, change_ver do
+		local e = change_log[ver]
+		if e.rowset == rs.name then
+			if not e.pks then return end
+			for _,t in ipairs(e.pks) do
+				if not add_pk(rowset_val, t) then return end
+			end
+		elseif e.table and rs.tables[e.table] then
+			if not e.pks or e.table ~= rs.pk_table then return end
+			for _,t in ipairs(e.pks) do
+				if not add_pk(table_val, t) then return end
+			end
+		end
+	end
+	return pks
+end
+
 function virtual_rowset(init, ...)
 
 	local rs = {}
@@ -153,6 +329,7 @@ function virtual_rowset(init, ...)
 		end
 
 		rs.client_fields = {}
+		rs.tables = {}
 		local computed_fields
 
 		for i,f in ipairs(rs.fields) do
@@ -172,6 +349,7 @@ function virtual_rowset(init, ...)
 
 			if f.table then
 				attr(rowset_tables, f.table)[rs.name] = true
+				rs.tables[f.table] = true
 			end
 			if f.compute then
 				computed_fields = computed_fields or {}
@@ -188,6 +366,20 @@ function virtual_rowset(init, ...)
 			rs.client_fields[i] = client_field
 		end
 
+		--rows from a delta-logged table map to rows of the rowset
+		--if the rowset's pk fields all come from that table.
+		rs.pk_cols = isstr(rs.pk) and collect(words(rs.pk)) or rs.pk or {}
+		rs.pk_table = nil
+		for i, as_col in ipairs(rs.pk_cols) do
+			local f = rs.fields[as_col]
+			local tbl = f and f.col and f.table
+			if not tbl or (i > 1 and tbl ~= rs.pk_table) then
+				rs.pk_table = nil
+				break
+			end
+			rs.pk_table = tbl
+		end
+
 		if not rs.insert_row then rs.can_add_rows    = false end
 		if not rs.update_row then rs.can_change_rows = false end
 		if not rs.delete_row then rs.can_remove_rows = false end
@@ -228,9 +420,9 @@ function virtual_rowset(init, ...)
 
 	local repl = repl
 
-	function rs:load(param_vals)
-		local res = {}
-		rs:load_rows(res, param_vals)
+	function rs:load(param_vals, view)
+		local res = {version = change_ver}
+		rs:load_rows(res, param_vals, view)
 		assert(res.rows[1] == nil or istab(res.rows[1]),
 			'first row not a table')
 		if update_computed_fields then
@@ -257,9 +449,54 @@ function virtual_rowset(init, ...)
 		return res
 	end
 
-	local function reload_row(op, rt, row_values)
-		if not rs.load_row then return end
-		local ok, row = catch('db', rs.load_row, rs, row_values)
+	--check if rows of the rowset might have changed since version `ver`.
+	function rs:changed_since(ver)
+		if ver < change_log_min_ver then
+			return true
+		end
+		for ver = ver + 1, change_ver do
+			local e = change_log[ver]
+			if e.rowset == rs.name or (e.table and rs.tables[e.table]) then
+				return true
+			end
+		end
+		return false
+	end
+
+	--load only the rows changed since version `since` or return nil
+	--if a full reload is needed.
+	function rs:load_delta(param_vals, since)
+		if not rs.load_changed_rows or not rs.tables then return end
+		local version = change_ver
+		local pks = changed_pks_since(rs, since)
+		if not pks then return end
+		local res = {delta = true, version = version, rows = {}, removed = {}}
+		if #pks == 0 then
+			return res
+		end
+		if rs:load_changed_rows(res, param_vals, pks) == false then
+			return
+		end
+		local loaded = {}
+		for _,row in ipairs(res.rows) do
+			local t = {}
+			for i, as_col in ipairs(rs.pk_cols) do
+				t[i] = tostring(row[rs.fields[as_col].index])
+			end
+			loaded[cat(t, '\0')] = true
+			if update_computed_fields then
+				update_computed_fields(row)
+			end
+		end
+		for _,pk in ipairs(pks) do
+			if not loaded[cat(imap(pk, tostring), '\0')] then
+				add(res.removed, pk)
+			end
+		end
+		return res
+	end
+
+	local function set_reloaded_row(op, rt, ok, row)
 		if ok then
 			if op == 'insert' or op == 'update' then
 				if not row then
@@ -302,6 +539,12 @@ function virtual_rowset(init, ...)
 		return not rt.error
 	end
 
+	local function reload_row(op, rt, row_values)
+		if not rs.load_row then return end
+		local ok, row = catch('db', rs.load_row, rs, row_values)
+		return set_reloaded_row(op, rt, ok, row)
+	end
+
 	function rs:validate_fields(values, only_present_values)
 		local errors
 		for i,fld in ipairs(rs.fields) do
@@ -350,7 +593,17 @@ function virtual_rowset(init, ...)
 		self.changed_rowsets[rowset_name] = true
 	end
 
-	function rs:table_changed(table_name)
+	function rs:table_changed(table_name, pks)
+		if self.changed_tables then
+			local t = self.changed_tables[table_name]
+			if pks and t ~= false then
+				t = t or {}
+				extend(t, pks)
+			else
+				t = false
+			end
+			self.changed_tables[table_name] = t
+		end
 		local rowsets = rowset_tables[table_name]
 		if rowsets then
 			for rowset_name in pairs(rowsets) do
@@ -359,136 +612,183 @@ function virtual_rowset(init, ...)
 		end
 	end
 
+	local ops = {new = 'insert', update = 'update', remove = 'delete'}
+
+	--copy :foo:old to :foo so we can select the row back.
+	local function set_old_values(vals)
+		for k,v in pairs(vals) do
+			local k1 = k:match'^(.-):old$'
+			if k1 and vals[k1] == nil then
+				vals[k1] = v
+			end
+		end
+	end
+
+	local function apply_row(self, row, rt)
+		local op = ops[row.type]
+		local update_method =
+			op == 'insert' and rs.insert_row or
+			op == 'update' and rs.update_row or
+			op == 'delete' and rs.delete_row
+		local ok, err = catch('db', update_method, self, row.values)
+		if ok then
+			if op == 'update' then
+				set_old_values(row.values)
+			end
+			reload_row(op, rt, row.values)
+		elseif op ~= 'delete' and err.col then
+			rt.field_errors = {[err.col] = err.message}
+		else
+			rt.error = db_error(err)
+		end
+	end
+
+	--batched path: apply_rows() makes all the changes in one transaction
+	--and reload_rows() loads back all the affected rows in one query.
+	--if apply_rows() fails we go row-by-row to get the errors of each row.
+	local function apply_rows(self, rows, rts)
+		if not catch('db', rs.apply_rows, self, rows) then
+			return false
+		end
+		for _,row in ipairs(rows) do
+			if row.type == 'update' then
+				set_old_values(row.values)
+			end
+		end
+		local ok, loaded_rows
+		if rs.reload_rows then
+			ok, loaded_rows = catch('db', rs.reload_rows, self, rows)
+		end
+		for i,row in ipairs(rows) do
+			local op = ops[row.type]
+			if rs.reload_rows then
+				if ok then
+					set_reloaded_row(op, rts[i], true, loaded_rows[i] or false)
+				else
+					set_reloaded_row(op, rts[i], false, loaded_rows) --the error
+				end
+			else
+				reload_row(op, rts[i], row.values)
+			end
+		end
+		return true
+	end
+
 	function rs:apply_changes(changes, update_id)
 
 		update_client_fields()
 		local res = {rows = {}, fields = rs.client_fields}
 		local self = object(rs)
 		self.changed_rowsets = {}
-		local rowset_changed = true
+		self.changed_tables = {} --{table->{{col->val},...}|false}
 
+		local rows, rts = {}, {}
 		for _,row in ipairs(changes.rows) do
 			local rt = {type = row.type}
+			local can, err, field_errors
 			if row.type == 'new' then
-				local can, err, field_errors = rs:can_add_row(row.values)
-				if can ~= false then
-					local ok, err = catch('db', rs.insert_row, self, row.values)
-					if ok then
-						if reload_row('insert', rt, row.values) then
-							rowset_changed = true
-						end
-					else
-						if err.col then
-							rt.field_errors = {[err.col] = err.message}
-						else
-							rt.error = db_error(err)
-						end
-					end
-				else
-					rt.error = err or true
-					rt.field_errors = field_errors
-				end
+				can, err, field_errors = rs:can_add_row(row.values)
 			elseif row.type == 'update' then
-				local can, err, field_errors = rs:can_change_row(row.values)
-				if can ~= false then
-					local ok, err = catch('db', rs.update_row, self, row.values)
-					if ok then
-						--copy :foo:old to :foo so we can select the row back.
-						for k,v in pairs(row.values) do
-							local k1 = k:match'^(.-):old$'
-							if k1 and row.values[k1] == nil then
-								row.values[k1] = v
-							end
-						end
-						if reload_row('update', rt, row.values) then
-							rowset_changed = true
-						end
-					else
-						if err.col then
-							rt.field_errors = {[err.col] = err.message}
-						else
-							rt.error = db_error(err)
-						end
-					end
-				else
-					rt.error = err or true
-					rt.field_errors = field_errors
-				end
+				can, err, field_errors = rs:can_change_row(row.values)
 			elseif row.type == 'remove' then
-				local can, err, field_errors = rs:can_remove_row(row.values)
-				if can ~= false then
-					local ok, err = catch('db', rs.delete_row, self, row.values)
-					if ok then
-						if reload_row('delete', rt, row.values) then
-							rowset_changed = true
-						end
-					else
-						rt.error = db_error(err)
-					end
-				else
-					rt.error = err or true
-					rt.field_errors = field_errors
-				end
-				rt.remove = not rt.error
+				can, err, field_errors = rs:can_remove_row(row.values)
 			else
 				assert(false)
 			end
+			if can ~= false then
+				add(rows, row)
+				add(rts, rt)
+			else
+				rt.error = err or true
+				rt.field_errors = field_errors
+			end
 			add(res.rows, rt)
 		end
 
-		if rowset_changed then
-			self:rowset_changed(rs.name, args'filter')
+		if not (rs.apply_rows and #rows > 1 and apply_rows(self, rows, rts)) then
+			for i,row in ipairs(rows) do
+				apply_row(self, row, rts[i])
+			end
+		end
+		for _,rt in ipairs(res.rows) do
+			if rt.type == 'remove' then
+				rt.remove = not rt.error
+			end
 		end
-		push_rowset_changed_events(self.changed_rowsets, update_id)
+
+		--log the pks of changed rows, old and new (pks can change too).
+		local pks = {}
+		for i,row in ipairs(changes.rows) do
+			local rt = res.rows[i]
+			local n = 0
+			for _,suffix in ipairs{'', ':old'} do
+				local t = {}
+				for _,as_col in ipairs(rs.pk_cols) do
+					t[as_col] = row.values[as_col..suffix]
+					if t[as_col] == nil then t = nil; break end
+				end
+				if t then
+					add(pks, t)
+					n = n + 1
+				end
+			end
+			if n == 0 and not (rt.error or rt.field_errors) then --pk unknown.
+				pks = false
+				break
+			end
+		end
+		self:rowset_changed(rs.name, args'filter')
+		local changed_tables, changed_rowsets = self.changed_tables, self.changed_rowsets
+		after_commit(function()
+			log_change{rowset = rs.name, pks = pks}
+			for tbl, pks in pairs(changed_tables) do
+				log_change{table = tbl, pks = pks}
+			end
+			push_rowset_changed_events(changed_rowsets, update_id)
+		end)
 
 		return res
 	end
 
 	local function download_as_xlsx(rs_name, rs)
 		setheader('content-disposition', {'attachment', filename = rs_name..'.xlsx'})
-		local file = tmppath('rowset-{name}-{request_id}.xlsx', {name = rs_name})
-		local wb = assert(xlsx_workbook:new(file))
-		fcall(function(finally, onerror)
-			onerror(function()
-				if wb then wb:close() end
-				fs.remove(file)
-			end)
-			local ws = wb:add_worksheet()
-			local bold = wb:add_format({bold = true})
-			local d    = wb:add_format({num_format = country('date_format')})
-			local dt   = wb:add_format({num_format = country('date_format')..' hh:mm'})
-			local dts  = wb:add_format({num_format = country('date_format')..' hh:mm:ss'})
-			for i,field in ipairs(rs.fields) do
-				ws:write(0, i-1, field.label or capitalize(field.name), bold)
-				local w = field.display_width
-				w = field.hidden and 1 or w and min(32, w)
-				local fmt
-				if field.type == 'date' then
-					fmt = field.precision == 'd' and d
-						or field.precision == 's' and dts or dt
-				end
-				if w or fmt then
-					ws:set_column(i-1, i-1, w, fmt)
-				end
+		--the workbook is compressed and sent as rows are written, no temp file.
+		local wb = xlsx_workbook:new(nil, {stream = out})
+		local ws = wb:add_worksheet()
+		local bold = wb:add_format({bold = true})
+		local d    = wb:add_format({num_format = country('date_format')})
+		local dt   = wb:add_format({num_format = country('date_format')..' hh:mm'})
+		local dts  = wb:add_format({num_format = country('date_format')..' hh:mm:ss'})
+		for i,field in ipairs(rs.fields) do
+			ws:write(0, i-1, field.label or capitalize(field.name), bold)
+			local w = field.display_width
+			w = field.hidden and 1 or w and min(32, w)
+			local fmt
+			if field.type == 'date' then
+				fmt = field.precision == 'd' and d
+					or field.precision == 's' and dts or dt
 			end
-			for i,row in ipairs(rs.rows) do
-				for j,field in ipairs(rs.fields) do
-					local v = row[j]
-					if v ~= null then
-						if field.type == 'date' then
-							v = v:gsub(' ', 'T')
-							ws:write_date_string(i, j-1, v)
-						else
-							ws:write(i, j-1, v)
-						end
+			if w or fmt then
+				ws:set_column(i-1, i-1, w, fmt)
+			end
+		end
+		local rows = rs.rows
+		for i=1,#rows do
+			local row = rows[i]
+			rows[i] = false --let written rows be collected.
+			for j,field in ipairs(rs.fields) do
+				local v = row[j]
+				if v ~= null then
+					if field.type == 'date' then
+						v = v:gsub(' ', 'T')
+						ws:write_date_string(i, j-1, v)
+					else
+						ws:write(i, j-1, v)
 					end
 				end
 			end
-			wb:close()
-			wb = nil
-			outfile(file)
-			rm(file)
-		end)
+		end
+		wb:close()
 	end
 
 	function rs:respond(rowset_name, out_format)
@@ -511,21 +811,27 @@ function virtual_rowset(init, ...)
 			params[k..':old'] = v
 		end
 		local post = post()
-		local method = post and post.exec and post.exec or 'load'
-		local method = checkfound(rs['exec_'..method], 'command not found')
-		local rs = method(rs, params, post)
+		local method_name = post and post.exec and post.exec or 'load'
+		local method = checkfound(rs['exec_'..method_name], 'command not found')
+		local res = method(rs, params, post)
 
 		if out_format == 'json' then
-			return rs
+			if method_name == 'load' and accepts_msgpack() then
+				rows_to_columns(rs, res)
+			end
+			return res
 		elseif out_format == 'xlsx' then
-			download_as_xlsx(rowset_name, rs)
+			download_as_xlsx(rowset_name, res)
 		else
 			assert(false)
 		end
 	end
 
 	function rs:exec_load(params, post)
-		return rs:load(params, post)
+		local since = tonumber(args'since')
+		local view = args'view' and checkarg(try_json_decode(args'view', null), 'invalid view')
+		return since and not view and rs:load_delta(params, since)
+			or rs:load(params, view)
 	end
 
 	function rs:exec_save(params, post)
@@ -567,12 +873,20 @@ local changed_rowsets = {} --{req->{rowset->'update_id1 ...'}}
 
 function rowset_changed(rowset_name, update_id, push_to_clients)
 	local rowsets = istab(rowset_name) and rowset_name or {[rowset_name] = true}
-	push_rowset_changed_events(rowsets, update_id or 'server', push_to_clients)
+	after_commit(function()
+		for rowset_name in pairs(rowsets) do
+			log_change{rowset = rowset_name:match'^[^:]*', pks = false}
+		end
+		push_rowset_changed_events(rowsets, update_id or 'server', push_to_clients)
+	end)
 end
 
-function table_changed(table_name, update_id, push_to_clients)
-	local rowsets = rowset_tables[table_name]
-	push_rowset_changed_events(rowsets, update_id, push_to_clients)
+function table_changed(table_name, update_id, push_to_clients, pks)
+	after_commit(function()
+		log_change{table = table_name, pks = pks or false}
+		local rowsets = rowset_tables[table_name]
+		push_rowset_changed_events(rowsets, update_id, push_to_clients)
+	end)
 end
 
 --[[local]] function push_rowset_changed_events(rowsets, update_id, push_to_clients)
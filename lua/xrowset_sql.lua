@@ -17,6 +17,23 @@
 		- select_row    : instead of select + where_row.
 		- select_none   : instead of select_row or (select + 'where 1 = 0').
 
+	For editable rowsets over a single table you can specify:
+		- update_table  : table to apply changes to.
+		- update_cols   : 'col1 ...' columns to change; defaults to the writable
+		                  fields that come from update_table.
+	This creates the rowset's I/U/D methods and applies changes in batches:
+	one multi-row query per change type, in one transaction, with all affected
+	rows loaded back with one select. If a batch fails, changes are applied
+	again row-by-row to get the errors of each row.
+
+	Paged loading (see xrowset) is supported for rowsets made from `select`
+	whose pk and sort/filter fields can be traced back to their origin tables:
+		- max_page_size       : max rows per page (1000).
+		- count_cache_size    : number of cached total counts (100).
+		- count_cache_max_age : seconds to keep a cached total count (10).
+	Total counts are cached per filter until the tables of the rowset's
+	fields change or until they expire, whichever comes first.
+
 	If all else fails, you can always implement the rowset's S/U/I/D methods yourself.
 
 	Inferred field attributes:
@@ -58,6 +75,7 @@
 require'xrowset'
 require'query'
 require'glue'
+require'lrucache_ffi'
 
 --usage in sql:
 	-- single-key : `foo in (:param:filter)`
@@ -115,6 +133,22 @@ setmetatable(rowset, {__index = function(self, rs_name)
 	end
 end})
 
+--multi-row queries are made on at most this many rows at a time
+--to keep `case` and `in` lists short.
+local max_batch_rows = 500
+
+local filter_ops = {
+	['=']=1, ['<>']=1, ['<']=1, ['>']=1, ['<=']=1, ['>=']=1, like=1,
+	['in']=1, null=1, not_null=1,
+}
+
+local function each_batch(rows, f)
+	for i = 1, #rows, max_batch_rows do
+		f(i == 1 and #rows <= max_batch_rows and rows
+			or {unpack(rows, i, min(#rows, i + max_batch_rows - 1))})
+	end
+end
+
 function sql_rowset(...)
 
 	return virtual_rowset(function(rs, sql, ...)
@@ -127,6 +161,9 @@ function sql_rowset(...)
 
 		rs.manual_init_fields = true
 
+		local custom_load_rows = rs.load_rows or rs.select_all
+		local custom_load_row = rs.load_row or rs.select_row
+
 		--the rowset's pk cannot be reliably inferred so it must be user-supplied.
 
 		rs.pk = collect(words(rs.pk))
@@ -176,18 +213,77 @@ function sql_rowset(...)
 
 		local configure
 
+		local view_sql --paged select and count queries for a client view.
+
 		if not rs.load_rows then
 			assert(rs.select_all, 'select_all missing')
-			function rs:load_rows(res, param_vals)
+			--only the tables of the selected fields are tracked by the change
+			--log, so counts also expire to catch changes in joined tables.
+			local count_cache = lrucache_ffi{
+				max_count = rs.count_cache_size or 100,
+				max_age = rs.count_cache_max_age or 10,
+			}
+			local function load_page(db, res, param_vals, view)
+				if configure then
+					local _, fields = db:query(load_opt, rs.select_none, param_vals)
+					configure(fields)
+				end
+				if not view_sql then return false end
+				local sql, count_sql, offset = view_sql(db, view)
+				local rows, _, params = db:query(load_opt, sql, param_vals)
+				rs.params = rs.params or params
+				res.rows = rows
+				res.paged = true
+				res.offset = offset
+				if view.count then
+					local key = db:sqlquery(count_sql, param_vals)
+					local e = count_cache:get(key)
+					if not e or rs:changed_since(e.version) then
+						e = {n = db:first_row_vals(count_sql, param_vals),
+							version = res.version}
+						count_cache:put(key, e)
+					end
+					res.total = e.n
+				end
+			end
+			function rs:load_rows(res, param_vals, view)
 				local db = isfunc(rs.db) and rs.db(param_vals) or db(rs.db)
 				if rs.get_params then
 					param_vals = rs:get_params(param_vals)
 				end
+				if view and not custom_load_rows and rs.select
+					and load_page(db, res, param_vals, view) ~= false
+				then
+					return
+				end
 				local rows, fields, params = db:query(load_opt, rs.select_all, param_vals)
 				if configure then
 					configure(fields)
-					rs.params = params
 				end
+				rs.params = rs.params or params
+				res.rows = rows
+			end
+		end
+
+		local where_pks_sql --where clause to select rows by pk.
+
+		--delta loading: select the rows with the given pks that are
+		--still in the rowset.
+
+		if not custom_load_rows and rs.select then
+			function rs:load_changed_rows(res, param_vals, pks)
+				if not where_pks_sql then return false end
+				local db = isfunc(rs.db) and rs.db(param_vals) or db(rs.db)
+				if rs.get_params then
+					param_vals = rs:get_params(param_vals)
+				end
+				local rows = {}
+				each_batch(pks, function(pks)
+					local sql = outdent(rs.select) .. '\nwhere '
+						.. (rs.where_all and '('..rs.where_all..') and ' or '')
+						.. '(' .. where_pks_sql(db, pks) .. ')'
+					extend(rows, (db:query(load_opt, sql, param_vals)))
+				end)
 				res.rows = rows
 			end
 		end
@@ -208,6 +304,8 @@ function sql_rowset(...)
 		end
 
 		local rw_col_map
+		local update_col_map --{col->field_name} for update_table.
+		local update_ai_field --auto-increment field of update_table.
 
 		--[[local]] function configure(fields)
 
@@ -238,12 +336,174 @@ function sql_rowset(...)
 				return cat(t)
 			end
 
+			if rs.update_table then
+				local tbl = rs.update_table
+				local tdef = checkfound(db(rs.db):table_def(tbl))
+				local col_map = {} --{col->field_name} of all fields from tbl.
+				for i,f in ipairs(fields) do
+					if f.table == tdef.name and f.col then
+						col_map[f.col] = f.name
+					end
+				end
+				update_col_map = {}
+				if rs.update_cols then
+					for col in words(rs.update_cols) do
+						update_col_map[col] = col_map[col] or col
+					end
+				else
+					for i,f in ipairs(fields) do
+						if col_map[f.col] == f.name and not f.readonly then
+							update_col_map[f.col] = f.name
+						end
+					end
+				end
+				for i,f in ipairs(tdef.fields) do
+					if f.auto_increment then
+						update_ai_field = col_map[f.col] or f.col
+					end
+				end
+			end
+
+			local t = {} --pk columns, qualified.
+			for i, as_col in ipairs(rs.pk) do
+				local f = fields[as_col]
+				t[i] = f and f.table and f.col
+					and (f.table_alias or f.db..'.'..f.table)..'.'..f.col
+				if not t[i] then t = nil; break end
+			end
+			if rs.select and t then
+
+				local function field_expr(name)
+					local f = checkarg(fields[name], 'invalid field: %s', name)
+					return checkarg(f.table and f.col
+						and (f.table_alias or f.db..'.'..f.table)..'.'..f.col,
+						'not a table field: %s', name), f
+				end
+
+				local function filter_sql(db, filter)
+					checkarg(istab(filter), 'invalid filter')
+					local name, op, v = unpack(filter, 1, 3)
+					local expr, f = field_expr(name)
+					checkarg(filter_ops[op], 'invalid filter op: %s', op)
+					if op == 'null' then
+						return expr..' is null'
+					elseif op == 'not_null' then
+						return expr..' is not null'
+					elseif op == 'in' then
+						checkarg(istab(v) and #v > 0, 'invalid filter value')
+						local t = {}
+						for i,v in ipairs(v) do
+							t[i] = db:sqlval(v, f)
+						end
+						return expr..' in ('..cat(t, ', ')..')'
+					else
+						checkarg(v ~= nil and v ~= null and not istab(v), 'invalid filter value')
+						return expr..' '..op..' '..db:sqlval(v, f)
+					end
+				end
+
+				--keyset condition: (c1, c2, ...) > (v1, v2, ...) with each
+				--column's sort direction, as `c1 > v1 or (c1 = v1 and c2 > v2) ...`.
+				local function after_sql(db, exprs, descs, vals)
+					checkarg(istab(vals) and #vals == #exprs, 'invalid after')
+					local ors = {}
+					for i = 1, #exprs do
+						local ands = {}
+						for j = 1, i do
+							local v = vals[j]
+							checkarg(v ~= nil and v ~= null and not istab(v), 'invalid after')
+							local op = j < i and ' = ' or descs[j] and ' < ' or ' > '
+							ands[j] = exprs[j]..op..db:sqlval(v, exprs[exprs[j]])
+						end
+						ors[i] = '('..cat(ands, ' and ')..')'
+					end
+					return cat(ors, ' or ')
+				end
+
+				--[[local]] function view_sql(db, view)
+					checkarg(istab(view), 'invalid view')
+					local exprs, descs, order = {}, {}, {}
+					if view.order_by then
+						checkarg(isstr(view.order_by), 'invalid order_by')
+						for s in words(view.order_by) do
+							local name, dir = s:match'^(.-):(.*)$'
+							name = name or s
+							checkarg(not dir or dir == 'asc' or dir == 'desc',
+								'invalid sort direction: %s', dir)
+							local expr, f = field_expr(name)
+							add(exprs, expr)
+							exprs[expr] = f
+							descs[#exprs] = dir == 'desc'
+						end
+					end
+					local pk_sort = not (#exprs == 0 and rs.order_by)
+					if pk_sort then --pk makes the sort order total.
+						for i, as_col in ipairs(rs.pk) do
+							if not exprs[t[i]] then
+								add(exprs, t[i])
+								exprs[t[i]] = fields[as_col]
+							end
+						end
+						for i, expr in ipairs(exprs) do
+							order[i] = expr..(descs[i] and ' desc' or '')
+						end
+					else --no keyset paging with a custom order.
+						order[1] = rs.order_by
+					end
+					local wheres = {}
+					if rs.where_all then
+						add(wheres, '('..rs.where_all..')')
+					end
+					for _,filter in ipairs(view.filters or empty) do
+						add(wheres, '('..filter_sql(db, filter)..')')
+					end
+					local where = #wheres > 0 and '\nwhere '..cat(wheres, ' and ') or ''
+					local count_sql = 'select count(1) from (\n'
+						..outdent(rs.select)..where..'\n) t'
+					local offset = 0
+					if view.after then
+						checkarg(pk_sort, 'after not supported without order_by')
+						add(wheres, '('..after_sql(db, exprs, descs, view.after)..')')
+						where = '\nwhere '..cat(wheres, ' and ')
+					else
+						offset = max(0, floor(tonumber(view.offset) or 0))
+					end
+					local limit = min(rs.max_page_size or 1000,
+						max(0, floor(tonumber(view.limit) or 1/0)))
+					local sql = outdent(rs.select)..where
+						..'\norder by '..cat(order, ', ')
+						..'\nlimit '..limit
+						..(offset > 0 and ' offset '..offset or '')
+					return sql, count_sql, offset
+				end
+
+				--pks: {{v1,...},...} in rs.pk order.
+				--[[local]] function where_pks_sql(db, pks)
+					if #t == 1 then --single-column pk: `pk in (...)`.
+						local vals = {}
+						for i, pk in ipairs(pks) do
+							vals[i] = db:sqlval(pk[1], fields[rs.pk[1]])
+						end
+						return t[1]..' in ('..cat(vals, ', ')..')'
+					end
+					local ors = {}
+					for i, pk in ipairs(pks) do
+						local ands = {}
+						for j, as_col in ipairs(rs.pk) do
+							ands[j] = t[j]..' = '..db:sqlval(pk[j], fields[as_col])
+						end
+						ors[i] = '('..cat(ands, ' and ')..')'
+					end
+					return cat(ors, ' or ')
+				end
+			end
+
 			if not rs.load_row then
 				assert(rs.select, 'select missing to create load_row()')
 				local where_row = where_row_sql()
 				function rs:load_row(vals)
-					local sql = outdent(rs.select) .. (where_all
-						and format('\nwhere (%s) and (%s)', where_all, where_row)
+					local sql = outdent(rs.select) .. (rs.where_all
+						and format('\nwhere (%s) and (%s)', rs.where_all, where_row)
 						 or format('\nwhere %s', where_row))
 					return first_row(load_opt, sql, vals)
 				end
@@ -251,12 +511,30 @@ function sql_rowset(...)
 
 		end
 
+		--pks of a changed table row, old and new, for delta loading.
+		local function table_pks(db, tbl, vals, col_map, pks)
+			local tdef = db:table_def(tbl)
+			local map = istab(col_map) and col_map or empty
+			local n = #pks
+			for _,suffix in ipairs{'', ':old'} do
+				local t = {}
+				for _,col in ipairs(tdef.pk) do
+					local v = vals[(map[col] or col)..suffix]
+					if v == nil then t = nil; break end
+					t[col] = v
+				end
+				if t then add(pks, t) end
+			end
+			return #pks > n and pks or nil
+		end
+
 		function rs:insert_into(tbl, vals, col_map, opt)
 			local db = db(rs.db)
 			local id, ret = db:insert_row(tbl, vals, col_map or rw_col_map, opt)
 			if ret.affected_rows > 0 then
 				assert(ret.affected_schema == db.db)
-				self:table_changed(ret.affected_table)
+				self:table_changed(ret.affected_table,
+					table_pks(db, tbl, vals, col_map or rw_col_map, {}))
 			end
 			return id, ret
 		end
@@ -266,7 +544,8 @@ function sql_rowset(...)
 			local ret = db:update_row(tbl, vals, col_map or rw_col_map, security_filter, opt)
 			if ret.affected_rows > 0 then
 				assert(ret.affected_schema == db.db)
-				self:table_changed(ret.affected_table)
+				self:table_changed(ret.affected_table,
+					table_pks(db, tbl, vals, col_map or rw_col_map, {}))
 			end
 			return ret
 		end
@@ -276,13 +555,172 @@ function sql_rowset(...)
 			local id, ret = db:insert_or_update_row(tbl, vals, col_map or rw_col_map, opt)
 			if ret.affected_rows > 0 then
 				assert(ret.affected_schema == db.db)
-				self:table_changed(ret.affected_table)
+				self:table_changed(ret.affected_table,
+					table_pks(db, tbl, vals, col_map or rw_col_map, {}))
 			end
 			return id, ret
 		end
 
-		function rs:delete_from(tbl, ...)
-			return delete_row(tbl, ...)
+		function rs:delete_from(tbl, vals, col_map, security_filter, opt)
+			local db = db(rs.db)
+			local ret = db:delete_row(tbl, vals, col_map, security_filter, opt)
+			if ret.affected_rows > 0 then
+				assert(ret.affected_schema == db.db)
+				self:table_changed(ret.affected_table,
+					table_pks(db, tbl, vals, col_map, {}))
+			end
+			return ret
+		end
+
+		--batched updates.
+
+		if rs.update_table then
+
+			local tbl = rs.update_table
+
+			--changes can only be batched when they're made by the generated
+			--methods: custom ones can have their own logic for each row.
+			local batchable = not (rs.insert_row or rs.update_row or rs.delete_row)
+
+			if not rs.insert_row then
+				function rs:insert_row(vals)
+					self:insert_into(tbl, vals, update_col_map)
+				end
+			end
+			if not rs.update_row then
+				function rs:update_row(vals)
+					self:update_into(tbl, vals, update_col_map)
+				end
+			end
+			if not rs.delete_row then
+				function rs:delete_row(vals)
+					self:delete_from(tbl, vals, update_col_map)
+				end
+			end
+
+			--inserted rows are grouped by the columns they set so that the
+			--missing values get their defaults instead of null.
+			local function insert_groups(rows)
+				local groups = {}
+				for _,vals in ipairs(rows) do
+					local col_map, t = {}, {}
+					for col, name in sortedpairs(update_col_map) do
+						if vals[name] ~= nil then
+							col_map[col] = name
+							add(t, col)
+						end
+					end
+					local k = cat(t, ' ')
+					local g = groups[k]
+					if not g then
+						g = {col_map = col_map, rows = {}}
+						groups[k] = g
+						add(groups, g)
+					end
+					add(g.rows, vals)
+				end
+				return groups
+			end
+
+			if batchable then
+				function rs:apply_rows(rows)
+					local db = db(rs.db)
+					local inserts, updates, deletes = {}, {}, {}
+					for _,row in ipairs(rows) do
+						add(row.type == 'new' and inserts
+							or row.type == 'update' and updates
+							or deletes, row.values)
+					end
+					local ids = {} --{vals->id}, set after commit.
+					local affected_rows = 0
+					db:atomic(function()
+						for _,g in ipairs(insert_groups(inserts)) do
+							local gen_ids = update_ai_field and g.rows[1][update_ai_field] == nil
+							local step = gen_ids and db:insert_id_step()
+							if gen_ids and not step then --ids not predictable.
+								for _,vals in ipairs(g.rows) do
+									local id, ret = db:insert_row(tbl, update({}, vals), g.col_map)
+									ids[vals] = id
+									affected_rows = affected_rows + ret.affected_rows
+								end
+							else
+								each_batch(g.rows, function(rows)
+									local ret = db:insert_rows(tbl, rows, g.col_map)
+									if gen_ids then
+										for i,vals in ipairs(rows) do
+											ids[vals] = ret.insert_id + (i - 1) * step
+										end
+									end
+									affected_rows = affected_rows + ret.affected_rows
+								end)
+							end
+						end
+						each_batch(updates, function(rows)
+							local ret = db:update_rows(tbl, rows, update_col_map)
+							affected_rows = affected_rows + ret.affected_rows
+						end)
+						each_batch(deletes, function(rows)
+							local ret = db:delete_rows(tbl, rows, update_col_map)
+							affected_rows = affected_rows + ret.affected_rows
+						end)
+					end)
+					for vals, id in pairs(ids) do
+						vals[update_ai_field] = id
+					end
+					if affected_rows > 0 then
+						local pks = {}
+						for _,row in ipairs(rows) do
+							if not table_pks(db, tbl, row.values, update_col_map, pks) then
+								pks = nil
+								break
+							end
+						end
+						self:table_changed(db:table_def(tbl).name, pks)
+					end
+				end
+			end
+
+			function rs:reload_rows(rows)
+				if custom_load_row or not where_pks_sql then --call load_row() for each row.
+					local loaded_rows = {}
+					for i,row in ipairs(rows) do
+						loaded_rows[i] = rs:load_row(row.values) or false
+					end
+					return loaded_rows
+				end
+				local db = db(rs.db)
+				local pks, keys = {}, {}
+				for i,row in ipairs(rows) do
+					local pk = {}
+					for j, as_col in ipairs(rs.pk) do
+						pk[j] = row.values[as_col]
+					end
+					pks[i] = pk
+					keys[i] = cat(imap(pk, tostring), '\0')
+				end
+				--all rows carry the same params (see exec_save()), and like
+				--load_row() we only load back rows that are still in the rowset.
+				local param_vals = rows[1] and rows[1].values
+				local by_key = {}
+				each_batch(pks, function(pks)
+					local sql = outdent(rs.select) .. '\nwhere '
+						.. (rs.where_all and '('..rs.where_all..') and ' or '')
+						.. '(' .. where_pks_sql(db, pks) .. ')'
+					for _,row in ipairs(db:query(load_opt, sql, param_vals)) do
+						local t = {}
+						for j, as_col in ipairs(rs.pk) do
+							t[j] = tostring(row[rs.fields[as_col].index])
+						end
+						by_key[cat(t, '\0')] = row
+					end
+				end)
+				local loaded_rows = {}
+				for i in ipairs(rows) do
+					loaded_rows[i] = by_key[keys[i]] or false
+				end
+				return loaded_rows
+			end
+
 		end
 
 	end, ...)
@@ -16,7 +16,7 @@ FEATURES
 
 LIMITATIONS
 	* no LZMA or bzip2 (the binding supports it but the binary doesn't).
-	* no stream API (use temp files, it's ok).
+	* no stream API (use temp files, it's ok; see zip_stream.lua for writing).
 
 BROWSING
 	[try_]zip_open(opt | file,[mode],[passwd]) -> rz|wz
@@ -0,0 +1,210 @@
+--[=[
+
+	Memory-mapped zip archive reader for serving entries as they are stored.
+	Written by Cosmin Apreutesei. Public Domain.
+
+	Maps a zip file in memory and indexes its central directory so that an
+	entry's stored data can be accessed directly, without copying or inflating
+	it. A deflated entry can then be sent to a HTTP client that accepts gzip
+	by wrapping its raw DEFLATE data in a gzip header and trailer, the latter
+	being made from the entry's CRC-32 and size from the central directory.
+
+	[try_]zip_mmap_open(path) -> za         map a zip file and index its entries
+	za.entries -> {filename -> e}           entries (directories not included)
+	za:entry(filename) -> e | nil           find an entry
+		e.filename                           filename in the archive
+		e.compression_method                 'store' | 'deflate'
+		e.crc                                crc-32 of the uncompressed data
+		e.compressed_size                    size of the stored data
+		e.uncompressed_size                  size of the uncompressed data
+		e.mtime                              last modified time
+	za:data(e) -> p, len                    pointer to the entry's stored data
+	za:read(e | filename, [write]) -> s|true  read (and inflate) an entry
+	za:close()                              unmap the file
+	gzip_header([mtime]) -> s               gzip member header
+	gzip_trailer(crc, size) -> s            gzip member trailer
+
+	The pointer returned by data() is valid until the archive is closed.
+	If `write(buf, len)` is given, read() outputs the data in chunks instead
+	of returning it as a string (and doesn't verify the crc).
+
+LIMITATIONS
+	* no zip64, no encryption, only store and deflate methods.
+	* the file must not be modified while it is mapped (see fs.lua mmap).
+
+]=]
+
+if not ... then require'zip_mmap_test'; return end
+
+require'glue'
+require'gzip'
+require'fs'
+
+local band, shr = bit.band, bit.rshift
+local u8p = ffi.typeof'uint8_t*'
+
+local function u16(p, i)
+	return p[i] + p[i+1] * 0x100
+end
+
+local function u32(p, i)
+	return p[i] + p[i+1] * 0x100 + p[i+2] * 0x10000 + p[i+3] * 0x1000000
+end
+
+local function le32(n)
+	return char(band(n, 0xff), band(shr(n, 8), 0xff),
+		band(shr(n, 16), 0xff), band(shr(n, 24), 0xff))
+end
+
+function gzip_header(mtime)
+	--magic, deflate, no flags, mtime, no extra flags, unknown OS.
+	return '\x1f\x8b\x08\x00'..le32(mtime and floor(mtime) or 0)..'\x00\xff'
+end
+
+function gzip_trailer(crc, size)
+	return le32(crc)..le32(size % 2^32)
+end
+
+local function dos_time(time, date)
+	return os.time{
+		year  = shr(date, 9) + 1980,
+		month = band(shr(date, 5), 0x0f),
+		day   = band(date, 0x1f),
+		hour  = shr(time, 11),
+		min   = band(shr(time, 5), 0x3f),
+		sec   = band(time, 0x1f) * 2,
+	}
+end
+
+local methods = {[0] = 'store', [8] = 'deflate'}
+
+local za = {}
+
+local function parse(self)
+	local p, size = self.p, self.size
+	--find the end of central directory record, which is followed by a
+	--variable-length comment of at most 64K.
+	local eocd
+	for i = size - 22, max(0, size - 22 - 0xffff), -1 do
+		if u32(p, i) == 0x06054b50 then
+			eocd = i
+			break
+		end
+	end
+	if not eocd then
+		return nil, 'not a zip file'
+	end
+	local n = u16(p, eocd + 10)
+	local cd_size = u32(p, eocd + 12)
+	local i = u32(p, eocd + 16)
+	if n == 0xffff or i == 0xffffffff or i + cd_size > eocd then
+		return nil, 'zip64 not supported'
+	end
+	for _ = 1, n do
+		if i + 46 > eocd or u32(p, i) ~= 0x02014b50 then
+			return nil, 'invalid central directory'
+		end
+		local flags = u16(p, i + 8)
+		local method = u16(p, i + 10)
+		local dtime = u16(p, i + 12)
+		local ddate = u16(p, i + 14)
+		local crc = u32(p, i + 16)
+		local csize = u32(p, i + 20)
+		local usize = u32(p, i + 24)
+		local name_len = u16(p, i + 28)
+		local extra_len = u16(p, i + 30)
+		local comment_len = u16(p, i + 32)
+		local offset = u32(p, i + 42)
+		local filename = str(p + i + 46, name_len)
+		i = i + 46 + name_len + extra_len + comment_len
+		if csize == 0xffffffff or usize == 0xffffffff or offset == 0xffffffff then
+			return nil, 'zip64 not supported'
+		end
+		if not filename:find'/$' --skip directories
+			and band(flags, 1) == 0 --skip encrypted entries
+			and methods[method]
+		then
+			if offset + 30 > size or u32(p, offset) ~= 0x04034b50 then
+				return nil, 'invalid local header: '..filename
+			end
+			local data_offset = offset + 30 + u16(p, offset + 26) + u16(p, offset + 28)
+			if data_offset + csize > size then
+				return nil, 'truncated entry: '..filename
+			end
+			self.entries[filename] = {
+				filename = filename,
+				compression_method = methods[method],
+				crc = crc,
+				compressed_size = csize,
+				uncompressed_size = usize,
+				mtime = dos_time(dtime, ddate),
+				data_offset = data_offset,
+			}
+		end
+	end
+	return true
+end
+
+function try_zip_mmap_open(path)
+	local map, err = try_mmap(path)
+	if not map then return nil, err end
+	local self = object(za, {
+		path = path,
+		map = map,
+		p = cast(u8p, map.addr),
+		size = tonumber(map.size),
+		entries = {},
+	})
+	local ok, err = parse(self)
+	if not ok then
+		map:free()
+		return nil, err..': '..path
+	end
+	return self
+end
+
+function zip_mmap_open(...)
+	return assert(try_zip_mmap_open(...))
+end
+
+function za:entry(filename)
+	return self.entries[filename]
+end
+
+function za:data(e)
+	assert(self.map, 'archive closed')
+	return self.p + e.data_offset, e.compressed_size
+end
+
+function za:read(e, write)
+	e = isstr(e) and assert(self:entry(e), 'entry not found') or e
+	local p, len = self:data(e)
+	if e.compression_method == 'store' then
+		if not write then
+			return str(p, len)
+		end
+		if len > 0 then
+			write(p, len)
+		end
+		return true
+	end
+	local read_once = function()
+		if not p then return end
+		local p1 = p; p = nil
+		return p1, len
+	end
+	if write then
+		return assert(inflate(read_once, write, nil, 'raw'))
+	end
+	local s = assert(inflate(read_once, '', nil, 'raw'))
+	assert(#s == e.uncompressed_size and crc32(s) == e.crc,
+		'corrupt entry: '..e.filename)
+	return s
+end
+
+function za:close()
+	if not self.map then return end
+	self.map:free()
+	self.map = false
+	self.p = nil
+end
@@ -0,0 +1,447 @@
+--[=[
+
+	Streaming zip writer.
+	Written by Cosmin Apreutesei. Public Domain.
+
+	Writes a zip archive to an output function as it is being generated,
+	without seeking back: entries are written with a data descriptor after
+	their data (general purpose flag bit 3) so that the CRC and sizes don't
+	have to be known upfront. Use it to send zip-based documents (eg. xlsx)
+	directly to a socket or an http response, without a temp file.
+
+	zip_stream_writer(write, [opt]) -> zw   create a writer
+		write(buf, len)                      output function (eg. webb's `out`)
+		                                     or a socket, file or pbuffer
+		compression_level                    default compression level (6; 0..9)
+		threads                              compress entries in parallel (0)
+	zw:open_entry(filename | e) -> zw       start a new entry (closes the current one)
+		e.filename                           filename in the archive
+		e.mtime                              last modified time (time())
+		e.compression_level                  compression level (zw.compression_level)
+	zw:write(s | buf,len)                   write entry data
+	zw:close_entry()                        finish the current entry
+	zw:add_memfile(filename, data, [size])  add an entry from a string or buffer
+	zw:add_memfile{filename=, data=, [size=], ...}
+	zw:add_file(path, [filename | e])       add an entry from a file
+	zw:close()                              write the central directory
+	zw:free()                               stop workers and free buffers
+	zw.offset -> n                          bytes written so far
+
+PARALLEL COMPRESSION
+
+	With `threads = n`, entries added with add_memfile() and add_file() are
+	compressed on `n` worker threads (see os_thread.lua) while the finished
+	ones are written out in the order they were added. Up to `2 * n` entries
+	are kept in flight. Entries written with open_entry() & write() are still
+	compressed inline, after all the pending entries are written. Waiting for
+	workers blocks the calling OS thread, like compressing inline would,
+	except in sock threads, which poll for results every `zw.poll_interval`
+	seconds (5ms) so that other sock threads can run in the meantime.
+	Files are read and compressed in chunks, but memfile data is copied to
+	the worker and the compressed data of each entry is kept in memory until
+	it's written, so up to `2 * n` whole entries can be in memory at once.
+	close() stops the workers, and so does an error while writing finished
+	entries; call free() instead if you abandon the writer for other reasons
+	(eg. when write() or the output function fails), or the worker threads
+	will block forever.
+	Use os_thread_preload'gzip' and os_thread_prewarm() at startup
+	to avoid creating thread states on the first archive.
+
+LIMITATIONS
+	* no zip64: entries and the archive itself must be smaller than 4G.
+	* no encryption.
+
+]=]
+
+if not ... then require'zip_stream_test'; return end
+
+require'glue'
+require'gzip'
+require'fs'
+
+local band, shr = bit.band, bit.rshift
+
+local function le16(n)
+	return char(band(n, 0xff), band(shr(n, 8), 0xff))
+end
+
+local function le32(n)
+	return char(band(n, 0xff), band(shr(n, 8), 0xff),
+		band(shr(n, 16), 0xff), band(shr(n, 24), 0xff))
+end
+
+local function dos_time(t)
+	local d = os.date('*t', t)
+	local time = shr(d.sec, 1) + d.min * 32 + d.hour * 2048
+	local date = d.day + d.month * 32 + (max(d.year, 1980) - 1980) * 512
+	return time, date
+end
+
+local MAX32 = 0xffffffff
+local FLAGS = 0x0808 --data descriptor follows + utf8 filenames.
+local BUF_SIZE = 64 * 1024
+
+local zw = {}
+
+function zip_stream_writer(write, opt)
+	local self = object(zw, opt)
+	if not isfunc(write) then --socket, file or pbuffer.
+		local f = write
+		local method = f.write and 'write' or 'send'
+		write = function(buf, len) return f[method](f, buf, len) end
+	end
+	self.out = write
+	self.compression_level = self.compression_level or 6
+	self.threads = self.threads or 0
+	self.offset = 0
+	self.entries = {}
+	self.buf = string_buffer()
+	return self
+end
+
+function zw:_out(s, len)
+	len = len or #s
+	self.out(s, len)
+	self.offset = self.offset + len
+	if self.offset > MAX32 then
+		error'zip_stream: archive too large (no zip64 support)'
+	end
+end
+
+local function new_entry(self, e)
+	if isstr(e) then
+		e = {filename = e}
+	end
+	local level = e.compression_level or self.compression_level
+	local dtime, ddate = dos_time(e.mtime or time())
+	return {
+		filename = e.filename,
+		level = level,
+		method = level > 0 and 8 or 0,
+		time = dtime,
+		date = ddate,
+		crc = 0,
+		csize = 0,
+		usize = 0,
+	}
+end
+
+function zw:_write_header(e)
+	e.offset = self.offset
+	self:_out(cat{
+		le32(0x04034b50),
+		le16(20), le16(FLAGS), le16(e.method), le16(e.time), le16(e.date),
+		le32(0), le32(0), le32(0), --crc & sizes are in the data descriptor.
+		le16(#e.filename), le16(0),
+		e.filename,
+	})
+	add(self.entries, e)
+end
+
+function zw:_write_descriptor(e)
+	self:_out(cat{
+		le32(0x08074b50), le32(e.crc), le32(e.csize), le32(e.usize),
+	})
+end
+
+function zw:open_entry(e)
+	self:close_entry()
+	self:_flush_jobs(true)
+	local e = new_entry(self, e)
+	self:_write_header(e)
+	if e.method == 8 then
+		local level = e.level
+		if not self.deflater then
+			self.deflater = deflater('raw', level)
+			self.deflater_level = level
+		elseif self.deflater_level ~= level then
+			self.deflater:free()
+			self.deflater = deflater('raw', level)
+			self.deflater_level = level
+		else
+			self.deflater:reset()
+		end
+		self.write_compressed = self.write_compressed or function(buf, len)
+			local e = self.entry
+			e.csize = e.csize + len
+			self:_out(buf, len)
+		end
+	end
+	self.entry = e
+	return self
+end
+
+function zw:_flush(finish)
+	local e, buf = self.entry, self.buf
+	if #buf == 0 and not finish then return end
+	local p, len = buf:ref()
+	e.crc = crc32(p, len, e.crc)
+	e.usize = e.usize + len
+	if e.usize > MAX32 then
+		error'zip_stream: entry too large (no zip64 support)'
+	end
+	if e.method == 8 then
+		assert(self.deflater:push(p, len, finish and 'finish' or 'none',
+			self.write_compressed))
+	elseif len > 0 then
+		e.csize = e.csize + len
+		self:_out(p, len)
+	end
+	buf:reset()
+end
+
+function zw:write(s, len)
+	assert(self.entry, 'no entry opened')
+	local buf = self.buf
+	if len then
+		buf:putcdata(s, len)
+	else
+		buf:put(s)
+	end
+	if #buf >= BUF_SIZE then
+		self:_flush()
+	end
+end
+
+function zw:close_entry()
+	local e = self.entry
+	if not e then return end
+	self:_flush(true)
+	self:_write_descriptor(e)
+	self.entry = false
+end
+
+function zw:add_memfile(e, ...)
+	if isstr(e) then
+		local data, size = ...
+		e = {filename = e, data = data, size = size}
+	end
+	if self.threads > 0 and (e.compression_level or self.compression_level) > 0 then
+		local data = e.size and str(e.data, e.size) or e.data
+		self:_add_job(new_entry(self, e), {data = data})
+		return
+	end
+	self:open_entry(e)
+	self:write(e.data, e.size)
+	self:close_entry()
+end
+
+function zw:add_file(path, e)
+	e = isstr(e) and {filename = e} or e or {}
+	e.filename = e.filename or path
+	e.mtime = e.mtime or mtime(path)
+	if self.threads > 0 and (e.compression_level or self.compression_level) > 0 then
+		self:_add_job(new_entry(self, e), {file = path})
+		return
+	end
+	local f = open(path)
+	local ok, err = pcall(function()
+		self:open_entry(e)
+		local buf = u8a(BUF_SIZE)
+		while true do
+			local len = f:read(buf, BUF_SIZE)
+			if len == 0 then break end
+			self:write(buf, len)
+		end
+		self:close_entry()
+	end)
+	f:close()
+	assert(ok, err)
+end
+
+--parallel compression --------------------------------------------------------
+
+--runs in a worker thread: compress files or strings until getting `false`.
+--files are read and compressed in chunks; only the compressed data is kept.
+local function compress_worker(jobs, results)
+	require'glue'
+	require'gzip'
+	local zs, zs_level
+	while true do
+		local _, job = jobs:shift()
+		if not job then break end
+		local f
+		local ok, err = pcall(function()
+			if zs_level ~= job.level then
+				if zs then zs:free() end
+				zs, zs_level = deflater('raw', job.level), job.level
+			else
+				zs:reset()
+			end
+			local t = {}
+			local function collect(buf, len)
+				t[#t+1] = str(buf, len)
+			end
+			local crc, usize
+			local data = job.data
+			if data then
+				crc, usize = crc32(data), #data
+				assert(zs:push(data, usize, 'finish', collect))
+			else
+				f = assert(io.open(job.file, 'rb'))
+				crc, usize = crc32(''), 0
+				while true do
+					local s = f:read(64 * 1024)
+					if not s then break end
+					crc, usize = crc32(s, #s, crc), usize + #s
+					assert(zs:push(s, #s, 'none', collect))
+				end
+				f:close(); f = nil
+				assert(zs:push('', 0, 'finish', collect))
+			end
+			results:push{id = job.id, data = concat(t), crc = crc, usize = usize}
+		end)
+		if not ok then
+			if f then f:close() end
+			results:push{id = job.id, err = tostring(err)}
+		end
+	end
+	if zs then zs:free() end
+end
+
+function zw:_start_workers()
+	require'os_thread'
+	self.jobs = synchronized_queue()
+	self.results = synchronized_queue()
+	self.workers = {}
+	self.pending = {} --entries waiting to be written, in order.
+	self.done = {} --{job_id -> result}
+	self.job_id = 0
+	for i = 1, self.threads do
+		self.workers[i] = os_thread(compress_worker, self.jobs, self.results)
+	end
+end
+
+function zw:_add_job(e, job)
+	self:close_entry()
+	if not self.workers then
+		self:_start_workers()
+	end
+	--bound the number of entries kept in memory.
+	while #self.pending >= self.threads * 2 do
+		self:_flush_jobs(true, 1)
+	end
+	self.job_id = self.job_id + 1
+	e.job_id = self.job_id
+	job.id = self.job_id
+	job.level = e.level
+	add(self.pending, e)
+	self.jobs:push(job)
+	self:_flush_jobs(false)
+end
+
+zw.poll_interval = .005 --seconds between polls for results in sock threads.
+
+--wait for the next finished entry. In a sock thread we poll the results queue
+--and let other threads run in between instead of blocking the whole loop.
+local function wait_result(self)
+	local currentthread = rawget(_G, 'currentthread') --sock is loaded.
+	if currentthread and not select(2, currentthread()) then
+		while true do
+			local ok, r = self.results:shift(0)
+			if ok then return r end
+			wait(self.poll_interval)
+		end
+	end
+	local _, r = self.results:shift()
+	return r
+end
+
+--write out finished entries in the order they were added. If `wait` is true,
+--wait for and write at most `n` entries (all of them if `n` is not given).
+local function flush_jobs(self, pending, wait, n)
+	n = n or 1/0
+	while n > 0 and #pending > 0 do
+		local e = pending[1]
+		local r = self.done[e.job_id]
+		if r then
+			remove(pending, 1)
+			self.done[e.job_id] = nil
+			if r.err then
+				error(r.err, 0)
+			end
+			if r.usize > MAX32 or #r.data > MAX32 then
+				error'zip_stream: entry too large (no zip64 support)'
+			end
+			e.crc, e.usize, e.csize = r.crc, r.usize, #r.data
+			self:_write_header(e)
+			self:_out(r.data)
+			self:_write_descriptor(e)
+			n = n - 1
+		elseif self.results:length() > 0 then
+			local _, r = self.results:shift()
+			self.done[r.id] = r
+		elseif wait then
+			local r = wait_result(self)
+			self.done[r.id] = r
+		else
+			break
+		end
+	end
+end
+
+function zw:_flush_jobs(wait, n)
+	local pending = self.pending
+	if not pending then return end
+	local ok, err = pcall(flush_jobs, self, pending, wait, n)
+	if not ok then
+		self:free() --the archive is broken: don't leave the workers hanging.
+		error(err, 0)
+	end
+end
+
+function zw:_stop_workers()
+	if not self.workers then return end
+	while self.jobs:shift(0) do end --drop the jobs not yet started.
+	for i = 1, #self.workers do
+		self.jobs:push(false)
+	end
+	for _,th in ipairs(self.workers) do
+		th:join()
+	end
+	self.jobs:free()
+	self.results:free()
+	self.workers = false
+	self.pending = false
+	self.done = false
+end
+
+function zw:free()
+	self:_stop_workers()
+	if self.deflater then
+		self.deflater:free()
+		self.deflater = false
+	end
+end
+
+--central directory -----------------------------------------------------------
+
+function zw:close()
+	local ok, err = pcall(function()
+		self:close_entry()
+		self:_flush_jobs(true)
+	end)
+	self:free()
+	assert(ok, err)
+	local cd_offset = self.offset
+	local t = {}
+	for _,e in ipairs(self.entries) do
+		add(t, cat{
+			le32(0x02014b50),
+			le16(20), le16(20), le16(FLAGS), le16(e.method), le16(e.time), le16(e.date),
+			le32(e.crc), le32(e.csize), le32(e.usize),
+			le16(#e.filename), le16(0), le16(0), --extra & comment lengths.
+			le16(0), le16(0), le32(0), --disk number & file attributes.
+			le32(e.offset),
+			e.filename,
+		})
+	end
+	local cd = cat(t)
+	assert(#self.entries <= 0xffff, 'zip_stream: too many entries (no zip64 support)')
+	self:_out(cd)
+	self:_out(cat{
+		le32(0x06054b50), le16(0), le16(0),
+		le16(#self.entries), le16(#self.entries),
+		le32(#cd), le32(cd_offset), le16(0),
+	})
+end
@@ -431,3 +431,52 @@ test('suspended coroutines are garbage-collected', function()
 	co = nil
 	collectgarbage(); assert(not next(t))
 end)
+
+test('pooled coroutines are reused', function()
+	coroutine.max_pooled = 2
+	local th1 = coroutine.create_pooled(function(a, b)
+		return a + b
+	end)
+	local ok, ret = coroutine.resume(th1, 2, 3)
+	assert(ok and ret == 5)
+	assert(coroutine.status(th1) == 'dead')
+	local th2 = coroutine.create_pooled(function(a)
+		assert(coroutine.running() == th1)
+		local x = coroutine.yield(a * 2)
+		error(x)
+	end)
+	assert(th2 == th1)
+	assert(coroutine.status(th2) == 'suspended')
+	local ok, ret = coroutine.resume(th2, 21)
+	assert(ok and ret == 42)
+	local ok, err = coroutine.resume(th2, 'boom')
+	assert(not ok and err:find'boom')
+	assert(coroutine.status(th2) == 'dead')
+	assert(not pcall(coroutine.transfer, th2))
+	--transfer-based threads return to the pool too.
+	local parent = coroutine.running()
+	local th3 = coroutine.create_pooled(function(x)
+		return coroutine.finish(parent, x + 1)
+	end)
+	assert(th3 == th1)
+	assert(coroutine.transfer(th3, 1) == 2)
+	assert(coroutine.create_pooled(print) == th1)
+	--the pool is capped.
+	coroutine.max_pooled = 0
+	local th4 = coroutine.create_pooled(function() end)
+	assert(coroutine.resume(th4))
+	assert(coroutine.create_pooled(print) ~= th4)
+end)
+
+test('finishing into a pooled thread that finished is an error', function()
+	coroutine.max_pooled = 1
+	local th1 = coroutine.create_pooled(function() end)
+	assert(coroutine.resume(th1))
+	assert(coroutine.status(th1) == 'dead') --but suspended in the pool.
+	local th2 = coroutine.create(function()
+		return coroutine.finish(th1)
+	end)
+	local ok, err = pcall(coroutine.transfer, th2)
+	assert(not ok and err:find'dead coroutine')
+	coroutine.max_pooled = 0
+end)
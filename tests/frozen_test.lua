@@ -0,0 +1,92 @@
+require'unit'
+require'frozen'
+
+local t = {
+	1, 2.5, 'three', true, false, {x = 1},
+	a = 'A', b = {1, 2, {c = 'C'}}, [10] = 'ten', [-5] = 'minus five',
+	[2^40] = 'big', [0.5] = 'half', [true] = 'yes', [false] = 'no',
+	n = -2^31, m = 2^31, f = 1/0, e = '',
+}
+t.shared1 = t.b
+t.shared2 = t.b
+
+local fz = freeze(t)
+local v = fz.value
+assert(isfrozen(v))
+test(#v, 6)
+test(v[1], 1)
+test(v[2], 2.5)
+test(v[3], 'three')
+test(v[4], true)
+test(v[5], false)
+test(v[6].x, 1)
+test(v[7], nil)
+test(v.a, 'A')
+test(v.b[3].c, 'C')
+test(v[10], 'ten')
+test(v[10.0], 'ten')
+test(v[-5], 'minus five')
+test(v[2^40], 'big')
+test(v[0.5], 'half')
+test(v[true], 'yes')
+test(v[false], 'no')
+test(v.n, -2^31)
+test(v.m, 2^31)
+test(v.f, 1/0)
+test(v.e, '')
+test(v.missing, nil)
+test(v[0/0], nil)
+test(v[{}], nil)
+assert(v.shared1 == v.shared2) --stored once.
+assert(not pcall(function() v.a = 1 end))
+
+--int keys over the whole int32 range.
+local ti = {[2^31-1] = 1, [-2^31] = 2, [-1] = 3, [0] = 4}
+for i = 1, 1000 do
+	ti[math.random(-2^31, 2^31-1)] = i
+end
+local vi = freeze(ti).value
+for k, x in pairs(ti) do
+	test(vi[k], x)
+end
+
+--iteration and thawing.
+local n = 0
+for k, x in frozen_pairs(v) do
+	n = n + 1
+	if not isfrozen(x) then
+		test(x, t[k])
+	end
+end
+test(n, count(t))
+local n = 0
+for i, x in frozen_ipairs(v) do
+	n = n + 1
+	assert(i == n)
+end
+test(n, 6)
+local t2 = thaw(v)
+t.shared1 = nil; t.shared2 = nil; t2.shared1 = nil; t2.shared2 = nil
+test(t2, t)
+
+--scalars and reopening from a string.
+test(freeze'hello'.value, 'hello')
+test(freeze(42).value, 42)
+test(freeze(nil).value, nil)
+local s = freeze{k = 'v'}:tostring()
+local p = new('uint8_t[?]', #s)
+copy(p, s, #s)
+test(frozen(p, #s).value.k, 'v')
+
+--errors.
+assert(not pcall(freeze, {f = print}))
+local cyclic = {}; cyclic.self = cyclic
+assert(not pcall(freeze, cyclic))
+
+--big table lookups.
+local big = {}
+for i = 1, 10000 do big['key'..i] = i end
+local fz = freeze(big) --must be kept alive while using its tables.
+local fv = fz.value
+for i = 1, 10000 do assert(fv['key'..i] == i) end
+test(fv.key0, nil)
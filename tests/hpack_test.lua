@@ -0,0 +1,90 @@
+require'unit'
+require'hpack'
+
+local function decode(dec, hex)
+	local s = fromhex(hex)
+	local buf = new('uint8_t[?]', #s)
+	copy(buf, s, #s)
+	return dec:decode(buf, #s)
+end
+
+local function encode(enc, t)
+	local sb = string_buffer()
+	enc:encode(t, sb)
+	return tohex(sb:tostring())
+end
+
+--Huffman roundtrip on all byte values.
+local s = ''
+for i = 0, 255 do s = s .. string.char(i) end
+local sb = string_buffer()
+test(huffman_encode(s, sb), huffman_size(s))
+local p, n = sb:ref()
+local sb2 = string_buffer()
+assert(huffman_decode(p, n, sb2))
+test(sb2:tostring(), s)
+
+--RFC 7541 C.4: requests with Huffman coding.
+local dec = hpack_decoder()
+test(decode(dec, '828684418cf1e3c2e5f23a6ba0ab90f4ff'), {
+	':method', 'GET', ':scheme', 'http', ':path', '/',
+	':authority', 'www.example.com'})
+test(decode(dec, '828684be5886a8eb10649cbf'), {
+	':method', 'GET', ':scheme', 'http', ':path', '/',
+	':authority', 'www.example.com', 'cache-control', 'no-cache'})
+test(decode(dec, '828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf'), {
+	':method', 'GET', ':scheme', 'https', ':path', '/index.html',
+	':authority', 'www.example.com', 'custom-key', 'custom-value'})
+test(dec.size, 164)
+
+--RFC 7541 C.6: responses with Huffman coding and evictions.
+local dec = hpack_decoder(256)
+test(decode(dec, '488264025885aec3771a4b6196d07abe941054d444a8200595040b'
+	..'8166e082a62d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3'), {
+	':status', '302', 'cache-control', 'private',
+	'date', 'Mon, 21 Oct 2013 20:13:21 GMT',
+	'location', 'https://www.example.com'})
+test(decode(dec, '4883640effc1c0bf'), {
+	':status', '307', 'cache-control', 'private',
+	'date', 'Mon, 21 Oct 2013 20:13:21 GMT',
+	'location', 'https://www.example.com'})
+test(decode(dec, '88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a'
+	..'839bd9ab77ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1ab27'
+	..'0fb5291f9587316065c003ed4ee5b1063d5007'), {
+	':status', '200', 'cache-control', 'private',
+	'date', 'Mon, 21 Oct 2013 20:13:22 GMT',
+	'location', 'https://www.example.com', 'content-encoding', 'gzip',
+	'set-cookie', 'foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1'})
+test(dec.size, 215)
+
+--errors.
+test(select(2, decode(hpack_decoder(), '80')), 'invalid index')
+test(select(2, decode(hpack_decoder(), 'be')), 'invalid index')
+test(select(2, decode(hpack_decoder(), '3fe21f')), 'invalid table size')
+
+--encoder/decoder roundtrip with dynamic table and size updates.
+local enc, dec = hpack_encoder(), hpack_decoder()
+local t = {
+	':status', '200', 'content-type', 'text/html', 'x-custom', 'value',
+	'set-cookie', 'a=1', 'set-cookie', 'b=2', 'content-length', '1234',
+}
+local function roundtrip(t)
+	local s = fromhex(encode(enc, t))
+	local buf = new('uint8_t[?]', #s)
+	copy(buf, s, #s)
+	test(dec:decode(buf, #s), t)
+	return #s
+end
+local n1 = roundtrip(t)
+local n2 = roundtrip(t)
+assert(n2 < n1) --second time around it's mostly indices.
+enc:set_max_table_size(64)
+roundtrip(t)
+test(enc.size, dec.size)
+
+--shrinking and growing between blocks signals the smallest size first.
+enc:set_max_table_size(0)
+enc:set_max_table_size(4096)
+test(encode(enc, {}), '203fe11f')
+enc:set_max_table_size(4096) --no change, no update.
+test(encode(enc, {}), '')
@@ -0,0 +1,61 @@
+require'unit'
+require'http_parser'
+
+local hp = http_head_parser(4)
+
+local function parse(s, response)
+	local buf = new('uint8_t[?]', #s)
+	copy(buf, s, #s)
+	return hp:parse(buf, #s, response)
+end
+
+--request head, fed byte by byte.
+local s = 'GET /a/b?x=1 HTTP/1.1\r\n'
+	..'Host: example.com\r\n'
+	..'X-Some-Header:   a  b\t c   \r\n'
+	..' folded  \r\n'
+	..'Set-Cookie: a=1\r\n'
+	..'set-cookie: b=2\r\n'
+	..'\r\nbody'
+for i = 1, #s-5 do
+	test(parse(s:sub(1, i)), 0)
+end
+test(parse(s), #s - 4)
+test({hp:line()}, {'GET', '/a/b?x=1', '1.1'})
+local t = hp:rawheaders()
+test(t.host, 'example.com')
+test(t['x-some-header'], 'a b c folded')
+test(t['set-cookie'], {'a=1', 'b=2'})
+test(t.missing, nil)
+local n = 0
+for k in pairs(t) do n = n + 1 end
+test(n, 3)
+
+--response head with folded duplicate headers.
+assert(parse('HTTP/1.1 404 Not Found\r\nA: 1\r\nA: 2\r\nEmpty:\r\n\r\n', true) > 0)
+test({hp:line()}, {'1.1', 404, 'Not Found'})
+test(hp:rawheaders().a, '1,2')
+test(hp:rawheaders().empty, '')
+
+--the headers of a previous message are still valid.
+test(t.host, 'example.com')
+
+--the search for the end of the head resumes where it stopped.
+local s = 'GET / HTTP/1.1\r\nA: 1\r\n\r'
+test(parse(s), 0)
+test(hp.h.scanned, #s - 3)
+test(parse(s..'\n'), #s + 1)
+test(hp.h.scanned, 0)
+test(hp:rawheaders().a, '1')
+
+--errors.
+test({parse('GET / HTTP/1.1\r\nHost : x\r\n\r\n')}, {nil, 'invalid header'})
+test({parse('GET / HTTP/1.1\r\nHost\t: x\r\n\r\n')}, {nil, 'invalid header'})
+test({parse('get / HTTP/1.1\r\n\r\n')}, {nil, 'invalid request line'})
+test({parse('GET / HTTP/1.1\r\nNo Colon\r\n\r\n')}, {nil, 'invalid header'})
+test({parse('GET / HTTP/1.1\r\nA: \1\r\n\r\n')}, {nil, 'invalid header'})
+test({parse('GET / HTTP/1.1\r\nA:1\r\nB:2\r\nC:3\r\nD:4\r\nE:5\r\n\r\n')},
+	{nil, 'too many headers'})
+test({parse('GARBAGE\r\n\r\n', true)}, {nil, 'invalid status line'})
+
+print'ok'
@@ -1,6 +1,68 @@
 --go@ plink d10 -t -batch sdk/bin/linux/luajit sdk/tests/http_server_test.lua
 require'glue'
 require'http_server'
+
+--timeouts and load shedding, over the loopback interface.
+run(function()
+	local port = 18082
+	local server = http_server{
+		listen = {{host = 'localhost', addr = '127.0.0.1', port = port}},
+		header_timeout = .2,
+		body_timeout = .2,
+		idle_timeout = .2,
+		respond = function(req)
+			local body = req:read_body'string'
+			--the body deadline only covers reading the body.
+			assert(not req.http.f.recv_expires)
+			wait(.3)
+			req:respond{content = body}
+		end,
+	}
+	--send a request and read the reply until the server closes the connection.
+	local function exchange(s, port1)
+		local c = connect('127.0.0.1', port1 or port)
+		c:send(s)
+		local t = {}
+		local buf = u8a(4096)
+		while true do
+			local n = c:try_recv(buf, 4096)
+			if not n or n == 0 then break end
+			add(t, str(buf, n))
+		end
+		c:close()
+		return cat(t)
+	end
+	local function status(s) return tonumber(s:match'^HTTP/1%.1 (%d+)') end
+	local function body(s) return s:match'\r\n\r\n(.*)' end
+
+	--a slow handler after the body was read, then closed when idle.
+	local s = exchange'POST / HTTP/1.1\r\nHost: x\r\nContent-Length: 5\r\n\r\nhello'
+	test(status(s), 200)
+	test(body(s), 'hello')
+
+	--closed when the head or the body doesn't arrive in time.
+	test(exchange'POST / HTTP/1.1\r\nHost: x\r\n', '')
+	test(exchange'POST / HTTP/1.1\r\nHost: x\r\nContent-Length: 5\r\n\r\nhe', '')
+
+	--new connections get a 503 while the event loop is lagging.
+	local port2 = port + 1
+	local server2 = http_server{
+		listen = {{host = 'localhost', addr = '127.0.0.1', port = port2}},
+		max_loop_lag = .5,
+		respond = function(req) req:respond{content = 'ok'} end,
+	}
+	server2.loop_lag = 1
+	local s = exchange('GET / HTTP/1.1\r\nHost: x\r\n\r\n', port2)
+	test(status(s), 503)
+	test(server2.shed_count, 1)
+
+	for _,server in ipairs{server, server2} do
+		server:stop()
+		for _,s in ipairs(server.sockets) do s:close() end
+	end
+end)
+
+--manual testing with a browser.
 logging.debug = true
 local zero6 = Linux
 
@@ -0,0 +1,63 @@
+require'unit'
+require'json'
+
+--json_encode_stream --------------------------------------------------------
+
+--encode with a small chunk size so that write() gets called a lot.
+local function stream(v, chunk_size)
+	local t = {}
+	local tail = json_encode_stream(v, function(buf, len)
+		assert(len >= chunk_size)
+		add(t, str(buf, len))
+	end, chunk_size)
+	add(t, tail)
+	return cat(t), #t - 1
+end
+
+--lazy array yielding the elements of t.
+local function lazy(t)
+	local i = 0
+	return function()
+		i = i + 1
+		return t[i]
+	end
+end
+
+local rows = {}
+for i = 1, 100 do
+	rows[i] = {i, 'row '..i, i % 3 == 0 and null or i / 4, {a = i, b = {i, i}}}
+end
+
+for _,v in ipairs{
+	42, 'hello', true, null,
+	{}, json_asarray{}, {{}}, {x = {}}, {json_asarray{}, {y = json_asarray{}}},
+	{1, 2, 3}, {a = 1, b = 'b', c = {d = {e = {1, {f = null}}}}},
+	{1, nil, {x = 1}, nil, {2}}, --sparse
+	{[2] = {1}, [5] = 'x'}, --sparse, starting with holes
+	json_asarray{{1}, nil, {2}}, --sparse asarray
+	{[0] = {1}, [1] = 2}, --non-array numeric keys
+	rows,
+} do
+	local s = json_encode(v)
+	for _,chunk_size in ipairs{1, 7, 64, 64 * 1024} do
+		test((stream(v, chunk_size)), s)
+	end
+end
+
+--big output goes through write(), small output is returned whole.
+local s, n = stream(rows, 64)
+assert(n > 10)
+local s, n = stream(rows, 1024 * 1024)
+assert(n == 0)
+
+--lazy arrays, at top level and nested, encode like the arrays they yield.
+test((stream(lazy(rows), 16)), json_encode(rows))
+test((stream(lazy{}, 16)), '[]')
+local t = {rows = rows, n = 100}
+local s = json_encode(t)
+t.rows = lazy(rows) --same key, so same pairs() order.
+test((stream(t, 16)), s)
+test((stream({lazy{1, lazy{2, 3}}, lazy{}}, 1)), '[[1,[2,3]],[]]')
+
+--collecting the whole output (write is never called).
+test(json_encode_stream({rows = lazy(rows)}, nil, 1/0), json_encode{rows = rows})
@@ -0,0 +1,66 @@
+require'unit'
+require'lrucache_ffi'
+
+local now = 0
+local cache = lrucache_ffi{max_count = 3, clock = function() return now end}
+
+--replacing a value keeps the count and size right.
+cache:put('k1', 1)
+cache:put('k1', 2)
+cache:put('k1', 3)
+test(cache:count(), 1)
+test(cache.total_size, 1)
+test(cache:get'k1', 3)
+
+--LRU eviction by count.
+cache:put('k2', 'v2')
+cache:put('k3', false) --any value type.
+cache:get'k1' --k2 is now the least recently used.
+cache:put('k4', 'v4')
+test(cache:get'k2', nil)
+test(cache:get'k1', 3)
+test(cache:get'k3', false)
+test(cache.evictions, 1)
+test(cache:count(), 3)
+
+--expiry.
+cache:put('k2', 'v2', 10)
+now = 9
+test(cache:get'k2', 'v2')
+now = 10
+test(cache:get'k2', nil)
+test(cache.expirations, 1)
+
+--removal.
+test(cache:get'k4', nil) --evicted by k2.
+test(cache:remove'k1', 3)
+test(cache:remove_val(false), 'k3')
+test(cache:remove_last(), nil)
+test(cache:count(), 0)
+
+--remove_val() after the value was replaced or put under another key.
+cache:put('a', 'x')
+cache:put('a', 'y')
+test(cache:remove_val'x', nil)
+cache:put('b', 'y')
+test(cache:remove_val'y', 'b')
+test(cache:remove_val'y', nil) --'a' still holds it but isn't indexed.
+test(cache:remove'a', 'y')
+test(cache:count(), 0)
+
+--size limit and node pool growth.
+local cache = lrucache_ffi{max_size = 1000, max_count = 1e5}
+function cache:value_size(s) return #s end
+for i = 1, 1000 do
+	cache:put(i, ('x'):rep(i % 10))
+end
+assert(cache.total_size <= 1000)
+test(cache:get(1000), '')
+test(cache:get(999), ('x'):rep(9))
+local cache = lrucache_ffi{max_count = 1e5}
+for i = 1, 1e5 do cache:put(i, i) end
+test(cache.capacity, 1e5)
+cache:put(0, 0)
+test(cache:count(), 1e5)
+test(cache:get(1), nil)
+test(cache:get(0), 0)
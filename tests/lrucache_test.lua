@@ -0,0 +1,45 @@
+require'unit'
+require'lrucache'
+
+local now = 0
+local cache = lrucache{max_size = 3, clock = function() return now end}
+
+local k1, k2, k3, k4 = 'k1', 'k2', 'k3', 'k4'
+local v1, v2, v3, v4 = {}, {}, {}, {}
+
+--replacing a value keeps the size right.
+cache:put(k1, v1)
+cache:put(k1, v2)
+cache:put(k1, v3)
+test(cache:count(), 1)
+test(cache.total_size, 1)
+test(cache:get(k1) == v3, true)
+
+--LRU eviction.
+cache:put(k2, v2)
+cache:put(k3, v1)
+cache:get(k1) --k2 is now the least recently used.
+cache:put(k4, v4)
+test(cache:get(k2), nil)
+test(cache:get(k1) == v3, true)
+test(cache.evictions, 1)
+test(cache:count(), 3)
+
+--expiry.
+cache:put(k2, v2, 10)
+now = 9
+test(cache:get(k2) == v2, true)
+now = 10
+test(cache:get(k2), nil)
+test(cache.expirations, 1)
+test(cache:count(), 2)
+
+--default max_age.
+cache.max_age = 5
+cache:put(k2, v2)
+now = 15
+test(cache:get(k2), nil)
+test(cache.expirations, 2)
+
+test(cache.hits, 4)
+test(cache.misses, 3)
@@ -274,3 +274,24 @@ local v1 = tohex(b:tostring())
 assert(v0 == v1)
 
 print'ok'
+
+--timestamps round-trip through all three encodings.
+for _,ts in ipairs{0, 1700000000, 1700000000.25, 2^33 + .5, -1.5, 2^35} do
+	local s = mp:encoding_buffer():encode_timestamp(ts):tostring()
+	local _, v = mp:decode_next(s, #s)
+	assert(math.abs(v - ts) < 1e-6)
+end
+
+--typed arrays and nil_value.
+local NULL = {}
+local mp = msgpack{nil_value = NULL}
+local b = mp:encoding_buffer():encode_f64_array({1, NULL, 2.5}, 3, NULL)
+local s = b:tostring()
+assert(#s == 2 + 3 * 8)
+local _, s1 = mp:decode_next(s, #s)
+local a = ffi.cast('double*', s1)
+assert(a[0] == 1 and a[1] ~= a[1] and a[2] == 2.5)
+local s = mp:encoding_buffer():encode(mp.array(NULL)):tostring()
+assert(s == '\x91\xc0')
+
+print'ok'
@@ -72,14 +72,19 @@ local function test_dump()
 		'  {{>nope}}\n  {{hei}} there {{#cowboy}}inside{{/cowboy}}'..
 		'{{=<% %>=}}  <%^cow%>outside<%/cow%>')
 	print()
+	print(mustache_lua('{{#list}}{{a.b}}{{^c}}-{{/c}}{{/list}}{{{d}}}'))
+	print()
 end
 
 local function test_basic()
 	local function test(template, view, expected)
-		local result = mustache_render(template, view)
-		if result == expected then return end
-		local pp = require'pp'
-		error(string.format('%s ~= %s', pp.format(result), pp.format(expected)))
+		for _,render in ipairs{mustache_render, mustache_interpret} do
+			local result = render(template, view)
+			if result ~= expected then
+				local pp = require'pp'
+				error(string.format('%s ~= %s', pp.format(result), pp.format(expected)))
+			end
+		end
 	end
 	test('', nil, '') --empty string, no view
 	test('{{#.}}{{.}}{{/.}}', {}, '') --empty list
@@ -88,6 +93,20 @@ local function test_basic()
 		{[5] = 'x', [6] = 'y'}, 'xy') --non-empty sparse list
 	test('{{x}}', {x=false}, 'false') --non-string values
 	test('{{#a}}{{#b}}{{c}}{{/b}}{{/a}}', {c=5,a={b={d=1}}}, '5') --inheritance
+	test('{{#a}}{{#.}}<{{.}}>{{/.}}{{/a}}', {a={{1,2},{3}}}, '<1><2><3>') --nested lists
+	test('{{a.b.c}}|{{a.x.c}}', {a={b={c='&'}}}, '&amp;|') --paths
+	test('{{^a}}{{b}}{{/a}}', {a=0, b='x'}, 'x') --inverted, falsey
+
+	--indented partials are compiled once and kept by the compiled partial.
+	local p = mustache_compile'{{x}}\n{{y}}\n'
+	for _,render in ipairs{mustache_render, mustache_interpret} do
+		local s = render('  {{>p}}\n', {x=1, y=2}, {p = p})
+		assert(s == '  1\n  2\n')
+	end
+	local ip = p.indented['  ']
+	collectgarbage()
+	mustache_render('  {{>p}}\n', {x=1, y=2}, {p = p})
+	assert(p.indented['  '] == ip)
 end
 
 local function test_errors()
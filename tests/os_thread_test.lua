@@ -82,6 +82,25 @@ local function test_thread_creation()
 	printtime('threads', n, dt)
 end
 
+local function test_recycled_thread_creation()
+	os_thread_free_states()
+	os_thread_preload('heap', function()
+		for i = 1, 1000 do local _ = tostring(i) end
+	end)
+	os_thread_prewarm(2)
+	local t0 = clock()
+	local n = 100
+	for i=1,n do
+		assert(os_thread(function(i) return i * 2 end, i):join() == i * 2)
+	end
+	local dt = clock() - t0
+	printtime('pooled threads', n, dt)
+	assert(not pcall(function()
+		os_thread(function() error'boom' end):join()
+	end))
+	assert(os_thread(function() return heap ~= nil end):join())
+end
+
 --pn/pm/cn/cm: producer/consumer threads/messages
 local function test_queue(qsize, pn, pm, cn, cm, msg)
 
@@ -140,6 +159,7 @@ end
 test_pthread_creation() --TODO: this crashes on mingw64 !!!
 test_luastate_creation()
 test_thread_creation()
+test_recycled_thread_creation()
 test_queue(1000, 10,  1000, 10,  1000)
 test_queue(1000,  1, 10000,  1, 10000)
 test_queue(1000,  1, 10000, 10,  1000)
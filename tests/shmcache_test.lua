@@ -0,0 +1,64 @@
+require'unit'
+require'shmcache'
+
+local cache = shmcache{size = 1024 * 1024, shards = 2, chunk_size = 64}
+
+--put/get/remove, including values spanning multiple chunks.
+local big = ('x'):rep(1000)
+assert(cache:put('a', '1'))
+assert(cache:put('b', big))
+assert(cache:put('', 'empty key'))
+test(cache:get'a', '1')
+test(cache:get'b', big)
+test(cache:get'', 'empty key')
+test(cache:get'c', nil)
+assert(cache:put('a', '2'))
+test(cache:get'a', '2')
+test(cache:count(), 3)
+test(cache:remove'a', true)
+test(cache:remove'a', false)
+test(cache:get'a', nil)
+test(cache:count(), 2)
+
+--expiry.
+assert(cache:put('e', 'v', -1))
+test(cache:get'e', nil)
+test(cache:stats().expirations, 1)
+
+--too big for a shard.
+test(cache:put('z', ('z'):rep(1024 * 1024)), false)
+
+--eviction keeps the cache within its limits and recently used values in.
+for i = 1, 20000 do
+	assert(cache:put('k'..i, ('v'):rep(i % 300)..i))
+	if i % 10 == 0 then
+		test(cache:get'b', big)
+	end
+end
+test(cache:get'b', big)
+test(cache:get'k20000', ('v'):rep(20000 % 300)..20000)
+local st = cache:stats()
+assert(st.evictions > 0)
+assert(st.count < 20000)
+test(st.count, cache:count())
+
+--a second mapping of the same named memory sees the same data.
+local name = 'shmcache_test_'..math.random(1e9)
+local c1 = shmcache{name = name, create = true, size = 1024 * 1024}
+local c2 = shmcache{name = name}
+c1:put('k', 'v')
+test(c2:get'k', 'v')
+c2:remove'k'
+test(c1:get'k', nil)
+test(c1:stats().hits, 1)
+c2:free()
+c1:free()
+c1:unlink()
+
+--values of other types with serializers.
+local cache = shmcache{size = 1024 * 1024, encode = tostring, decode = tonumber}
+cache:put('n', 42)
+test(cache:get'n', 42)
+cache:clear()
+test(cache:count(), 0)
+test(cache:get'n', nil)
@@ -134,6 +134,153 @@ local function test_http()
 	pr('start', start())
 end
 
+local function same(t1, t2)
+	if type(t1) ~= 'table' then return t1 == t2 end
+	for k,v in pairs(t1) do if t2[k] ~= v then return false end end
+	for k,v in pairs(t2) do if t1[k] ~= v then return false end end
+	return true
+end
+
+local function test_chan()
+	run(function()
+		--buffered: send doesn't wait until full.
+		local c = chan(2)
+		assert(c:send(1))
+		assert(c:send(2))
+		assert(c:count() == 2)
+		assert(same({c:send(3, 0)}, {nil, 'timeout'}))
+		assert(c:recv() == 1)
+		assert(c:recv() == 2)
+		assert(same({c:recv(clock() + .1)}, {nil, 'timeout'}))
+
+		--backpressure: a producer on a small channel feeding a consumer.
+		local c = chan(1)
+		local got = {}
+		local ts = threadset()
+		resume(ts:thread(function()
+			for i = 1, 100 do assert(c:send(i)) end
+			c:close()
+		end))
+		resume(ts:thread(function()
+			while true do
+				local v, err = c:recv()
+				if not v then assert(err == 'closed'); break end
+				add(got, v)
+			end
+		end))
+		ts:join()
+		assert(#got == 100)
+		for i = 1, 100 do assert(got[i] == i) end
+		assert(same({c:send(1)}, {nil, 'closed'}))
+
+		--unbuffered: the sender waits for the receiver.
+		local c = chan()
+		local sent
+		resume(thread(function()
+			sent = c:send'hi'
+		end))
+		assert(not sent)
+		assert(c:recv() == 'hi')
+		assert(sent)
+
+		--select.
+		local c1, c2 = chan(), chan(1)
+		resume(thread(function()
+			wait(.05)
+			c2:send'two'
+		end))
+		local c, v = chan_select(c1, c2)
+		assert(c == c2 and v == 'two')
+		assert(same({chan_select(c1, c2, clock() + .05)}, {nil, 'timeout'}))
+		resume(thread(function() c1:close() end))
+		local c, v, err = chan_select(c1, c2)
+		assert(c == c1 and v == nil and err == 'closed')
+		assert(#c1.recvq + #c2.recvq == 0)
+
+		--closing wakes up waiting senders.
+		local c = chan(0)
+		local ret
+		resume(thread(function() ret = {c:send(1)} end))
+		c:close()
+		assert(same(ret, {nil, 'closed'}))
+	end)
+	pr'chan ok'
+end
+
+local function test_udp_batch()
+	run(function()
+		local a = udp(); a:bind('127.0.0.1', 47001)
+		local b = udp(); b:bind('127.0.0.1', 47002)
+		local ai = a:addr('127.0.0.1', 47002)
+		local sb = udp_batch(8, 64)
+		for i = 1, 5 do sb:set(i, 'msg'..i, nil, ai) end
+		assert(a:sendmmsg(sb) == 5)
+		local rb = udp_batch(8, 64)
+		b:settimeout(1)
+		local n = b:recvmmsg(rb)
+		assert(n >= 1 and n <= 5)
+		for i = 1, n do
+			local p, len = rb:buf(i)
+			assert(str(p, len) == 'msg'..i)
+			assert(rb:addr(i):tostring() == '127.0.0.1:47001')
+			sb:set(i, 'ack'..i, nil, rb:addr(i)) --reply to sender.
+		end
+		assert(b:sendmmsg(sb, n) == n)
+		a:settimeout(1)
+		assert(a:recvmmsg(rb) >= 1)
+		assert(str(rb:buf(1)) == 'ack1')
+		a:close()
+		b:close()
+	end)
+	pr'udp batch ok'
+end
+
+local function test_loop_stats()
+	run(function()
+		loop_stats_start()
+		resume(thread(function()
+			for i = 1, 3 do
+				wait(.05)
+				local t0 = clock()
+				while clock() - t0 < .02 do end --block the loop.
+			end
+		end, 'blocker'))
+		wait(.5)
+		local t = loop_stats(true)
+		assert(t.enabled)
+		assert(t.iterations > 0)
+		assert(t.timers >= 4)
+		assert(t.max_lag >= .02)
+		assert(t.threads.blocker.wakeups == 3)
+		assert(t.threads.blocker.time >= .06)
+		assert(loop_stats().iterations == 0)
+		loop_stats_stop()
+		assert(not loop_stats().enabled)
+	end)
+	pr'loop stats ok'
+end
+
+local function test_pooled_threads()
+	run(function()
+		--pooled threads are reused and start with a clean threadenv.
+		local th1 = pooled_thread(function()
+			ownthreadenv().x = 1
+		end)
+		resume(th1)
+		assert(threadstatus(th1) == 'dead')
+		local th2 = pooled_thread(function()
+			assert(not ownthreadenv(nil, false))
+		end)
+		assert(th2 == th1)
+		resume(th2)
+		--plain threads are not.
+		local th3 = thread(function() end)
+		resume(th3)
+		assert(thread(function() end) ~= th3)
+	end)
+	pr'pooled threads ok'
+end
+
 local function test_timers()
 	run(function()
 		local i = 1
@@ -148,6 +295,10 @@ local function test_timers()
 	end)
 end
 
+test_chan()
+test_udp_batch()
+test_loop_stats()
+test_pooled_threads()
 test_timers()
 test_addr()
 test_sockopt()
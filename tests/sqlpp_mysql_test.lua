@@ -129,4 +129,121 @@ run(function()
 
 	end
 
+	--copy_table with keyset paging on a composite pk and with limit/offset
+	--paging on a table without a pk, both over several pages.
+	do
+		cmd:query'create database if not exists sp_copy'
+		local dst_opt = {
+			host = '10.0.0.5',
+			port = 3307,
+			user = 'root',
+			pass = 'root',
+			db = 'sp_copy',
+			charset = 'utf8mb4',
+		}
+		local dst = spp.connect(dst_opt)
+		for _,c in ipairs{cmd, dst} do
+			c:query'drop table if exists copy_pk'
+			c:query'drop table if exists copy_nopk'
+			c:query'create table copy_pk (a int, b int, s varchar(10), primary key (a, b))'
+			c:query'create table copy_nopk (a int, s varchar(10))'
+		end
+		local t1, t2 = {}, {}
+		for i = 1, 50 do
+			add(t1, fmt("(%d, %d, 's%d')", i % 5, i, i))
+			add(t2, fmt("(%d, 's%d')", i % 7, i % 3)) --with duplicate rows.
+		end
+		cmd:query('insert into copy_pk values '..cat(t1, ','))
+		cmd:query('insert into copy_nopk values '..cat(t2, ','))
+
+		assert(cmd:copy_table('copy_pk', dst, {page_size = 7, pk = 'a b'}) == 50)
+		assert(cmd:copy_table('copy_nopk', dst, {page_size = 7, pk = false}) == 50)
+
+		for _,tbl in ipairs{'copy_pk', 'copy_nopk'} do
+			local sql = 'select * from '..tbl..' order by 1, 2'
+			local rows1 = cmd:query({compact = true}, sql)
+			local rows2 = dst:query({compact = true}, sql)
+			assert(#rows1 == 50 and #rows2 == 50)
+			for i = 1, #rows1 do
+				assert(cat(rows1[i], ',') == cat(rows2[i], ','))
+			end
+		end
+
+		--writers that were opened are closed when opening another one fails.
+		local opened, closed = 0, 0
+		local ok, err = pcall(cmd.copy_table, cmd, 'copy_pk', dst, {
+			writers = 3,
+			connect = function()
+				if opened == 1 then error'connect failed' end
+				opened = opened + 1
+				local c = spp.connect(dst_opt)
+				local close = c.close
+				function c:close()
+					closed = closed + 1
+					return close(self)
+				end
+				return c
+			end,
+		})
+		assert(not ok and tostring(err):find'connect failed')
+		assert(opened == 1 and closed == 1)
+
+		cmd:query'drop database sp_copy'
+		dst:close()
+	end
+
+	--multi-row insert, update and delete, and atomic() inside a transaction.
+	do
+		cmd:query'drop table if exists rows_test'
+		cmd:query'create table rows_test (id int auto_increment primary key, s varchar(10), n int)'
+		local function rows()
+			local t = {}
+			for _,row in ipairs(cmd:query({compact = true}, 'select * from rows_test order by id')) do
+				add(t, cat(imap(row, tostring), ','))
+			end
+			return cat(t, ' ')
+		end
+
+		local ret = cmd:insert_rows('rows_test',
+			{{s = 'a', n = 1}, {s = 'b', n = 2}, {s = 'c', n = 3}}, 's n')
+		local step = cmd:insert_id_step()
+		if step then
+			local id = cmd:first_row_vals"select id from rows_test where s = 'c'"
+			assert(id == ret.insert_id + 2 * step)
+		end
+		cmd:query'delete from rows_test'
+		cmd:query'alter table rows_test auto_increment = 1'
+		cmd:query"insert into rows_test values (1, 'a', 1), (2, 'b', 2), (3, 'c', 3)"
+
+		--row 3 changes its pk so it is updated separately.
+		local ret = cmd:update_rows('rows_test', {
+			{['id:old'] = 1, s = 'A'},
+			{['id:old'] = 2, n = 20},
+			{['id:old'] = 3, id = 30, s = 'C'},
+		}, 'id s n')
+		assert(ret.affected_rows == 3)
+		assert(rows() == '1,A,1 2,b,20 30,C,3')
+
+		local ret = cmd:delete_rows('rows_test', {{['id:old'] = 1}, {['id:old'] = 30}}, 'id')
+		assert(ret.affected_rows == 2)
+		assert(rows() == '2,b,20')
+
+		--atomic() inside a transaction only rolls back its own changes.
+		cmd:start_transaction()
+		cmd:query"insert into rows_test values (4, 'd', 4)"
+		local ok, err = pcall(cmd.atomic, cmd, function()
+			cmd:query"insert into rows_test values (5, 'e', 5)"
+			error'rollback'
+		end)
+		assert(not ok and tostring(err):find'rollback')
+		cmd:atomic(function()
+			cmd:query"insert into rows_test values (6, 'f', 6)"
+		end)
+		assert(cmd:in_transaction() and cmd.atomic_depth == 0)
+		cmd:end_transaction'commit'
+		assert(rows() == '2,b,20 4,d,4 6,f,6')
+
+		cmd:query'drop table rows_test'
+	end
+
 end)
@@ -0,0 +1,134 @@
+require'unit'
+require'tasks'
+
+--cron_parse -----------------------------------------------------------------
+
+local function values(set)
+	local t = {}
+	for v in pairs(set) do add(t, v) end
+	return sort(t)
+end
+
+local c = cron_parse'5-10/2 */6 1,15 1-3,12 *'
+test(values(c.min), {5, 7, 9})
+test(values(c.hour), {0, 6, 12, 18})
+test(values(c.day), {1, 15})
+test(values(c.month), {1, 2, 3, 12})
+assert(c.wday_any and not c.min_any)
+
+test(values(cron_parse'*/15 * * * *'.min), {0, 15, 30, 45})
+test(values(cron_parse'50/5 * * * *'.min), {50, 55}) --a/n runs to the max.
+test(values(cron_parse'0 0 * * 7'.wday), {0, 7}) --7 is Sunday too.
+test(values(cron_parse'@daily'.hour), {0})
+
+for _,s in ipairs{
+	'60 * * * *', '* 24 * * *', '* * 0 * *', '* * * 13 *', '* * * * 8',
+	'5-3 * * * *', '*/0 * * * *', '* * * *', '* * * * * *', 'x * * * *',
+} do
+	assert(not pcall(cron_parse, s), s)
+end
+
+--cron_next ------------------------------------------------------------------
+
+local function T(y, m, d, h, min, sec)
+	return os.time{year = y, month = m, day = d, hour = h or 0, min = min or 0,
+		sec = sec or 0}
+end
+
+local function next_date(s, t)
+	local t = cron_next(s, t)
+	return t and os.date('%Y-%m-%d %H:%M', t)
+end
+
+--next minute, always strictly after t.
+test(next_date('* * * * *', T(2024, 5, 10, 10, 20, 30)), '2024-05-10 10:21')
+test(next_date('* * * * *', T(2024, 5, 10, 10, 20)), '2024-05-10 10:21')
+
+--steps and lists.
+test(next_date('*/15 * * * *', T(2024, 5, 10, 10, 31)), '2024-05-10 10:45')
+test(next_date('0,30 9-17 * * *', T(2024, 5, 10, 17, 30)), '2024-05-11 09:00')
+
+--rollover across day, month and year boundaries.
+test(next_date('0 */6 * * *', T(2024, 12, 31, 19)), '2025-01-01 00:00')
+test(next_date('0 0 * * *', T(2024, 1, 31, 23, 59, 30)), '2024-02-01 00:00')
+test(next_date('@yearly', T(2024, 6, 15)), '2025-01-01 00:00')
+test(next_date('0 12 30 * *', T(2024, 1, 30, 13)), '2024-03-30 12:00') --no Feb 30
+test(next_date('0 0 29 2 *', T(2025, 3, 1)), '2028-02-29 00:00') --leap years
+test(next_date('0 0 31 * *', T(2024, 4, 1)), '2024-05-31 00:00')
+
+--day-of-month and day-of-week: either matches when both are restricted.
+test(next_date('0 0 1 * 1', T(2024, 1, 1)), '2024-01-08 00:00') --Monday
+test(next_date('0 0 1 * 1', T(2024, 1, 29)), '2024-02-01 00:00') --the 1st
+test(next_date('0 0 * * 1', T(2024, 1, 29)), '2024-02-05 00:00') --only Mondays
+test(next_date('0 0 1 * *', T(2024, 1, 29)), '2024-02-01 00:00') --only the 1st
+test(next_date('0 0 * * 0', T(2024, 9, 1)), '2024-09-08 00:00') --Sunday as 0
+test(next_date('0 0 * * 7', T(2024, 9, 1)), '2024-09-08 00:00') --Sunday as 7
+
+--impossible dates never match.
+test(next_date('0 0 30 2 *', T(2024, 1, 1)), nil)
+
+--scheduler ------------------------------------------------------------------
+
+run(function()
+
+	task_scheduler'start'
+
+	--run log of scheduled tasks; each task runs once, for `duration` seconds.
+	local log, running, max_running = {}, 0, 0
+	local function schedule(name, opt)
+		local duration = opt.duration or 0
+		set_scheduled_task(name, update({
+			action = function()
+				set_scheduled_task(name, nil)
+				add(log, name)
+				running = running + 1
+				max_running = max(max_running, running)
+				wait(duration)
+				running = running - 1
+			end,
+			run_every = 1,
+		}, opt))
+	end
+	local function wait_done(n)
+		while #log < n or running > 0 do wait(.01) end
+	end
+
+	--tasks run in the order of their next run time, not of adding them.
+	local now = time()
+	schedule('a', {last_run = now, run_every = .3})
+	schedule('b', {last_run = now, run_every = .1})
+	schedule('c', {last_run = now, run_every = .2})
+	wait_done(3)
+	test(log, {'b', 'c', 'a'})
+
+	--per-group limit: due tasks over it wait in the run queue, in FIFO order.
+	log, max_running = {}, 0
+	task_group_max_running.g = 1
+	schedule('x', {group = 'g', duration = .05})
+	schedule('y', {group = 'g', duration = .05})
+	schedule('z', {group = 'g', duration = .05})
+	wait_done(3)
+	test(log, {'x', 'y', 'z'})
+	test(max_running, 1)
+
+	--tasks of other groups don't wait for the group's limit.
+	log, max_running = {}, 0
+	schedule('g1', {group = 'g', duration = .1})
+	schedule('g2', {group = 'g', duration = .1})
+	schedule('h1', {group = 'h', duration = .1})
+	wait_done(3)
+	test(log, {'g1', 'h1', 'g2'})
+	test(max_running, 2)
+
+	--global limit.
+	log, max_running = {}, 0
+	task_scheduler_max_running = 2
+	schedule('m1', {duration = .05})
+	schedule('m2', {duration = .05})
+	schedule('m3', {duration = .05})
+	wait_done(3)
+	test(max_running, 2)
+	task_scheduler_max_running = 1/0
+
+	task_scheduler'stop'
+end)
@@ -0,0 +1,91 @@
+require'unit'
+require'websocket'
+require'sock'
+
+--handshake helpers (key/accept example from RFC 6455).
+test(websocket_accept_key'dGhlIHNhbXBsZSBub25jZQ==', 's3pPLMBiTxaQ9kYGzzhZRbK+xOo=')
+test(#websocket_key(), 24)
+
+local params, hdr = websocket_deflate_accept
+	'x-webkit-deflate-frame, permessage-deflate; client_max_window_bits'
+assert(params and hdr:find'^permessage%-deflate')
+local cparams = assert(websocket_deflate_params(hdr))
+test(websocket_deflate_accept'x-unknown', nil)
+
+run(function()
+
+--connected pairs of tcp sockets over the loopback interface.
+--NOTE: closing the listening socket closes the accepted sockets too.
+local ls = tcp()
+ls:setopt('reuseaddr', true)
+ls:listen('127.0.0.1', 18091)
+local function socket_pair()
+	local fc = connect('127.0.0.1', 18091)
+	return fc, ls:accept()
+end
+local fc, fs = socket_pair()
+
+local function ws(f, client, deflate)
+	return websocket{f = f, b = pbuffer{f = f}, client = client, deflate = deflate}
+end
+local c = ws(fc, true, cparams)
+local s = ws(fs, false, params)
+
+--send from another thread so that big messages don't fill up the socket
+--buffers while nobody is reading.
+local function send(ws, ...)
+	local args = pack(...)
+	resume(thread(function()
+		assert(ws:send(unpack(args)))
+	end, 'ws-test-send'))
+end
+
+--all length encodings, with and without compression.
+for _,msg in ipairs{'', 'hi', ('x'):rep(125), ('y'):rep(126),
+	('z'):rep(70000), ('abc'):rep(1e5)}
+do
+	send(c, msg)
+	test({s:recv()}, {msg, 'text'})
+	send(s, msg, 'binary')
+	test({c:recv()}, {msg, 'binary'})
+end
+
+--ping is answered by the reader, data keeps flowing.
+assert(c:ping'x')
+assert(c:send'after ping')
+test(s:recv(), 'after ping')
+
+--fragmented message with an interleaved ping (server->client, unmasked).
+fs:send'\1\3abc\0\3def\137\0\128\3ghi'
+test(c:recv(), 'abcdefghi')
+
+--a received message in buffer mode is not clobbered by compressing a send.
+local msg1, msg2 = ('a'):rep(1000), ('b'):rep(2000)
+assert(s:send(msg1))
+local p, n = c:recv'buffer'
+assert(c:send(msg2))
+test(str(p, n), msg1)
+test(s:recv(), msg2)
+
+--closing handshake: close() waits for the peer to reply, which it does
+--when it reads the close frame, and then both sides close the socket.
+local closed = false
+resume(thread(function()
+	assert(c:close(1000, 'bye'))
+	closed = true
+end, 'ws-test-close'))
+test(select(2, s:recv()), 'closed')
+assert(fs:closed())
+while not closed do wait(.01) end
+assert(fc:closed())
+
+--reading from a socket closed by the peer without a closing handshake.
+local fc, fs = socket_pair()
+local c = ws(fc, true)
+fs:close()
+local ok, err = c:recv()
+assert(not ok and err.errortype == 'io' and err.message == 'eof')
+
+ls:close()
+
+end)
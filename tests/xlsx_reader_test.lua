@@ -0,0 +1,63 @@
+require'glue'
+require'xlsx_reader'
+local Workbook = require'xlsxwriter.workbook'
+
+local file = 'xlsx_reader_test.xlsx'
+local wb = Workbook:new(file)
+local ws = wb:add_worksheet'Data'
+local date_format = wb:add_format{num_format = 'yyyy-mm-dd hh:mm:ss'}
+ws:write(0, 0, 'id')
+ws:write(0, 1, 'name')
+ws:write(0, 2, 'flag')
+ws:write(0, 3, 'date')
+for i = 1, 10000 do
+	ws:write(i, 0, i)
+	ws:write(i, 1, 'name '..(i % 100))
+	ws:write_boolean(i, 2, i % 2 == 0)
+	ws:write_date_string(i, 3, '2024-01-02T03:04:05', date_format)
+end
+ws:write(10002, 4, 'last')
+wb:add_worksheet'Empty'
+wb:close()
+
+local xr = xlsx_open(file)
+assert(#xr.sheets == 2 and xr.sheets[1] == 'Data' and xr.sheets[2] == 'Empty')
+
+local n = 0
+for i, row, cn in xr:rows('Data', {dates = true}) do
+	if i == 1 then
+		assert(row[1] == 'id' and row[4] == 'date' and cn == 4)
+	elseif i == 10003 then
+		assert(row[5] == 'last' and row[1] == nil and cn == 5)
+	else
+		assert(row[1] == i - 1)
+		assert(row[2] == 'name '..((i - 1) % 100))
+		assert(row[3] == ((i - 1) % 2 == 0))
+		assert(row[4] == time(true, 2024, 1, 2, 3, 4, 5))
+	end
+	n = n + 1
+end
+assert(n == 10002)
+
+for i, row in xr:rows(2) do
+	error'rows in empty sheet'
+end
+
+--abandoning an iterator and starting another one.
+local iter = xr:rows(1)
+assert(iter() == 1)
+local i, row = xr:rows(1, {null = false})()
+assert(i == 1 and row[1] == 'id')
+xr:close()
+
+--abandoning an iterator and starting one that needs to load the styles.
+local xr = xlsx_open(file)
+local iter = xr:rows(1)
+assert(iter() == 1)
+local iter = xr:rows(1, {dates = true})
+assert(iter() == 1)
+local i, row = iter()
+assert(i == 2 and row[4] == time(true, 2024, 1, 2, 3, 4, 5))
+xr:close()
+os.remove(file)
+print'ok'
@@ -1,7 +1,157 @@
 
+require'unit'
 require'xrowset'
 require'xrowset_sql'
 
+--delta loading --------------------------------------------------------------
+
+do
+	local data = {'a', 'b', 'c'}
+	local rs = virtual_rowset(function(rs)
+		rs.name = 'delta_test'
+		rs.fields = {
+			{name = 'id'  , index = 1, table = 'delta_test', col = 'id'},
+			{name = 'name', index = 2, table = 'delta_test', col = 'name'},
+		}
+		rs.fields.id   = rs.fields[1]
+		rs.fields.name = rs.fields[2]
+		rs.pk = 'id'
+		function rs:load_rows(res)
+			res.rows = {}
+			for id, name in pairs(data) do
+				add(res.rows, {id, name})
+			end
+		end
+		function rs:load_changed_rows(res, param_vals, pks)
+			res.rows = {}
+			for _,pk in ipairs(pks) do
+				if data[pk[1]] then
+					add(res.rows, {pk[1], data[pk[1]]})
+				end
+			end
+		end
+	end)
+
+	local v0 = rs:load().version
+	test(rs:changed_since(v0), false)
+	test(rs:load_delta(nil, v0), {delta = true, version = v0, rows = {}, removed = {}})
+
+	--changed and removed rows, each pk once.
+	data[2] = 'B'
+	table_changed('delta_test', nil, false, {{id = 2}})
+	data[3] = nil
+	table_changed('delta_test', nil, false, {{id = 3}, {id = 2}})
+	local res = rs:load_delta(nil, v0)
+	test(res.rows, {{2, 'B'}})
+	test(res.removed, {{3}})
+	assert(rs:changed_since(v0))
+	test(rs:changed_since(res.version), false)
+
+	--full reload when the log doesn't reach back to `since`,
+	--when `since` is from the future, or on a change without pks.
+	local v1 = res.version
+	test(rs:load_delta(nil, 0), nil)
+	test(rs:load_delta(nil, v1 + 1), nil)
+	table_changed('delta_test', nil, false)
+	test(rs:load_delta(nil, v1), nil)
+
+	--changes made in a request are logged after the request finishes.
+	run(function()
+		local req = {onfinish = function(req, f) after(req, 'finish', f) end}
+		ownthreadenv().http_request = req
+		local v = rs:load().version
+		table_changed('delta_test', nil, false, {{id = 1}})
+		test(rs:changed_since(v), false)
+		req:finish(true)
+		assert(rs:changed_since(v))
+		local v = rs:load().version
+		rowset_changed('delta_test', nil, false)
+		req:finish(false) --rolled back: nothing is logged.
+		test(rs:changed_since(v), false)
+	end)
+end
+
+--paged loading ---------------------------------------------------------------
+
+do
+	--db mock which records the queries and returns no rows.
+	local fields = {
+		{name = 'id'  , index = 1, table = 't', table_alias = 't', col = 'id'  , db = 'd'},
+		{name = 'name', index = 2, table = 't', table_alias = 't', col = 'name', db = 'd'},
+		{name = 'n'   , index = 3, table = 't', table_alias = 't', col = 'n'   , db = 'd'},
+		{name = 'x'   , index = 4}, --expression, not a table field.
+	}
+	for _,f in ipairs(fields) do
+		fields[f.name] = f
+	end
+	local sqls, counts = {}, 0
+	local db = {}
+	function db:query(opt, sql)
+		add(sqls, sql)
+		return {}, fields
+	end
+	function db:sqlval(v)
+		return isstr(v) and "'"..v.."'" or tostring(v)
+	end
+	function db:sqlquery(sql) return sql end
+	function db:first_row_vals(sql)
+		counts = counts + 1
+		return 42
+	end
+
+	local rs = sql_rowset{
+		name = 'paged_test',
+		select = 'select id, name, n, 2 * n as x from t',
+		pk = 'id',
+		db = function() return db end,
+	}
+	local function load(view)
+		sqls = {}
+		local res = rs:load(nil, view)
+		return sqls[#sqls], res
+	end
+
+	--filters and offset.
+	local sql, res = load{
+		filters = {{'n', '>', 5}, {'name', 'null'}, {'id', 'in', {1, 2}}},
+		offset = 20, limit = 10, count = true,
+	}
+	test(sql, 'select id, name, n, 2 * n as x from t'
+		..'\nwhere (t.n > 5) and (t.name is null) and (t.id in (1, 2))'
+		..'\norder by t.id\nlimit 10 offset 20')
+	test(res.offset, 20)
+	test(res.total, 42)
+
+	--keyset paging: the pk is added to the sort order.
+	local sql = load{order_by = 'name:desc', after = {'b', 2}, limit = 10}
+	test(sql, 'select id, name, n, 2 * n as x from t'
+		.."\nwhere ((t.name < 'b') or (t.name = 'b' and t.id > 2))"
+		..'\norder by t.name desc, t.id\nlimit 10')
+
+	--page size is limited.
+	test(load{}:match'limit (%d+)$', '1000')
+
+	--invalid views.
+	for _,view in ipairs{
+		{order_by = 'x'}, {order_by = 'foo'}, {order_by = 'name:up'},
+		{filters = {{'n', 'is', 1}}}, {filters = {{'n', 'in', {}}}},
+		{filters = {{'n', '=', null}}}, {after = {1, 2}},
+	} do
+		assert(not pcall(load, view))
+	end
+
+	--total counts are cached until the rowset's tables change.
+	counts = 0
+	load{count = true}
+	load{count = true}
+	test(counts, 1)
+	table_changed('t', nil, false, {{id = 1}})
+	load{count = true}
+	test(counts, 2)
+	load{count = true, filters = {{'n', '=', 1}}}
+	test(counts, 3)
+end
+
 local function send_slowly(s, dt)
 	setheader('content-length', #s)
 	local n = floor(#s * .1 / dt)
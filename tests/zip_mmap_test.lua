@@ -0,0 +1,38 @@
+require'glue'
+require'zip_stream'
+require'zip_mmap'
+require'gzip'
+require'fs'
+
+local file = 'zip_mmap_test.zip'
+local big = ('hello world\n'):rep(10000)
+
+local f = open(file, 'w')
+local zw = zip_stream_writer(f)
+zw:add_memfile('hello.txt', big)
+zw:add_memfile{filename = 'stored.txt', data = 'hello stored', compression_level = 0}
+zw:open_entry'dir/empty.txt'
+zw:close()
+f:close()
+
+local za = zip_mmap_open(file)
+local e = assert(za:entry'hello.txt')
+assert(e.compression_method == 'deflate')
+assert(e.uncompressed_size == #big and e.compressed_size < #big)
+assert(e.crc == crc32(big))
+assert(za:read'hello.txt' == big)
+assert(za:read'stored.txt' == 'hello stored')
+assert(za:read'dir/empty.txt' == '')
+assert(not za:entry'missing.txt')
+local t = {}
+assert(za:read(e, function(buf, len) add(t, str(buf, len)) end))
+assert(cat(t) == big)
+
+--wrap the raw DEFLATE data in a gzip member and inflate it back.
+local p, len = za:data(e)
+local gz = gzip_header(e.mtime)..str(p, len)..gzip_trailer(e.crc, e.uncompressed_size)
+assert(inflate(gz, '', nil, 'gzip') == big)
+
+za:close()
+rmfile(file)
+print'ok'
@@ -0,0 +1,148 @@
+require'glue'
+require'zip_stream'
+require'zip'
+
+local t = {}
+local zw = zip_stream_writer(function(buf, len)
+	add(t, len and str(buf, len) or buf)
+end)
+zw:add_memfile('hello.txt', 'hello world')
+zw:open_entry'test/big.txt'
+for i=1,100000 do
+	zw:write('hello '..i..'\n')
+end
+zw:close_entry()
+zw:add_memfile{filename = 'stored.txt', data = 'hello stored', compression_level = 0}
+zw:open_entry'empty.txt'
+zw:close()
+local s = cat(t)
+assert(#s == zw.offset)
+
+local z = assert(zip_open{data = s})
+local n = 0
+for e in z:entries() do
+	local s = e.uncompressed_size > 0 and z:read'*a' or ''
+	if e.filename == 'hello.txt' then
+		assert(s == 'hello world')
+	elseif e.filename == 'test/big.txt' then
+		assert(s:find'^hello 1\n' and s:find'\nhello 100000\n$')
+	elseif e.filename == 'stored.txt' then
+		assert(e.compression_method == 'store')
+		assert(s == 'hello stored')
+	else
+		assert(e.filename == 'empty.txt' and s == '')
+	end
+	n = n + 1
+end
+assert(n == 4)
+z:close()
+
+--parallel compression: entries must come out in the order they were added.
+local t = {}
+local zw = zip_stream_writer(function(buf, len)
+	add(t, len and str(buf, len) or buf)
+end, {threads = 2})
+for i=1,10 do
+	zw:add_memfile('file'..i..'.txt', ('hello '..i..'\n'):rep(10000))
+end
+zw:open_entry'inline.txt'
+zw:write'hello inline'
+zw:add_memfile('last.txt', 'hello last')
+zw:close()
+local s = cat(t)
+assert(#s == zw.offset)
+
+local z = assert(zip_open{data = s})
+local n = 0
+for e in z:entries() do
+	n = n + 1
+	local s = z:read'*a'
+	if n <= 10 then
+		assert(e.filename == 'file'..n..'.txt')
+		assert(s == ('hello '..n..'\n'):rep(10000))
+	elseif n == 11 then
+		assert(e.filename == 'inline.txt' and s == 'hello inline')
+	else
+		assert(e.filename == 'last.txt' and s == 'hello last')
+	end
+end
+assert(n == 12)
+z:close()
+
+--parallel compression of files bigger than the read chunk size.
+local file = 'zip_stream_test.txt'
+local big = ('hello file\n'):rep(50000)
+save(file, big)
+local t = {}
+local zw = zip_stream_writer(function(buf, len)
+	add(t, len and str(buf, len) or buf)
+end, {threads = 2})
+zw:add_file(file, 'a.txt')
+zw:add_file(file, 'b.txt')
+zw:close()
+rmfile(file)
+local z = assert(zip_open{data = cat(t)})
+local n = 0
+for e in z:entries() do
+	n = n + 1
+	assert(e.filename == (n == 1 and 'a.txt' or 'b.txt'))
+	assert(e.uncompressed_size == #big)
+	assert(z:read'*a' == big)
+end
+assert(n == 2)
+z:close()
+
+--workers are stopped when writing fails or when the writer is abandoned.
+local zw = zip_stream_writer(function(buf, len)
+	error'write failed'
+end, {threads = 2})
+local ok, err = pcall(function()
+	for i=1,10 do
+		zw:add_memfile('file'..i..'.txt', ('hello '..i..'\n'):rep(10000))
+	end
+	zw:close()
+end)
+assert(not ok and err:find'write failed')
+assert(not zw.workers)
+
+local zw = zip_stream_writer(function() end, {threads = 2})
+zw:add_file('missing.txt', {filename = 'missing.txt', mtime = 0})
+assert(not pcall(zw.close, zw))
+assert(not zw.workers)
+
+local zw = zip_stream_writer(function() end, {threads = 2})
+zw:add_memfile('hello.txt', 'hello world')
+zw:free()
+assert(not zw.workers)
+
+--waiting for workers in a sock thread lets the other threads run.
+require'sock'
+run(function()
+	local ticks, done = 0
+	resume(thread(function()
+		while not done do
+			ticks = ticks + 1
+			wait(.001)
+		end
+	end))
+	local t = {}
+	local zw = zip_stream_writer(function(buf, len)
+		add(t, len and str(buf, len) or buf)
+	end, {threads = 2})
+	for i=1,10 do
+		zw:add_memfile('file'..i..'.txt', ('hello '..i..'\n'):rep(100000))
+	end
+	zw:close()
+	done = true
+	assert(ticks > 0)
+	local z = assert(zip_open{data = cat(t)})
+	local n = 0
+	for e in z:entries() do
+		n = n + 1
+		assert(z:read'*a' == ('hello '..n..'\n'):rep(100000))
+	end
+	assert(n == 10)
+	z:close()
+end)
+
+print'ok'